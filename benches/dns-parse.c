@@ -0,0 +1,329 @@
+/* DNS UDP parser micro benchmark.
+ *
+ * Runs the DNS records of a pcap through DNSUDPRequestParse and
+ * DNSUDPResponseParse and reports transactions/sec, once with the per
+ * thread state/tx/record cache disabled and once with it enabled. Every
+ * query/response pair on a client address/port is one flow: its state is
+ * allocated on the first packet and freed after the response, like the
+ * flow manager does for short DNS flows.
+ *
+ * The parser sources are included below, so this runs the real code. Build
+ * it from src/ of a configured tree (the libhtp include path is only needed
+ * when htp isn't installed system wide):
+ *
+ * gcc -O2 -DHAVE_CONFIG_H -I. -o dns-parse ../benches/dns-parse.c -lpthread
+ * ./dns-parse dns.pcap [loops]
+ *
+ * Only ethernet (optionally vlan tagged) and raw IPv4/IPv6 pcaps with UDP
+ * port 53 traffic are used, other packets are skipped.
+ */
+
+#include "suricata-common.h"
+#include <sys/time.h>
+
+/* count the allocator calls of the parser code */
+static uint64_t bench_allocs = 0;
+static uint64_t bench_frees = 0;
+
+static void *BenchMalloc(size_t size) { bench_allocs++; return malloc(size); }
+static void *BenchRealloc(void *ptr, size_t size) { bench_allocs++; return realloc(ptr, size); }
+static void BenchFree(void *ptr) { if (ptr != NULL) bench_frees++; free(ptr); }
+
+#define malloc(s)       BenchMalloc((s))
+#define realloc(p, s)   BenchRealloc((p), (s))
+#define free(p)         BenchFree((p))
+
+/* runtime switch for the size of the thread cache, 0 disables it */
+static uint32_t bench_cache_max = 256;
+#define DNS_CACHE_MAX   bench_cache_max
+
+#include "app-layer-dns-common.c"
+#include "app-layer-dns-udp.c"
+
+#undef malloc
+#undef realloc
+#undef free
+
+/* the parser sources reference these, but nothing here uses them */
+SC_ATOMIC_DECLARE(unsigned int, engine_stage);
+SCLogLevel sc_log_global_log_level = SC_LOG_ERROR;
+AlpProtoDetectCtx alp_proto_ctx;
+
+SCError SCLogMessage(SCLogLevel l, char **m, const char *f, unsigned ln, const char *fn) { return SC_OK; }
+void SCLogOutputBuffer(SCLogLevel l, char *m) { }
+const char *SCErrorToString(SCError e) { return ""; }
+int SCMapEnumNameToValue(const char *n, SCEnumCharMap *t) { return -1; }
+int RunmodeIsUnittests(void) { return 0; }
+ConfNode *ConfGetNode(char *key) { return NULL; }
+int ParseSizeStringU32(const char *s, uint32_t *r) { return -1; }
+int AppLayerParserEnabled(const char *p) { return 0; }
+int AppLayerProtoDetectionEnabled(const char *p) { return 0; }
+void AppLayerParseProbingParserPorts(const char *n, uint16_t p, uint16_t mi,
+        uint16_t ma, ProbingParserFPtr pp) { }
+void AppLayerRegisterProbingParser(struct AlpProtoDetectCtx_ *c, uint16_t ip,
+        char *ps, char *n, uint16_t p, uint16_t mi, uint16_t ma, uint8_t fl,
+        ProbingParserFPtr pp) { }
+int AppLayerRegisterProto(char *n, uint8_t p, uint8_t fl,
+        int (*Parser)(Flow *, void *, AppLayerParserState *, uint8_t *,
+            uint32_t, void *, AppLayerParserResult *)) { return 0; }
+void AppLayerRegisterStateFuncs(uint16_t p, void *(*A)(void), void (*F)(void *)) { }
+void AppLayerRegisterTxFreeFunc(uint16_t p, void (*F)(void *, uint64_t)) { }
+void AppLayerRegisterGetEventsFunc(uint16_t p,
+        AppLayerDecoderEvents *(*F)(void *, uint64_t)) { }
+void AppLayerRegisterHasEventsFunc(uint16_t p, int (*F)(void *)) { }
+void AppLayerRegisterGetTxCnt(uint16_t p, uint64_t (*F)(void *)) { }
+void AppLayerRegisterGetTx(uint16_t p, void *(*F)(void *, uint64_t)) { }
+void AppLayerRegisterGetAlstateProgressFunc(uint16_t p, int (*F)(void *, uint8_t)) { }
+void AppLayerRegisterGetAlstateProgressCompletionStatus(uint16_t p,
+        int (*F)(uint8_t)) { }
+void AppLayerRegisterGetEventInfo(uint16_t p,
+        int (*F)(const char *, int *, AppLayerEventType *)) { }
+
+typedef struct BenchPacket_ {
+    uint8_t *payload;
+    uint32_t len;
+    uint32_t flow;          /**< index in the flow array */
+    int toserver;
+} BenchPacket;
+
+typedef struct BenchFlowKey_ {
+    uint8_t addr[16];       /**< client address */
+    uint16_t port;          /**< client port */
+} BenchFlowKey;
+
+#define FLOW_HASH_SIZE  65536
+
+static BenchPacket *pkts = NULL;
+static uint32_t pkts_cnt = 0;
+static BenchFlowKey *keys = NULL;
+static uint32_t *flow_hash = NULL;  /**< flow index + 1, 0 is free */
+static uint32_t flows_cnt = 0;
+
+static double Now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static uint32_t FlowGet(BenchFlowKey *k)
+{
+    uint32_t h = k->port, i;
+    for (i = 0; i < sizeof(k->addr); i++)
+        h = h * 31 + k->addr[i];
+
+    for (h %= FLOW_HASH_SIZE; flow_hash[h] != 0; h = (h + 1) % FLOW_HASH_SIZE) {
+        if (memcmp(&keys[flow_hash[h] - 1], k, sizeof(*k)) == 0)
+            return flow_hash[h] - 1;
+    }
+    if (flows_cnt == FLOW_HASH_SIZE / 2) {
+        printf("too many flows\n");
+        exit(EXIT_FAILURE);
+    }
+    keys[flows_cnt] = *k;
+    flow_hash[h] = flows_cnt + 1;
+    return flows_cnt++;
+}
+
+/* pick the DNS payload out of a frame, store it with its flow */
+static void PacketAdd(const uint8_t *pkt, uint32_t len, uint32_t linktype)
+{
+    BenchFlowKey k;
+    const uint8_t *src, *dst;
+    uint32_t addr_len;
+    uint16_t sp, dp;
+
+    if (linktype == 1) {
+        if (len < 14)
+            return;
+        uint16_t type = (pkt[12] << 8) | pkt[13];
+        pkt += 14; len -= 14;
+        if (type == 0x8100 && len >= 4) {
+            type = (pkt[2] << 8) | pkt[3];
+            pkt += 4; len -= 4;
+        }
+        if (type != 0x0800 && type != 0x86dd)
+            return;
+    }
+
+    if (len >= 20 && (pkt[0] >> 4) == 4) {
+        uint32_t hlen = (pkt[0] & 0x0f) * 4;
+        if (pkt[9] != IPPROTO_UDP || hlen < 20 || len < hlen)
+            return;
+        src = pkt + 12; dst = pkt + 16; addr_len = 4;
+        pkt += hlen; len -= hlen;
+    } else if (len >= 40 && (pkt[0] >> 4) == 6) {
+        if (pkt[6] != IPPROTO_UDP)
+            return;
+        src = pkt + 8; dst = pkt + 24; addr_len = 16;
+        pkt += 40; len -= 40;
+    } else {
+        return;
+    }
+
+    if (len < 8)
+        return;
+    sp = (pkt[0] << 8) | pkt[1];
+    dp = (pkt[2] << 8) | pkt[3];
+    if (sp != 53 && dp != 53)
+        return;
+
+    memset(&k, 0x00, sizeof(k));
+    memcpy(k.addr, dp == 53 ? src : dst, addr_len);
+    k.port = dp == 53 ? sp : dp;
+
+    BenchPacket *p = &pkts[pkts_cnt++];
+    p->len = len - 8;
+    p->payload = malloc(p->len > 0 ? p->len : 1);
+    if (p->payload == NULL)
+        exit(EXIT_FAILURE);
+    memcpy(p->payload, pkt + 8, p->len);
+    p->toserver = (dp == 53);
+    p->flow = FlowGet(&k);
+}
+
+static void PcapLoad(const char *file)
+{
+    uint8_t hdr[24], rec[16];
+    uint32_t max = 1024, swap, linktype;
+    uint8_t *buf = malloc(65536);
+
+    FILE *fp = fopen(file, "rb");
+    if (fp == NULL || buf == NULL || fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr)) {
+        printf("can't read %s\n", file);
+        exit(EXIT_FAILURE);
+    }
+
+#define RD32(b) (swap ? ((uint32_t)(b)[0] << 24 | (b)[1] << 16 | (b)[2] << 8 | (b)[3]) : \
+                        ((uint32_t)(b)[3] << 24 | (b)[2] << 16 | (b)[1] << 8 | (b)[0]))
+    if (hdr[0] == 0xd4 && hdr[1] == 0xc3)
+        swap = 0;
+    else if (hdr[0] == 0xa1 && hdr[1] == 0xb2)
+        swap = 1;
+    else {
+        printf("%s: not a pcap file\n", file);
+        exit(EXIT_FAILURE);
+    }
+    linktype = RD32(hdr + 20);
+    if (linktype != 1 && linktype != 12 && linktype != 101) {
+        printf("%s: unsupported linktype %u\n", file, linktype);
+        exit(EXIT_FAILURE);
+    }
+
+    pkts = malloc(max * sizeof(BenchPacket));
+    keys = malloc(FLOW_HASH_SIZE / 2 * sizeof(BenchFlowKey));
+    flow_hash = calloc(FLOW_HASH_SIZE, sizeof(uint32_t));
+    if (pkts == NULL || keys == NULL || flow_hash == NULL)
+        exit(EXIT_FAILURE);
+
+    while (fread(rec, 1, sizeof(rec), fp) == sizeof(rec)) {
+        uint32_t caplen = RD32(rec + 8);
+        if (caplen > 65536 || fread(buf, 1, caplen, fp) != caplen)
+            break;
+        if (pkts_cnt == max) {
+            max *= 2;
+            pkts = realloc(pkts, max * sizeof(BenchPacket));
+            if (pkts == NULL)
+                exit(EXIT_FAILURE);
+        }
+        PacketAdd(buf, caplen, linktype);
+    }
+#undef RD32
+    fclose(fp);
+    free(buf);
+}
+
+/* run all packets through the parsers 'loops' times, returns tx/sec */
+static double Bench(uint32_t loops, uint64_t *txs)
+{
+    DNSState **states = calloc(flows_cnt, sizeof(DNSState *));
+    uint32_t l, i;
+    if (states == NULL)
+        exit(EXIT_FAILURE);
+
+    *txs = 0;
+    double start = Now();
+    for (l = 0; l < loops; l++) {
+        for (i = 0; i < pkts_cnt; i++) {
+            BenchPacket *p = &pkts[i];
+            DNSState *s = states[p->flow];
+            if (s == NULL) {
+                s = states[p->flow] = DNSStateAlloc();
+                if (s == NULL)
+                    exit(EXIT_FAILURE);
+            }
+
+            if (p->toserver) {
+                (void)DNSUDPRequestParse(NULL, s, NULL, p->payload, p->len, NULL, NULL);
+            } else {
+                (void)DNSUDPResponseParse(NULL, s, NULL, p->payload, p->len, NULL, NULL);
+                *txs += s->transaction_max;
+                DNSStateFree(s);
+                states[p->flow] = NULL;
+            }
+        }
+        /* queries that didn't get a response */
+        for (i = 0; i < flows_cnt; i++) {
+            if (states[i] != NULL) {
+                *txs += states[i]->transaction_max;
+                DNSStateFree(states[i]);
+                states[i] = NULL;
+            }
+        }
+    }
+    double elapsed = Now() - start;
+
+    free(states);
+    return *txs / elapsed;
+}
+
+/* best of a few rounds, the first one also warms up the allocator */
+#define ROUNDS  5
+
+static void Run(const char *label, uint32_t cache_max, uint32_t loops)
+{
+    double rate, best = 0;
+    uint64_t txs = 0, allocs = 0;
+    int r;
+
+    bench_cache_max = cache_max;
+    for (r = 0; r < ROUNDS; r++) {
+        bench_allocs = bench_frees = 0;
+        rate = Bench(loops, &txs);
+        allocs = bench_allocs + bench_frees;
+        if (rate > best)
+            best = rate;
+    }
+    printf("%s %.0f tx/sec, %.2f allocator calls/tx\n", label, best,
+            (double)allocs / txs);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t loops = 20;
+
+    if (argc < 2) {
+        printf("usage: %s <pcap> [loops]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2)
+        loops = (uint32_t)atoi(argv[2]);
+    if (loops == 0)
+        loops = 1;
+
+    DNSConfigInit();
+    DNSConfigSetRequestFlood(DNS_CONFIG_DEFAULT_REQUEST_FLOOD);
+    PcapLoad(argv[1]);
+    if (pkts_cnt == 0) {
+        printf("%s: no DNS over UDP packets\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    printf("%u DNS packets, %u flows, %u loops, best of %d\n", pkts_cnt,
+            flows_cnt, loops, ROUNDS);
+
+    /* no cache first, so the cached run doesn't start out warm */
+    Run("before (no cache):  ", 0, loops);
+    Run("after  (with cache):", 256, loops);
+
+    exit(0);
+}
@@ -0,0 +1,170 @@
+/* SMTP DATA parser micro benchmark.
+ *
+ * Feeds a multi-MB DATA section (a base64 attachment with 76 character
+ * lines by default) to the SMTP client parser in segment sized chunks and
+ * reports MB/s and allocator calls. Lines straddle the chunk boundaries,
+ * so about every chunk ends in a fragmented line.
+ *
+ * The parser source is included below, so this runs the real code. The
+ * state is put in DATA mode directly: the reply parsing that normally does
+ * that needs the mpm, which isn't what is measured here. Build it from
+ * src/ of a configured tree:
+ *
+ * gcc -O2 -DHAVE_CONFIG_H -I. -o smtp-data ../benches/smtp-data.c
+ * ./smtp-data [MB] [segment size] [line length]
+ */
+
+#include "suricata-common.h"
+#include <sys/time.h>
+
+/* count the allocator calls of the parser code */
+static uint64_t bench_allocs = 0;
+static uint64_t bench_frees = 0;
+
+static void *BenchMalloc(size_t size) { bench_allocs++; return malloc(size); }
+static void *BenchRealloc(void *ptr, size_t size) { bench_allocs++; return realloc(ptr, size); }
+static void BenchFree(void *ptr) { if (ptr != NULL) bench_frees++; free(ptr); }
+
+#define malloc(s)       BenchMalloc((s))
+#define realloc(p, s)   BenchRealloc((p), (s))
+#define free(p)         BenchFree((p))
+
+#include "app-layer-smtp.c"
+
+#undef malloc
+#undef realloc
+#undef free
+
+/* the parser source references these, but nothing here uses them */
+SC_ATOMIC_DECLARE(unsigned int, engine_stage);
+SCLogLevel sc_log_global_log_level = SC_LOG_ERROR;
+AlpProtoDetectCtx alp_proto_ctx;
+
+SCError SCLogMessage(SCLogLevel l, char **m, const char *f, unsigned ln, const char *fn) { return SC_OK; }
+void SCLogOutputBuffer(SCLogLevel l, char *m) { }
+const char *SCErrorToString(SCError e) { return ""; }
+int SCMapEnumNameToValue(const char *n, SCEnumCharMap *t) { return -1; }
+int PmqSetup(PatternMatcherQueue *pmq, uint32_t sig_maxid, uint32_t patmaxid) { return 0; }
+void PmqReset(PatternMatcherQueue *pmq) { }
+void PmqFree(PatternMatcherQueue *pmq) { }
+void AlpProtoAdd(AlpProtoDetectCtx *ctx, char *name, uint16_t ip_proto,
+        uint16_t al_proto, char *content, uint16_t depth, uint16_t offset,
+        uint8_t flags) { }
+int AppLayerParserEnabled(const char *p) { return 0; }
+int AppLayerProtoDetectionEnabled(const char *p) { return 0; }
+int AppLayerRegisterProto(char *n, uint8_t p, uint8_t fl,
+        int (*Parser)(Flow *, void *, AppLayerParserState *, uint8_t *,
+            uint32_t, void *, AppLayerParserResult *)) { return 0; }
+void AppLayerRegisterStateFuncs(uint16_t p, void *(*A)(void), void (*F)(void *)) { }
+void AppLayerRegisterLocalStorageFunc(uint16_t p, void *(*A)(void), void (*F)(void *)) { }
+void AppLayerRegisterGetEventInfo(uint16_t p,
+        int (*F)(const char *, int *, AppLayerEventType *)) { }
+
+static double Now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* DATA section of about 'size' bytes, ending in the "." line */
+static uint8_t *DataBuild(uint32_t size, uint32_t line_len, uint32_t *len)
+{
+    static const char b64[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint8_t *data = malloc(size + line_len + 8);
+    uint32_t o = 0, i, seed = 1;
+    if (data == NULL)
+        exit(EXIT_FAILURE);
+
+    while (o < size) {
+        for (i = 0; i < line_len; i++) {
+            seed = seed * 1103515245 + 12345;
+            data[o++] = b64[(seed >> 16) & 63];
+        }
+        data[o++] = '\r';
+        data[o++] = '\n';
+    }
+    memcpy(data + o, ".\r\n", 3);
+    *len = o + 3;
+    return data;
+}
+
+/* parse the DATA section 'loops' times, returns MB/s */
+static double Bench(uint8_t *data, uint32_t len, uint32_t seg, uint32_t loops)
+{
+    uint32_t l, o;
+
+    double start = Now();
+    for (l = 0; l < loops; l++) {
+        SMTPState *state = SMTPStateAlloc();
+        if (state == NULL)
+            exit(EXIT_FAILURE);
+        /* as if the server accepted the DATA command with a 354 */
+        state->parser_state |= SMTP_PARSER_STATE_FIRST_REPLY_SEEN |
+                               SMTP_PARSER_STATE_COMMAND_DATA_MODE;
+        state->current_command = SMTP_COMMAND_DATA;
+
+        for (o = 0; o < len; o += seg) {
+            uint32_t chunk = (len - o < seg) ? len - o : seg;
+            if (SMTPParseClientRecord(NULL, state, NULL, data + o, chunk,
+                                      NULL, NULL) != 0) {
+                printf("parser error at offset %u\n", o);
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (state->parser_state & SMTP_PARSER_STATE_COMMAND_DATA_MODE) {
+            printf("end of DATA not seen\n");
+            exit(EXIT_FAILURE);
+        }
+        SMTPStateFree(state);
+    }
+    double elapsed = Now() - start;
+
+    return (double)len * loops / (1024 * 1024) / elapsed;
+}
+
+/* best of a few rounds, the first one also warms up the allocator */
+#define ROUNDS  5
+
+int main(int argc, char *argv[])
+{
+    uint32_t mb = 8;
+    uint32_t seg = 1460;
+    uint32_t line_len = 76;
+    uint32_t loops = 10;
+    uint32_t len, r;
+    double rate, best = 0;
+    uint64_t allocs = 0;
+
+    if (argc > 1)
+        mb = (uint32_t)atoi(argv[1]);
+    if (argc > 2)
+        seg = (uint32_t)atoi(argv[2]);
+    if (argc > 3)
+        line_len = (uint32_t)atoi(argv[3]);
+    if (mb == 0 || mb > 1024 || seg == 0 || line_len == 0 || line_len > mb << 20) {
+        printf("usage: %s [MB] [segment size] [line length]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    uint8_t *data = DataBuild(mb << 20, line_len, &len);
+    uint32_t segs = (len + seg - 1) / seg;
+
+    for (r = 0; r < ROUNDS; r++) {
+        bench_allocs = bench_frees = 0;
+        rate = Bench(data, len, seg, loops);
+        allocs = bench_allocs + bench_frees;
+        if (rate > best)
+            best = rate;
+    }
+
+    printf("DATA of %u bytes, %u byte segments, %u byte lines, %u loops, "
+            "best of %d\n", len, seg, line_len, loops, ROUNDS);
+    printf("%.0f MB/s, %llu allocator calls per message (%.3f per segment)\n",
+            best, (unsigned long long)(allocs / loops),
+            (double)allocs / loops / segs);
+
+    free(data);
+    exit(0);
+}
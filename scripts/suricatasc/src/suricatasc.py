@@ -76,7 +76,7 @@ class SuricataCompleter:
 
 class SuricataSC:
     def __init__(self, sck_path, verbose=False):
-        self.cmd_list=['shutdown','quit','pcap-file','pcap-file-number','pcap-file-list','iface-list','iface-stat']
+        self.cmd_list=['shutdown','quit','pcap-file','pcap-dir','pcap-file-number','pcap-file-list','iface-list','iface-stat']
         self.sck_path = sck_path
         self.verbose = verbose
 
@@ -176,6 +176,19 @@ class SuricataSC:
                             arguments = {}
                             arguments["filename"] = filename
                             arguments["output-dir"] = output
+                    elif "pcap-dir " in command:
+                        try:
+                            [cmd, directory, output] = command.split(' ', 2)
+                        except:
+                            print "Error: arguments to command '%s' is missing" % (command)
+                            continue
+                        if cmd != "pcap-dir":
+                            print "Error: invalid command '%s'" % (command)
+                            continue
+                        else:
+                            arguments = {}
+                            arguments["directory"] = directory
+                            arguments["output-dir"] = output
                     elif "iface-stat" in command:
                         try:
                             [cmd, iface] = command.split(' ', 1)
@@ -275,6 +275,8 @@ TmEcode AlertDebugLogger(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq,
     PrintRawDataToBuffer(aft->buffer->buffer, &aft->buffer->offset, aft->buffer->size,
                          GET_PKT_DATA(p), GET_PKT_LEN(p));
 
+    MemBufferWriteString(aft->buffer, "TENANT ID:           %" PRIu32 "\n",
+                         p->tenant_id);
     MemBufferWriteString(aft->buffer, "ALERT CNT:           %" PRIu32 "\n",
                          p->alerts.cnt);
 
@@ -373,6 +375,8 @@ TmEcode AlertDebugLogDecoderEvent(ThreadVars *tv, Packet *p, void *data, PacketQ
     }
     pkt_src_str = PktSrcToString(p->pkt_src);
     MemBufferWriteString(aft->buffer, "PKT SRC:           %s\n", pkt_src_str);
+    MemBufferWriteString(aft->buffer,
+                         "TENANT ID:         %" PRIu32 "\n", p->tenant_id);
     MemBufferWriteString(aft->buffer,
                          "ALERT CNT:         %" PRIu32 "\n", p->alerts.cnt);
 
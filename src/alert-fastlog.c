@@ -119,6 +119,11 @@ TmEcode AlertFastLogIPv4(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq,
 
     CreateTimeString(&p->ts, timebuf, sizeof(timebuf));
 
+    /* multi tenancy: tag the alerts with the tenant of the engine */
+    char tenant[32] = "";
+    if (p->tenant_id != 0)
+        snprintf(tenant, sizeof(tenant), "[Tenant: %" PRIu32 "] ", p->tenant_id);
+
     char srcip[16], dstip[16];
     PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), srcip, sizeof(srcip));
     PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), dstip, sizeof(dstip));
@@ -143,9 +148,9 @@ TmEcode AlertFastLogIPv4(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq,
         }
 
         SCMutexLock(&aft->file_ctx->fp_mutex);
-        fprintf(aft->file_ctx->fp, "%s  %s[**] [%" PRIu32 ":%" PRIu32 ":%"
+        fprintf(aft->file_ctx->fp, "%s  %s%s[**] [%" PRIu32 ":%" PRIu32 ":%"
                 PRIu32 "] %s [**] [Classification: %s] [Priority: %"PRIu32"]"
-                " {%s} %s:%" PRIu32 " -> %s:%" PRIu32 "\n", timebuf, action,
+                " {%s} %s:%" PRIu32 " -> %s:%" PRIu32 "\n", timebuf, action, tenant,
                 pa->s->gid, pa->s->id, pa->s->rev, pa->s->msg, pa->s->class_msg, pa->s->prio,
                 proto, srcip, p->sp, dstip, p->dp);
         fflush(aft->file_ctx->fp);
@@ -169,6 +174,10 @@ TmEcode AlertFastLogIPv6(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq,
 
     CreateTimeString(&p->ts, timebuf, sizeof(timebuf));
 
+    char tenant[32] = "";
+    if (p->tenant_id != 0)
+        snprintf(tenant, sizeof(tenant), "[Tenant: %" PRIu32 "] ", p->tenant_id);
+
     char srcip[46], dstip[46];
     PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), srcip, sizeof(srcip));
     PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), dstip, sizeof(dstip));
@@ -193,10 +202,10 @@ TmEcode AlertFastLogIPv6(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq,
         }
 
         SCMutexLock(&aft->file_ctx->fp_mutex);
-        fprintf(aft->file_ctx->fp, "%s  %s[**] [%" PRIu32 ":%" PRIu32 ":%"
+        fprintf(aft->file_ctx->fp, "%s  %s%s[**] [%" PRIu32 ":%" PRIu32 ":%"
                 PRIu32 "] %s [**] [Classification: %s] [Priority: %"
                 PRIu32 "] {%s} %s:%" PRIu32 " -> %s:%" PRIu32 "\n", timebuf,
-                action, pa->s->gid, pa->s->id, pa->s->rev, pa->s->msg, pa->s->class_msg,
+                action, tenant, pa->s->gid, pa->s->id, pa->s->rev, pa->s->msg, pa->s->class_msg,
                 pa->s->prio, proto, srcip, p->sp,
                 dstip, p->dp);
 
@@ -221,6 +230,10 @@ TmEcode AlertFastLogDecoderEvent(ThreadVars *tv, Packet *p, void *data, PacketQu
 
     CreateTimeString(&p->ts, timebuf, sizeof(timebuf));
 
+    char tenant[32] = "";
+    if (p->tenant_id != 0)
+        snprintf(tenant, sizeof(tenant), "[Tenant: %" PRIu32 "] ", p->tenant_id);
+
     for (i = 0; i < p->alerts.cnt; i++) {
         PacketAlert *pa = &p->alerts.alerts[i];
         if (unlikely(pa->s == NULL)) {
@@ -234,9 +247,9 @@ TmEcode AlertFastLogDecoderEvent(ThreadVars *tv, Packet *p, void *data, PacketQu
         }
 
         SCMutexLock(&aft->file_ctx->fp_mutex);
-        fprintf(aft->file_ctx->fp, "%s  %s[**] [%" PRIu32 ":%" PRIu32
+        fprintf(aft->file_ctx->fp, "%s  %s%s[**] [%" PRIu32 ":%" PRIu32
                 ":%" PRIu32 "] %s [**] [Classification: %s] [Priority: "
-                "%" PRIu32 "] [**] [Raw pkt: ", timebuf, action, pa->s->gid,
+                "%" PRIu32 "] [**] [Raw pkt: ", timebuf, action, tenant, pa->s->gid,
                 pa->s->id, pa->s->rev, pa->s->msg, pa->s->class_msg, pa->s->prio);
 
         PrintRawLineHexFp(aft->file_ctx->fp, GET_PKT_DATA(p), GET_PKT_LEN(p) < 32 ? GET_PKT_LEN(p) : 32);
@@ -260,6 +260,11 @@ TmEcode AlertSyslogIPv4(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq,
     if (p->alerts.cnt == 0)
         return TM_ECODE_OK;
 
+    /* multi tenancy: tag the alerts with the tenant of the engine */
+    char tenant[32] = "";
+    if (p->tenant_id != 0)
+        snprintf(tenant, sizeof(tenant), "[Tenant: %" PRIu32 "] ", p->tenant_id);
+
     SCMutexLock(&ast->file_ctx->fp_mutex);
 
     ast->file_ctx->alerts += p->alerts.cnt;
@@ -282,16 +287,16 @@ TmEcode AlertSyslogIPv4(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq,
         }
 
         if (SCProtoNameValid(IPV4_GET_IPPROTO(p)) == TRUE) {
-            syslog(alert_syslog_level, "%s[%" PRIu32 ":%" PRIu32 ":%"
+            syslog(alert_syslog_level, "%s%s[%" PRIu32 ":%" PRIu32 ":%"
                     PRIu32 "] %s [Classification: %s] [Priority: %"PRIu32"]"
-                    " {%s} %s:%" PRIu32 " -> %s:%" PRIu32 "", action, pa->s->gid,
+                    " {%s} %s:%" PRIu32 " -> %s:%" PRIu32 "", action, tenant, pa->s->gid,
                     pa->s->id, pa->s->rev, pa->s->msg, pa->s->class_msg, pa->s->prio,
                     known_proto[IPV4_GET_IPPROTO(p)], srcip, p->sp, dstip, p->dp);
         } else {
-            syslog(alert_syslog_level, "%s[%" PRIu32 ":%" PRIu32 ":%"
+            syslog(alert_syslog_level, "%s%s[%" PRIu32 ":%" PRIu32 ":%"
                     PRIu32 "] %s [Classification: %s] [Priority: %"PRIu32"]"
                     " {PROTO:%03" PRIu32 "} %s:%" PRIu32 " -> %s:%" PRIu32 "",
-                    action, pa->s->gid, pa->s->id, pa->s->rev, pa->s->msg, pa->s->class_msg,
+                    action, tenant, pa->s->gid, pa->s->id, pa->s->rev, pa->s->msg, pa->s->class_msg,
                     pa->s->prio, IPV4_GET_IPPROTO(p), srcip, p->sp, dstip, p->dp);
         }
     }
@@ -321,6 +326,10 @@ TmEcode AlertSyslogIPv6(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq,
     if (p->alerts.cnt == 0)
         return TM_ECODE_OK;
 
+    char tenant[32] = "";
+    if (p->tenant_id != 0)
+        snprintf(tenant, sizeof(tenant), "[Tenant: %" PRIu32 "] ", p->tenant_id);
+
     SCMutexLock(&ast->file_ctx->fp_mutex);
 
     ast->file_ctx->alerts += p->alerts.cnt;
@@ -343,18 +352,18 @@ TmEcode AlertSyslogIPv6(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq,
         }
 
         if (SCProtoNameValid(IPV6_GET_L4PROTO(p)) == TRUE) {
-            syslog(alert_syslog_level, "%s[%" PRIu32 ":%" PRIu32 ":%"
+            syslog(alert_syslog_level, "%s%s[%" PRIu32 ":%" PRIu32 ":%"
                     "" PRIu32 "] %s [Classification: %s] [Priority: %"
                     "" PRIu32 "] {%s} %s:%" PRIu32 " -> %s:%" PRIu32 "",
-                    action, pa->s->gid, pa->s->id, pa->s->rev, pa->s->msg, pa->s->class_msg,
+                    action, tenant, pa->s->gid, pa->s->id, pa->s->rev, pa->s->msg, pa->s->class_msg,
                     pa->s->prio, known_proto[IPV6_GET_L4PROTO(p)], srcip, p->sp,
                     dstip, p->dp);
 
         } else {
-            syslog(alert_syslog_level, "%s[%" PRIu32 ":%" PRIu32 ":%"
+            syslog(alert_syslog_level, "%s%s[%" PRIu32 ":%" PRIu32 ":%"
                     "" PRIu32 "] %s [Classification: %s] [Priority: %"
                     "" PRIu32 "] {PROTO:%03" PRIu32 "} %s:%" PRIu32 " -> %s:%" PRIu32 "",
-                    action, pa->s->gid, pa->s->id, pa->s->rev, pa->s->msg, pa->s->class_msg,
+                    action, tenant, pa->s->gid, pa->s->id, pa->s->rev, pa->s->msg, pa->s->class_msg,
                     pa->s->prio, IPV6_GET_L4PROTO(p), srcip, p->sp, dstip, p->dp);
         }
 
@@ -385,6 +394,10 @@ TmEcode AlertSyslogDecoderEvent(ThreadVars *tv, Packet *p, void *data,
     if (p->alerts.cnt == 0)
         return TM_ECODE_OK;
 
+    char tenant[32] = "";
+    if (p->tenant_id != 0)
+        snprintf(tenant, sizeof(tenant), "[Tenant: %" PRIu32 "] ", p->tenant_id);
+
     SCMutexLock(&ast->file_ctx->fp_mutex);
 
     ast->file_ctx->alerts += p->alerts.cnt;
@@ -405,9 +418,9 @@ TmEcode AlertSyslogDecoderEvent(ThreadVars *tv, Packet *p, void *data,
             action = "[wDrop] ";
         }
 
-        snprintf(temp_buf_hdr, sizeof(temp_buf_hdr), "%s[%" PRIu32 ":%" PRIu32
+        snprintf(temp_buf_hdr, sizeof(temp_buf_hdr), "%s%s[%" PRIu32 ":%" PRIu32
                 ":%" PRIu32 "] %s [Classification: %s] [Priority: %" PRIu32
-                "] [**] [Raw pkt: ", action, pa->s->gid, pa->s->id, pa->s->rev, pa->s->msg,
+                "] [**] [Raw pkt: ", action, tenant, pa->s->gid, pa->s->id, pa->s->rev, pa->s->msg,
                 pa->s->class_msg, pa->s->prio);
         strlcpy(alert, temp_buf_hdr, sizeof(alert));
 
@@ -94,7 +94,7 @@ void AlpProtoInit(AlpProtoDetectCtx *ctx) {
  *  \param proto the proto id
  *  \initonly
  */
-static void AlpProtoAddSignature(AlpProtoDetectCtx *ctx, DetectContentData *co, uint16_t ip_proto, uint16_t proto) {
+static AlpProtoSignature *AlpProtoAddSignature(AlpProtoDetectCtx *ctx, DetectContentData *co, uint16_t ip_proto, uint16_t proto) {
     AlpProtoSignature *s = SCMalloc(sizeof(AlpProtoSignature));
     if (unlikely(s == NULL)) {
         SCLogError(SC_ERR_FATAL, "Error allocating memory. Signature not loaded. Not enough memory so.. exiting..");
@@ -114,6 +114,91 @@ static void AlpProtoAddSignature(AlpProtoDetectCtx *ctx, DetectContentData *co,
     }
 
     ctx->sigs++;
+    return s;
+}
+
+/**
+ *  \brief Add a signature to the prefix table for its offset, if its
+ *         pattern is at a fixed offset.
+ *
+ *  \param dir direction to add the signature to
+ *  \param s the signature
+ *
+ *  \retval 0 added
+ *  \retval -1 not added, the pattern needs the mpm
+ *  \initonly
+ */
+static int AlpProtoPrefixAdd(AlpProtoDetectDirection *dir, AlpProtoSignature *s)
+{
+    DetectContentData *co = s->co;
+
+    if (co->content_len == 0 || co->offset + co->content_len != co->depth) {
+        SCLogDebug("pattern with offset %"PRIu16" depth %"PRIu16" isn't at a "
+                "fixed offset, the mpm is needed for this direction",
+                co->offset, co->depth);
+        return -1;
+    }
+
+    AlpProtoPrefixTable *pt = NULL;
+    uint16_t i;
+    for (i = 0; i < dir->prefix_cnt; i++) {
+        if (dir->prefix[i]->offset == co->offset) {
+            pt = dir->prefix[i];
+            break;
+        }
+    }
+    if (pt == NULL) {
+        AlpProtoPrefixTable **prefix = SCRealloc(dir->prefix,
+                (dir->prefix_cnt + 1) * sizeof(AlpProtoPrefixTable *));
+        if (unlikely(prefix == NULL))
+            return -1;
+        dir->prefix = prefix;
+
+        pt = SCMalloc(sizeof(AlpProtoPrefixTable));
+        if (unlikely(pt == NULL))
+            return -1;
+        memset(pt, 0x00, sizeof(AlpProtoPrefixTable));
+        pt->offset = co->offset;
+        dir->prefix[dir->prefix_cnt++] = pt;
+    }
+
+    /* build the value and mask to compare the first 4 bytes with. For
+     * nocase patterns letters are compared with the case bit masked out. */
+    uint8_t val[4] = { 0, 0, 0, 0 };
+    uint8_t mask[4] = { 0, 0, 0, 0 };
+    for (i = 0; i < 4 && i < co->content_len; i++) {
+        uint8_t c = co->content[i];
+        if ((co->flags & DETECT_CONTENT_NOCASE) && isalpha(c)) {
+            mask[i] = 0xdf;
+            val[i] = c & 0xdf;
+        } else {
+            mask[i] = 0xff;
+            val[i] = c;
+        }
+    }
+    memcpy(&s->prefix_val, val, sizeof(val));
+    memcpy(&s->prefix_mask, mask, sizeof(mask));
+
+    /* append, so signatures are tried in the order they were added */
+    AlpProtoSignature **tail = &pt->sigs[u8_tolower(co->content[0])];
+    while (*tail != NULL)
+        tail = &(*tail)->prefix_next;
+    *tail = s;
+
+    return 0;
+}
+
+/** \brief free the prefix tables of a direction */
+static void AlpProtoPrefixFree(AlpProtoDetectDirection *dir)
+{
+    uint16_t i;
+    for (i = 0; i < dir->prefix_cnt; i++) {
+        SCFree(dir->prefix[i]);
+    }
+    if (dir->prefix != NULL)
+        SCFree(dir->prefix);
+    dir->prefix = NULL;
+    dir->prefix_cnt = 0;
 }
 
 /** \brief free a AlpProtoSignature, recursively free any next sig */
@@ -248,7 +333,12 @@ void AlpProtoAddPattern(AlpProtoDetectCtx *ctx, char *name, uint16_t ip_proto,
         dir->min_len = depth;
 
     /* finally turn into a signature and add to the ctx */
-    AlpProtoAddSignature(ctx, cd, ip_proto, al_proto);
+    AlpProtoSignature *s = AlpProtoAddSignature(ctx, cd, ip_proto, al_proto);
+
+    /* patterns at a fixed offset can be found through the prefix tables,
+     * the mpm is still set up with all patterns */
+    if (AlpProtoPrefixAdd(dir, s) < 0)
+        dir->mpm_only++;
 }
 
 
@@ -276,6 +366,8 @@ void AlpProtoAdd(AlpProtoDetectCtx *ctx, char *name, uint16_t ip_proto,
 void AlpProtoTestDestroy(AlpProtoDetectCtx *ctx) {
     mpm_table[ctx->toserver.mpm_ctx.mpm_type].DestroyCtx(&ctx->toserver.mpm_ctx);
     mpm_table[ctx->toclient.mpm_ctx.mpm_type].DestroyCtx(&ctx->toclient.mpm_ctx);
+    AlpProtoPrefixFree(&ctx->toserver);
+    AlpProtoPrefixFree(&ctx->toclient);
     AlpProtoFreeSignature(ctx->head);
     AppLayerFreeProbingParsers(ctx->probing_parsers);
     ctx->probing_parsers = NULL;
@@ -289,6 +381,8 @@ void AlpProtoDestroy() {
     mpm_table[alp_proto_ctx.toserver.mpm_ctx.mpm_type].DestroyCtx(&alp_proto_ctx.toserver.mpm_ctx);
     mpm_table[alp_proto_ctx.toclient.mpm_ctx.mpm_type].DestroyCtx(&alp_proto_ctx.toclient.mpm_ctx);
     MpmPatternIdTableFreeHash(alp_proto_ctx.mpm_pattern_id_store);
+    AlpProtoPrefixFree(&alp_proto_ctx.toserver);
+    AlpProtoPrefixFree(&alp_proto_ctx.toclient);
     AlpProtoFreeSignature(alp_proto_ctx.head);
     AppLayerFreeProbingParsers(alp_proto_ctx.probing_parsers);
     alp_proto_ctx.probing_parsers = NULL;
@@ -380,6 +474,62 @@ void AppLayerDetectProtoThreadInit(void) {
     return;
 }
 
+/**
+ *  \brief Look up the signatures matching a buffer in the prefix tables
+ *
+ *  For each anchor offset the byte at that offset selects a bucket. The
+ *  signatures in it are checked by comparing the first 4 buffer bytes
+ *  at once, longer patterns are verified after that.
+ *
+ *  \param dir direction
+ *  \param buf buffer to inspect
+ *  \param buflen length of buf
+ *  \param ipproto ip protocol of the flow
+ *  \param pm_results array to store the matching protocols in
+ *
+ *  \retval pm_matches number of protocols in pm_results
+ */
+static uint16_t AlpProtoPrefixSearch(AlpProtoDetectDirection *dir,
+                                     uint8_t *buf, uint16_t buflen,
+                                     uint8_t ipproto, uint16_t *pm_results)
+{
+    uint16_t pm_matches = 0;
+
+    /* alproto bit field */
+    uint8_t pm_results_bf[ALPROTO_MAX / 8];
+    memset(pm_results_bf, 0, sizeof(pm_results_bf));
+
+    uint16_t t;
+    for (t = 0; t < dir->prefix_cnt; t++) {
+        AlpProtoPrefixTable *pt = dir->prefix[t];
+        if (pt->offset >= buflen)
+            continue;
+
+        uint8_t *sbuf = buf + pt->offset;
+        uint16_t sbuflen = buflen - pt->offset;
+        uint32_t word = 0;
+        memcpy(&word, sbuf, sbuflen < sizeof(word) ? sbuflen : sizeof(word));
+
+        AlpProtoSignature *s = pt->sigs[u8_tolower(sbuf[0])];
+        for ( ; s != NULL; s = s->prefix_next) {
+            if (s->co->depth > buflen || s->ip_proto != ipproto)
+                continue;
+            if ((word & s->prefix_mask) != s->prefix_val)
+                continue;
+            if (s->co->content_len > sizeof(word) &&
+                AlpProtoMatchSignature(s, buf, buflen, ipproto) == ALPROTO_UNKNOWN)
+                continue;
+
+            if (!(pm_results_bf[s->proto / 8] & (1 << (s->proto % 8)))) {
+                pm_results[pm_matches++] = s->proto;
+                pm_results_bf[s->proto / 8] |= 1 << (s->proto % 8);
+            }
+        }
+    }
+
+    return pm_matches;
+}
+
 /**
  *  \brief Get the app layer proto based on a buffer using a Patter matcher
  *         parser.
@@ -423,6 +573,13 @@ uint16_t AppLayerDetectGetProtoPMParser(AlpProtoDetectCtx *ctx,
         goto end;
     }
 
+    /* all patterns are at fixed offsets, so the prefix tables give us
+     * the complete answer and we can skip the mpm */
+    if (dir->mpm_only == 0) {
+        pm_matches = AlpProtoPrefixSearch(dir, buf, buflen, ipproto, pm_results);
+        goto end;
+    }
+
     /* see if we can limit the data we inspect */
     uint16_t searchlen = buflen;
     if (searchlen > dir->max_len)
@@ -1229,6 +1386,115 @@ int AlpDetectTest14(void) {
     return r;
 }
 
+/** \test prefix tables: fixed offset patterns don't need the mpm */
+int AlpDetectTest15(void) {
+    uint8_t l7data_ftp[] = "user anonymous\r\n";
+    uint8_t l7data_smb[] = "\x00\x00\x00\x85\xff\x53\x4d\x42\x72\x00";
+    uint8_t l7data_http[] = "OPTIONS * HTTP/1.0\r\n";
+    uint8_t l7data_msn[] = "VER 1 MSNP8 CVR0\r\n";
+    int r = 0;
+    AlpProtoDetectCtx ctx;
+    AlpProtoDetectThreadCtx tctx;
+    uint16_t pm_results[ALPROTO_MAX];
+    Flow f;
+
+    AlpProtoInit(&ctx);
+
+    AlpProtoAddCI(&ctx, "ftp", IPPROTO_TCP, ALPROTO_FTP, "USER ", 5, 0, STREAM_TOSERVER);
+    AlpProtoAdd(&ctx, "smb", IPPROTO_TCP, ALPROTO_SMB, "|ff|SMB", 8, 4, STREAM_TOSERVER);
+    AlpProtoAdd(&ctx, "http", IPPROTO_TCP, ALPROTO_HTTP, "OPTIONS|20|", 8, 0, STREAM_TOSERVER);
+    AlpProtoAdd(&ctx, "http", IPPROTO_TCP, ALPROTO_HTTP, "OPTIONS|09|", 8, 0, STREAM_TOSERVER);
+
+    if (ctx.toserver.prefix_cnt != 2 || ctx.toserver.mpm_only != 0) {
+        printf("prefix_cnt %u mpm_only %u, expected 2 and 0: ",
+                ctx.toserver.prefix_cnt, ctx.toserver.mpm_only);
+        goto end;
+    }
+
+    AlpProtoFinalizeGlobal(&ctx);
+    AlpProtoFinalizeThread(&ctx, &tctx);
+
+    if (AppLayerDetectGetProtoPMParser(&ctx, &tctx, &f, l7data_ftp, sizeof(l7data_ftp) - 1, STREAM_TOSERVER, IPPROTO_TCP, pm_results) != 1 ||
+        pm_results[0] != ALPROTO_FTP) {
+        printf("nocase ftp not detected: ");
+        goto end;
+    }
+    if (AppLayerDetectGetProtoPMParser(&ctx, &tctx, &f, l7data_smb, sizeof(l7data_smb) - 1, STREAM_TOSERVER, IPPROTO_TCP, pm_results) != 1 ||
+        pm_results[0] != ALPROTO_SMB) {
+        printf("smb at offset 4 not detected: ");
+        goto end;
+    }
+    if (AppLayerDetectGetProtoPMParser(&ctx, &tctx, &f, l7data_http, sizeof(l7data_http) - 1, STREAM_TOSERVER, IPPROTO_TCP, pm_results) != 1 ||
+        pm_results[0] != ALPROTO_HTTP) {
+        printf("http not detected: ");
+        goto end;
+    }
+    /* too short for the full pattern */
+    if (AppLayerDetectGetProtoPMParser(&ctx, &tctx, &f, l7data_http, 6, STREAM_TOSERVER, IPPROTO_TCP, pm_results) != 0 ||
+        pm_results[0] != ALPROTO_UNKNOWN) {
+        printf("http detected on a partial pattern: ");
+        goto end;
+    }
+    if (AppLayerDetectGetProtoPMParser(&ctx, &tctx, &f, l7data_ftp, sizeof(l7data_ftp) - 1, STREAM_TOSERVER, IPPROTO_UDP, pm_results) != 0) {
+        printf("ftp detected on udp: ");
+        goto end;
+    }
+    AlpProtoTestDestroy(&ctx);
+
+    /* a pattern that can be anywhere within its depth needs the mpm */
+    AlpProtoInit(&ctx);
+    AlpProtoAddCI(&ctx, "ftp", IPPROTO_TCP, ALPROTO_FTP, "USER ", 5, 0, STREAM_TOSERVER);
+    AlpProtoAdd(&ctx, "msn", IPPROTO_TCP, ALPROTO_MSN, "MSNP", 10, 0, STREAM_TOSERVER);
+    if (ctx.toserver.prefix_cnt != 1 || ctx.toserver.mpm_only != 1) {
+        printf("prefix_cnt %u mpm_only %u, expected 1 and 1: ",
+                ctx.toserver.prefix_cnt, ctx.toserver.mpm_only);
+        goto end;
+    }
+
+    AlpProtoFinalizeGlobal(&ctx);
+    AlpProtoFinalizeThread(&ctx, &tctx);
+
+    if (AppLayerDetectGetProtoPMParser(&ctx, &tctx, &f, l7data_msn, sizeof(l7data_msn) - 1, STREAM_TOSERVER, IPPROTO_TCP, pm_results) != 1 ||
+        pm_results[0] != ALPROTO_MSN) {
+        printf("msn not detected: ");
+        goto end;
+    }
+    if (AppLayerDetectGetProtoPMParser(&ctx, &tctx, &f, l7data_ftp, sizeof(l7data_ftp) - 1, STREAM_TOSERVER, IPPROTO_TCP, pm_results) != 1 ||
+        pm_results[0] != ALPROTO_FTP) {
+        printf("ftp not detected through the mpm: ");
+        goto end;
+    }
+
+    AlpProtoTestDestroy(&ctx);
+
+    /* more anchor offsets than the default registrations use */
+    AlpProtoInit(&ctx);
+    AlpProtoAddCI(&ctx, "ftp", IPPROTO_TCP, ALPROTO_FTP, "USER ", 5, 0, STREAM_TOSERVER);
+    AlpProtoAdd(&ctx, "tls", IPPROTO_TCP, ALPROTO_TLS, "|01 00 02|", 5, 2, STREAM_TOSERVER);
+    AlpProtoAdd(&ctx, "smb", IPPROTO_TCP, ALPROTO_SMB, "|ff|SMB", 8, 4, STREAM_TOSERVER);
+    AlpProtoAdd(&ctx, "msn", IPPROTO_TCP, ALPROTO_MSN, "MSNP", 10, 6, STREAM_TOSERVER);
+    AlpProtoAdd(&ctx, "imap", IPPROTO_TCP, ALPROTO_IMAP, "IMAP", 12, 8, STREAM_TOSERVER);
+    if (ctx.toserver.prefix_cnt != 5 || ctx.toserver.mpm_only != 0) {
+        printf("prefix_cnt %u mpm_only %u, expected 5 and 0: ",
+                ctx.toserver.prefix_cnt, ctx.toserver.mpm_only);
+        goto end;
+    }
+
+    /* the default registrations can all be done w/o the mpm */
+    if (alp_proto_ctx.toserver.mpm_only != 0 ||
+        alp_proto_ctx.toclient.mpm_only != 0) {
+        printf("default registrations: mpm_only %u/%u, expected 0/0: ",
+                alp_proto_ctx.toserver.mpm_only,
+                alp_proto_ctx.toclient.mpm_only);
+        goto end;
+    }
+
+    r = 1;
+end:
+    AlpProtoTestDestroy(&ctx);
+    return r;
+}
+
 /** \test test if the engine detect the proto and match with it */
 static int AlpDetectTestSig1(void)
 {
@@ -1709,6 +1975,7 @@ void AlpDetectRegisterTests(void) {
     UtRegisterTest("AlpDetectTest12", AlpDetectTest12, 1);
     UtRegisterTest("AlpDetectTest13", AlpDetectTest13, 1);
     UtRegisterTest("AlpDetectTest14", AlpDetectTest14, 1);
+    UtRegisterTest("AlpDetectTest15", AlpDetectTest15, 1);
     UtRegisterTest("AlpDetectTestSig1", AlpDetectTestSig1, 1);
     UtRegisterTest("AlpDetectTestSig2", AlpDetectTestSig2, 1);
     UtRegisterTest("AlpDetectTestSig3", AlpDetectTestSig3, 1);
@@ -37,10 +37,22 @@ typedef struct AlpProtoSignature_ {
     DetectContentData *co;              /**< content match that needs to match */
     struct AlpProtoSignature_ *next;    /**< next signature */
     struct AlpProtoSignature_ *map_next;    /**< next signature with same id */
+    uint32_t prefix_val;                /**< first (up to 4) pattern bytes */
+    uint32_t prefix_mask;               /**< mask to apply to the buffer bytes
+                                             before comparing to prefix_val */
+    struct AlpProtoSignature_ *prefix_next; /**< next signature in the same
+                                                 prefix table bucket */
 } AlpProtoSignature;
 
 #define ALP_DETECT_MAX 256
 
+/** Signatures whose pattern sits at a fixed offset (depth - offset equals
+ *  the pattern length), bucketed by the lower cased first pattern byte. */
+typedef struct AlpProtoPrefixTable_ {
+    uint16_t offset;                    /**< offset the patterns start at */
+    AlpProtoSignature *sigs[256];
+} AlpProtoPrefixTable;
+
 typedef struct AlpProtoDetectDirection_ {
     MpmCtx mpm_ctx;
     uint32_t id;
@@ -52,6 +64,11 @@ typedef struct AlpProtoDetectDirection_ {
                                          tell the stream engine to feed data
                                          to app layer as soon as it has min
                                          size data */
+    AlpProtoPrefixTable **prefix;  /**< prefix tables, one per anchor offset */
+    uint16_t prefix_cnt;           /**< number of prefix tables */
+    uint16_t mpm_only;             /**< number of patterns that are not in a
+                                        prefix table, if 0 we don't need
+                                        to run the mpm */
 } AlpProtoDetectDirection;
 
 typedef struct AlpProtoDetectCtx_ {
@@ -28,6 +28,138 @@
 #include "util-print.h"
 #endif
 
+/** max number of objects of each type kept in a thread's cache */
+#ifndef DNS_CACHE_MAX
+#define DNS_CACHE_MAX           256
+#endif
+/** records up to this size come from the cache, larger ones are
+ *  allocated and freed directly */
+#define DNS_RECORD_CACHE_SIZE   (sizeof(DNSAnswerEntry) + 128)
+
+typedef struct DNSCacheItem_ {
+    struct DNSCacheItem_ *next;
+} DNSCacheItem;
+
+typedef struct DNSCacheList_ {
+    DNSCacheItem *head;
+    uint32_t cnt;
+} DNSCacheList;
+
+/** per thread cache of freed states, transactions and records. Objects
+ *  freed by another thread than the one that allocated them simply end
+ *  up in the cache of the freeing thread. */
+typedef struct DNSThreadCache_ {
+    DNSCacheList states;
+    DNSCacheList txs;
+    DNSCacheList records;
+} DNSThreadCache;
+
+static pthread_key_t dns_cache_key;
+static pthread_once_t dns_cache_once = PTHREAD_ONCE_INIT;
+static int dns_cache_key_set = 0;
+
+static void DNSCacheListFree(DNSCacheList *l) {
+    DNSCacheItem *item = l->head;
+    while (item != NULL) {
+        DNSCacheItem *next = item->next;
+        SCFree(item);
+        item = next;
+    }
+    l->head = NULL;
+    l->cnt = 0;
+}
+
+/** \internal
+ *  \brief free a thread's cache, called on thread exit */
+static void DNSThreadCacheFree(void *data) {
+    DNSThreadCache *cache = (DNSThreadCache *)data;
+    if (cache == NULL)
+        return;
+
+    DNSCacheListFree(&cache->states);
+    DNSCacheListFree(&cache->txs);
+    DNSCacheListFree(&cache->records);
+    SCFree(cache);
+}
+
+static void DNSThreadCacheKeyInit(void) {
+    if (pthread_key_create(&dns_cache_key, DNSThreadCacheFree) == 0)
+        dns_cache_key_set = 1;
+}
+
+/** \internal
+ *  \brief get the cache of the calling thread, setting it up if needed
+ *  \retval cache or NULL if we can't have one */
+static DNSThreadCache *DNSGetThreadCache(void) {
+    pthread_once(&dns_cache_once, DNSThreadCacheKeyInit);
+    if (unlikely(dns_cache_key_set == 0))
+        return NULL;
+
+    DNSThreadCache *cache = pthread_getspecific(dns_cache_key);
+    if (likely(cache != NULL))
+        return cache;
+
+    cache = SCMalloc(sizeof(DNSThreadCache));
+    if (unlikely(cache == NULL))
+        return NULL;
+    memset(cache, 0x00, sizeof(DNSThreadCache));
+
+    if (pthread_setspecific(dns_cache_key, cache) != 0) {
+        SCFree(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+/** \internal
+ *  \brief get an object of size bytes from a cache list, or allocate
+ *         it if the list is empty */
+static void *DNSCacheGet(DNSCacheList *l, size_t size) {
+    if (l != NULL && l->head != NULL) {
+        DNSCacheItem *item = l->head;
+        l->head = item->next;
+        l->cnt--;
+        return item;
+    }
+    return SCMalloc(size);
+}
+
+/** \internal
+ *  \brief return an object to a cache list, or free it if the list is full */
+static void DNSCachePut(DNSCacheList *l, void *ptr) {
+    if (l != NULL && l->cnt < DNS_CACHE_MAX) {
+        DNSCacheItem *item = (DNSCacheItem *)ptr;
+        item->next = l->head;
+        l->head = item;
+        l->cnt++;
+        return;
+    }
+    SCFree(ptr);
+}
+
+/** \internal
+ *  \brief get memory for a query or answer record of size bytes */
+static void *DNSRecordAlloc(size_t size) {
+    if (size > DNS_RECORD_CACHE_SIZE)
+        return SCMalloc(size);
+
+    DNSThreadCache *cache = DNSGetThreadCache();
+    return DNSCacheGet(cache ? &cache->records : NULL, DNS_RECORD_CACHE_SIZE);
+}
+
+/** \internal
+ *  \brief free a record allocated by DNSRecordAlloc
+ *  \param cache cache of the calling thread or NULL
+ *  \param size size that was passed to DNSRecordAlloc */
+static void DNSRecordFree(DNSThreadCache *cache, void *ptr, size_t size) {
+    if (size > DNS_RECORD_CACHE_SIZE) {
+        SCFree(ptr);
+        return;
+    }
+
+    DNSCachePut(cache ? &cache->records : NULL, ptr);
+}
+
 typedef struct DNSConfig_ {
     uint32_t request_flood;
 } DNSConfig;
@@ -142,7 +274,9 @@ void DNSSetEvent(DNSState *s, uint8_t e) {
  *  \brief Allocate a DNS TX
  *  \retval tx or NULL */
 DNSTransaction *DNSTransactionAlloc(const uint16_t tx_id) {
-    DNSTransaction *tx = SCMalloc(sizeof(DNSTransaction));
+    DNSThreadCache *cache = DNSGetThreadCache();
+    DNSTransaction *tx = DNSCacheGet(cache ? &cache->txs : NULL,
+            sizeof(DNSTransaction));
     if (unlikely(tx == NULL))
         return NULL;
     memset(tx, 0x00, sizeof(DNSTransaction));
@@ -157,28 +291,30 @@ DNSTransaction *DNSTransactionAlloc(const uint16_t tx_id) {
 
 /** \internal
  *  \brief Free a DNS TX
+ *  \param cache cache of the calling thread or NULL
  *  \param tx DNS TX to free */
-static void DNSTransactionFree(DNSTransaction *tx) {
+static void DNSTransactionFree(DNSThreadCache *cache, DNSTransaction *tx) {
     SCEnter();
 
     DNSQueryEntry *q = NULL;
     while ((q = TAILQ_FIRST(&tx->query_list))) {
         TAILQ_REMOVE(&tx->query_list, q, next);
-        SCFree(q);
+        DNSRecordFree(cache, q, sizeof(DNSQueryEntry) + q->len);
     }
 
     DNSAnswerEntry *a = NULL;
     while ((a = TAILQ_FIRST(&tx->answer_list))) {
         TAILQ_REMOVE(&tx->answer_list, a, next);
-        SCFree(a);
+        DNSRecordFree(cache, a, sizeof(DNSAnswerEntry) + a->fqdn_len + a->data_len);
     }
     while ((a = TAILQ_FIRST(&tx->authority_list))) {
         TAILQ_REMOVE(&tx->authority_list, a, next);
-        SCFree(a);
+        DNSRecordFree(cache, a, sizeof(DNSAnswerEntry) + a->fqdn_len + a->data_len);
     }
 
     AppLayerDecoderEventsFreeEvents(tx->decoder_events);
-    SCFree(tx);
+
+    DNSCachePut(cache ? &cache->txs : NULL, tx);
     SCReturn;
 }
 
@@ -211,7 +347,7 @@ void DNSStateTransactionFree(void *state, uint64_t tx_id) {
         }
 
         TAILQ_REMOVE(&dns_state->tx_list, tx, next);
-        DNSTransactionFree(tx);
+        DNSTransactionFree(DNSGetThreadCache(), tx);
         break;
     }
     SCReturn;
@@ -243,7 +379,8 @@ DNSTransaction *DNSTransactionFindByTxId(const DNSState *dns_state, const uint16
 }
 
 void *DNSStateAlloc(void) {
-    void *s = SCMalloc(sizeof(DNSState));
+    DNSThreadCache *cache = DNSGetThreadCache();
+    void *s = DNSCacheGet(cache ? &cache->states : NULL, sizeof(DNSState));
     if (unlikely(s == NULL))
         return NULL;
 
@@ -259,17 +396,19 @@ void DNSStateFree(void *s) {
     SCEnter();
     if (s) {
         DNSState *dns_state = (DNSState *) s;
+        /* look the cache up once for the state and all its txs */
+        DNSThreadCache *cache = DNSGetThreadCache();
 
         DNSTransaction *tx = NULL;
         while ((tx = TAILQ_FIRST(&dns_state->tx_list))) {
             TAILQ_REMOVE(&dns_state->tx_list, tx, next);
-            DNSTransactionFree(tx);
+            DNSTransactionFree(cache, tx);
         }
 
         if (dns_state->buffer != NULL)
             SCFree(dns_state->buffer);
 
-        SCFree(s);
+        DNSCachePut(cache ? &cache->states : NULL, s);
         s = NULL;
     }
     SCReturn;
@@ -361,7 +500,7 @@ void DNSStoreQueryInState(DNSState *dns_state, const uint8_t *fqdn, const uint16
         SCLogDebug("new tx %u with internal id %u", tx->tx_id, tx->tx_num);
     }
 
-    DNSQueryEntry *q = SCMalloc(sizeof(DNSQueryEntry) + fqdn_len);
+    DNSQueryEntry *q = DNSRecordAlloc(sizeof(DNSQueryEntry) + fqdn_len);
     if (unlikely(q == NULL))
         return;
     q->type = type;
@@ -388,7 +527,7 @@ void DNSStoreAnswerInState(DNSState *dns_state, const int rtype, const uint8_t *
         tx->tx_num = dns_state->transaction_max;
     }
 
-    DNSAnswerEntry *q = SCMalloc(sizeof(DNSAnswerEntry) + fqdn_len + data_len);
+    DNSAnswerEntry *q = DNSRecordAlloc(sizeof(DNSAnswerEntry) + fqdn_len + data_len);
     if (unlikely(q == NULL))
         return;
     q->type = type;
@@ -416,7 +416,68 @@ end:
     return (result);
 }
 
+/** \test freed states and transactions are reused from the thread cache */
+static int DNSUDPParserTest02 (void) {
+    int result = 0;
+    /* response for abcdefghijk.com, see DNSUDPParserTest01 */
+    uint8_t buf[] = { 0x00, 0x3c, 0x85, 0x00, 0x00, 0x01, 0x00, 0x00,
+                      0x00, 0x01, 0x00, 0x00, 0x0b, 0x61, 0x62, 0x63,
+                      0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b,
+                      0x03, 0x63, 0x6f, 0x6d, 0x00, 0x00, 0x0f, 0x00,
+                      0x01, 0x00, 0x00, 0x06, 0x00, 0x01, 0x00, 0x01,
+                      0x51, 0x80, 0x00, 0x25, 0x02, 0x6e, 0x73, 0x00,
+                      0x0a, 0x68, 0x6f, 0x73, 0x74, 0x6d, 0x61, 0x73,
+                      0x74, 0x65, 0x72, 0xc0, 0x2f, 0x01, 0x33, 0x2a,
+                      0x76, 0x00, 0x00, 0x70, 0x80, 0x00, 0x00, 0x1c,
+                      0x20, 0x00, 0x09, 0x3a, 0x80, 0x00, 0x01, 0x51,
+                      0x80};
+    size_t buflen = sizeof(buf);
+    Flow *f = NULL;
+    DNSState *dns_state = NULL;
+
+    f = UTHBuildFlow(AF_INET, "1.2.3.4", "1.2.3.5", 1024, 53);
+    if (f == NULL)
+        goto end;
+    f->proto = IPPROTO_UDP;
+    f->alproto = ALPROTO_DNS_UDP;
+
+    dns_state = DNSStateAlloc();
+    if (dns_state == NULL)
+        goto end;
+    if (DNSUDPResponseParse(f, dns_state, NULL, buf, buflen, NULL, NULL) != 1)
+        goto end;
+    DNSTransaction *tx = dns_state->curr;
+    if (tx == NULL || TAILQ_FIRST(&tx->authority_list) == NULL) {
+        printf("no tx or authority record: ");
+        goto end;
+    }
+
+    DNSState *old_state = dns_state;
+    DNSStateFree(dns_state);
+
+    /* most recently freed objects come back first */
+    dns_state = DNSStateAlloc();
+    if (dns_state != old_state) {
+        printf("state not reused: ");
+        goto end;
+    }
+    if (DNSUDPResponseParse(f, dns_state, NULL, buf, buflen, NULL, NULL) != 1)
+        goto end;
+    if (dns_state->curr != tx || dns_state->curr->tx_id != 0x003c) {
+        printf("tx not reused: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (dns_state != NULL)
+        DNSStateFree(dns_state);
+    UTHFreeFlow(f);
+    return (result);
+}
+
 void DNSUDPParserRegisterTests(void) {
 	UtRegisterTest("DNSUDPParserTest01", DNSUDPParserTest01, 1);
+	UtRegisterTest("DNSUDPParserTest02", DNSUDPParserTest02, 1);
 }
 #endif
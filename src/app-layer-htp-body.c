@@ -63,77 +63,175 @@
 
 #include "util-memcmp.h"
 
+/** memory used by the body data blocks of all transactions */
+SC_ATOMIC_DECLARE(uint64_t, htp_body_memuse);
+
+void HtpBodyMemuseInit(void)
+{
+    SC_ATOMIC_INIT(htp_body_memuse);
+}
+
+uint64_t HtpBodyMemuse(void)
+{
+    return SC_ATOMIC_GET(htp_body_memuse);
+}
+
+static void HtpBodyBlockFree(HtpBodyBlock *blk)
+{
+    (void) SC_ATOMIC_SUB(htp_body_memuse, sizeof(HtpBodyBlock) + blk->size);
+    SCFree(blk);
+}
+
+/**
+ * \brief Get a chunk descriptor, reusing a pruned one if we have it
+ *
+ * \param body pointer to the HtpBody holding the list
+ *
+ * \retval bd chunk or NULL on error
+ */
+static HtpBodyChunk *HtpBodyGetChunk(HtpBody *body)
+{
+    HtpBodyChunk *bd = body->free_chunks;
+    if (bd != NULL) {
+        body->free_chunks = bd->next;
+        return bd;
+    }
+
+    return SCMalloc(sizeof(HtpBodyChunk));
+}
+
+/**
+ * \brief Get room for len bytes of body data
+ *
+ * Data is carved from the last block of the body. If that doesn't have
+ * enough room a new block is added. Blocks are HTP_BODY_BLOCK_SIZE, or
+ * smaller if the body limit or the content length tells us less data
+ * will be stored. Chunks larger than that get a block of their own.
+ *
+ * \param body pointer to the HtpBody holding the blocks
+ * \param len number of bytes needed
+ * \param limit body limit, 0 for unlimited
+ *
+ * \retval blk block the data was carved from or NULL on error
+ */
+static HtpBodyBlock *HtpBodyGetData(HtpBody *body, uint32_t len, uint32_t limit)
+{
+    HtpBodyBlock *blk = body->blocks_last;
+
+    if (blk != NULL) {
+        /* all chunks in the block are gone, start at the beginning */
+        if (blk->chunks == 0)
+            blk->used = 0;
+
+        if (blk->size - blk->used >= len)
+            return blk;
+    }
+
+    uint32_t size = HTP_BODY_BLOCK_SIZE;
+    if (limit > 0 && limit > body->content_len_so_far) {
+        uint64_t left = limit - body->content_len_so_far;
+        if (left < (uint64_t)size)
+            size = (uint32_t)left;
+    }
+    if (body->content_len > body->content_len_so_far) {
+        uint64_t left = body->content_len - body->content_len_so_far;
+        if (left < (uint64_t)size)
+            size = (uint32_t)left;
+    }
+    if (len > size)
+        size = len;
+
+    blk = SCMalloc(sizeof(HtpBodyBlock) + size);
+    if (blk == NULL)
+        return NULL;
+    (void) SC_ATOMIC_ADD(htp_body_memuse, sizeof(HtpBodyBlock) + size);
+
+    blk->next = NULL;
+    blk->size = size;
+    blk->used = 0;
+    blk->chunks = 0;
+
+    if (body->blocks_last == NULL) {
+        body->blocks_first = blk;
+    } else {
+        body->blocks_last->next = blk;
+    }
+    body->blocks_last = blk;
+
+    SCLogDebug("body %p: new block %p of %"PRIu32" bytes", body, blk, size);
+    return blk;
+}
+
+/**
+ * \brief Free the blocks at the head of the list no chunk uses anymore
+ *
+ * The last block is kept so the next chunk can reuse it.
+ */
+static void HtpBodyReleaseBlocks(HtpBody *body)
+{
+    while (body->blocks_first != NULL &&
+            body->blocks_first != body->blocks_last &&
+            body->blocks_first->chunks == 0)
+    {
+        HtpBodyBlock *blk = body->blocks_first;
+        body->blocks_first = blk->next;
+        HtpBodyBlockFree(blk);
+    }
+}
+
 /**
  * \brief Append a chunk of body to the HtpBody struct
  *
  * \param body pointer to the HtpBody holding the list
  * \param data pointer to the data of the chunk
  * \param len length of the chunk pointed by data
+ * \param limit configured body limit, 0 for unlimited. Used to size the
+ *              data blocks, the caller already truncates len to it.
  *
  * \retval 0 ok
  * \retval -1 error
  */
-int HtpBodyAppendChunk(HtpTxUserData *htud, HtpBody *body, uint8_t *data, uint32_t len)
+int HtpBodyAppendChunk(HtpTxUserData *htud, HtpBody *body, uint8_t *data,
+                       uint32_t len, uint32_t limit)
 {
     SCEnter();
 
-    HtpBodyChunk *bd = NULL;
-
     if (len == 0 || data == NULL) {
         SCReturnInt(0);
     }
 
-    if (body->first == NULL) {
-        /* New chunk */
-        bd = (HtpBodyChunk *)SCMalloc(sizeof(HtpBodyChunk));
-        if (bd == NULL)
-            goto error;
-
-        bd->len = len;
-        bd->stream_offset = 0;
-        bd->next = NULL;
-
-        bd->data = SCMalloc(len);
-        if (bd->data == NULL) {
-            goto error;
-        }
-        memcpy(bd->data, data, len);
+    HtpBodyChunk *bd = HtpBodyGetChunk(body);
+    if (bd == NULL)
+        SCReturnInt(-1);
 
-        body->first = body->last = bd;
-
-        body->content_len_so_far = len;
-    } else {
-        bd = (HtpBodyChunk *)SCMalloc(sizeof(HtpBodyChunk));
-        if (bd == NULL)
-            goto error;
+    HtpBodyBlock *blk = HtpBodyGetData(body, len, limit);
+    if (blk == NULL) {
+        bd->next = body->free_chunks;
+        body->free_chunks = bd;
+        SCReturnInt(-1);
+    }
 
-        bd->len = len;
-        bd->stream_offset = body->content_len_so_far;
-        bd->next = NULL;
+    bd->data = blk->data + blk->used;
+    bd->block = blk;
+    bd->len = len;
+    bd->next = NULL;
+    memcpy(bd->data, data, len);
 
-        bd->data = SCMalloc(len);
-        if (bd->data == NULL) {
-            goto error;
-        }
-        memcpy(bd->data, data, len);
+    blk->used += len;
+    blk->chunks++;
 
+    /* offsets keep counting if earlier chunks were pruned already */
+    bd->stream_offset = body->content_len_so_far;
+    if (body->first == NULL) {
+        body->first = body->last = bd;
+    } else {
         body->last->next = bd;
         body->last = bd;
-
-        body->content_len_so_far += len;
     }
+    body->content_len_so_far += len;
     SCLogDebug("Body %p; data %p, len %"PRIu32, body, bd->data, (uint32_t)bd->len);
 
     SCReturnInt(0);
-
-error:
-    if (bd != NULL) {
-        if (bd->data != NULL) {
-            SCFree(bd->data);
-        }
-        SCFree(bd);
-    }
-    SCReturnInt(-1);
 }
 
 /**
@@ -170,11 +268,10 @@ void HtpBodyFree(HtpBody *body)
 {
     SCEnter();
 
-    if (body->first == NULL)
-        return;
-
-    SCLogDebug("Removing chunks of Body %p; data %p, len %"PRIu32, body,
-            body->last->data, (uint32_t)body->last->len);
+    if (body->first != NULL) {
+        SCLogDebug("Removing chunks of Body %p; data %p, len %"PRIu32, body,
+                body->last->data, (uint32_t)body->last->len);
+    }
 
     HtpBodyChunk *cur = NULL;
     HtpBodyChunk *prev = NULL;
@@ -182,22 +279,40 @@ void HtpBodyFree(HtpBody *body)
     prev = body->first;
     while (prev != NULL) {
         cur = prev->next;
-        if (prev->data != NULL)
-            SCFree(prev->data);
         SCFree(prev);
         prev = cur;
     }
     body->first = body->last = NULL;
+
+    prev = body->free_chunks;
+    while (prev != NULL) {
+        cur = prev->next;
+        SCFree(prev);
+        prev = cur;
+    }
+    body->free_chunks = NULL;
+
+    HtpBodyBlock *blk = body->blocks_first;
+    while (blk != NULL) {
+        HtpBodyBlock *next = blk->next;
+        HtpBodyBlockFree(blk);
+        blk = next;
+    }
+    body->blocks_first = body->blocks_last = NULL;
 }
 
 /**
  * \brief Free request body chunks that are already fully parsed.
  *
- * \param htud pointer to the HtpTxUserData holding the body
+ * Chunks inside the last window bytes before body_inspected are kept,
+ * the body inspection engines inspect those again with the new data.
+ *
+ * \param body pointer to the HtpBody holding the list
+ * \param window inspect window size for this body
  *
  * \retval none
  */
-void HtpBodyPrune(HtpBody *body)
+void HtpBodyPrune(HtpBody *body, uint32_t window)
 {
     SCEnter();
 
@@ -220,7 +335,8 @@ void HtpBodyPrune(HtpBody *body)
                 "body->body_parsed %"PRIu64, cur->stream_offset, cur->len,
                 cur->stream_offset + cur->len, body->body_parsed);
 
-        if (cur->stream_offset >= body->body_inspected) {
+        if (cur->stream_offset >= body->body_inspected ||
+            cur->stream_offset + cur->len + window > body->body_inspected) {
             break;
         }
 
@@ -229,13 +345,14 @@ void HtpBodyPrune(HtpBody *body)
             body->last = next;
         }
 
-        if (cur->data != NULL) {
-            SCFree(cur->data);
-        }
-        SCFree(cur);
+        cur->block->chunks--;
+        cur->data = NULL;
+        cur->next = body->free_chunks;
+        body->free_chunks = cur;
 
         cur = next;
     }
 
+    HtpBodyReleaseBlocks(body);
     SCReturn;
 }
@@ -28,9 +28,11 @@
 #ifndef __APP_LAYER_HTP_BODY_H__
 #define __APP_LAYER_HTP_BODY_H__
 
-int HtpBodyAppendChunk(HtpTxUserData *, HtpBody *, uint8_t *, uint32_t);
+int HtpBodyAppendChunk(HtpTxUserData *, HtpBody *, uint8_t *, uint32_t, uint32_t);
 void HtpBodyPrint(HtpBody *);
 void HtpBodyFree(HtpBody *);
-void HtpBodyPrune(HtpBody *);
+void HtpBodyPrune(HtpBody *, uint32_t);
+void HtpBodyMemuseInit(void);
+uint64_t HtpBodyMemuse(void);
 
 #endif /* __APP_LAYER_HTP_BODY_H__ */
@@ -1762,7 +1762,8 @@ int HTPCallbackRequestBodyData(htp_tx_data_t *d)
         }
         SCLogDebug("len %u", len);
 
-        HtpBodyAppendChunk(tx_ud, &tx_ud->request_body, (uint8_t *)d->data, len);
+        HtpBodyAppendChunk(tx_ud, &tx_ud->request_body, (uint8_t *)d->data, len,
+                hstate->cfg->request_body_limit);
 
         uint8_t *chunks_buffer = NULL;
         uint32_t chunks_buffer_len = 0;
@@ -1797,8 +1798,12 @@ int HTPCallbackRequestBodyData(htp_tx_data_t *d)
     }
 
 end:
-    /* see if we can get rid of htp body chunks */
-    HtpBodyPrune(&tx_ud->request_body);
+    /* see if we can get rid of htp body chunks, keeping what the client
+     * body inspection looks back on */
+    uint32_t window = hstate->cfg->request_inspect_min_size;
+    if (hstate->cfg->request_inspect_mpm_maxlen > window)
+        window = hstate->cfg->request_inspect_mpm_maxlen;
+    HtpBodyPrune(&tx_ud->request_body, window);
 
     /* set the new chunk flag */
     hstate->flags |= HTP_FLAG_NEW_BODY_SET;
@@ -1866,13 +1871,17 @@ int HTPCallbackResponseBodyData(htp_tx_data_t *d)
         }
         SCLogDebug("len %u", len);
 
-        HtpBodyAppendChunk(tx_ud, &tx_ud->response_body, (uint8_t *)d->data, len);
+        HtpBodyAppendChunk(tx_ud, &tx_ud->response_body, (uint8_t *)d->data, len,
+                hstate->cfg->response_body_limit);
 
         HtpResponseBodyHandle(hstate, tx_ud, d->tx, (uint8_t *)d->data, (uint32_t)d->len);
     }
 
     /* see if we can get rid of htp body chunks */
-    HtpBodyPrune(&tx_ud->response_body);
+    uint32_t window = hstate->cfg->response_inspect_window;
+    if (hstate->cfg->response_inspect_mpm_maxlen > window)
+        window = hstate->cfg->response_inspect_mpm_maxlen;
+    HtpBodyPrune(&tx_ud->response_body, window);
 
     /* set the new chunk flag */
     hstate->flags |= HTP_FLAG_NEW_BODY_SET;
@@ -1883,6 +1892,30 @@ int HTPCallbackResponseBodyData(htp_tx_data_t *d)
 /**
  * \brief Print the stats of the HTTP requests
  */
+/**
+ *  \brief Make the body pruning keep as much inspected body data as the
+ *         detection engine looks back at.
+ *
+ *  Body inspection looks back max(inspect window, longest body mpm
+ *  pattern of the sgh), so the chunks in that range can't be pruned.
+ *  Called at detection engine setup. Only grows the values, as an older
+ *  engine may still be in use after a reload.
+ *
+ *  \param ts longest http_client_body mpm pattern
+ *  \param tc longest file_data/http_server_body mpm pattern
+ */
+void HTPConfigSetBodyInspectMpmMaxlen(uint32_t ts, uint32_t tc)
+{
+    HTPCfgRec *rec;
+
+    for (rec = &cfglist; rec != NULL; rec = rec->next) {
+        if (ts > rec->request_inspect_mpm_maxlen)
+            rec->request_inspect_mpm_maxlen = ts;
+        if (tc > rec->response_inspect_mpm_maxlen)
+            rec->response_inspect_mpm_maxlen = tc;
+    }
+}
+
 void HTPAtExitPrintStats(void)
 {
 #ifdef DEBUG
@@ -2406,6 +2439,7 @@ void AppLayerHtpPrintStats(void) {
     SCMutexLock(&htp_state_mem_lock);
     SCLogInfo("htp memory %"PRIu64" (%"PRIu64")", htp_state_memuse, htp_state_memcnt);
     SCMutexUnlock(&htp_state_mem_lock);
+    SCLogInfo("htp body memory %"PRIu64, HtpBodyMemuse());
 #endif
 }
 
@@ -2484,6 +2518,8 @@ void RegisterHTPParsers(void)
 
     char *proto_name = "http";
 
+    HtpBodyMemuseInit();
+
     /** HTTP */
     if (AppLayerProtoDetectionEnabled(proto_name)) {
         AlpProtoAdd(&alp_proto_ctx, proto_name, IPPROTO_TCP, ALPROTO_HTTP, "GET|20|", 4, 0, STREAM_TOSERVER);
@@ -5040,9 +5076,9 @@ static int HTPBodyReassemblyTest01(void)
     uint8_t chunk1[] = "--e5a320f21416a02493a0a6f561b1c494\r\nContent-Disposition: form-data; name=\"uploadfile\"; filename=\"D2GUef.jpg\"\r";
     uint8_t chunk2[] = "POST /uri HTTP/1.1\r\nHost: hostname.com\r\nKeep-Alive: 115\r\nAccept-Charset: utf-8\r\nUser-Agent: Mozilla/5.0 (X11; Linux i686; rv:9.0.1) Gecko/20100101 Firefox/9.0.1\r\nAccept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\nConnection: keep-alive\r\nContent-length: 68102\r\nReferer: http://otherhost.com\r\nAccept-Encoding: gzip\r\nContent-Type: multipart/form-data; boundary=e5a320f21416a02493a0a6f561b1c494\r\nCookie: blah\r\nAccept-Language: us\r\n\r\n--e5a320f21416a02493a0a6f561b1c494\r\nContent-Disposition: form-data; name=\"uploadfile\"; filename=\"D2GUef.jpg\"\r";
 
-    int r = HtpBodyAppendChunk(&htud, &htud.request_body, (uint8_t *)chunk1, sizeof(chunk1)-1);
+    int r = HtpBodyAppendChunk(&htud, &htud.request_body, (uint8_t *)chunk1, sizeof(chunk1)-1, 0);
     BUG_ON(r != 0);
-    r = HtpBodyAppendChunk(&htud, &htud.request_body, (uint8_t *)chunk2, sizeof(chunk2)-1);
+    r = HtpBodyAppendChunk(&htud, &htud.request_body, (uint8_t *)chunk2, sizeof(chunk2)-1, 0);
     BUG_ON(r != 0);
 
     uint8_t *chunks_buffer = NULL;
@@ -5073,6 +5109,149 @@ end:
     return result;
 }
 
+/** \test body chunks share blocks, pruned chunks and blocks get reused */
+static int HTPBodyBlockTest01(void)
+{
+    int result = 0;
+    HtpTxUserData htud;
+    memset(&htud, 0x00, sizeof(htud));
+    HtpBody *body = &htud.request_body;
+    uint8_t chunk[1000];
+    memset(chunk, 'A', sizeof(chunk));
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        if (HtpBodyAppendChunk(&htud, body, chunk, sizeof(chunk), 0) != 0)
+            goto end;
+    }
+
+    /* all three in one block */
+    if (body->blocks_first == NULL || body->blocks_first != body->blocks_last ||
+        body->blocks_first->chunks != 3 || body->blocks_first->used != 3000) {
+        printf("expected 3 chunks in a single block: ");
+        goto end;
+    }
+    if (body->first->next->data != body->first->data + sizeof(chunk)) {
+        printf("chunks not contiguous: ");
+        goto end;
+    }
+
+    HtpBodyBlock *blk = body->blocks_first;
+    HtpBodyChunk *last = body->last;
+
+    /* everything parsed and inspected */
+    body->body_parsed = body->body_inspected = body->content_len_so_far;
+    HtpBodyPrune(body, 0);
+
+    if (body->first != NULL || body->free_chunks == NULL ||
+        blk->chunks != 0 || body->blocks_first != blk) {
+        printf("prune didn't release the chunks: ");
+        goto end;
+    }
+
+    /* next chunk reuses the descriptor and the start of the block */
+    if (HtpBodyAppendChunk(&htud, body, chunk, sizeof(chunk), 0) != 0)
+        goto end;
+    if (body->first != last || body->first->data != blk->data ||
+        body->blocks_first != blk || body->blocks_last != blk) {
+        printf("descriptor or block not reused: ");
+        goto end;
+    }
+    if (body->first->stream_offset != 3000 || body->content_len_so_far != 4000) {
+        printf("offsets off: ");
+        goto end;
+    }
+
+    /* chunk larger than the block size gets a block of its own */
+    uint8_t *big = SCMalloc(HTP_BODY_BLOCK_SIZE + 1);
+    if (big == NULL)
+        goto end;
+    memset(big, 'B', HTP_BODY_BLOCK_SIZE + 1);
+    int r = HtpBodyAppendChunk(&htud, body, big, HTP_BODY_BLOCK_SIZE + 1, 0);
+    SCFree(big);
+    if (r != 0)
+        goto end;
+    if (body->blocks_last == blk || body->blocks_last->size != HTP_BODY_BLOCK_SIZE + 1 ||
+        body->last->data[HTP_BODY_BLOCK_SIZE] != 'B') {
+        printf("large chunk not in its own block: ");
+        goto end;
+    }
+
+    /* pruning the first chunk frees the first block */
+    body->body_parsed = body->body_inspected = 4000;
+    HtpBodyPrune(body, 0);
+    if (body->blocks_first == blk || body->blocks_first != body->blocks_last) {
+        printf("empty block not freed: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    HtpBodyFree(body);
+    if (body->blocks_first != NULL || body->free_chunks != NULL)
+        result = 0;
+    return result;
+}
+
+/** \test body blocks are sized to the body limit and content length and
+ *        accounted in the body memuse */
+static int HTPBodyBlockTest02(void)
+{
+    int result = 0;
+    HtpTxUserData htud;
+    memset(&htud, 0x00, sizeof(htud));
+    HtpBody *body = &htud.request_body;
+    uint8_t chunk[1000];
+    memset(chunk, 'A', sizeof(chunk));
+    uint64_t memuse = HtpBodyMemuse();
+
+    /* unknown content length: the body limit caps the block */
+    if (HtpBodyAppendChunk(&htud, body, chunk, sizeof(chunk), 3072) != 0)
+        goto end;
+    if (body->blocks_last->size != 3072) {
+        printf("block size %"PRIu32", expected 3072: ", body->blocks_last->size);
+        goto end;
+    }
+    if (HtpBodyMemuse() != memuse + sizeof(HtpBodyBlock) + 3072) {
+        printf("memuse %"PRIu64", expected %"PRIu64": ", HtpBodyMemuse(),
+                (uint64_t)(memuse + sizeof(HtpBodyBlock) + 3072));
+        goto end;
+    }
+    HtpBodyFree(body);
+    if (HtpBodyMemuse() != memuse) {
+        printf("memuse not back to %"PRIu64": ", memuse);
+        goto end;
+    }
+
+    /* what's left of the limit after data was stored */
+    memset(&htud, 0x00, sizeof(htud));
+    body->content_len_so_far = 2000;
+    if (HtpBodyAppendChunk(&htud, body, chunk, sizeof(chunk), 3072) != 0)
+        goto end;
+    if (body->blocks_last->size != 1072) {
+        printf("block size %"PRIu32", expected 1072: ", body->blocks_last->size);
+        goto end;
+    }
+    HtpBodyFree(body);
+
+    /* content length smaller than the limit */
+    memset(&htud, 0x00, sizeof(htud));
+    body->content_len = 1500;
+    if (HtpBodyAppendChunk(&htud, body, chunk, sizeof(chunk), 4096) != 0)
+        goto end;
+    if (body->blocks_last->size != 1500) {
+        printf("block size %"PRIu32", expected 1500: ", body->blocks_last->size);
+        goto end;
+    }
+
+    result = 1;
+end:
+    HtpBodyFree(body);
+    if (HtpBodyMemuse() != memuse)
+        result = 0;
+    return result;
+}
+
 /** \test BG crash */
 static int HTPSegvTest01(void) {
     int result = 0;
@@ -5331,6 +5510,8 @@ void HTPParserRegisterTests(void) {
     UtRegisterTest("HTPParserDecodingTest07", HTPParserDecodingTest07, 1);
 
     UtRegisterTest("HTPBodyReassemblyTest01", HTPBodyReassemblyTest01, 1);
+    UtRegisterTest("HTPBodyBlockTest01", HTPBodyBlockTest01, 1);
+    UtRegisterTest("HTPBodyBlockTest02", HTPBodyBlockTest02, 1);
 
     UtRegisterTest("HTPSegvTest01", HTPSegvTest01, 1);
     UtRegisterTest("HTPParserTest14", HTPParserTest14, 1);
@@ -143,12 +143,31 @@ typedef struct HTPCfgRec_ {
 
     uint32_t            response_inspect_min_size;
     uint32_t            response_inspect_window;
+
+    /** longest http client/server body mpm pattern of the detection
+     *  engines, body inspection looks back at least this far */
+    uint32_t            request_inspect_mpm_maxlen;
+    uint32_t            response_inspect_mpm_maxlen;
 } HTPCfgRec;
 
+/** default size of the data blocks body chunks are carved from */
+#define HTP_BODY_BLOCK_SIZE     32768
+
+/** Block of body data. Chunks are carved from the last block of a body
+ *  in order, so blocks are released in order as the chunks are pruned. */
+typedef struct HtpBodyBlock_ {
+    struct HtpBodyBlock_ *next;
+    uint32_t size;              /**< size of the data area */
+    uint32_t used;              /**< bytes handed out to chunks */
+    uint32_t chunks;            /**< chunks still using this block */
+    uint8_t data[];
+} HtpBodyBlock;
+
 /** Struct used to hold chunks of a body on a request */
 struct HtpBodyChunk_ {
     uint8_t *data;              /**< Pointer to the data of the chunk */
     struct HtpBodyChunk_ *next; /**< Pointer to the next chunk */
+    HtpBodyBlock *block;        /**< block holding the data */
     uint64_t stream_offset;
     uint32_t len;               /**< Length of the chunk */
 } __attribute__((__packed__));
@@ -167,6 +186,12 @@ typedef struct HtpBody_ {
     uint64_t body_parsed;
     /* inspection tracker */
     uint64_t body_inspected;
+
+    /* data blocks, chunks are carved from blocks_last */
+    HtpBodyBlock *blocks_first;
+    HtpBodyBlock *blocks_last;
+    /* pruned chunk descriptors kept for reuse */
+    HtpBodyChunk *free_chunks;
 } HtpBody;
 
 #define HTP_CONTENTTYPE_SET     0x01    /**< We have the content type */
@@ -263,6 +288,7 @@ void AppLayerHtpNeedFileInspection(void);
 void AppLayerHtpPrintStats(void);
 
 void HTPConfigure(void);
+void HTPConfigSetBodyInspectMpmMaxlen(uint32_t, uint32_t);
 
 void HtpConfigCreateBackup(void);
 void HtpConfigRestoreBackup(void);
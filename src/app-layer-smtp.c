@@ -185,10 +185,78 @@ SCEnumCharMap smtp_reply_map[ ] = {
 //    return;
 //}
 
+/** line buffers up to this size are kept for the next fragmented line */
+#define SMTP_LINE_BUFFER_KEEP_SIZE  4096
+/** minimal allocation size of a line buffer */
+#define SMTP_LINE_BUFFER_MIN_SIZE   256
+
+/**
+ * \internal
+ * \brief Append data to a line buffer, growing it if needed.
+ *
+ * The buffer is grown at least twice its size, so a long line
+ * fragmented over many chunks isn't copied over and over.
+ *
+ * \param db pointer to the line buffer
+ * \param db_len pointer to the length of the data in the buffer
+ * \param db_size pointer to the size of the buffer
+ * \param data data to append
+ * \param data_len length of data
+ *
+ * \retval  0 ok
+ * \retval -1 error
+ */
+static int SMTPLineBufferAppend(uint8_t **db, int32_t *db_len, int32_t *db_size,
+                                uint8_t *data, int32_t data_len)
+{
+    if (*db_len + data_len > *db_size) {
+        int32_t size = *db_size * 2;
+        if (size < SMTP_LINE_BUFFER_MIN_SIZE)
+            size = SMTP_LINE_BUFFER_MIN_SIZE;
+        if (size < *db_len + data_len)
+            size = *db_len + data_len;
+
+        uint8_t *ptr = SCRealloc(*db, size);
+        if (ptr == NULL) {
+            SCFree(*db);
+            *db = NULL;
+            *db_len = 0;
+            *db_size = 0;
+            return -1;
+        }
+        *db = ptr;
+        *db_size = size;
+    }
+
+    memcpy(*db + *db_len, data, data_len);
+    *db_len += data_len;
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Done with the line in a line buffer. Small buffers are kept
+ *        for the next fragmented line, large ones are freed.
+ */
+static void SMTPLineBufferReset(uint8_t **db, int32_t *db_len, int32_t *db_size)
+{
+    if (*db_size > SMTP_LINE_BUFFER_KEEP_SIZE) {
+        SCFree(*db);
+        *db = NULL;
+        *db_size = 0;
+    }
+    *db_len = 0;
+}
+
 /**
  * \internal
  * \brief Get the next line from input.  It doesn't do any length validation.
  *
+ * Complete lines are returned in place in the input. Only the tail of a
+ * line that continues in the next chunk is copied into the line buffer
+ * of the direction, and the rest of the line is appended to it once it
+ * comes in.
+ *
  * \param state The smtp state.
  *
  * \retval  0 On suceess.
@@ -203,193 +271,98 @@ static int SMTPGetLine(SMTPState *state)
     if (state->input_len <= 0)
         return -1;
 
-    /* toserver */
+    uint8_t **db;
+    int32_t *db_len;
+    int32_t *db_size;
+    uint8_t *current_line_db;
+    uint8_t *current_line_lf_seen;
+
     if (state->direction == 0) {
-        if (state->ts_current_line_lf_seen == 1) {
-            /* we have seen the lf for the previous line.  Clear the parser
-             * details to parse new line */
-            state->ts_current_line_lf_seen = 0;
-            if (state->ts_current_line_db == 1) {
-                state->ts_current_line_db = 0;
-                SCFree(state->ts_db);
-                state->ts_db = NULL;
-                state->ts_db_len = 0;
-                state->current_line = NULL;
-                state->current_line_len = 0;
-            }
+        db = &state->ts_db;
+        db_len = &state->ts_db_len;
+        db_size = &state->ts_db_size;
+        current_line_db = &state->ts_current_line_db;
+        current_line_lf_seen = &state->ts_current_line_lf_seen;
+    } else {
+        db = &state->tc_db;
+        db_len = &state->tc_db_len;
+        db_size = &state->tc_db_size;
+        current_line_db = &state->tc_current_line_db;
+        current_line_lf_seen = &state->tc_current_line_lf_seen;
+    }
+
+    if (*current_line_lf_seen == 1) {
+        /* we have seen the lf for the previous line.  Clear the parser
+         * details to parse new line */
+        *current_line_lf_seen = 0;
+        if (*current_line_db == 1) {
+            *current_line_db = 0;
+            SMTPLineBufferReset(db, db_len, db_size);
+            state->current_line = NULL;
+            state->current_line_len = 0;
         }
+    }
 
-        uint8_t *lf_idx = memchr(state->input, 0x0a, state->input_len);
-
-        if (lf_idx == NULL) {
-            /* fragmented lines.  Decoder event for special cases.  Not all
-             * fragmented lines should be treated as a possible evasion
-             * attempt.  With multi payload smtp chunks we can have valid
-             * cases of fragmentation.  But within the same segment chunk
-             * if we see fragmentation then it's definitely something you
-             * should alert about */
-            if (state->ts_current_line_db == 0) {
-                state->ts_db = SCMalloc(state->input_len);
-                if (state->ts_db == NULL) {
-                    return -1;
-                }
-                state->ts_current_line_db = 1;
-                memcpy(state->ts_db, state->input, state->input_len);
-                state->ts_db_len = state->input_len;
-            } else {
-                state->ts_db = SCRealloc(state->ts_db, (state->ts_db_len +
-                                                        state->input_len));
-                if (state->ts_db == NULL) {
-                    return -1;
-                }
-                memcpy(state->ts_db + state->ts_db_len,
-                       state->input, state->input_len);
-                state->ts_db_len += state->input_len;
-            } /* else */
-            state->input += state->input_len;
-            state->input_len = 0;
+    uint8_t *lf_idx = memchr(state->input, 0x0a, state->input_len);
 
+    if (lf_idx == NULL) {
+        /* fragmented lines.  Decoder event for special cases.  Not all
+         * fragmented lines should be treated as a possible evasion
+         * attempt.  With multi payload smtp chunks we can have valid
+         * cases of fragmentation.  But within the same segment chunk
+         * if we see fragmentation then it's definitely something you
+         * should alert about */
+        if (SMTPLineBufferAppend(db, db_len, db_size,
+                                 state->input, state->input_len) < 0) {
+            *current_line_db = 0;
             return -1;
+        }
+        *current_line_db = 1;
 
-        } else {
-            state->ts_current_line_lf_seen = 1;
-
-            if (state->ts_current_line_db == 1) {
-                state->ts_db = SCRealloc(state->ts_db,
-                                         (state->ts_db_len +
-                                          (lf_idx + 1 - state->input)));
-                if (state->ts_db == NULL) {
-                    return -1;
-                }
-                memcpy(state->ts_db + state->ts_db_len,
-                       state->input, (lf_idx + 1 - state->input));
-                state->ts_db_len += (lf_idx + 1 - state->input);
-
-                if (state->ts_db_len > 1 &&
-                    state->ts_db[state->ts_db_len - 2] == 0x0D) {
-                    state->ts_db_len -= 2;
-                    state->current_line_delimiter_len = 2;
-                } else {
-                    state->ts_db_len -= 1;
-                    state->current_line_delimiter_len = 1;
-                }
-
-                state->current_line = state->ts_db;
-                state->current_line_len = state->ts_db_len;
-
-            } else {
-                state->current_line = state->input;
-                state->current_line_len = lf_idx - state->input;
-
-                if (state->input != lf_idx &&
-                    *(lf_idx - 1) == 0x0D) {
-                    state->current_line_len--;
-                    state->current_line_delimiter_len = 2;
-                } else {
-                    state->current_line_delimiter_len = 1;
-                }
-            }
-
-            state->input_len -= (lf_idx - state->input) + 1;
-            state->input = (lf_idx + 1);
+        state->input += state->input_len;
+        state->input_len = 0;
 
-            return 0;
-        }
+        return -1;
 
-        /* toclient */
     } else {
-        if (state->tc_current_line_lf_seen == 1) {
-            /* we have seen the lf for the previous line.  Clear the parser
-             * details to parse new line */
-            state->tc_current_line_lf_seen = 0;
-            if (state->tc_current_line_db == 1) {
-                state->tc_current_line_db = 0;
-                SCFree(state->tc_db);
-                state->tc_db = NULL;
-                state->tc_db_len = 0;
-                state->current_line = NULL;
-                state->current_line_len = 0;
+        *current_line_lf_seen = 1;
+
+        if (*current_line_db == 1) {
+            if (SMTPLineBufferAppend(db, db_len, db_size, state->input,
+                                     (lf_idx + 1 - state->input)) < 0) {
+                *current_line_db = 0;
+                return -1;
             }
-        }
 
-        uint8_t *lf_idx = memchr(state->input, 0x0a, state->input_len);
-
-        if (lf_idx == NULL) {
-            /* fragmented lines.  Decoder event for special cases.  Not all
-             * fragmented lines should be treated as a possible evasion
-             * attempt.  With multi payload smtp chunks we can have valid
-             * cases of fragmentation.  But within the same segment chunk
-             * if we see fragmentation then it's definitely something you
-             * should alert about */
-            if (state->tc_current_line_db == 0) {
-                state->tc_db = SCMalloc(state->input_len);
-                if (state->tc_db == NULL) {
-                    return -1;
-                }
-                state->tc_current_line_db = 1;
-                memcpy(state->tc_db, state->input, state->input_len);
-                state->tc_db_len = state->input_len;
+            if (*db_len > 1 && (*db)[*db_len - 2] == 0x0D) {
+                *db_len -= 2;
+                state->current_line_delimiter_len = 2;
             } else {
-                state->tc_db = SCRealloc(state->tc_db, (state->tc_db_len +
-                                                        state->input_len));
-                if (state->tc_db == NULL) {
-                    return -1;
-                }
-                memcpy(state->tc_db + state->tc_db_len,
-                       state->input, state->input_len);
-                state->tc_db_len += state->input_len;
-            } /* else */
-            state->input += state->input_len;
-            state->input_len = 0;
+                *db_len -= 1;
+                state->current_line_delimiter_len = 1;
+            }
 
-            return -1;
+            state->current_line = *db;
+            state->current_line_len = *db_len;
 
         } else {
-            state->tc_current_line_lf_seen = 1;
-
-            if (state->tc_current_line_db == 1) {
-                state->tc_db = SCRealloc(state->tc_db,
-                                         (state->tc_db_len +
-                                          (lf_idx + 1 - state->input)));
-                if (state->tc_db == NULL) {
-                    return -1;
-                }
-                memcpy(state->tc_db + state->tc_db_len,
-                       state->input, (lf_idx + 1 - state->input));
-                state->tc_db_len += (lf_idx + 1 - state->input);
-
-                if (state->tc_db_len > 1 &&
-                    state->tc_db[state->tc_db_len - 2] == 0x0D) {
-                    state->tc_db_len -= 2;
-                    state->current_line_delimiter_len = 2;
-                } else {
-                    state->tc_db_len -= 1;
-                    state->current_line_delimiter_len = 1;
-                }
-
-                state->current_line = state->tc_db;
-                state->current_line_len = state->tc_db_len;
+            state->current_line = state->input;
+            state->current_line_len = lf_idx - state->input;
 
+            if (state->input != lf_idx &&
+                *(lf_idx - 1) == 0x0D) {
+                state->current_line_len--;
+                state->current_line_delimiter_len = 2;
             } else {
-                state->current_line = state->input;
-                state->current_line_len = lf_idx - state->input;
-
-                if (state->input != lf_idx &&
-                    *(lf_idx - 1) == 0x0D) {
-                    state->current_line_len--;
-                    state->current_line_delimiter_len = 2;
-                } else {
-                    state->current_line_delimiter_len = 1;
-                }
+                state->current_line_delimiter_len = 1;
             }
+        }
 
-            state->input_len -= (lf_idx - state->input) + 1;
-            state->input = (lf_idx + 1);
+        state->input_len -= (lf_idx - state->input) + 1;
+        state->input = (lf_idx + 1);
 
-            return 0;
-        } /* else - if (lf_idx == NULL) */
+        return 0;
     }
-
 }
 
 static int SMTPInsertCommandIntoCommandBuffer(uint8_t command, SMTPState *state, Flow *f)
@@ -789,10 +762,10 @@ static void SMTPStateFree(void *p)
     if (smtp_state->cmds != NULL) {
         SCFree(smtp_state->cmds);
     }
-    if (smtp_state->ts_current_line_db) {
+    if (smtp_state->ts_db != NULL) {
         SCFree(smtp_state->ts_db);
     }
-    if (smtp_state->tc_current_line_db) {
+    if (smtp_state->tc_db != NULL) {
         SCFree(smtp_state->tc_db);
     }
 
@@ -2839,7 +2812,7 @@ int SMTPParserTest07(void)
     }
     SCMutexUnlock(&f.m);
     if (smtp_state->ts_current_line_db != 0 ||
-        smtp_state->ts_db != NULL ||
+        smtp_state->current_line == smtp_state->ts_db ||
         smtp_state->ts_db_len != 0 ||
         smtp_state->current_line == NULL ||
         smtp_state->current_line_len != (int32_t)strlen(request1_str) ||
@@ -2950,7 +2923,7 @@ int SMTPParserTest08(void)
     }
     SCMutexUnlock(&f.m);
     if (smtp_state->ts_current_line_db != 0 ||
-        smtp_state->ts_db != NULL ||
+        smtp_state->current_line == smtp_state->ts_db ||
         smtp_state->ts_db_len != 0 ||
         smtp_state->current_line == NULL ||
         smtp_state->current_line_len != (int32_t)strlen(request1_str) ||
@@ -3061,7 +3034,7 @@ int SMTPParserTest09(void)
     }
     SCMutexUnlock(&f.m);
     if (smtp_state->ts_current_line_db != 0 ||
-        smtp_state->ts_db != NULL ||
+        smtp_state->current_line == smtp_state->ts_db ||
         smtp_state->ts_db_len != 0 ||
         smtp_state->current_line == NULL ||
         smtp_state->current_line_len != (int32_t)strlen(request1_str) ||
@@ -3172,7 +3145,7 @@ int SMTPParserTest10(void)
     }
     SCMutexUnlock(&f.m);
     if (smtp_state->ts_current_line_db != 0 ||
-        smtp_state->ts_db != NULL ||
+        smtp_state->current_line == smtp_state->ts_db ||
         smtp_state->ts_db_len != 0 ||
         smtp_state->current_line == NULL ||
         smtp_state->current_line_len != (int32_t)strlen(request2_str) ||
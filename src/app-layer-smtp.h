@@ -56,6 +56,8 @@ typedef struct SMTPState_ {
      * use a malloced buffer, if a line is fragmented */
     uint8_t *tc_db;
     int32_t tc_db_len;
+    /** allocated size of tc_db, it is kept between lines */
+    int32_t tc_db_size;
     uint8_t tc_current_line_db;
     /** we have see LF for the currently parsed line */
     uint8_t tc_current_line_lf_seen;
@@ -64,6 +66,8 @@ typedef struct SMTPState_ {
      * use a malloced buffer, if a line is fragmented */
     uint8_t *ts_db;
     int32_t ts_db_len;
+    /** allocated size of ts_db, it is kept between lines */
+    int32_t ts_db_size;
     uint8_t ts_current_line_db;
     /** we have see LF for the currently parsed line */
     uint8_t ts_current_line_lf_seen;
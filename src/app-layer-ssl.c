@@ -73,6 +73,9 @@ SCEnumCharMap tls_decoder_event_table[ ] = {
 
 typedef struct SslConfig_ {
     int no_reassemble;
+    /** stop inspection and reassembly as soon as the handshake is done,
+     *  instead of on the first application data record */
+    int bypass_after_handshake;
 } SslConfig;
 
 SslConfig ssl_config;
@@ -719,8 +722,19 @@ static int SSLv3Decode(uint8_t direction, SSLState *ssl_state,
             break;
 
         case SSLV3_HANDSHAKE_PROTOCOL:
-            if (ssl_state->flags & SSL_AL_FLAG_CHANGE_CIPHER_SPEC)
+            if (ssl_state->flags & SSL_AL_FLAG_CHANGE_CIPHER_SPEC) {
+                /* encrypted Finished message. If both sides have changed
+                 * the cipher spec, this completes the handshake. */
+                if (ssl_config.bypass_after_handshake == 1 &&
+                    (ssl_state->flags & SSL_AL_FLAG_CLIENT_CHANGE_CIPHER_SPEC) &&
+                    (ssl_state->flags & SSL_AL_FLAG_SERVER_CHANGE_CIPHER_SPEC)) {
+                    SCLogDebug("handshake done, bypassing the rest of the session");
+                    pstate->flags |= APP_LAYER_PARSER_DONE;
+                    pstate->flags |= APP_LAYER_PARSER_NO_INSPECTION;
+                    pstate->flags |= APP_LAYER_PARSER_NO_REASSEMBLY;
+                }
                 break;
+            }
 
             if (ssl_state->curr_connp->record_length < 4) {
                 SSLParserReset(ssl_state);
@@ -780,6 +794,52 @@ static int SSLv3Decode(uint8_t direction, SSLState *ssl_state,
 
 }
 
+/**
+ * \internal
+ * \brief Skip complete application data records in place.
+ *
+ *        The payload of these records is encrypted, so there is nothing
+ *        in it for us. The record headers are read straight from the input
+ *        and the records are skipped without going through the record
+ *        parser state. A record that is cut off by the end of the input is
+ *        left to SSLv3Decode().
+ *
+ * \retval Number of bytes skipped.
+ */
+static int SSLv3SkipApplicationRecords(SSLState *ssl_state,
+                                       AppLayerParserState *pstate,
+                                       uint8_t *input, uint32_t input_len)
+{
+    uint32_t skipped = 0;
+
+    while (input_len - skipped >= SSLV3_RECORD_HDR_LEN &&
+           input[skipped] == SSLV3_APPLICATION_PROTOCOL)
+    {
+        uint32_t record_len = SSLV3_RECORD_HDR_LEN +
+            (input[skipped + 3] << 8 | input[skipped + 4]);
+        if (record_len > input_len - skipped)
+            break;
+
+        ssl_state->curr_connp->version = input[skipped + 1] << 8 |
+                                         input[skipped + 2];
+        skipped += record_len;
+    }
+
+    if (skipped > 0) {
+        ssl_state->curr_connp->content_type = SSLV3_APPLICATION_PROTOCOL;
+
+        if ((ssl_state->flags & SSL_AL_FLAG_CLIENT_CHANGE_CIPHER_SPEC) &&
+            (ssl_state->flags & SSL_AL_FLAG_SERVER_CHANGE_CIPHER_SPEC)) {
+            pstate->flags |= APP_LAYER_PARSER_DONE;
+            pstate->flags |= APP_LAYER_PARSER_NO_INSPECTION;
+            if (ssl_config.no_reassemble == 1)
+                pstate->flags |= APP_LAYER_PARSER_NO_REASSEMBLY;
+        }
+    }
+
+    return (int)skipped;
+}
+
 /**
  * \internal
  * \brief SSLv2, SSLv23, SSLv3, TLSv1.1, TLSv1.2, TLSv1.3 parser.
@@ -853,6 +913,15 @@ static int SSLDecode(Flow *f, uint8_t direction, void *alstate, AppLayerParserSt
                     /* we will keep it this way till our record parser tells
                      * us what exact version it is */
                     ssl_state->curr_connp->version = TLS_VERSION_UNKNOWN;
+                    if (input[0] == SSLV3_APPLICATION_PROTOCOL) {
+                        retval = SSLv3SkipApplicationRecords(ssl_state, pstate,
+                                                             input, input_len);
+                        if (retval > 0) {
+                            input_len -= retval;
+                            input += retval;
+                            break;
+                        }
+                    }
                     retval = SSLv3Decode(direction, ssl_state, pstate, input,
                                          input_len);
                     if (retval < 0) {
@@ -1111,6 +1180,10 @@ void RegisterSSLParsers(void)
             if (ConfGetBool("app-layer.protocols.tls.no-reassemble", &ssl_config.no_reassemble) != 1)
                 ssl_config.no_reassemble = 1;
         }
+
+        /* Get the value of the bypass after handshake option */
+        if (ConfGetBool("app-layer.protocols.tls.bypass-after-handshake", &ssl_config.bypass_after_handshake) != 1)
+            ssl_config.bypass_after_handshake = 0;
     } else {
         SCLogInfo("Parsed disabled for %s protocol. Protocol detection"
                   "still on.", proto_name);
@@ -3800,6 +3873,184 @@ end:
     return result;
 }
 
+/**
+ * \test Test that with bypass-after-handshake the session is bypassed as
+ *       soon as the encrypted Finished messages are seen.
+ */
+static int SSLParserTest26(void)
+{
+    int result = 0;
+    Flow f;
+    /* change cipher spec + encrypted finished */
+    uint8_t client_finished[] = {
+        0x14, 0x03, 0x01, 0x00, 0x01, 0x01,
+        0x16, 0x03, 0x01, 0x00, 0x04, 0xa1, 0xb2, 0xc3,
+        0xd4,
+    };
+    uint32_t client_finished_len = sizeof(client_finished);
+    uint8_t server_finished[] = {
+        0x14, 0x03, 0x01, 0x00, 0x01, 0x01,
+        0x16, 0x03, 0x01, 0x00, 0x04, 0x5e, 0x6f, 0x70,
+        0x81,
+    };
+    uint32_t server_finished_len = sizeof(server_finished);
+    TcpSession ssn;
+    int bypass = ssl_config.bypass_after_handshake;
+
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+
+    StreamTcpInitConfig(TRUE);
+    ssl_config.bypass_after_handshake = 1;
+
+    SCMutexLock(&f.m);
+    int r = AppLayerParse(NULL, &f, ALPROTO_TLS, STREAM_TOSERVER | STREAM_START,
+                          client_finished, client_finished_len);
+    if (r != 0) {
+        printf("toserver chunk 1 returned %" PRId32 ", expected 0: ", r);
+        SCMutexUnlock(&f.m);
+        goto end;
+    }
+    SCMutexUnlock(&f.m);
+
+    AppLayerParserStateStore *parser_state_store =
+        (AppLayerParserStateStore *)f.alparser;
+    if (parser_state_store == NULL) {
+        printf("no parser state: ");
+        goto end;
+    }
+
+    /* only one side is done with the handshake */
+    if ((parser_state_store->to_server.flags & APP_LAYER_PARSER_NO_INSPECTION) ||
+        (f.flags & FLOW_NOPAYLOAD_INSPECTION)) {
+        printf("the flags should not be set: ");
+        goto end;
+    }
+
+    SCMutexLock(&f.m);
+    r = AppLayerParse(NULL, &f, ALPROTO_TLS, STREAM_TOCLIENT,
+                      server_finished, server_finished_len);
+    if (r != 0) {
+        printf("toclient chunk 1 returned %" PRId32 ", expected 0: ", r);
+        SCMutexUnlock(&f.m);
+        goto end;
+    }
+    SCMutexUnlock(&f.m);
+
+    AppLayerParserState *parser_state = &parser_state_store->to_client;
+    if (!(parser_state->flags & APP_LAYER_PARSER_NO_INSPECTION) ||
+        !(parser_state->flags & APP_LAYER_PARSER_NO_REASSEMBLY)) {
+        printf("the parser flags should be set: ");
+        goto end;
+    }
+
+    if (!(ssn.client.flags & STREAMTCP_STREAM_FLAG_NOREASSEMBLY) ||
+        !(ssn.server.flags & STREAMTCP_STREAM_FLAG_NOREASSEMBLY)) {
+        printf("reassembly should be disabled for both streams: ");
+        goto end;
+    }
+
+    if (!(f.flags & FLOW_NOPAYLOAD_INSPECTION)) {
+        printf("the flow flags should be set: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    ssl_config.bypass_after_handshake = bypass;
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    return result;
+}
+
+/**
+ * \test Test that a chunk with many small application data records is
+ *       skipped in one go, including a record that continues in the
+ *       next chunk.
+ */
+static int SSLParserTest27(void)
+{
+    int result = 0;
+    Flow f;
+    uint8_t buf[40 * 6 + 3];
+    uint32_t buf_len = sizeof(buf);
+    uint8_t buf2[] = { 0x00, 0x01, 0x42 };
+    uint32_t buf2_len = sizeof(buf2);
+    TcpSession ssn;
+    int i;
+
+    /* 40 records of 1 byte of application data, the last record only
+     * has the first 3 bytes of its header in this chunk */
+    for (i = 0; i < 40; i++) {
+        buf[i * 6] = 0x17;
+        buf[i * 6 + 1] = 0x03;
+        buf[i * 6 + 2] = 0x01;
+        buf[i * 6 + 3] = 0x00;
+        buf[i * 6 + 4] = 0x01;
+        buf[i * 6 + 5] = (uint8_t)i;
+    }
+    buf[240] = 0x17;
+    buf[241] = 0x03;
+    buf[242] = 0x01;
+
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+
+    StreamTcpInitConfig(TRUE);
+
+    SCMutexLock(&f.m);
+    int r = AppLayerParse(NULL, &f, ALPROTO_TLS, STREAM_TOSERVER | STREAM_START,
+                          buf, buf_len);
+    if (r != 0) {
+        printf("toserver chunk 1 returned %" PRId32 ", expected 0: ", r);
+        SCMutexUnlock(&f.m);
+        goto end;
+    }
+    SCMutexUnlock(&f.m);
+
+    SSLState *ssl_state = f.alstate;
+    if (ssl_state == NULL) {
+        printf("no tls state: ");
+        goto end;
+    }
+
+    if (ssl_state->client_connp.content_type != SSLV3_APPLICATION_PROTOCOL ||
+        ssl_state->client_connp.bytes_processed != 3) {
+        printf("expected content_type %" PRIu8 " and 3 bytes processed, "
+               "got %" PRIu8 " and %" PRIu32 ": ", SSLV3_APPLICATION_PROTOCOL,
+               ssl_state->client_connp.content_type,
+               ssl_state->client_connp.bytes_processed);
+        goto end;
+    }
+
+    SCMutexLock(&f.m);
+    r = AppLayerParse(NULL, &f, ALPROTO_TLS, STREAM_TOSERVER, buf2, buf2_len);
+    if (r != 0) {
+        printf("toserver chunk 2 returned %" PRId32 ", expected 0: ", r);
+        SCMutexUnlock(&f.m);
+        goto end;
+    }
+    SCMutexUnlock(&f.m);
+
+    if (ssl_state->client_connp.bytes_processed != 0 ||
+        ssl_state->client_connp.version != TLS_VERSION_10) {
+        printf("record not completed: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 void SSLParserRegisterTests(void)
@@ -3832,6 +4083,8 @@ void SSLParserRegisterTests(void)
     UtRegisterTest("SSLParserTest23", SSLParserTest23, 1);
     UtRegisterTest("SSLParserTest24", SSLParserTest24, 1);
     UtRegisterTest("SSLParserTest25", SSLParserTest25, 1);
+    UtRegisterTest("SSLParserTest26", SSLParserTest26, 1);
+    UtRegisterTest("SSLParserTest27", SSLParserTest27, 1);
 
     UtRegisterTest("SSLParserMultimsgTest01", SSLParserMultimsgTest01, 1);
     UtRegisterTest("SSLParserMultimsgTest02", SSLParserMultimsgTest02, 1);
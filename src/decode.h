@@ -470,6 +470,8 @@ typedef struct Packet_
     struct LiveDevice_ *livedev;
 
     PacketAlerts alerts;
+    /** multi tenancy: tenant of the engine that inspected the packet */
+    uint32_t tenant_id;
 
     struct Host_ *host_src;
     struct Host_ *host_dst;
@@ -699,6 +701,7 @@ typedef struct DecodeThreadVars_
         (p)->payload_len = 0;                   \
         (p)->pktlen = 0;                        \
         (p)->alerts.cnt = 0;                    \
+        (p)->tenant_id = 0;                     \
         HostDeReference(&((p)->host_src));      \
         HostDeReference(&((p)->host_dst));      \
         (p)->pcap_cnt = 0;                      \
@@ -256,8 +256,13 @@ DetectContentData *DetectContentParse (char *contentstr)
     memcpy(cd->content, content, len);
     cd->content_len = len;
 
-    /* Prepare Boyer Moore context for searching faster */
-    cd->bm_ctx = BoyerMooreCtxInit(cd->content, cd->content_len);
+    /* Prepare the spm context for searching faster */
+    cd->spm_ctx = SpmInitCtx(cd->content, cd->content_len, 0);
+    if (cd->spm_ctx == NULL) {
+        SCFree(content);
+        SCFree(cd);
+        return NULL;
+    }
     cd->depth = 0;
     cd->offset = 0;
     cd->within = 0;
@@ -425,7 +430,7 @@ void DetectContentFree(void *ptr) {
     if (cd == NULL)
         SCReturn;
 
-    BoyerMooreCtxDeInit(cd->bm_ctx);
+    SpmDestroyCtx(cd->spm_ctx);
 
     SCFree(cd);
     SCReturn;
@@ -61,7 +61,7 @@
                                         ((c)->flags & DETECT_CONTENT_DEPTH) || \
                                         ((c)->flags & DETECT_CONTENT_OFFSET) ))
 
-#include "util-spm-bm.h"
+#include "util-spm.h"
 
 typedef struct DetectContentData_ {
     uint8_t *content;
@@ -75,8 +75,8 @@ typedef struct DetectContentData_ {
     uint16_t offset;
     int32_t distance;
     int32_t within;
-    /* Boyer Moore context (for spm search) */
-    BmCtx *bm_ctx;
+    /* single pattern search context */
+    SpmCtx *spm_ctx;
     /* for chopped fast pattern, the offset */
     uint16_t fp_chop_offset;
     /* for chopped fast pattern, the length */
@@ -152,30 +152,42 @@ static uint8_t *DetectEngineHSBDGetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
         goto end;
     }
 
+    /* only inspect the new data plus a window of data we inspected
+     * before, so patterns crossing the boundary still match. The window
+     * is at least as large as the longest mpm pattern. */
+    uint64_t window_start = 0;
+    if (htud->response_body.body_inspected > 0) {
+        uint32_t window = htp_state->cfg->response_inspect_window;
+        if (det_ctx->sgh != NULL && det_ctx->sgh->mpm_hsbd_ctx_tc != NULL &&
+            det_ctx->sgh->mpm_hsbd_ctx_tc->maxlen > window) {
+            window = det_ctx->sgh->mpm_hsbd_ctx_tc->maxlen;
+        }
+        if (htud->response_body.body_inspected > window)
+            window_start = htud->response_body.body_inspected - window;
+    }
+
     int first = 1;
     while (cur != NULL) {
-        /* see if we can filter out chunks */
-        if (htud->response_body.body_inspected > 0) {
-            if (cur->stream_offset < htud->response_body.body_inspected) {
-                if ((htud->response_body.body_inspected - cur->stream_offset) > htp_state->cfg->response_inspect_window) {
-                    cur = cur->next;
-                    continue;
-                } else {
-                    /* include this one */
-                }
-            } else {
-                /* include this one */
-            }
+        /* skip chunks entirely before the window */
+        if (cur->stream_offset + cur->len <= window_start) {
+            cur = cur->next;
+            continue;
         }
 
+        /* part of a chunk straddling the window start */
+        uint32_t skip = 0;
+        if (cur->stream_offset < window_start)
+            skip = (uint32_t)(window_start - cur->stream_offset);
+        uint32_t len = cur->len - skip;
+
         if (first) {
-            det_ctx->hsbd[index].offset = cur->stream_offset;
+            det_ctx->hsbd[index].offset = cur->stream_offset + skip;
             first = 0;
         }
 
         /* see if we need to grow the buffer */
-        if (det_ctx->hsbd[index].buffer == NULL || (det_ctx->hsbd[index].buffer_len + cur->len) > det_ctx->hsbd[index].buffer_size) {
-            det_ctx->hsbd[index].buffer_size += cur->len * 2;
+        if (det_ctx->hsbd[index].buffer == NULL || (det_ctx->hsbd[index].buffer_len + len) > det_ctx->hsbd[index].buffer_size) {
+            det_ctx->hsbd[index].buffer_size += len * 2;
 
             if ((det_ctx->hsbd[index].buffer = SCRealloc(det_ctx->hsbd[index].buffer, det_ctx->hsbd[index].buffer_size)) == NULL) {
                 det_ctx->hsbd[index].buffer_size = 0;
@@ -183,8 +195,8 @@ static uint8_t *DetectEngineHSBDGetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
                 goto end;
             }
         }
-        memcpy(det_ctx->hsbd[index].buffer + det_ctx->hsbd[index].buffer_len, cur->data, cur->len);
-        det_ctx->hsbd[index].buffer_len += cur->len;
+        memcpy(det_ctx->hsbd[index].buffer + det_ctx->hsbd[index].buffer_len, cur->data + skip, len);
+        det_ctx->hsbd[index].buffer_len += len;
 
         cur = cur->next;
     }
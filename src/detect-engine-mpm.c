@@ -53,6 +53,8 @@
 #include "util-debug.h"
 #include "util-print.h"
 #include "util-memcmp.h"
+
+#include "app-layer-htp.h"
 #ifdef __SC_CUDA_SUPPORT__
 #include "util-mpm-ac.h"
 #endif
@@ -816,231 +818,92 @@ void PatternMatchThreadPrepare(MpmThreadCtx *mpm_thread_ctx, uint16_t mpm_matche
 }
 
 
+/**
+ *  \brief Release a sig group head mpm ctx. Ctxs shared between sig group
+ *         heads are only destroyed when the last user releases them.
+ */
+static void PatternMatchDestroyGroupCtx(MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx == NULL || mpm_ctx->global)
+        return;
+
+    if (mpm_ctx->refcnt > 1) {
+        mpm_ctx->refcnt--;
+        return;
+    }
+
+    SCLogDebug("destroying mpm_ctx %p", mpm_ctx);
+    if (mpm_ctx->pattern_keys != NULL)
+        SCFree(mpm_ctx->pattern_keys);
+    mpm_table[mpm_ctx->mpm_type].DestroyCtx(mpm_ctx);
+    SCFree(mpm_ctx);
+}
+
 /* free the pattern matcher part of a SigGroupHead */
 void PatternMatchDestroyGroup(SigGroupHead *sh) {
     /* content */
     if (!(sh->flags & SIG_GROUP_HEAD_MPM_COPY)) {
-        SCLogDebug("destroying mpm_ctx %p (sh %p)",
-                   sh->mpm_proto_tcp_ctx_ts, sh);
-        if (sh->mpm_proto_tcp_ctx_ts != NULL &&
-            !sh->mpm_proto_tcp_ctx_ts->global) {
-            mpm_table[sh->mpm_proto_tcp_ctx_ts->mpm_type].
-                DestroyCtx(sh->mpm_proto_tcp_ctx_ts);
-            SCFree(sh->mpm_proto_tcp_ctx_ts);
-        }
+        PatternMatchDestroyGroupCtx(sh->mpm_proto_tcp_ctx_ts);
+        PatternMatchDestroyGroupCtx(sh->mpm_proto_tcp_ctx_tc);
+        PatternMatchDestroyGroupCtx(sh->mpm_proto_udp_ctx_ts);
+        PatternMatchDestroyGroupCtx(sh->mpm_proto_udp_ctx_tc);
+        PatternMatchDestroyGroupCtx(sh->mpm_proto_other_ctx);
         /* ready for reuse */
         sh->mpm_proto_tcp_ctx_ts = NULL;
-
-        SCLogDebug("destroying mpm_ctx %p (sh %p)",
-                   sh->mpm_proto_tcp_ctx_tc, sh);
-        if (sh->mpm_proto_tcp_ctx_tc != NULL &&
-            !sh->mpm_proto_tcp_ctx_tc->global) {
-            mpm_table[sh->mpm_proto_tcp_ctx_tc->mpm_type].
-                DestroyCtx(sh->mpm_proto_tcp_ctx_tc);
-            SCFree(sh->mpm_proto_tcp_ctx_tc);
-        }
-        /* ready for reuse */
         sh->mpm_proto_tcp_ctx_tc = NULL;
-
-        SCLogDebug("destroying mpm_ctx %p (sh %p)",
-                   sh->mpm_proto_udp_ctx_ts, sh);
-        if (sh->mpm_proto_udp_ctx_ts != NULL &&
-            !sh->mpm_proto_udp_ctx_ts->global) {
-            mpm_table[sh->mpm_proto_udp_ctx_ts->mpm_type].
-                DestroyCtx(sh->mpm_proto_udp_ctx_ts);
-            SCFree(sh->mpm_proto_udp_ctx_ts);
-        }
-        /* ready for reuse */
         sh->mpm_proto_udp_ctx_ts = NULL;
-
-        SCLogDebug("destroying mpm_ctx %p (sh %p)",
-                   sh->mpm_proto_udp_ctx_tc, sh);
-        if (sh->mpm_proto_udp_ctx_tc != NULL &&
-            !sh->mpm_proto_udp_ctx_tc->global) {
-            mpm_table[sh->mpm_proto_udp_ctx_tc->mpm_type].
-                DestroyCtx(sh->mpm_proto_udp_ctx_tc);
-            SCFree(sh->mpm_proto_udp_ctx_tc);
-        }
-        /* ready for reuse */
         sh->mpm_proto_udp_ctx_tc = NULL;
-
-        SCLogDebug("destroying mpm_ctx %p (sh %p)",
-                   sh->mpm_proto_other_ctx, sh);
-        if (sh->mpm_proto_other_ctx != NULL &&
-            !sh->mpm_proto_other_ctx->global) {
-            mpm_table[sh->mpm_proto_other_ctx->mpm_type].
-                DestroyCtx(sh->mpm_proto_other_ctx);
-            SCFree(sh->mpm_proto_other_ctx);
-        }
-        /* ready for reuse */
         sh->mpm_proto_other_ctx = NULL;
     }
 
     /* uricontent */
-    if ((sh->mpm_uri_ctx_ts != NULL) && !(sh->flags & SIG_GROUP_HEAD_MPM_URI_COPY)) {
-        if (sh->mpm_uri_ctx_ts != NULL) {
-            SCLogDebug("destroying mpm_uri_ctx %p (sh %p)", sh->mpm_uri_ctx_ts, sh);
-            if (!sh->mpm_uri_ctx_ts->global) {
-                mpm_table[sh->mpm_uri_ctx_ts->mpm_type].DestroyCtx(sh->mpm_uri_ctx_ts);
-                SCFree(sh->mpm_uri_ctx_ts);
-            }
-            /* ready for reuse */
-            sh->mpm_uri_ctx_ts = NULL;
-        }
+    if (!(sh->flags & SIG_GROUP_HEAD_MPM_URI_COPY)) {
+        PatternMatchDestroyGroupCtx(sh->mpm_uri_ctx_ts);
+        sh->mpm_uri_ctx_ts = NULL;
     }
 
     /* stream content */
-    if ((sh->mpm_stream_ctx_ts != NULL || sh->mpm_stream_ctx_tc != NULL) &&
-        !(sh->flags & SIG_GROUP_HEAD_MPM_STREAM_COPY)) {
-        if (sh->mpm_stream_ctx_ts != NULL) {
-            SCLogDebug("destroying mpm_stream_ctx %p (sh %p)", sh->mpm_stream_ctx_ts, sh);
-            if (!sh->mpm_stream_ctx_ts->global) {
-                mpm_table[sh->mpm_stream_ctx_ts->mpm_type].DestroyCtx(sh->mpm_stream_ctx_ts);
-                SCFree(sh->mpm_stream_ctx_ts);
-            }
-            /* ready for reuse */
-            sh->mpm_stream_ctx_ts = NULL;
-        }
-        if (sh->mpm_stream_ctx_tc != NULL) {
-            SCLogDebug("destroying mpm_stream_ctx %p (sh %p)", sh->mpm_stream_ctx_tc, sh);
-            if (!sh->mpm_stream_ctx_tc->global) {
-                mpm_table[sh->mpm_stream_ctx_tc->mpm_type].DestroyCtx(sh->mpm_stream_ctx_tc);
-                SCFree(sh->mpm_stream_ctx_tc);
-            }
-            /* ready for reuse */
-            sh->mpm_stream_ctx_tc = NULL;
-        }
-    }
-
-    if (sh->mpm_hcbd_ctx_ts != NULL) {
-        if (sh->mpm_hcbd_ctx_ts != NULL) {
-            if (!sh->mpm_hcbd_ctx_ts->global) {
-                mpm_table[sh->mpm_hcbd_ctx_ts->mpm_type].DestroyCtx(sh->mpm_hcbd_ctx_ts);
-                SCFree(sh->mpm_hcbd_ctx_ts);
-            }
-            sh->mpm_hcbd_ctx_ts = NULL;
-        }
-    }
-
-    if (sh->mpm_hsbd_ctx_tc != NULL) {
-        if (sh->mpm_hsbd_ctx_tc != NULL) {
-            if (!sh->mpm_hsbd_ctx_tc->global) {
-                mpm_table[sh->mpm_hsbd_ctx_tc->mpm_type].DestroyCtx(sh->mpm_hsbd_ctx_tc);
-                SCFree(sh->mpm_hsbd_ctx_tc);
-            }
-            sh->mpm_hsbd_ctx_tc = NULL;
-        }
-    }
-
-    if (sh->mpm_hhd_ctx_ts != NULL || sh->mpm_hhd_ctx_tc != NULL) {
-        if (sh->mpm_hhd_ctx_ts != NULL) {
-            if (!sh->mpm_hhd_ctx_ts->global) {
-                mpm_table[sh->mpm_hhd_ctx_ts->mpm_type].DestroyCtx(sh->mpm_hhd_ctx_ts);
-                SCFree(sh->mpm_hhd_ctx_ts);
-            }
-            sh->mpm_hhd_ctx_ts = NULL;
-        }
-        if (sh->mpm_hhd_ctx_tc != NULL) {
-            if (!sh->mpm_hhd_ctx_tc->global) {
-                mpm_table[sh->mpm_hhd_ctx_tc->mpm_type].DestroyCtx(sh->mpm_hhd_ctx_tc);
-                SCFree(sh->mpm_hhd_ctx_tc);
-            }
-            sh->mpm_hhd_ctx_tc = NULL;
-        }
-    }
-
-    if (sh->mpm_hrhd_ctx_ts != NULL || sh->mpm_hrhd_ctx_tc != NULL) {
-        if (sh->mpm_hrhd_ctx_ts != NULL) {
-            if (!sh->mpm_hrhd_ctx_ts->global) {
-                mpm_table[sh->mpm_hrhd_ctx_ts->mpm_type].DestroyCtx(sh->mpm_hrhd_ctx_ts);
-                SCFree(sh->mpm_hrhd_ctx_ts);
-            }
-            sh->mpm_hrhd_ctx_ts = NULL;
-        }
-        if (sh->mpm_hrhd_ctx_tc != NULL) {
-            if (!sh->mpm_hrhd_ctx_tc->global) {
-                mpm_table[sh->mpm_hrhd_ctx_tc->mpm_type].DestroyCtx(sh->mpm_hrhd_ctx_tc);
-                SCFree(sh->mpm_hrhd_ctx_tc);
-            }
-            sh->mpm_hrhd_ctx_tc = NULL;
-        }
-    }
-
-    if (sh->mpm_hmd_ctx_ts != NULL) {
-        if (sh->mpm_hmd_ctx_ts != NULL) {
-            if (!sh->mpm_hmd_ctx_ts->global) {
-                mpm_table[sh->mpm_hmd_ctx_ts->mpm_type].DestroyCtx(sh->mpm_hmd_ctx_ts);
-                SCFree(sh->mpm_hmd_ctx_ts);
-            }
-            sh->mpm_hmd_ctx_ts = NULL;
-        }
-    }
-
-    if (sh->mpm_hcd_ctx_ts != NULL || sh->mpm_hcd_ctx_tc != NULL) {
-        if (sh->mpm_hcd_ctx_ts != NULL) {
-            if (!sh->mpm_hcd_ctx_ts->global) {
-                mpm_table[sh->mpm_hcd_ctx_ts->mpm_type].DestroyCtx(sh->mpm_hcd_ctx_ts);
-                SCFree(sh->mpm_hcd_ctx_ts);
-            }
-            sh->mpm_hcd_ctx_ts = NULL;
-        }
-        if (sh->mpm_hcd_ctx_tc != NULL) {
-            if (!sh->mpm_hcd_ctx_tc->global) {
-                mpm_table[sh->mpm_hcd_ctx_tc->mpm_type].DestroyCtx(sh->mpm_hcd_ctx_tc);
-                SCFree(sh->mpm_hcd_ctx_tc);
-            }
-            sh->mpm_hcd_ctx_tc = NULL;
-        }
-    }
-
-    if (sh->mpm_hrud_ctx_ts != NULL) {
-        if (sh->mpm_hrud_ctx_ts != NULL) {
-            if (!sh->mpm_hrud_ctx_ts->global) {
-                mpm_table[sh->mpm_hrud_ctx_ts->mpm_type].DestroyCtx(sh->mpm_hrud_ctx_ts);
-                SCFree(sh->mpm_hrud_ctx_ts);
-            }
-            sh->mpm_hrud_ctx_ts = NULL;
-        }
-    }
-
-    if (sh->mpm_hsmd_ctx_tc != NULL) {
-        if (sh->mpm_hsmd_ctx_tc != NULL) {
-            if (!sh->mpm_hsmd_ctx_tc->global) {
-                mpm_table[sh->mpm_hsmd_ctx_tc->mpm_type].DestroyCtx(sh->mpm_hsmd_ctx_tc);
-                SCFree(sh->mpm_hsmd_ctx_tc);
-            }
-            sh->mpm_hsmd_ctx_tc = NULL;
-        }
-    }
-
-    if (sh->mpm_hscd_ctx_tc != NULL) {
-        if (sh->mpm_hscd_ctx_tc != NULL) {
-            if (!sh->mpm_hscd_ctx_tc->global) {
-                mpm_table[sh->mpm_hscd_ctx_tc->mpm_type].DestroyCtx(sh->mpm_hscd_ctx_tc);
-                SCFree(sh->mpm_hscd_ctx_tc);
-            }
-            sh->mpm_hscd_ctx_tc = NULL;
-        }
+    if (!(sh->flags & SIG_GROUP_HEAD_MPM_STREAM_COPY)) {
+        PatternMatchDestroyGroupCtx(sh->mpm_stream_ctx_ts);
+        PatternMatchDestroyGroupCtx(sh->mpm_stream_ctx_tc);
+        sh->mpm_stream_ctx_ts = NULL;
+        sh->mpm_stream_ctx_tc = NULL;
     }
 
-    if (sh->mpm_huad_ctx_ts != NULL) {
-        if (sh->mpm_huad_ctx_ts != NULL) {
-            if (!sh->mpm_huad_ctx_ts->global) {
-                mpm_table[sh->mpm_huad_ctx_ts->mpm_type].DestroyCtx(sh->mpm_huad_ctx_ts);
-                SCFree(sh->mpm_huad_ctx_ts);
-            }
-            sh->mpm_huad_ctx_ts = NULL;
-        }
-    }
+    PatternMatchDestroyGroupCtx(sh->mpm_hcbd_ctx_ts);
+    sh->mpm_hcbd_ctx_ts = NULL;
+    PatternMatchDestroyGroupCtx(sh->mpm_hsbd_ctx_tc);
+    sh->mpm_hsbd_ctx_tc = NULL;
+    PatternMatchDestroyGroupCtx(sh->mpm_hhd_ctx_ts);
+    sh->mpm_hhd_ctx_ts = NULL;
+    PatternMatchDestroyGroupCtx(sh->mpm_hhd_ctx_tc);
+    sh->mpm_hhd_ctx_tc = NULL;
+    PatternMatchDestroyGroupCtx(sh->mpm_hrhd_ctx_ts);
+    sh->mpm_hrhd_ctx_ts = NULL;
+    PatternMatchDestroyGroupCtx(sh->mpm_hrhd_ctx_tc);
+    sh->mpm_hrhd_ctx_tc = NULL;
+    PatternMatchDestroyGroupCtx(sh->mpm_hmd_ctx_ts);
+    sh->mpm_hmd_ctx_ts = NULL;
+    PatternMatchDestroyGroupCtx(sh->mpm_hcd_ctx_ts);
+    sh->mpm_hcd_ctx_ts = NULL;
+    PatternMatchDestroyGroupCtx(sh->mpm_hcd_ctx_tc);
+    sh->mpm_hcd_ctx_tc = NULL;
+    PatternMatchDestroyGroupCtx(sh->mpm_hrud_ctx_ts);
+    sh->mpm_hrud_ctx_ts = NULL;
+    PatternMatchDestroyGroupCtx(sh->mpm_hsmd_ctx_tc);
+    sh->mpm_hsmd_ctx_tc = NULL;
+    PatternMatchDestroyGroupCtx(sh->mpm_hscd_ctx_tc);
+    sh->mpm_hscd_ctx_tc = NULL;
+    PatternMatchDestroyGroupCtx(sh->mpm_huad_ctx_ts);
+    sh->mpm_huad_ctx_ts = NULL;
+    PatternMatchDestroyGroupCtx(sh->mpm_hhhd_ctx_ts);
+    sh->mpm_hhhd_ctx_ts = NULL;
+    PatternMatchDestroyGroupCtx(sh->mpm_hrhhd_ctx_ts);
+    sh->mpm_hrhhd_ctx_ts = NULL;
 
     /* dns query */
-    if (sh->mpm_dnsquery_ctx_ts != NULL) {
-        if (!sh->mpm_dnsquery_ctx_ts->global) {
-            mpm_table[sh->mpm_dnsquery_ctx_ts->mpm_type].DestroyCtx(sh->mpm_dnsquery_ctx_ts);
-            SCFree(sh->mpm_dnsquery_ctx_ts);
-        }
-        sh->mpm_dnsquery_ctx_ts = NULL;
-    }
+    PatternMatchDestroyGroupCtx(sh->mpm_dnsquery_ctx_ts);
+    sh->mpm_dnsquery_ctx_ts = NULL;
 
     return;
 }
@@ -1182,6 +1045,54 @@ uint32_t PatternStrength(uint8_t *pat, uint16_t patlen) {
     return s;
 }
 
+/**
+ *  \brief Remember the id and flags of a pattern added to a sig group
+ *         head mpm ctx, so that ctxs with the same patterns can be shared.
+ *
+ *  Global (single) ctxs are shared by all sig group heads already.
+ */
+static void PopulateMpmRecordPattern(MpmCtx *mpm_ctx, uint32_t pid,
+                                     uint8_t flags)
+{
+    if (mpm_ctx->global)
+        return;
+
+    if (mpm_ctx->pattern_keys_cnt == mpm_ctx->pattern_keys_size) {
+        uint32_t size = mpm_ctx->pattern_keys_size ?
+                        mpm_ctx->pattern_keys_size * 2 : 16;
+        uint32_t *ptmp = SCRealloc(mpm_ctx->pattern_keys, size * sizeof(uint32_t));
+        if (unlikely(ptmp == NULL)) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+            exit(EXIT_FAILURE);
+        }
+        mpm_ctx->pattern_keys = ptmp;
+        mpm_ctx->pattern_keys_size = size;
+    }
+
+    /* pattern ids are PatIntId's, so the flags fit below them */
+    mpm_ctx->pattern_keys[mpm_ctx->pattern_keys_cnt++] = (pid << 8) | flags;
+}
+
+static void PopulateMpmAddPatternCS(MpmCtx *mpm_ctx, uint8_t *pat,
+                                    uint16_t patlen, uint16_t offset,
+                                    uint16_t depth, uint32_t pid,
+                                    uint32_t sid, uint8_t flags)
+{
+    PopulateMpmRecordPattern(mpm_ctx, pid, flags);
+    mpm_table[mpm_ctx->mpm_type].AddPattern(mpm_ctx, pat, patlen, offset,
+                                            depth, pid, sid, flags);
+}
+
+static void PopulateMpmAddPatternCI(MpmCtx *mpm_ctx, uint8_t *pat,
+                                    uint16_t patlen, uint16_t offset,
+                                    uint16_t depth, uint32_t pid,
+                                    uint32_t sid, uint8_t flags)
+{
+    PopulateMpmRecordPattern(mpm_ctx, pid, flags | MPM_PATTERN_FLAG_NOCASE);
+    mpm_table[mpm_ctx->mpm_type].AddPatternNocase(mpm_ctx, pat, patlen, offset,
+                                                  depth, pid, sid, flags);
+}
+
 static void PopulateMpmHelperAddPatternToPktCtx(MpmCtx *mpm_ctx,
                                                 DetectContentData *cd,
                                                 Signature *s, uint8_t flags,
@@ -1189,31 +1100,27 @@ static void PopulateMpmHelperAddPatternToPktCtx(MpmCtx *mpm_ctx,
 {
     if (cd->flags & DETECT_CONTENT_NOCASE) {
         if (chop) {
-            mpm_table[mpm_ctx->mpm_type].
-                AddPatternNocase(mpm_ctx,
-                                 cd->content + cd->fp_chop_offset,
-                                 cd->fp_chop_len,
-                                 0, 0, cd->id, s->num, flags);
+            PopulateMpmAddPatternCI(mpm_ctx,
+                                    cd->content + cd->fp_chop_offset,
+                                    cd->fp_chop_len,
+                                    0, 0, cd->id, s->num, flags);
         } else {
-            mpm_table[mpm_ctx->mpm_type].
-                AddPatternNocase(mpm_ctx,
-                                 cd->content,
-                                 cd->content_len,
-                                 0, 0, cd->id, s->num, flags);
+            PopulateMpmAddPatternCI(mpm_ctx,
+                                    cd->content,
+                                    cd->content_len,
+                                    0, 0, cd->id, s->num, flags);
         }
     } else {
         if (chop) {
-            mpm_table[mpm_ctx->mpm_type].
-                AddPattern(mpm_ctx,
-                           cd->content + cd->fp_chop_offset,
-                           cd->fp_chop_len,
-                           0, 0, cd->id, s->num, flags);
+            PopulateMpmAddPatternCS(mpm_ctx,
+                                    cd->content + cd->fp_chop_offset,
+                                    cd->fp_chop_len,
+                                    0, 0, cd->id, s->num, flags);
         } else {
-            mpm_table[mpm_ctx->mpm_type].
-                AddPattern(mpm_ctx,
-                           cd->content,
-                           cd->content_len,
-                           0, 0, cd->id, s->num, flags);
+            PopulateMpmAddPatternCS(mpm_ctx,
+                                    cd->content,
+                                    cd->content_len,
+                                    0, 0, cd->id, s->num, flags);
         }
     }
 
@@ -1295,33 +1202,29 @@ static void PopulateMpmAddPatternToMpm(DetectEngineCtx *de_ctx,
                 if (SignatureHasStreamContent(s)) {
                     if (cd->flags & DETECT_CONTENT_NOCASE) {
                         if (s->flags & SIG_FLAG_TOSERVER) {
-                            mpm_table[sgh->mpm_stream_ctx_ts->mpm_type].
-                                AddPatternNocase(sgh->mpm_stream_ctx_ts,
-                                                 cd->content + cd->fp_chop_offset,
-                                                 cd->fp_chop_len,
-                                                 0, 0, cd->id, s->num, flags);
+                            PopulateMpmAddPatternCI(sgh->mpm_stream_ctx_ts,
+                                                    cd->content + cd->fp_chop_offset,
+                                                    cd->fp_chop_len,
+                                                    0, 0, cd->id, s->num, flags);
                         }
                         if (s->flags & SIG_FLAG_TOCLIENT) {
-                            mpm_table[sgh->mpm_stream_ctx_tc->mpm_type].
-                                AddPatternNocase(sgh->mpm_stream_ctx_tc,
-                                                 cd->content + cd->fp_chop_offset,
-                                                 cd->fp_chop_len,
-                                                 0, 0, cd->id, s->num, flags);
+                            PopulateMpmAddPatternCI(sgh->mpm_stream_ctx_tc,
+                                                    cd->content + cd->fp_chop_offset,
+                                                    cd->fp_chop_len,
+                                                    0, 0, cd->id, s->num, flags);
                         }
                     } else {
                         if (s->flags & SIG_FLAG_TOSERVER) {
-                            mpm_table[sgh->mpm_stream_ctx_ts->mpm_type].
-                                AddPattern(sgh->mpm_stream_ctx_ts,
-                                           cd->content + cd->fp_chop_offset,
-                                           cd->fp_chop_len,
-                                           0, 0, cd->id, s->num, flags);
+                            PopulateMpmAddPatternCS(sgh->mpm_stream_ctx_ts,
+                                                    cd->content + cd->fp_chop_offset,
+                                                    cd->fp_chop_len,
+                                                    0, 0, cd->id, s->num, flags);
                         }
                         if (s->flags & SIG_FLAG_TOCLIENT) {
-                            mpm_table[sgh->mpm_stream_ctx_tc->mpm_type].
-                                AddPattern(sgh->mpm_stream_ctx_tc,
-                                           cd->content + cd->fp_chop_offset,
-                                           cd->fp_chop_len,
-                                           0, 0, cd->id, s->num, flags);
+                            PopulateMpmAddPatternCS(sgh->mpm_stream_ctx_tc,
+                                                    cd->content + cd->fp_chop_offset,
+                                                    cd->fp_chop_len,
+                                                    0, 0, cd->id, s->num, flags);
                         }
                     }
                     /* tell matcher we are inspecting stream */
@@ -1385,29 +1288,25 @@ static void PopulateMpmAddPatternToMpm(DetectEngineCtx *de_ctx,
                     /* add the content to the "packet" mpm */
                     if (cd->flags & DETECT_CONTENT_NOCASE) {
                         if (s->flags & SIG_FLAG_TOSERVER) {
-                            mpm_table[sgh->mpm_stream_ctx_ts->mpm_type].
-                                AddPatternNocase(sgh->mpm_stream_ctx_ts,
-                                                 cd->content, cd->content_len,
-                                                 0, 0, cd->id, s->num, flags);
+                            PopulateMpmAddPatternCI(sgh->mpm_stream_ctx_ts,
+                                                    cd->content, cd->content_len,
+                                                    0, 0, cd->id, s->num, flags);
                         }
                         if (s->flags & SIG_FLAG_TOCLIENT) {
-                            mpm_table[sgh->mpm_stream_ctx_tc->mpm_type].
-                                AddPatternNocase(sgh->mpm_stream_ctx_tc,
-                                                 cd->content, cd->content_len,
-                                                 0, 0, cd->id, s->num, flags);
+                            PopulateMpmAddPatternCI(sgh->mpm_stream_ctx_tc,
+                                                    cd->content, cd->content_len,
+                                                    0, 0, cd->id, s->num, flags);
                         }
                     } else {
                         if (s->flags & SIG_FLAG_TOSERVER) {
-                            mpm_table[sgh->mpm_stream_ctx_ts->mpm_type].
-                                AddPattern(sgh->mpm_stream_ctx_ts,
-                                           cd->content, cd->content_len,
-                                           0, 0, cd->id, s->num, flags);
+                            PopulateMpmAddPatternCS(sgh->mpm_stream_ctx_ts,
+                                                    cd->content, cd->content_len,
+                                                    0, 0, cd->id, s->num, flags);
                         }
                         if (s->flags & SIG_FLAG_TOCLIENT) {
-                            mpm_table[sgh->mpm_stream_ctx_tc->mpm_type].
-                                AddPattern(sgh->mpm_stream_ctx_tc,
-                                           cd->content, cd->content_len,
-                                           0, 0, cd->id, s->num, flags);
+                            PopulateMpmAddPatternCS(sgh->mpm_stream_ctx_tc,
+                                                    cd->content, cd->content_len,
+                                                    0, 0, cd->id, s->num, flags);
                         }
                     }
                     /* tell matcher we are inspecting stream */
@@ -1569,33 +1468,29 @@ static void PopulateMpmAddPatternToMpm(DetectEngineCtx *de_ctx,
                 /* add the content to the mpm */
                 if (cd->flags & DETECT_CONTENT_NOCASE) {
                     if (mpm_ctx_ts != NULL) {
-                        mpm_table[mpm_ctx_ts->mpm_type].
-                            AddPatternNocase(mpm_ctx_ts,
-                                             cd->content + cd->fp_chop_offset,
-                                             cd->fp_chop_len,
-                                             0, 0, cd->id, s->num, flags);
+                        PopulateMpmAddPatternCI(mpm_ctx_ts,
+                                                cd->content + cd->fp_chop_offset,
+                                                cd->fp_chop_len,
+                                                0, 0, cd->id, s->num, flags);
                     }
                     if (mpm_ctx_tc != NULL) {
-                        mpm_table[mpm_ctx_tc->mpm_type].
-                            AddPatternNocase(mpm_ctx_tc,
-                                             cd->content + cd->fp_chop_offset,
-                                             cd->fp_chop_len,
-                                             0, 0, cd->id, s->num, flags);
+                        PopulateMpmAddPatternCI(mpm_ctx_tc,
+                                                cd->content + cd->fp_chop_offset,
+                                                cd->fp_chop_len,
+                                                0, 0, cd->id, s->num, flags);
                     }
                 } else {
                     if (mpm_ctx_ts != NULL) {
-                        mpm_table[mpm_ctx_ts->mpm_type].
-                            AddPattern(mpm_ctx_ts,
-                                       cd->content + cd->fp_chop_offset,
-                                       cd->fp_chop_len,
-                                       0, 0, cd->id, s->num, flags);
+                        PopulateMpmAddPatternCS(mpm_ctx_ts,
+                                                cd->content + cd->fp_chop_offset,
+                                                cd->fp_chop_len,
+                                                0, 0, cd->id, s->num, flags);
                     }
                     if (mpm_ctx_tc != NULL) {
-                        mpm_table[mpm_ctx_tc->mpm_type].
-                            AddPattern(mpm_ctx_tc,
-                                       cd->content + cd->fp_chop_offset,
-                                       cd->fp_chop_len,
-                                       0, 0, cd->id, s->num, flags);
+                        PopulateMpmAddPatternCS(mpm_ctx_tc,
+                                                cd->content + cd->fp_chop_offset,
+                                                cd->fp_chop_len,
+                                                0, 0, cd->id, s->num, flags);
                     }
                 }
             } else {
@@ -1608,29 +1503,25 @@ static void PopulateMpmAddPatternToMpm(DetectEngineCtx *de_ctx,
                 /* add the content to the "uri" mpm */
                 if (cd->flags & DETECT_CONTENT_NOCASE) {
                     if (mpm_ctx_ts != NULL) {
-                        mpm_table[mpm_ctx_ts->mpm_type].
-                            AddPatternNocase(mpm_ctx_ts,
-                                             cd->content, cd->content_len,
-                                             0, 0, cd->id, s->num, flags);
+                        PopulateMpmAddPatternCI(mpm_ctx_ts,
+                                                cd->content, cd->content_len,
+                                                0, 0, cd->id, s->num, flags);
                     }
                     if (mpm_ctx_tc != NULL) {
-                        mpm_table[mpm_ctx_tc->mpm_type].
-                            AddPatternNocase(mpm_ctx_tc,
-                                             cd->content, cd->content_len,
-                                             0, 0, cd->id, s->num, flags);
+                        PopulateMpmAddPatternCI(mpm_ctx_tc,
+                                                cd->content, cd->content_len,
+                                                0, 0, cd->id, s->num, flags);
                     }
                 } else {
                     if (mpm_ctx_ts != NULL) {
-                        mpm_table[mpm_ctx_ts->mpm_type].
-                            AddPattern(mpm_ctx_ts,
-                                       cd->content, cd->content_len,
-                                       0, 0, cd->id, s->num, flags);
+                        PopulateMpmAddPatternCS(mpm_ctx_ts,
+                                                cd->content, cd->content_len,
+                                                0, 0, cd->id, s->num, flags);
                     }
                     if (mpm_ctx_tc != NULL) {
-                        mpm_table[mpm_ctx_tc->mpm_type].
-                            AddPattern(mpm_ctx_tc,
-                                       cd->content, cd->content_len,
-                                       0, 0, cd->id, s->num, flags);
+                        PopulateMpmAddPatternCS(mpm_ctx_tc,
+                                                cd->content, cd->content_len,
+                                                0, 0, cd->id, s->num, flags);
                     }
                 }
             }
@@ -1895,6 +1786,169 @@ SigMatch *RetrieveFPForSigV2(Signature *s)
  *
  * \retval  0 Always.
  */
+/** \brief Entry in the hash of prepared sig group head mpm ctxs, keyed
+ *         on the patterns that were added to the ctx. */
+typedef struct MpmCtxShareElmt_ {
+    MpmCtx *mpm_ctx;            /**< prepared ctx, owned by the sgh's */
+    uint32_t *pattern_keys;     /**< sorted, unique pattern keys */
+    uint32_t pattern_keys_cnt;
+    uint16_t mpm_type;
+} MpmCtxShareElmt;
+
+static uint32_t MpmCtxShareHashFunc(HashListTable *ht, void *data, uint16_t datalen)
+{
+    MpmCtxShareElmt *e = (MpmCtxShareElmt *)data;
+    uint32_t hash = e->mpm_type;
+    uint32_t u;
+
+    for (u = 0; u < e->pattern_keys_cnt; u++)
+        hash = hash * 31 + e->pattern_keys[u];
+
+    return hash % ht->array_size;
+}
+
+static char MpmCtxShareCompareFunc(void *data1, uint16_t len1, void *data2,
+                                   uint16_t len2)
+{
+    MpmCtxShareElmt *e1 = (MpmCtxShareElmt *)data1;
+    MpmCtxShareElmt *e2 = (MpmCtxShareElmt *)data2;
+
+    if (e1->mpm_type != e2->mpm_type ||
+        e1->pattern_keys_cnt != e2->pattern_keys_cnt)
+        return 0;
+
+    return (memcmp(e1->pattern_keys, e2->pattern_keys,
+                   e1->pattern_keys_cnt * sizeof(uint32_t)) == 0);
+}
+
+static void MpmCtxShareFreeFunc(void *data)
+{
+    MpmCtxShareElmt *e = (MpmCtxShareElmt *)data;
+
+    SCFree(e->pattern_keys);
+    SCFree(e);
+}
+
+/**
+ * \brief Initializes the hash used to share mpm ctxs between sig group
+ *        heads that have the same patterns.
+ *
+ * \param de_ctx Pointer to the detection engine context.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int MpmCtxShareHashInit(DetectEngineCtx *de_ctx)
+{
+    de_ctx->mpm_ctx_share_hash_table = HashListTableInit(4096,
+            MpmCtxShareHashFunc, MpmCtxShareCompareFunc, MpmCtxShareFreeFunc);
+    if (de_ctx->mpm_ctx_share_hash_table == NULL)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * \brief Frees the mpm ctx share hash. The ctxs themselves are owned by
+ *        the sig group heads and are not touched.
+ *
+ * \param de_ctx Pointer to the detection engine context.
+ */
+void MpmCtxShareHashFree(DetectEngineCtx *de_ctx)
+{
+    if (de_ctx->mpm_ctx_share_hash_table == NULL)
+        return;
+
+    HashListTableFree(de_ctx->mpm_ctx_share_hash_table);
+    de_ctx->mpm_ctx_share_hash_table = NULL;
+}
+
+static int MpmCtxShareKeyCmp(const void *a, const void *b)
+{
+    uint32_t ka = *(const uint32_t *)a;
+    uint32_t kb = *(const uint32_t *)b;
+
+    if (ka < kb)
+        return -1;
+    return (ka > kb);
+}
+
+/**
+ *  \brief Prepare a sig group head mpm ctx. If a ctx with the same
+ *         patterns was prepared before, that ctx is returned instead
+ *         and the passed ctx is freed.
+ *
+ *  \param de_ctx detection engine ctx
+ *  \param mpm_ctx populated ctx, not global
+ *
+ *  \retval mpm_ctx the ctx the sig group head should use
+ */
+static MpmCtx *PatternMatchPrepareCtx(DetectEngineCtx *de_ctx, MpmCtx *mpm_ctx)
+{
+    MpmCtxShareElmt lookup;
+    uint32_t *keys = mpm_ctx->pattern_keys;
+    uint32_t cnt = 0;
+    uint32_t u;
+
+    de_ctx->mpm_ctx_total++;
+
+    /* the same pattern is added once per sig, so sort and dedup */
+    if (keys != NULL) {
+        qsort(keys, mpm_ctx->pattern_keys_cnt, sizeof(uint32_t), MpmCtxShareKeyCmp);
+        for (u = 0; u < mpm_ctx->pattern_keys_cnt; u++) {
+            if (cnt == 0 || keys[cnt - 1] != keys[u])
+                keys[cnt++] = keys[u];
+        }
+    }
+    mpm_ctx->pattern_keys = NULL;
+    mpm_ctx->pattern_keys_cnt = 0;
+    mpm_ctx->pattern_keys_size = 0;
+
+    if (keys == NULL || de_ctx->mpm_ctx_share_hash_table == NULL)
+        goto prepare;
+
+    lookup.mpm_ctx = NULL;
+    lookup.pattern_keys = keys;
+    lookup.pattern_keys_cnt = cnt;
+    lookup.mpm_type = mpm_ctx->mpm_type;
+
+    MpmCtxShareElmt *e = HashListTableLookup(de_ctx->mpm_ctx_share_hash_table,
+                                             &lookup, 0);
+    if (e != NULL) {
+        SCLogDebug("mpm_ctx %p has the same %"PRIu32" patterns as %p, sharing",
+                   mpm_ctx, cnt, e->mpm_ctx);
+        e->mpm_ctx->refcnt++;
+        de_ctx->mpm_ctx_shared++;
+        de_ctx->mpm_ctx_shared_memory += e->mpm_ctx->memory_size + sizeof(MpmCtx);
+
+        SCFree(keys);
+        mpm_table[mpm_ctx->mpm_type].DestroyCtx(mpm_ctx);
+        SCFree(mpm_ctx);
+        return e->mpm_ctx;
+    }
+
+    e = SCMalloc(sizeof(MpmCtxShareElmt));
+    if (unlikely(e == NULL)) {
+        SCFree(keys);
+        keys = NULL;
+        goto prepare;
+    }
+    *e = lookup;
+    e->mpm_ctx = mpm_ctx;
+    if (HashListTableAdd(de_ctx->mpm_ctx_share_hash_table, e, 0) != 0) {
+        MpmCtxShareFreeFunc(e);
+    }
+    keys = NULL;
+
+prepare:
+    if (keys != NULL)
+        SCFree(keys);
+    if (mpm_table[mpm_ctx->mpm_type].Prepare != NULL)
+        mpm_table[mpm_ctx->mpm_type].Prepare(mpm_ctx);
+    mpm_ctx->refcnt = 1;
+    return mpm_ctx;
+}
+
 static int PatternMatchPreparePopulateMpm(DetectEngineCtx *de_ctx,
                                           SigGroupHead *sgh)
 {
@@ -2311,10 +2365,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_proto_tcp_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_proto_tcp_ctx_ts->mpm_type].Prepare != NULL) {
-                         mpm_table[sh->mpm_proto_tcp_ctx_ts->mpm_type].
-                             Prepare(sh->mpm_proto_tcp_ctx_ts);
-                     }
+                     sh->mpm_proto_tcp_ctx_ts = PatternMatchPrepareCtx(de_ctx, sh->mpm_proto_tcp_ctx_ts);
                  }
              }
          }
@@ -2324,10 +2375,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_proto_tcp_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_proto_tcp_ctx_tc->mpm_type].Prepare != NULL) {
-                         mpm_table[sh->mpm_proto_tcp_ctx_tc->mpm_type].
-                             Prepare(sh->mpm_proto_tcp_ctx_tc);
-                     }
+                     sh->mpm_proto_tcp_ctx_tc = PatternMatchPrepareCtx(de_ctx, sh->mpm_proto_tcp_ctx_tc);
                  }
              }
          }
@@ -2338,10 +2386,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_proto_udp_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_proto_udp_ctx_ts->mpm_type].Prepare != NULL) {
-                         mpm_table[sh->mpm_proto_udp_ctx_ts->mpm_type].
-                             Prepare(sh->mpm_proto_udp_ctx_ts);
-                     }
+                     sh->mpm_proto_udp_ctx_ts = PatternMatchPrepareCtx(de_ctx, sh->mpm_proto_udp_ctx_ts);
                  }
              }
          }
@@ -2351,10 +2396,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_proto_udp_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_proto_udp_ctx_tc->mpm_type].Prepare != NULL) {
-                         mpm_table[sh->mpm_proto_udp_ctx_tc->mpm_type].
-                             Prepare(sh->mpm_proto_udp_ctx_tc);
-                     }
+                     sh->mpm_proto_udp_ctx_tc = PatternMatchPrepareCtx(de_ctx, sh->mpm_proto_udp_ctx_tc);
                  }
              }
          }
@@ -2365,10 +2407,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_proto_other_ctx = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_proto_other_ctx->mpm_type].Prepare != NULL) {
-                         mpm_table[sh->mpm_proto_other_ctx->mpm_type].
-                             Prepare(sh->mpm_proto_other_ctx);
-                     }
+                     sh->mpm_proto_other_ctx = PatternMatchPrepareCtx(de_ctx, sh->mpm_proto_other_ctx);
                  }
              }
          }
@@ -2379,8 +2418,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_stream_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_stream_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_stream_ctx_ts->mpm_type].Prepare(sh->mpm_stream_ctx_ts);
+                     sh->mpm_stream_ctx_ts = PatternMatchPrepareCtx(de_ctx, sh->mpm_stream_ctx_ts);
                  }
              }
          }
@@ -2390,8 +2428,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_stream_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_stream_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_stream_ctx_tc->mpm_type].Prepare(sh->mpm_stream_ctx_tc);
+                     sh->mpm_stream_ctx_tc = PatternMatchPrepareCtx(de_ctx, sh->mpm_stream_ctx_tc);
                  }
              }
          }
@@ -2402,8 +2439,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_uri_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_uri_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_uri_ctx_ts->mpm_type].Prepare(sh->mpm_uri_ctx_ts);
+                     sh->mpm_uri_ctx_ts = PatternMatchPrepareCtx(de_ctx, sh->mpm_uri_ctx_ts);
                  }
              }
          }
@@ -2414,9 +2450,10 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hcbd_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hcbd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hcbd_ctx_ts->mpm_type].Prepare(sh->mpm_hcbd_ctx_ts);
+                     sh->mpm_hcbd_ctx_ts = PatternMatchPrepareCtx(de_ctx, sh->mpm_hcbd_ctx_ts);
                  }
+                 /* body pruning has to keep what the inspection looks back at */
+                 HTPConfigSetBodyInspectMpmMaxlen(sh->mpm_hcbd_ctx_ts->maxlen, 0);
              }
          }
 
@@ -2426,9 +2463,9 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hsbd_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hsbd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hsbd_ctx_tc->mpm_type].Prepare(sh->mpm_hsbd_ctx_tc);
+                     sh->mpm_hsbd_ctx_tc = PatternMatchPrepareCtx(de_ctx, sh->mpm_hsbd_ctx_tc);
                  }
+                 HTPConfigSetBodyInspectMpmMaxlen(0, sh->mpm_hsbd_ctx_tc->maxlen);
              }
          }
 
@@ -2438,8 +2475,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hhd_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hhd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hhd_ctx_ts->mpm_type].Prepare(sh->mpm_hhd_ctx_ts);
+                     sh->mpm_hhd_ctx_ts = PatternMatchPrepareCtx(de_ctx, sh->mpm_hhd_ctx_ts);
                  }
              }
          }
@@ -2449,8 +2485,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hhd_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hhd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hhd_ctx_tc->mpm_type].Prepare(sh->mpm_hhd_ctx_tc);
+                     sh->mpm_hhd_ctx_tc = PatternMatchPrepareCtx(de_ctx, sh->mpm_hhd_ctx_tc);
                  }
              }
          }
@@ -2461,8 +2496,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hrhd_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hrhd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hrhd_ctx_ts->mpm_type].Prepare(sh->mpm_hrhd_ctx_ts);
+                     sh->mpm_hrhd_ctx_ts = PatternMatchPrepareCtx(de_ctx, sh->mpm_hrhd_ctx_ts);
                  }
              }
          }
@@ -2472,8 +2506,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hrhd_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hrhd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hrhd_ctx_tc->mpm_type].Prepare(sh->mpm_hrhd_ctx_tc);
+                     sh->mpm_hrhd_ctx_tc = PatternMatchPrepareCtx(de_ctx, sh->mpm_hrhd_ctx_tc);
                  }
              }
          }
@@ -2484,8 +2517,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hmd_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hmd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hmd_ctx_ts->mpm_type].Prepare(sh->mpm_hmd_ctx_ts);
+                     sh->mpm_hmd_ctx_ts = PatternMatchPrepareCtx(de_ctx, sh->mpm_hmd_ctx_ts);
                  }
              }
          }
@@ -2496,8 +2528,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hcd_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hcd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hcd_ctx_ts->mpm_type].Prepare(sh->mpm_hcd_ctx_ts);
+                     sh->mpm_hcd_ctx_ts = PatternMatchPrepareCtx(de_ctx, sh->mpm_hcd_ctx_ts);
                  }
              }
          }
@@ -2507,8 +2538,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hcd_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hcd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hcd_ctx_tc->mpm_type].Prepare(sh->mpm_hcd_ctx_tc);
+                     sh->mpm_hcd_ctx_tc = PatternMatchPrepareCtx(de_ctx, sh->mpm_hcd_ctx_tc);
                  }
              }
          }
@@ -2519,8 +2549,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hrud_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hrud_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hrud_ctx_ts->mpm_type].Prepare(sh->mpm_hrud_ctx_ts);
+                     sh->mpm_hrud_ctx_ts = PatternMatchPrepareCtx(de_ctx, sh->mpm_hrud_ctx_ts);
                  }
              }
          }
@@ -2531,8 +2560,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hsmd_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hsmd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hsmd_ctx_tc->mpm_type].Prepare(sh->mpm_hsmd_ctx_tc);
+                     sh->mpm_hsmd_ctx_tc = PatternMatchPrepareCtx(de_ctx, sh->mpm_hsmd_ctx_tc);
                  }
              }
          }
@@ -2543,8 +2571,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hscd_ctx_tc = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hscd_ctx_tc->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hscd_ctx_tc->mpm_type].Prepare(sh->mpm_hscd_ctx_tc);
+                     sh->mpm_hscd_ctx_tc = PatternMatchPrepareCtx(de_ctx, sh->mpm_hscd_ctx_tc);
                  }
              }
          }
@@ -2555,8 +2582,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_huad_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_huad_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_huad_ctx_ts->mpm_type].Prepare(sh->mpm_huad_ctx_ts);
+                     sh->mpm_huad_ctx_ts = PatternMatchPrepareCtx(de_ctx, sh->mpm_huad_ctx_ts);
                  }
              }
          }
@@ -2567,8 +2593,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hhhd_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hhhd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hhhd_ctx_ts->mpm_type].Prepare(sh->mpm_hhhd_ctx_ts);
+                     sh->mpm_hhhd_ctx_ts = PatternMatchPrepareCtx(de_ctx, sh->mpm_hhhd_ctx_ts);
                  }
              }
          }
@@ -2579,8 +2604,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_hrhhd_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_hrhhd_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_hrhhd_ctx_ts->mpm_type].Prepare(sh->mpm_hrhhd_ctx_ts);
+                     sh->mpm_hrhhd_ctx_ts = PatternMatchPrepareCtx(de_ctx, sh->mpm_hrhhd_ctx_ts);
                  }
              }
          }
@@ -2591,8 +2615,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                  sh->mpm_dnsquery_ctx_ts = NULL;
              } else {
                  if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL) {
-                     if (mpm_table[sh->mpm_dnsquery_ctx_ts->mpm_type].Prepare != NULL)
-                         mpm_table[sh->mpm_dnsquery_ctx_ts->mpm_type].Prepare(sh->mpm_dnsquery_ctx_ts);
+                     sh->mpm_dnsquery_ctx_ts = PatternMatchPrepareCtx(de_ctx, sh->mpm_dnsquery_ctx_ts);
                  }
              }
          }
@@ -2812,10 +2835,28 @@ typedef struct DetectFPAndItsId_ {
     uint8_t *content;
 } DetectFPAndItsId;
 
+static int DetectFPAndItsIdCmp(const void *a, const void *b)
+{
+    const DetectFPAndItsId *fa = (const DetectFPAndItsId *)a;
+    const DetectFPAndItsId *fb = (const DetectFPAndItsId *)b;
+
+    if (fa->sm_list != fb->sm_list)
+        return fa->sm_list < fb->sm_list ? -1 : 1;
+    if (fa->content_len != fb->content_len)
+        return fa->content_len < fb->content_len ? -1 : 1;
+    return memcmp(fa->content, fb->content, fa->content_len);
+}
+
 /**
  * \brief Figured out the FP and their respective content ids for all the
  *        sigs in the engine.
  *
+ * On a rule reload patterns that the running engine also has get the id
+ * they have there, so that mpm ctxs that aren't affected by the reload
+ * end up with the same patterns and ids as before. New patterns get ids
+ * after the highest id of the running engine. If that would waste too
+ * much of the id space the ids are assigned from 0 again.
+ *
  * \param de_ctx Detection engine context.
  *
  * \retval  0 On success.
@@ -2826,6 +2867,7 @@ int DetectSetFastPatternAndItsId(DetectEngineCtx *de_ctx)
     uint32_t struct_total_size = 0;
     uint32_t content_total_size = 0;
     Signature *s = NULL;
+    DetectEngineCtx *base = de_ctx->reload_base;
 
     for (s = de_ctx->sig_list; s != NULL; s = s->next) {
         s->mpm_sm = RetrieveFPForSigV2(s);
@@ -2846,6 +2888,16 @@ int DetectSetFastPatternAndItsId(DetectEngineCtx *de_ctx)
     PatIntId max_id = 0;
     DetectFPAndItsId *struct_offset = (DetectFPAndItsId *)ahb;
     uint8_t *content_offset = ahb + struct_total_size;
+    uint32_t fp_cnt = struct_total_size / sizeof(DetectFPAndItsId);
+
+    if (base != NULL && base->fp_id_buf != NULL &&
+        base->max_fp_id <= 2 * fp_cnt &&
+        (uint32_t)base->max_fp_id + fp_cnt <= 0xffff) {
+        max_id = base->max_fp_id;
+    } else {
+        base = NULL;
+    }
+
     for (s = de_ctx->sig_list; s != NULL; s = s->next) {
         if (s->mpm_sm != NULL) {
             int sm_list = SigMatchListSMBelongsTo(s, s->mpm_sm);
@@ -2874,21 +2926,35 @@ int DetectSetFastPatternAndItsId(DetectEngineCtx *de_ctx)
                 continue;
             }
 
-            struct_offset->id = max_id++;
-            cd->id = struct_offset->id;
             struct_offset->content_len = content_len;
             struct_offset->sm_list = sm_list;
             struct_offset->content = content_offset;
             content_offset += content_len;
             memcpy(struct_offset->content, content, content_len);
 
+            DetectFPAndItsId *found = NULL;
+            if (base != NULL) {
+                found = bsearch(struct_offset, base->fp_id_buf, base->fp_id_cnt,
+                                sizeof(DetectFPAndItsId), DetectFPAndItsIdCmp);
+            }
+            if (found != NULL)
+                struct_offset->id = found->id;
+            else
+                struct_offset->id = max_id++;
+            cd->id = struct_offset->id;
+
             struct_offset++;
         } /* if (s->mpm_sm != NULL) */
     } /* for */
 
     de_ctx->max_fp_id = max_id;
 
-    SCFree(ahb);
+    /* keep the mapping for the next reload */
+    if (de_ctx->fp_id_buf != NULL)
+        SCFree(de_ctx->fp_id_buf);
+    de_ctx->fp_id_buf = ahb;
+    de_ctx->fp_id_cnt = struct_offset - (DetectFPAndItsId *)ahb;
+    qsort(ahb, de_ctx->fp_id_cnt, sizeof(DetectFPAndItsId), DetectFPAndItsIdCmp);
 
     return 0;
 }
@@ -174,7 +174,7 @@ void SigGroupHeadFree(SigGroupHead *sgh)
 
     PatternMatchDestroyGroup(sgh);
 
-#if defined(__SSE3__) || defined(__tile__)
+#ifdef DETECT_SIMD_MASK_ARRAY
     if (sgh->mask_array != NULL) {
         /* mask is aligned */
         SCFreeAligned(sgh->mask_array);
@@ -1689,11 +1689,12 @@ int SigGroupHeadBuildHeadArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
         return 0;
 
     BUG_ON(sgh->head_array != NULL);
-#if defined(__SSE3__) || defined(__tile__)
+#ifdef DETECT_SIMD_MASK_ARRAY
     BUG_ON(sgh->mask_array != NULL);
 
-    /* mask array is 16 byte aligned for SIMD checking, also we always
-     * alloc a multiple of 32/64 bytes */
+    /* mask array is 64 byte aligned for SIMD checking, so that a batch
+     * is a single cache line, also we always alloc a multiple of 32/64
+     * bytes */
     int cnt = sgh->sig_cnt;
 #if __WORDSIZE == 32
     if (cnt % 32 != 0) {
@@ -1705,7 +1706,7 @@ int SigGroupHeadBuildHeadArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
     }
 #endif /* __WORDSIZE */
 
-    sgh->mask_array = (SignatureMask *)SCMallocAligned((cnt * sizeof(SignatureMask)), 16);
+    sgh->mask_array = (SignatureMask *)SCMallocAligned((cnt * sizeof(SignatureMask)), 64);
     if (sgh->mask_array == NULL)
         return -1;
 
@@ -1731,7 +1732,7 @@ int SigGroupHeadBuildHeadArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
         sgh->head_array[idx].hdr_copy3 = s->hdr_copy3;
         sgh->head_array[idx].full_sig = s;
 
-#if defined(__SSE3__) || defined(__tile__)
+#ifdef DETECT_SIMD_MASK_ARRAY
         sgh->mask_array[idx] = s->mask;
 #endif
         idx++;
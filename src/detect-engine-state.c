@@ -22,12 +22,17 @@
  * This is done by this code. It uses the ::Flow structure to store
  * the list of signatures to match on the reconstructed stream.
  *
- * The Flow::de_state is a ::DetectEngineState structure. This is
- * basically a containter for storage item of type ::DeStateStore.
- * They contains an array of ::DeStateStoreItem which store the
+ * The Flow::de_state is a ::DetectEngineState structure. Per direction
+ * it holds a contiguous array of ::DeStateStoreItem which store the
  * state of match for an individual signature identified by
  * DeStateStoreItem::sid.
  *
+ * States are recycled: a freed state goes on a free list of the thread
+ * that frees it, with its item array intact, so that a new flow normally
+ * gets its state and storage without touching the allocator or a lock.
+ * Thread lists exchange states in batches with a global pool that is
+ * bounded by the memory the states hold.
+ *
  * The state is constructed by DeStateDetectStartDetection() which
  * also starts the matching. Work is continued by
  * DeStateDetectContinueDetection().
@@ -80,52 +85,168 @@
 
 /******** static internal helpers *********/
 
-static DeStateStore *DeStateStoreAlloc(void)
+/** free list of a thread */
+typedef struct DeStateFreeList_ {
+    DetectEngineState *head;
+    uint32_t cnt;
+} DeStateFreeList;
+
+/** global pool of free states. Thread free lists that grow too long hand
+ *  half their states to it, and empty lists take a batch from it. */
+static DetectEngineState *de_state_pool = NULL;
+/** memory held by the states in the global pool */
+static uint64_t de_state_pool_bytes = 0;
+static SCMutex de_state_pool_m = SCMUTEX_INITIALIZER;
+
+static pthread_key_t de_state_free_key;
+static pthread_once_t de_state_free_once = PTHREAD_ONCE_INIT;
+static int de_state_free_key_set = 0;
+
+static DetectEngineState *DeStateNew(void)
 {
-    DeStateStore *d = SCMalloc(sizeof(DeStateStore));
+    DetectEngineState *d = SCMalloc(sizeof(DetectEngineState));
     if (unlikely(d == NULL))
         return NULL;
-    memset(d, 0, sizeof(DeStateStore));
+    memset(d, 0, sizeof(DetectEngineState));
 
     return d;
 }
 
+static void DeStateDestroy(DetectEngineState *state)
+{
+    if (state->dir_state[0].store != NULL)
+        SCFree(state->dir_state[0].store);
+    if (state->dir_state[1].store != NULL)
+        SCFree(state->dir_state[1].store);
+    SCFree(state);
+}
+
+/** \internal
+ *  \brief memory held by a state, including its item storage */
+static uint32_t DeStateMemory(DetectEngineState *state)
+{
+    return sizeof(DetectEngineState) +
+           ((uint32_t)state->dir_state[0].size + state->dir_state[1].size) *
+           sizeof(DeStateStoreItem);
+}
+
+/** \internal
+ *  \brief Move a list of states to the global pool. States that would
+ *         take the pool over DE_STATE_POOL_MAX_BYTES are destroyed.
+ */
+static void DeStatePoolPut(DetectEngineState *list)
+{
+    DetectEngineState *d, *excess = NULL;
+
+    if (list == NULL)
+        return;
+
+    SCMutexLock(&de_state_pool_m);
+    while ((d = list) != NULL) {
+        list = d->next;
+
+        uint32_t size = DeStateMemory(d);
+        if (de_state_pool_bytes + size <= DE_STATE_POOL_MAX_BYTES) {
+            d->next = de_state_pool;
+            de_state_pool = d;
+            de_state_pool_bytes += size;
+        } else {
+            d->next = excess;
+            excess = d;
+        }
+    }
+    SCMutexUnlock(&de_state_pool_m);
+
+    while ((d = excess) != NULL) {
+        excess = d->next;
+        DeStateDestroy(d);
+    }
+}
+
+/** \internal
+ *  \brief hand the states of a thread's free list to the global pool,
+ *         called on thread exit */
+static void DeStateFreeListFree(void *data)
+{
+    DeStateFreeList *fl = (DeStateFreeList *)data;
+    if (fl == NULL)
+        return;
+
+    DeStatePoolPut(fl->head);
+    SCFree(fl);
+}
+
+static void DeStateFreeListKeyInit(void)
+{
+    if (pthread_key_create(&de_state_free_key, DeStateFreeListFree) == 0)
+        de_state_free_key_set = 1;
+}
+
+/** \internal
+ *  \brief get the free list of the calling thread, setting it up if needed
+ *  \retval fl free list or NULL if we can't have one */
+static DeStateFreeList *DeStateGetFreeList(void)
+{
+    pthread_once(&de_state_free_once, DeStateFreeListKeyInit);
+    if (unlikely(de_state_free_key_set == 0))
+        return NULL;
+
+    DeStateFreeList *fl = pthread_getspecific(de_state_free_key);
+    if (likely(fl != NULL))
+        return fl;
+
+    fl = SCMalloc(sizeof(DeStateFreeList));
+    if (unlikely(fl == NULL))
+        return NULL;
+    memset(fl, 0x00, sizeof(DeStateFreeList));
+
+    if (pthread_setspecific(de_state_free_key, fl) != 0) {
+        SCFree(fl);
+        return NULL;
+    }
+    return fl;
+}
+
+/**
+ *  \brief Make room for at least one more item in the store.
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+static int DeStateStoreGrow(DetectEngineStateDirection *dir_state)
+{
+    uint32_t size = dir_state->size ? (uint32_t)dir_state->size * 2 :
+                                      DE_STATE_STORE_INITIAL_SIZE;
+    if (size > (SigIntId)~0)
+        size = (SigIntId)~0;
+    if (size <= dir_state->cnt)
+        return -1;
+
+    DeStateStoreItem *store = SCRealloc(dir_state->store,
+                                        size * sizeof(DeStateStoreItem));
+    if (unlikely(store == NULL))
+        return -1;
+
+    dir_state->store = store;
+    dir_state->size = (SigIntId)size;
+    return 0;
+}
+
 static void DeStateSignatureAppend(DetectEngineState *state, Signature *s,
                                    SigMatch *sm, uint32_t inspect_flags,
                                    uint8_t direction)
 {
-    int jump = 0;
-    int i = 0;
     DetectEngineStateDirection *dir_state = &state->dir_state[direction & STREAM_TOSERVER ? 0 : 1];
-    DeStateStore *store = dir_state->head;
 
-    if (store == NULL) {
-        store = DeStateStoreAlloc();
-        if (store != NULL) {
-            dir_state->head = store;
-            dir_state->tail = store;
-        }
-    } else {
-        jump = dir_state->cnt / DE_STATE_CHUNK_SIZE;
-        for (i = 0; i < jump; i++) {
-            store = store->next;
-        }
-        if (store == NULL) {
-            store = DeStateStoreAlloc();
-            if (store != NULL) {
-                dir_state->tail->next = store;
-                dir_state->tail = store;
-            }
-        }
+    if (dir_state->cnt == dir_state->size) {
+        if (DeStateStoreGrow(dir_state) < 0)
+            return;
     }
 
-    if (store == NULL)
-        return;
-
-    SigIntId idx = dir_state->cnt++ % DE_STATE_CHUNK_SIZE;
-    store->store[idx].sid = s->num;
-    store->store[idx].flags = inspect_flags;
-    store->store[idx].nm = sm;
+    DeStateStoreItem *item = &dir_state->store[dir_state->cnt++];
+    item->sid = s->num;
+    item->flags = inspect_flags;
+    item->nm = sm;
 
     return;
 }
@@ -182,33 +303,106 @@ static void DeStateResetFileInspection(Flow *f, uint16_t alproto, void *alstate,
 
 DetectEngineState *DetectEngineStateAlloc(void)
 {
-    DetectEngineState *d = SCMalloc(sizeof(DetectEngineState));
-    if (unlikely(d == NULL))
-        return NULL;
-    memset(d, 0, sizeof(DetectEngineState));
+    DetectEngineState *d;
+    DeStateFreeList *fl = DeStateGetFreeList();
+
+    if (unlikely(fl == NULL))
+        return DeStateNew();
+
+    if (fl->head == NULL) {
+        SCMutexLock(&de_state_pool_m);
+        while (de_state_pool != NULL && fl->cnt < DE_STATE_THREAD_POOL_SIZE / 2) {
+            d = de_state_pool;
+            de_state_pool = d->next;
+            de_state_pool_bytes -= DeStateMemory(d);
+
+            d->next = fl->head;
+            fl->head = d;
+            fl->cnt++;
+        }
+        SCMutexUnlock(&de_state_pool_m);
+
+        if (fl->head == NULL)
+            return DeStateNew();
+    }
 
+    d = fl->head;
+    fl->head = d->next;
+    fl->cnt--;
+    d->next = NULL;
     return d;
 }
 
 void DetectEngineStateFree(DetectEngineState *state)
 {
-    DeStateStore *store;
-    DeStateStore *store_next;
     int i = 0;
 
     for (i = 0; i < 2; i++) {
-        store = state->dir_state[i].head;
-        while (store != NULL) {
-            store_next = store->next;
-            SCFree(store);
-            store = store_next;
+        DetectEngineStateDirection *dir_state = &state->dir_state[i];
+
+        /* don't let a single busy flow pin a large store in the pool */
+        if (dir_state->size > DE_STATE_STORE_POOL_MAX_SIZE) {
+            SCFree(dir_state->store);
+            dir_state->store = NULL;
+            dir_state->size = 0;
         }
+        dir_state->cnt = 0;
+        dir_state->filestore_cnt = 0;
+        dir_state->alversion = 0;
+        dir_state->flags = 0;
+    }
+
+    DeStateFreeList *fl = DeStateGetFreeList();
+    if (unlikely(fl == NULL)) {
+        DeStateDestroy(state);
+        return;
+    }
+
+    state->next = fl->head;
+    fl->head = state;
+    fl->cnt++;
+
+    /* keep the most recently freed half, hand the rest to the global
+     * pool so that threads that mostly allocate can get them */
+    if (fl->cnt > DE_STATE_THREAD_POOL_SIZE) {
+        DetectEngineState *last = fl->head;
+        for (i = 1; i < DE_STATE_THREAD_POOL_SIZE / 2; i++)
+            last = last->next;
+
+        DetectEngineState *list = last->next;
+        last->next = NULL;
+        fl->cnt = DE_STATE_THREAD_POOL_SIZE / 2;
+
+        DeStatePoolPut(list);
     }
-    SCFree(state);
 
     return;
 }
 
+void DetectEngineStatePoolCleanup(void)
+{
+    DetectEngineState *d;
+
+    /* threads hand in their lists on exit, the calling thread is still
+     * running */
+    DeStateFreeList *fl = DeStateGetFreeList();
+    if (fl != NULL) {
+        while ((d = fl->head) != NULL) {
+            fl->head = d->next;
+            DeStateDestroy(d);
+        }
+        fl->cnt = 0;
+    }
+
+    SCMutexLock(&de_state_pool_m);
+    while ((d = de_state_pool) != NULL) {
+        de_state_pool = d->next;
+        DeStateDestroy(d);
+    }
+    de_state_pool_bytes = 0;
+    SCMutexUnlock(&de_state_pool_m);
+}
+
 int DeStateFlowHasInspectableState(Flow *f, uint16_t alproto, uint16_t alversion, uint8_t flags)
 {
     int r = 0;
@@ -461,13 +655,11 @@ void DeStateDetectContinueDetection(ThreadVars *tv, DetectEngineCtx *de_ctx,
     HtpState *htp_state = NULL;
     SMBState *smb_state = NULL;
 
-    SigIntId store_cnt = 0;
     SigIntId state_cnt = 0;
     int match = 0;
     uint8_t alert = 0;
 
     DetectEngineStateDirection *dir_state = &f->de_state->dir_state[flags & STREAM_TOSERVER ? 0 : 1];
-    DeStateStore *store = dir_state->head;
     void *inspect_tx = NULL;
     uint64_t inspect_tx_id = 0;
     uint64_t total_txs = 0;
@@ -499,185 +691,180 @@ void DeStateDetectContinueDetection(ThreadVars *tv, DetectEngineCtx *de_ctx,
         alproto_supports_txs = 1;
     }
 
-    for (; store != NULL; store = store->next) {
-        for (store_cnt = 0;
-             store_cnt < DE_STATE_CHUNK_SIZE && state_cnt < dir_state->cnt;
-             store_cnt++, state_cnt++)
-        {
-            total_matches = 0;
-            DeStateStoreItem *item = &store->store[store_cnt];
-            Signature *s = de_ctx->sig_array[item->sid];
-
-            if (item->flags & DE_STATE_FLAG_FULL_INSPECT) {
-                if (item->flags & (DE_STATE_FLAG_FILE_TC_INSPECT |
-                                   DE_STATE_FLAG_FILE_TS_INSPECT)) {
-                    if ((flags & STREAM_TOCLIENT) &&
-                        (dir_state->flags & DETECT_ENGINE_STATE_FLAG_FILE_TC_NEW))
-                    {
-                        item->flags &= ~DE_STATE_FLAG_FILE_TC_INSPECT;
-                        item->flags &= ~DE_STATE_FLAG_FULL_INSPECT;
-                    }
-
-                    if ((flags & STREAM_TOSERVER) &&
-                        (dir_state->flags & DETECT_ENGINE_STATE_FLAG_FILE_TS_NEW))
-                    {
-                        item->flags &= ~DE_STATE_FLAG_FILE_TS_INSPECT;
-                        item->flags &= ~DE_STATE_FLAG_FULL_INSPECT;
-                    }
-                }
+    for (state_cnt = 0; state_cnt < dir_state->cnt; state_cnt++) {
+        total_matches = 0;
+        DeStateStoreItem *item = &dir_state->store[state_cnt];
+        Signature *s = de_ctx->sig_array[item->sid];
 
-                if (item->flags & DE_STATE_FLAG_FULL_INSPECT) {
-                    if (alproto_supports_txs) {
-                        if ((total_txs - inspect_tx_id) <= 1)
-                            det_ctx->de_state_sig_array[item->sid] = DE_STATE_MATCH_NO_NEW_STATE;
-                    } else {
-                        det_ctx->de_state_sig_array[item->sid] = DE_STATE_MATCH_NO_NEW_STATE;
-                    }
-                    continue;
+        if (item->flags & DE_STATE_FLAG_FULL_INSPECT) {
+            if (item->flags & (DE_STATE_FLAG_FILE_TC_INSPECT |
+                               DE_STATE_FLAG_FILE_TS_INSPECT)) {
+                if ((flags & STREAM_TOCLIENT) &&
+                    (dir_state->flags & DETECT_ENGINE_STATE_FLAG_FILE_TC_NEW))
+                {
+                    item->flags &= ~DE_STATE_FLAG_FILE_TC_INSPECT;
+                    item->flags &= ~DE_STATE_FLAG_FULL_INSPECT;
                 }
-            }
 
-            if (item->flags & DE_STATE_FLAG_SIG_CANT_MATCH) {
                 if ((flags & STREAM_TOSERVER) &&
-                    (item->flags & DE_STATE_FLAG_FILE_TS_INSPECT) &&
                     (dir_state->flags & DETECT_ENGINE_STATE_FLAG_FILE_TS_NEW))
                 {
                     item->flags &= ~DE_STATE_FLAG_FILE_TS_INSPECT;
-                    item->flags &= ~DE_STATE_FLAG_SIG_CANT_MATCH;
-                } else if ((flags & STREAM_TOCLIENT) &&
-                           (item->flags & DE_STATE_FLAG_FILE_TC_INSPECT) &&
-                           (dir_state->flags & DETECT_ENGINE_STATE_FLAG_FILE_TC_NEW))
-                {
-                    item->flags &= ~DE_STATE_FLAG_FILE_TC_INSPECT;
-                    item->flags &= ~DE_STATE_FLAG_SIG_CANT_MATCH;
-                } else {
-                    if (alproto_supports_txs) {
-                        if ((total_txs - inspect_tx_id) <= 1)
-                            det_ctx->de_state_sig_array[item->sid] = DE_STATE_MATCH_NO_NEW_STATE;
-                    } else {
+                    item->flags &= ~DE_STATE_FLAG_FULL_INSPECT;
+                }
+            }
+
+            if (item->flags & DE_STATE_FLAG_FULL_INSPECT) {
+                if (alproto_supports_txs) {
+                    if ((total_txs - inspect_tx_id) <= 1)
                         det_ctx->de_state_sig_array[item->sid] = DE_STATE_MATCH_NO_NEW_STATE;
-                    }
-                    continue;
+                } else {
+                    det_ctx->de_state_sig_array[item->sid] = DE_STATE_MATCH_NO_NEW_STATE;
                 }
+                continue;
             }
+        }
 
-            alert = 0;
-            inspect_flags = 0;
-            match = 0;
+        if (item->flags & DE_STATE_FLAG_SIG_CANT_MATCH) {
+            if ((flags & STREAM_TOSERVER) &&
+                (item->flags & DE_STATE_FLAG_FILE_TS_INSPECT) &&
+                (dir_state->flags & DETECT_ENGINE_STATE_FLAG_FILE_TS_NEW))
+            {
+                item->flags &= ~DE_STATE_FLAG_FILE_TS_INSPECT;
+                item->flags &= ~DE_STATE_FLAG_SIG_CANT_MATCH;
+            } else if ((flags & STREAM_TOCLIENT) &&
+                       (item->flags & DE_STATE_FLAG_FILE_TC_INSPECT) &&
+                       (dir_state->flags & DETECT_ENGINE_STATE_FLAG_FILE_TC_NEW))
+            {
+                item->flags &= ~DE_STATE_FLAG_FILE_TC_INSPECT;
+                item->flags &= ~DE_STATE_FLAG_SIG_CANT_MATCH;
+            } else {
+                if (alproto_supports_txs) {
+                    if ((total_txs - inspect_tx_id) <= 1)
+                        det_ctx->de_state_sig_array[item->sid] = DE_STATE_MATCH_NO_NEW_STATE;
+                } else {
+                    det_ctx->de_state_sig_array[item->sid] = DE_STATE_MATCH_NO_NEW_STATE;
+                }
+                continue;
+            }
+        }
 
-            RULE_PROFILING_START;
+        alert = 0;
+        inspect_flags = 0;
+        match = 0;
 
-            if (alproto_supports_txs) {
-                FLOWLOCK_WRLOCK(f);
+        RULE_PROFILING_START;
 
-                if (alproto == ALPROTO_HTTP) {
-                    htp_state = (HtpState *)alstate;
-                    if (htp_state->conn == NULL) {
-                        FLOWLOCK_UNLOCK(f);
-                        RULE_PROFILING_END(det_ctx, s, match);
-                        goto end;
-                    }
-                }
+        if (alproto_supports_txs) {
+            FLOWLOCK_WRLOCK(f);
 
-                engine = app_inspection_engine[alproto][(flags & STREAM_TOSERVER) ? 0 : 1];
-                inspect_tx = AppLayerGetTx(alproto, alstate, inspect_tx_id);
-                if (inspect_tx == NULL) {
+            if (alproto == ALPROTO_HTTP) {
+                htp_state = (HtpState *)alstate;
+                if (htp_state->conn == NULL) {
                     FLOWLOCK_UNLOCK(f);
                     RULE_PROFILING_END(det_ctx, s, match);
                     goto end;
                 }
-                while (engine != NULL) {
-                    if (!(item->flags & engine->inspect_flags) &&
-                        s->sm_lists[engine->sm_list] != NULL)
-                    {
-                        KEYWORD_PROFILING_SET_LIST(det_ctx, engine->sm_list);
-                        match = engine->Callback(tv, de_ctx, det_ctx, s, f,
-                                                 flags, alstate, inspect_tx, inspect_tx_id);
-                        if (match == 1) {
-                            inspect_flags |= engine->inspect_flags;
-                            engine = engine->next;
-                            total_matches++;
-                            continue;
-                        } else if (match == 2) {
-                            inspect_flags |= DE_STATE_FLAG_SIG_CANT_MATCH;
-                            inspect_flags |= engine->inspect_flags;
-                        } else if (match == 3) {
-                            inspect_flags |= DE_STATE_FLAG_SIG_CANT_MATCH;
-                            inspect_flags |= engine->inspect_flags;
-                            file_no_match++;
-                        }
-                        break;
-                    }
-                    engine = engine->next;
-                }
-                if (total_matches > 0 && (engine == NULL || inspect_flags & DE_STATE_FLAG_SIG_CANT_MATCH)) {
-                    if (engine == NULL)
-                        alert = 1;
-                    inspect_flags |= DE_STATE_FLAG_FULL_INSPECT;
-                }
+            }
 
+            engine = app_inspection_engine[alproto][(flags & STREAM_TOSERVER) ? 0 : 1];
+            inspect_tx = AppLayerGetTx(alproto, alstate, inspect_tx_id);
+            if (inspect_tx == NULL) {
                 FLOWLOCK_UNLOCK(f);
+                RULE_PROFILING_END(det_ctx, s, match);
+                goto end;
+            }
+            while (engine != NULL) {
+                if (!(item->flags & engine->inspect_flags) &&
+                    s->sm_lists[engine->sm_list] != NULL)
+                {
+                    KEYWORD_PROFILING_SET_LIST(det_ctx, engine->sm_list);
+                    match = engine->Callback(tv, de_ctx, det_ctx, s, f,
+                                             flags, alstate, inspect_tx, inspect_tx_id);
+                    if (match == 1) {
+                        inspect_flags |= engine->inspect_flags;
+                        engine = engine->next;
+                        total_matches++;
+                        continue;
+                    } else if (match == 2) {
+                        inspect_flags |= DE_STATE_FLAG_SIG_CANT_MATCH;
+                        inspect_flags |= engine->inspect_flags;
+                    } else if (match == 3) {
+                        inspect_flags |= DE_STATE_FLAG_SIG_CANT_MATCH;
+                        inspect_flags |= engine->inspect_flags;
+                        file_no_match++;
+                    }
+                    break;
+                }
+                engine = engine->next;
+            }
+            if (total_matches > 0 && (engine == NULL || inspect_flags & DE_STATE_FLAG_SIG_CANT_MATCH)) {
+                if (engine == NULL)
+                    alert = 1;
+                inspect_flags |= DE_STATE_FLAG_FULL_INSPECT;
             }
 
-            KEYWORD_PROFILING_SET_LIST(det_ctx, DETECT_SM_LIST_AMATCH);
-            for (sm = item->nm; sm != NULL; sm = sm->next) {
-                if (sigmatch_table[sm->type].AppLayerMatch != NULL &&
-                    (alproto == s->alproto || alproto == ALPROTO_SMB || alproto == ALPROTO_SMB2))
-                    {
-                        if (alproto == ALPROTO_SMB || alproto == ALPROTO_SMB2) {
-                            smb_state = (SMBState *)alstate;
-                            if (smb_state->dcerpc_present) {
-                                KEYWORD_PROFILING_START;
-                                match = sigmatch_table[sm->type].
-                                    AppLayerMatch(tv, det_ctx, f, flags, &smb_state->dcerpc, s, sm);
-                                KEYWORD_PROFILING_END(det_ctx, sm->type, (match > 0));
-                            }
-                        } else {
+            FLOWLOCK_UNLOCK(f);
+        }
+
+        KEYWORD_PROFILING_SET_LIST(det_ctx, DETECT_SM_LIST_AMATCH);
+        for (sm = item->nm; sm != NULL; sm = sm->next) {
+            if (sigmatch_table[sm->type].AppLayerMatch != NULL &&
+                (alproto == s->alproto || alproto == ALPROTO_SMB || alproto == ALPROTO_SMB2))
+                {
+                    if (alproto == ALPROTO_SMB || alproto == ALPROTO_SMB2) {
+                        smb_state = (SMBState *)alstate;
+                        if (smb_state->dcerpc_present) {
                             KEYWORD_PROFILING_START;
                             match = sigmatch_table[sm->type].
-                                AppLayerMatch(tv, det_ctx, f, flags, alstate, s, sm);
+                                AppLayerMatch(tv, det_ctx, f, flags, &smb_state->dcerpc, s, sm);
                             KEYWORD_PROFILING_END(det_ctx, sm->type, (match > 0));
                         }
-
-                        if (match == 0)
-                            break;
-                        else if (match == 2)
-                            inspect_flags |= DE_STATE_FLAG_SIG_CANT_MATCH;
+                    } else {
+                        KEYWORD_PROFILING_START;
+                        match = sigmatch_table[sm->type].
+                            AppLayerMatch(tv, det_ctx, f, flags, alstate, s, sm);
+                        KEYWORD_PROFILING_END(det_ctx, sm->type, (match > 0));
                     }
-            }
-            RULE_PROFILING_END(det_ctx, s, match);
 
-            if (s->sm_lists[DETECT_SM_LIST_AMATCH] != NULL) {
-                if (sm == NULL || inspect_flags & DE_STATE_FLAG_SIG_CANT_MATCH) {
-                    if (sm == NULL)
-                        alert = 1;
-                    inspect_flags |= DE_STATE_FLAG_FULL_INSPECT;
+                    if (match == 0)
+                        break;
+                    else if (match == 2)
+                        inspect_flags |= DE_STATE_FLAG_SIG_CANT_MATCH;
                 }
-                det_ctx->de_state_sig_array[item->sid] = DE_STATE_MATCH_NO_NEW_STATE;
+        }
+        RULE_PROFILING_END(det_ctx, s, match);
+
+        if (s->sm_lists[DETECT_SM_LIST_AMATCH] != NULL) {
+            if (sm == NULL || inspect_flags & DE_STATE_FLAG_SIG_CANT_MATCH) {
+                if (sm == NULL)
+                    alert = 1;
+                inspect_flags |= DE_STATE_FLAG_FULL_INSPECT;
             }
+            det_ctx->de_state_sig_array[item->sid] = DE_STATE_MATCH_NO_NEW_STATE;
+        }
 
-            item->flags |= inspect_flags;
-            item->nm = sm;
-            if ((total_txs - inspect_tx_id) <= 1)
-                det_ctx->de_state_sig_array[item->sid] = DE_STATE_MATCH_NO_NEW_STATE;
+        item->flags |= inspect_flags;
+        item->nm = sm;
+        if ((total_txs - inspect_tx_id) <= 1)
+            det_ctx->de_state_sig_array[item->sid] = DE_STATE_MATCH_NO_NEW_STATE;
 
-            if (alert) {
-                SigMatchSignaturesRunPostMatch(tv, de_ctx, det_ctx, p, s);
+        if (alert) {
+            SigMatchSignaturesRunPostMatch(tv, de_ctx, det_ctx, p, s);
 
-                if (!(s->flags & SIG_FLAG_NOALERT)) {
-                    if (alproto_supports_txs)
-                        PacketAlertAppend(det_ctx, s, p, inspect_tx_id,
-                                PACKET_ALERT_FLAG_STATE_MATCH|PACKET_ALERT_FLAG_TX);
-                    else
-                        PacketAlertAppend(det_ctx, s, p, 0,
-                                PACKET_ALERT_FLAG_STATE_MATCH);
-                } else {
-                    PACKET_UPDATE_ACTION(p, s->action);
-                }
+            if (!(s->flags & SIG_FLAG_NOALERT)) {
+                if (alproto_supports_txs)
+                    PacketAlertAppend(det_ctx, s, p, inspect_tx_id,
+                            PACKET_ALERT_FLAG_STATE_MATCH|PACKET_ALERT_FLAG_TX);
+                else
+                    PacketAlertAppend(det_ctx, s, p, 0,
+                            PACKET_ALERT_FLAG_STATE_MATCH);
+            } else {
+                PACKET_UPDATE_ACTION(p, s->action);
             }
-
-            DetectFlowvarProcessList(det_ctx, f);
         }
+
+        DetectFlowvarProcessList(det_ctx, f);
     }
 
     DeStateStoreStateVersion(f->de_state, alversion, flags);
@@ -753,8 +940,6 @@ static int DeStateTest01(void)
 {
     SCLogDebug("sizeof(DetectEngineState)\t\t%"PRIuMAX,
             (uintmax_t)sizeof(DetectEngineState));
-    SCLogDebug("sizeof(DeStateStore)\t\t\t%"PRIuMAX,
-            (uintmax_t)sizeof(DeStateStore));
     SCLogDebug("sizeof(DeStateStoreItem)\t\t%"PRIuMAX"",
             (uintmax_t)sizeof(DeStateStoreItem));
 
@@ -811,27 +996,27 @@ static int DeStateTest02(void)
     s.num = 166;
     DeStateSignatureAppend(state, &s, NULL, 0, direction);
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head == NULL) {
+    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store == NULL) {
         goto end;
     }
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[1].sid != 11) {
+    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].cnt != 17) {
         goto end;
     }
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->next == NULL) {
+    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store[1].sid != 11) {
         goto end;
     }
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[14].sid != 144) {
+    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store[14].sid != 144) {
         goto end;
     }
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->next->store[0].sid != 155) {
+    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store[15].sid != 155) {
         goto end;
     }
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->next->store[1].sid != 166) {
+    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store[16].sid != 166) {
         goto end;
     }
 
@@ -863,23 +1048,23 @@ static int DeStateTest03(void)
     s.num = 22;
     DeStateSignatureAppend(state, &s, NULL, DE_STATE_FLAG_URI_INSPECT, direction);
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head == NULL) {
+    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store == NULL) {
         goto end;
     }
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[0].sid != 11) {
+    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store[0].sid != 11) {
         goto end;
     }
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[0].flags & DE_STATE_FLAG_URI_INSPECT) {
+    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store[0].flags & DE_STATE_FLAG_URI_INSPECT) {
         goto end;
     }
 
-    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[1].sid != 22) {
+    if (state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store[1].sid != 22) {
         goto end;
     }
 
-    if (!(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].head->store[1].flags & DE_STATE_FLAG_URI_INSPECT)) {
+    if (!(state->dir_state[direction & STREAM_TOSERVER ? 0 : 1].store[1].flags & DE_STATE_FLAG_URI_INSPECT)) {
         goto end;
     }
 
@@ -891,6 +1076,124 @@ end:
     return result;
 }
 
+/** \test a freed state is recycled with its storage, but without its
+ *        items and flags */
+static int DeStateTest04(void)
+{
+    int result = 0;
+    int i;
+    DetectEngineState *state2 = NULL;
+
+    DetectEngineState *state = DetectEngineStateAlloc();
+    if (state == NULL) {
+        printf("d == NULL: ");
+        goto end;
+    }
+
+    Signature s;
+    memset(&s, 0x00, sizeof(s));
+
+    for (i = 0; i < 20; i++) {
+        s.num = i;
+        DeStateSignatureAppend(state, &s, NULL, DE_STATE_FLAG_URI_INSPECT, STREAM_TOCLIENT);
+    }
+    state->dir_state[1].flags |= DETECT_ENGINE_STATE_FLAG_FILE_TC_NEW;
+
+    if (state->dir_state[1].cnt != 20 || state->dir_state[0].cnt != 0) {
+        printf("cnt %u/%u: ", state->dir_state[0].cnt, state->dir_state[1].cnt);
+        goto end;
+    }
+    if (state->dir_state[1].store[19].sid != 19) {
+        goto end;
+    }
+    DeStateStoreItem *store = state->dir_state[1].store;
+    SigIntId size = state->dir_state[1].size;
+
+    DetectEngineStateFree(state);
+    state2 = DetectEngineStateAlloc();
+    if (state2 != state) {
+        printf("state not recycled: ");
+        state = NULL;
+        goto end;
+    }
+    state = NULL;
+
+    if (state2->dir_state[1].cnt != 0 || state2->dir_state[1].flags != 0) {
+        printf("recycled state not reset: ");
+        goto end;
+    }
+    if (state2->dir_state[1].store != store || state2->dir_state[1].size != size) {
+        printf("storage not kept: ");
+        goto end;
+    }
+
+    s.num = 33;
+    DeStateSignatureAppend(state2, &s, NULL, 0, STREAM_TOCLIENT);
+    if (state2->dir_state[1].cnt != 1 || state2->dir_state[1].store[0].sid != 33 ||
+        state2->dir_state[1].store[0].flags != 0) {
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (state != NULL) {
+        DetectEngineStateFree(state);
+    }
+    if (state2 != NULL) {
+        DetectEngineStateFree(state2);
+    }
+    DetectEngineStatePoolCleanup();
+    return result;
+}
+
+/** \test freeing more states than a thread keeps moves them to the
+ *        global pool, which takes no more than its memory limit */
+static int DeStateTest05(void)
+{
+    int result = 0;
+    int i;
+    DetectEngineState *states[DE_STATE_THREAD_POOL_SIZE * 2];
+
+    DetectEngineStatePoolCleanup();
+
+    for (i = 0; i < DE_STATE_THREAD_POOL_SIZE * 2; i++) {
+        states[i] = DetectEngineStateAlloc();
+        if (states[i] == NULL)
+            goto end;
+    }
+    for (i = 0; i < DE_STATE_THREAD_POOL_SIZE * 2; i++)
+        DetectEngineStateFree(states[i]);
+
+    DeStateFreeList *fl = DeStateGetFreeList();
+    if (fl == NULL || fl->cnt > DE_STATE_THREAD_POOL_SIZE) {
+        printf("thread list not bounded: ");
+        goto end;
+    }
+    if (de_state_pool == NULL ||
+        de_state_pool_bytes != (DE_STATE_THREAD_POOL_SIZE * 2 - fl->cnt) *
+                               sizeof(DetectEngineState)) {
+        printf("pool holds %"PRIu64" bytes: ", de_state_pool_bytes);
+        goto end;
+    }
+
+    /* a full pool takes no more states */
+    de_state_pool_bytes = DE_STATE_POOL_MAX_BYTES;
+    DetectEngineState *d = DeStateNew();
+    if (d == NULL)
+        goto end;
+    d->next = NULL;
+    DeStatePoolPut(d);
+    if (de_state_pool_bytes != DE_STATE_POOL_MAX_BYTES) {
+        printf("pool took a state beyond its limit: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    DetectEngineStatePoolCleanup();
+    return result;
+}
+
 static int DeStateSigTest01(void)
 {
     int result = 0;
@@ -1856,6 +2159,8 @@ void DeStateRegisterTests(void)
     UtRegisterTest("DeStateTest01", DeStateTest01, 1);
     UtRegisterTest("DeStateTest02", DeStateTest02, 1);
     UtRegisterTest("DeStateTest03", DeStateTest03, 1);
+    UtRegisterTest("DeStateTest04", DeStateTest04, 1);
+    UtRegisterTest("DeStateTest05", DeStateTest05, 1);
     UtRegisterTest("DeStateSigTest01", DeStateSigTest01, 1);
     UtRegisterTest("DeStateSigTest02", DeStateSigTest02, 1);
     UtRegisterTest("DeStateSigTest03", DeStateSigTest03, 1);
@@ -53,8 +53,15 @@
 #define DETECT_ENGINE_INSPECT_SIG_CANT_MATCH 2
 #define DETECT_ENGINE_INSPECT_SIG_CANT_MATCH_FILESTORE 3
 
-/** number of DeStateStoreItem's in one DeStateStore object */
-#define DE_STATE_CHUNK_SIZE             15
+/** number of DeStateStoreItem's a direction's store starts out with */
+#define DE_STATE_STORE_INITIAL_SIZE     16
+/** stores grown beyond this are shrunk when the state goes back to the pool */
+#define DE_STATE_STORE_POOL_MAX_SIZE    64
+/** max number of free states a thread keeps for itself */
+#define DE_STATE_THREAD_POOL_SIZE       32
+/** max memory held by the free states in the global pool, including
+ *  their item storage */
+#define DE_STATE_POOL_MAX_BYTES         (16 * 1024 * 1024)
 
 /* per sig flags */
 #define DE_STATE_FLAG_URI_INSPECT         (1)
@@ -108,15 +115,11 @@ typedef struct DeStateStoreItem_ {
     SigIntId sid;
 } DeStateStoreItem;
 
-typedef struct DeStateStore_ {
-    DeStateStoreItem store[DE_STATE_CHUNK_SIZE];
-    struct DeStateStore_ *next;
-} DeStateStore;
-
 typedef struct DetectEngineStateDirection_ {
-    DeStateStore *head;
-    DeStateStore *tail;
+    /** contiguous array of 'size' items, the first 'cnt' are in use */
+    DeStateStoreItem *store;
     SigIntId cnt;
+    SigIntId size;
     uint16_t filestore_cnt;
     uint8_t alversion;
     uint8_t flags;
@@ -124,6 +127,8 @@ typedef struct DetectEngineStateDirection_ {
 
 typedef struct DetectEngineState_ {
     DetectEngineStateDirection dir_state[2];
+    /** next free state while the state is in a pool */
+    struct DetectEngineState_ *next;
 } DetectEngineState;
 
 /**
@@ -136,10 +141,19 @@ DetectEngineState *DetectEngineStateAlloc(void);
 /**
  * \brief Frees a DetectEngineState object.
  *
+ *        The state is put on the free list of the calling thread, keeping
+ *        its item storage around for the next flow.
+ *
  * \param state DetectEngineState instance to free.
  */
 void DetectEngineStateFree(DetectEngineState *state);
 
+/**
+ * \brief Free all states in the global pool and on the free list of
+ *        the calling thread. Called at shutdown.
+ */
+void DetectEngineStatePoolCleanup(void);
+
 /**
  * \brief Check if a flow already contains(newly updated as well) de state.
  *
@@ -175,7 +175,7 @@ int ThresholdTimeoutCheck(Host *host, struct timeval *tv)
     return retval;
 }
 
-static inline DetectThresholdEntry *DetectThresholdEntryAlloc(DetectThresholdData *td, Packet *p, uint32_t sid, uint32_t gid) {
+static inline DetectThresholdEntry *DetectThresholdEntryAlloc(DetectThresholdData *td, Packet *p, uint32_t sid, uint32_t gid, uint32_t tenant_id) {
     SCEnter();
 
     DetectThresholdEntry *ste = SCMalloc(sizeof(DetectThresholdEntry));
@@ -185,6 +185,7 @@ static inline DetectThresholdEntry *DetectThresholdEntryAlloc(DetectThresholdDat
 
     ste->sid = sid;
     ste->gid = gid;
+    ste->tenant_id = tenant_id;
 
     ste->track = td->track;
     ste->seconds = td->seconds;
@@ -193,12 +194,15 @@ static inline DetectThresholdEntry *DetectThresholdEntryAlloc(DetectThresholdDat
     SCReturnPtr(ste, "DetectThresholdEntry");
 }
 
-static DetectThresholdEntry *ThresholdHostLookupEntry(Host *h, uint32_t sid, uint32_t gid)
+static DetectThresholdEntry *ThresholdHostLookupEntry(Host *h, uint32_t sid, uint32_t gid,
+                                                      uint32_t tenant_id)
 {
     DetectThresholdEntry *e;
 
+    /* tenants can use the same sids for different rules, so their
+     * entries on a host are kept apart */
     for (e = HostGetStorageById(h, threshold_id); e != NULL; e = e->next) {
-        if (e->sid == sid && e->gid == gid)
+        if (e->sid == sid && e->gid == gid && e->tenant_id == tenant_id)
             break;
     }
 
@@ -210,11 +214,12 @@ static DetectThresholdEntry *ThresholdHostLookupEntry(Host *h, uint32_t sid, uin
  *  \retval 1 normal match
  *  \retval 0 no match
  */
-int ThresholdHandlePacketHost(Host *h, Packet *p, DetectThresholdData *td, uint32_t sid, uint32_t gid) {
+int ThresholdHandlePacketHost(Host *h, Packet *p, DetectThresholdData *td, uint32_t sid, uint32_t gid,
+                              uint32_t tenant_id) {
     int ret = 0;
 
-    DetectThresholdEntry *lookup_tsh = ThresholdHostLookupEntry(h, sid, gid);
-    SCLogDebug("lookup_tsh %p sid %u gid %u", lookup_tsh, sid, gid);
+    DetectThresholdEntry *lookup_tsh = ThresholdHostLookupEntry(h, sid, gid, tenant_id);
+    SCLogDebug("lookup_tsh %p sid %u gid %u tenant %u", lookup_tsh, sid, gid, tenant_id);
 
     switch(td->type)   {
         case TYPE_LIMIT:
@@ -237,7 +242,7 @@ int ThresholdHandlePacketHost(Host *h, Packet *p, DetectThresholdData *td, uint3
                     ret = 1;
                 }
             } else {
-                DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid);
+                DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid, tenant_id);
                 if (e == NULL) {
                     break;
                 }
@@ -272,7 +277,7 @@ int ThresholdHandlePacketHost(Host *h, Packet *p, DetectThresholdData *td, uint3
                 if (td->count == 1)  {
                     ret = 1;
                 } else {
-                    DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid);
+                    DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid, tenant_id);
                     if (e == NULL) {
                         break;
                     }
@@ -312,7 +317,7 @@ int ThresholdHandlePacketHost(Host *h, Packet *p, DetectThresholdData *td, uint3
                     }
                 }
             } else {
-                DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid);
+                DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid, tenant_id);
                 if (e == NULL) {
                     break;
                 }
@@ -355,7 +360,7 @@ int ThresholdHandlePacketHost(Host *h, Packet *p, DetectThresholdData *td, uint3
                     lookup_tsh->current_count = 1;
                 }
             } else {
-                DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid);
+                DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid, tenant_id);
                 if (e == NULL) {
                     break;
                 }
@@ -444,7 +449,7 @@ int ThresholdHandlePacketHost(Host *h, Packet *p, DetectThresholdData *td, uint3
                     ret = 1;
                 }
 
-                DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid);
+                DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid, tenant_id);
                 if (e == NULL) {
                     break;
                 }
@@ -559,7 +564,7 @@ static int ThresholdHandlePacketRule(DetectEngineCtx *de_ctx, Packet *p, DetectT
             ret = 1;
         }
 
-        DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, s->id, s->gid);
+        DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, s->id, s->gid, de_ctx->tenant_id);
         if (e != NULL) {
             e->current_count = 1;
             e->tv_sec1 = p->ts.tv_sec;
@@ -597,13 +602,13 @@ int PacketAlertThreshold(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
     if (td->track == TRACK_SRC) {
         Host *src = HostGetHostFromHash(&p->src);
         if (src) {
-            ret = ThresholdHandlePacketHost(src,p,td,s->id,s->gid);
+            ret = ThresholdHandlePacketHost(src,p,td,s->id,s->gid,de_ctx->tenant_id);
             HostRelease(src);
         }
     } else if (td->track == TRACK_DST) {
         Host *dst = HostGetHostFromHash(&p->dst);
         if (dst) {
-            ret = ThresholdHandlePacketHost(dst,p,td,s->id,s->gid);
+            ret = ThresholdHandlePacketHost(dst,p,td,s->id,s->gid,de_ctx->tenant_id);
             HostRelease(dst);
         }
     } else if (td->track == TRACK_RULE) {
@@ -72,6 +72,8 @@
 #include "util-error.h"
 #include "util-hash.h"
 #include "util-byte.h"
+#include "util-cpu.h"
+#include "util-mpm-ac.h"
 #include "util-debug.h"
 #include "util-unittest.h"
 #include "util-action.h"
@@ -79,6 +81,7 @@
 #include "util-signal.h"
 
 #include "util-var-name.h"
+#include "util-device.h"
 
 #include "tm-threads.h"
 #include "runmodes.h"
@@ -390,6 +393,112 @@ void DetectEngineRegisterAppInspectionEngine(uint16_t alproto,
     return;
 }
 
+typedef struct DetectEngineSigId_ {
+    uint32_t gid;
+    uint32_t id;
+    uint32_t rev;
+} DetectEngineSigId;
+
+static int DetectEngineSigIdCmp(const void *a, const void *b)
+{
+    const DetectEngineSigId *sa = a, *sb = b;
+
+    if (sa->gid != sb->gid)
+        return sa->gid < sb->gid ? -1 : 1;
+    if (sa->id != sb->id)
+        return sa->id < sb->id ? -1 : 1;
+    return 0;
+}
+
+/**
+ *  \internal
+ *  \brief get the gid/sid/rev of all rules, sorted on gid/sid
+ */
+static DetectEngineSigId *DetectEngineGetSigIds(DetectEngineCtx *de_ctx,
+        uint32_t *cnt)
+{
+    DetectEngineSigId *ids;
+    Signature *s;
+    uint32_t n = 0;
+
+    for (s = de_ctx->sig_list; s != NULL; s = s->next)
+        n++;
+
+    ids = SCMalloc((n ? n : 1) * sizeof(DetectEngineSigId));
+    if (unlikely(ids == NULL))
+        return NULL;
+
+    n = 0;
+    for (s = de_ctx->sig_list; s != NULL; s = s->next) {
+        ids[n].gid = s->gid;
+        ids[n].id = s->id;
+        ids[n].rev = s->rev;
+        n++;
+    }
+    qsort(ids, n, sizeof(DetectEngineSigId), DetectEngineSigIdCmp);
+
+    *cnt = n;
+    return ids;
+}
+
+/**
+ *  \brief compare the rules of two detection engines on gid/sid/rev
+ *
+ *  \param old_de_ctx the running engine
+ *  \param new_de_ctx the engine loaded by the reload
+ *  \param diff filled with the number of added, removed, changed (same
+ *              gid/sid, other rev) and unchanged rules
+ *
+ *  \retval 0 ok, -1 on memory error
+ */
+int DetectEngineCompareSigs(DetectEngineCtx *old_de_ctx,
+        DetectEngineCtx *new_de_ctx, DetectEngineSigDiff *diff)
+{
+    uint32_t old_cnt = 0, new_cnt = 0;
+    uint32_t o = 0, n = 0;
+
+    memset(diff, 0, sizeof(*diff));
+
+    DetectEngineSigId *old_ids = DetectEngineGetSigIds(old_de_ctx, &old_cnt);
+    DetectEngineSigId *new_ids = DetectEngineGetSigIds(new_de_ctx, &new_cnt);
+    if (old_ids == NULL || new_ids == NULL) {
+        if (old_ids != NULL)
+            SCFree(old_ids);
+        if (new_ids != NULL)
+            SCFree(new_ids);
+        return -1;
+    }
+
+    while (o < old_cnt || n < new_cnt) {
+        int r;
+        if (o == old_cnt)
+            r = 1;
+        else if (n == new_cnt)
+            r = -1;
+        else
+            r = DetectEngineSigIdCmp(&old_ids[o], &new_ids[n]);
+
+        if (r < 0) {
+            diff->removed++;
+            o++;
+        } else if (r > 0) {
+            diff->added++;
+            n++;
+        } else {
+            if (old_ids[o].rev != new_ids[n].rev)
+                diff->changed++;
+            else
+                diff->unchanged++;
+            o++;
+            n++;
+        }
+    }
+
+    SCFree(old_ids);
+    SCFree(new_ids);
+    return 0;
+}
+
 static void *DetectEngineLiveRuleSwap(void *arg)
 {
     SCEnter();
@@ -398,6 +507,7 @@ static void *DetectEngineLiveRuleSwap(void *arg)
     int no_of_detect_tvs = 0;
     DetectEngineCtx *old_de_ctx = NULL;
     ThreadVars *tv = NULL;
+    uint32_t mpm_built = 0, mpm_reused = 0;
 
     if (SCSetThreadName("LiveRuleSwap") < 0) {
         SCLogWarning(SC_ERR_THREAD_INIT, "Unable to set thread name");
@@ -481,12 +591,19 @@ static void *DetectEngineLiveRuleSwap(void *arg)
 
     SCMutexUnlock(&tv_root_lock);
 
+    /* the running engine, for the reload report. It stays around until
+     * the new engine is swapped in, so mpm ctxs of the new engine that
+     * have the same patterns share its state tables. */
+    DetectEngineCtx *cur_de_ctx = DetectEngineGetGlobalDeCtx();
+    SCACSharedTableStats(&mpm_built, &mpm_reused);
+
     DetectEngineCtx *de_ctx = DetectEngineCtxInit();
     if (de_ctx == NULL) {
         SCLogError(SC_ERR_LIVE_RULE_SWAP, "Allocation failure in live "
                    "swap.  Let's get out of here.");
         goto error;
     }
+    de_ctx->reload_base = cur_de_ctx;
 
     SCClassConfLoadClassficationConfigFile(de_ctx);
     SCRConfLoadReferenceConfigFile(de_ctx);
@@ -509,6 +626,33 @@ static void *DetectEngineLiveRuleSwap(void *arg)
     }
 
     SCThresholdConfInitContext(de_ctx, NULL);
+    de_ctx->reload_base = NULL;
+
+    if (DetectEngineMultiTenantSetup(de_ctx, cur_de_ctx) < 0) {
+        if (de_ctx->failure_fatal)
+            exit(EXIT_FAILURE);
+        DetectEngineCtxFree(de_ctx);
+        SCLogError(SC_ERR_LIVE_RULE_SWAP, "Failure encountered while "
+                   "loading tenant engines with live swap.");
+        SCLogError(SC_ERR_LIVE_RULE_SWAP, "rule reload failed");
+        TmThreadsSetFlag(tv_local, THV_CLOSED);
+        UtilSignalHandlerSetup(SIGUSR2, SignalHandlerSigusr2);
+        pthread_exit(NULL);
+    }
+
+    if (cur_de_ctx != NULL) {
+        DetectEngineSigDiff diff;
+        if (DetectEngineCompareSigs(cur_de_ctx, de_ctx, &diff) == 0) {
+            SCLogInfo("rule reload: %"PRIu32" rules added, %"PRIu32" removed, "
+                      "%"PRIu32" changed, %"PRIu32" unchanged", diff.added,
+                      diff.removed, diff.changed, diff.unchanged);
+        }
+    }
+    SCACSharedTableStats(&mpm_built, &mpm_reused);
+    if (mpm_built + mpm_reused > 0) {
+        SCLogInfo("rule reload: %"PRIu32" mpm state tables built, %"PRIu32
+                  " shared with the running engine", mpm_built, mpm_reused);
+    }
 
     /* start the process of swapping detect threads ctxs */
 
@@ -736,6 +880,346 @@ DetectEngineCtx *DetectEngineGetGlobalDeCtx(void)
     return NULL;
 }
 
+/**
+ *  \brief Get a config node for a detection engine. Tenant engines look
+ *         the name up under their own config prefix.
+ *
+ *  \param de_ctx detection engine, may be NULL for the global config
+ *  \param name config name, e.g. "rule-files"
+ *
+ *  \retval node or NULL if not set
+ */
+ConfNode *DetectEngineConfGetNode(const DetectEngineCtx *de_ctx, const char *name)
+{
+    char key[128];
+
+    if (de_ctx == NULL || de_ctx->config_prefix[0] == '\0')
+        return ConfGetNode((char *)name);
+
+    snprintf(key, sizeof(key), "%s.%s", de_ctx->config_prefix, name);
+    return ConfGetNode(key);
+}
+
+/**
+ *  \brief Get a config value for a detection engine, see
+ *         DetectEngineConfGetNode().
+ *
+ *  \retval 1 value found and set in vptr
+ *  \retval 0 not found
+ */
+int DetectEngineConfGet(const DetectEngineCtx *de_ctx, const char *name, char **vptr)
+{
+    ConfNode *node = DetectEngineConfGetNode(de_ctx, name);
+    if (node == NULL || node->val == NULL)
+        return 0;
+
+    *vptr = node->val;
+    return 1;
+}
+
+/**
+ *  \internal
+ *  \brief Find a tenant engine by tenant id.
+ *
+ *  \retval idx index in de_ctx->tenant_array + 1, 0 if not found
+ */
+static uint32_t DetectEngineTenantLookup(const DetectEngineCtx *de_ctx, uint32_t tenant_id)
+{
+    uint32_t i;
+
+    for (i = 0; i < de_ctx->tenant_array_cnt; i++) {
+        if (de_ctx->tenant_array[i]->tenant_id == tenant_id)
+            return i + 1;
+    }
+    return 0;
+}
+
+/**
+ *  \internal
+ *  \brief Load a tenant's rules and thresholds into a new engine.
+ *
+ *  \param prefix config prefix holding the tenant's settings
+ *  \param base_de_ctx running engine of the same tenant on a rule reload,
+ *                     or NULL
+ */
+static DetectEngineCtx *DetectEngineTenantLoad(uint32_t tenant_id, const char *prefix,
+                                               DetectEngineCtx *base_de_ctx)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL)
+        return NULL;
+
+    de_ctx->tenant_id = tenant_id;
+    strlcpy(de_ctx->config_prefix, prefix, sizeof(de_ctx->config_prefix));
+
+    if (DetectEngineConfGetNode(de_ctx, "rule-files") == NULL) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "multi-detect: tenant %"PRIu32
+                   " has no rule-files", tenant_id);
+        goto error;
+    }
+
+    de_ctx->reload_base = base_de_ctx;
+
+    SCClassConfLoadClassficationConfigFile(de_ctx);
+    SCRConfLoadReferenceConfigFile(de_ctx);
+
+    if (SigLoadSignatures(de_ctx, NULL, FALSE) < 0) {
+        SCLogError(SC_ERR_NO_RULES_LOADED, "multi-detect: loading signatures "
+                   "for tenant %"PRIu32" failed", tenant_id);
+        goto error;
+    }
+
+    SCThresholdConfInitContext(de_ctx, NULL);
+    de_ctx->reload_base = NULL;
+    return de_ctx;
+
+error:
+    DetectEngineCtxFree(de_ctx);
+    return NULL;
+}
+
+/**
+ *  \brief Load the tenant engines and the packet to tenant mappings from
+ *         the "multi-detect" config into the default engine.
+ *
+ *  Packets that don't map to a tenant are inspected by the default engine.
+ *
+ *  \param de_ctx the default engine, its rules should be loaded already
+ *  \param base_de_ctx on a rule reload the running default engine, its
+ *                     tenants are used as reload base for the new ones
+ *
+ *  \retval 0 ok, or multi-detect not enabled
+ *  \retval -1 error
+ */
+int DetectEngineMultiTenantSetup(DetectEngineCtx *de_ctx, DetectEngineCtx *base_de_ctx)
+{
+    int enabled = 0;
+    char *selector = NULL;
+    ConfNode *tenants = NULL;
+    ConfNode *mappings = NULL;
+    ConfNode *node = NULL;
+    uint32_t cnt = 0;
+
+    if (ConfGetBool("multi-detect.enabled", &enabled) != 1 || enabled == 0)
+        return 0;
+
+    if (ConfGet("multi-detect.selector", &selector) != 1 || selector == NULL) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "multi-detect: no selector set");
+        return -1;
+    }
+    if (strcmp(selector, "vlan") == 0) {
+        de_ctx->tenant_selector = TENANT_SELECTOR_VLAN;
+    } else if (strcmp(selector, "interface") == 0) {
+        de_ctx->tenant_selector = TENANT_SELECTOR_INTERFACE;
+    } else {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "multi-detect: unknown "
+                   "selector \"%s\", use \"vlan\" or \"interface\"", selector);
+        return -1;
+    }
+
+    tenants = ConfGetNode("multi-detect.tenants");
+    if (tenants != NULL) {
+        TAILQ_FOREACH(node, &tenants->head, next) {
+            cnt++;
+        }
+    }
+    if (cnt == 0) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "multi-detect: no tenants");
+        return -1;
+    }
+
+    de_ctx->tenant_array = SCMalloc(cnt * sizeof(DetectEngineCtx *));
+    if (unlikely(de_ctx->tenant_array == NULL))
+        return -1;
+    memset(de_ctx->tenant_array, 0, cnt * sizeof(DetectEngineCtx *));
+
+    TAILQ_FOREACH(node, &tenants->head, next) {
+        intmax_t tenant_id = 0;
+        char prefix[64];
+
+        if (ConfGetChildValueInt(node, "id", &tenant_id) != 1 ||
+            tenant_id <= 0 || tenant_id > UINT32_MAX) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "multi-detect: tenant "
+                       "without a valid id");
+            return -1;
+        }
+        if (DetectEngineTenantLookup(de_ctx, (uint32_t)tenant_id) != 0) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "multi-detect: duplicate "
+                       "tenant id %"PRIdMAX, tenant_id);
+            return -1;
+        }
+
+        DetectEngineCtx *base = NULL;
+        if (base_de_ctx != NULL) {
+            uint32_t idx = DetectEngineTenantLookup(base_de_ctx, (uint32_t)tenant_id);
+            if (idx > 0)
+                base = base_de_ctx->tenant_array[idx - 1];
+        }
+
+        snprintf(prefix, sizeof(prefix), "multi-detect.tenants.%s", node->name);
+        SCLogInfo("multi-detect: loading tenant %"PRIdMAX, tenant_id);
+
+        DetectEngineCtx *tenant = DetectEngineTenantLoad((uint32_t)tenant_id,
+                                                         prefix, base);
+        if (tenant == NULL)
+            return -1;
+        de_ctx->tenant_array[de_ctx->tenant_array_cnt++] = tenant;
+    }
+
+    if (de_ctx->tenant_selector == TENANT_SELECTOR_VLAN) {
+        de_ctx->tenant_vlan_map = SCMalloc(4096 * sizeof(uint16_t));
+        if (unlikely(de_ctx->tenant_vlan_map == NULL))
+            return -1;
+        memset(de_ctx->tenant_vlan_map, 0, 4096 * sizeof(uint16_t));
+    }
+
+    cnt = 0;
+    mappings = ConfGetNode("multi-detect.mappings");
+    if (mappings != NULL) {
+        TAILQ_FOREACH(node, &mappings->head, next) {
+            cnt++;
+        }
+    }
+    if (cnt > 0 && de_ctx->tenant_selector == TENANT_SELECTOR_INTERFACE) {
+        de_ctx->tenant_iface_map = SCMalloc(cnt * sizeof(DetectEngineTenantIface));
+        if (unlikely(de_ctx->tenant_iface_map == NULL))
+            return -1;
+        memset(de_ctx->tenant_iface_map, 0, cnt * sizeof(DetectEngineTenantIface));
+    }
+
+    if (mappings != NULL) {
+        TAILQ_FOREACH(node, &mappings->head, next) {
+            intmax_t tenant_id = 0;
+
+            if (ConfGetChildValueInt(node, "tenant-id", &tenant_id) != 1 ||
+                tenant_id <= 0 || tenant_id > UINT32_MAX) {
+                SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "multi-detect: "
+                           "mapping without a valid tenant-id");
+                return -1;
+            }
+            uint32_t idx = DetectEngineTenantLookup(de_ctx, (uint32_t)tenant_id);
+            if (idx == 0) {
+                SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "multi-detect: "
+                           "mapping to unknown tenant %"PRIdMAX, tenant_id);
+                return -1;
+            }
+
+            if (de_ctx->tenant_selector == TENANT_SELECTOR_VLAN) {
+                intmax_t vlan_id = 0;
+                if (ConfGetChildValueInt(node, "vlan-id", &vlan_id) != 1 ||
+                    vlan_id < 0 || vlan_id > 4095) {
+                    SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "multi-detect: "
+                               "mapping without a valid vlan-id");
+                    return -1;
+                }
+                de_ctx->tenant_vlan_map[vlan_id] = (uint16_t)idx;
+            } else {
+                char *iface = NULL;
+                if (ConfGetChildValue(node, "interface", &iface) != 1 ||
+                    iface == NULL) {
+                    SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "multi-detect: "
+                               "mapping without an interface");
+                    return -1;
+                }
+                DetectEngineTenantIface *map =
+                    &de_ctx->tenant_iface_map[de_ctx->tenant_iface_map_cnt];
+                map->iface = SCStrdup(iface);
+                if (unlikely(map->iface == NULL))
+                    return -1;
+                map->idx = idx;
+                de_ctx->tenant_iface_map_cnt++;
+            }
+        }
+    }
+
+    SCLogInfo("multi-detect: %"PRIu32" tenant engines loaded, selecting on %s",
+              de_ctx->tenant_array_cnt, selector);
+    return 0;
+}
+
+/**
+ *  \internal
+ *  \brief Free the tenant engines and mappings of a default engine.
+ */
+static void DetectEngineMultiTenantFree(DetectEngineCtx *de_ctx)
+{
+    uint32_t i;
+
+    if (de_ctx->tenant_array != NULL) {
+        for (i = 0; i < de_ctx->tenant_array_cnt; i++)
+            DetectEngineCtxFree(de_ctx->tenant_array[i]);
+        SCFree(de_ctx->tenant_array);
+        de_ctx->tenant_array = NULL;
+    }
+    de_ctx->tenant_array_cnt = 0;
+
+    if (de_ctx->tenant_vlan_map != NULL) {
+        SCFree(de_ctx->tenant_vlan_map);
+        de_ctx->tenant_vlan_map = NULL;
+    }
+
+    if (de_ctx->tenant_iface_map != NULL) {
+        for (i = 0; i < de_ctx->tenant_iface_map_cnt; i++)
+            SCFree(de_ctx->tenant_iface_map[i].iface);
+        SCFree(de_ctx->tenant_iface_map);
+        de_ctx->tenant_iface_map = NULL;
+    }
+    de_ctx->tenant_iface_map_cnt = 0;
+}
+
+/**
+ *  \brief Get the thread ctx of the engine that should inspect a packet.
+ *
+ *  Packets of a flow are mapped using the vlan id and interface of the
+ *  flow, so that pseudo packets go to the same engine.
+ *
+ *  \param det_ctx thread ctx of the default engine
+ *
+ *  \retval det_ctx of the tenant, or the default engine's if the packet
+ *          doesn't map to a tenant
+ */
+DetectEngineThreadCtx *DetectEngineGetTenantThreadCtx(DetectEngineThreadCtx *det_ctx,
+                                                      const Packet *p)
+{
+    const DetectEngineCtx *de_ctx = det_ctx->de_ctx;
+    uint32_t idx = 0;
+    uint32_t i;
+
+    switch (de_ctx->tenant_selector) {
+        case TENANT_SELECTOR_VLAN:
+        {
+            uint16_t vlan_id = p->flow ? p->flow->vlan_id[0] : p->vlan_id[0];
+            idx = de_ctx->tenant_vlan_map[vlan_id & 0x0fff];
+            break;
+        }
+        case TENANT_SELECTOR_INTERFACE:
+        {
+            struct LiveDevice_ *dev = p->flow ? p->flow->livedev : p->livedev;
+            if (dev == NULL)
+                break;
+
+            if (dev != det_ctx->tenant_last_dev) {
+                det_ctx->tenant_last_idx = 0;
+                for (i = 0; i < de_ctx->tenant_iface_map_cnt; i++) {
+                    if (strcmp(de_ctx->tenant_iface_map[i].iface, dev->dev) == 0) {
+                        det_ctx->tenant_last_idx = de_ctx->tenant_iface_map[i].idx;
+                        break;
+                    }
+                }
+                det_ctx->tenant_last_dev = dev;
+            }
+            idx = det_ctx->tenant_last_idx;
+            break;
+        }
+        default:
+            break;
+    }
+
+    if (idx == 0 || idx > det_ctx->tenant_det_ctxs_cnt)
+        return det_ctx;
+    return det_ctx->tenant_det_ctxs[idx - 1];
+}
+
 DetectEngineCtx *DetectEngineCtxInit(void) {
     DetectEngineCtx *de_ctx;
 
@@ -792,6 +1276,7 @@ DetectEngineCtx *DetectEngineCtxInit(void) {
 
     SigGroupHeadHashInit(de_ctx);
     SigGroupHeadMpmHashInit(de_ctx);
+    MpmCtxShareHashInit(de_ctx);
     SigGroupHeadMpmUriHashInit(de_ctx);
     SigGroupHeadSPortHashInit(de_ctx);
     SigGroupHeadDPortHashInit(de_ctx);
@@ -850,9 +1335,12 @@ void DetectEngineCtxFree(DetectEngineCtx *de_ctx) {
      * to be sure look at them again here.
      */
     MpmPatternIdTableFreeHash(de_ctx->mpm_pattern_id_store); /* normally cleaned up in SigGroupBuild */
+    if (de_ctx->fp_id_buf != NULL)
+        SCFree(de_ctx->fp_id_buf);
 
     SigGroupHeadHashFree(de_ctx);
     SigGroupHeadMpmHashFree(de_ctx);
+    MpmCtxShareHashFree(de_ctx);
     SigGroupHeadMpmUriHashFree(de_ctx);
     SigGroupHeadSPortHashFree(de_ctx);
     SigGroupHeadDPortHashFree(de_ctx);
@@ -877,6 +1365,7 @@ void DetectEngineCtxFree(DetectEngineCtx *de_ctx) {
     }
 
     DetectEngineCtxFreeThreadKeywordData(de_ctx);
+    DetectEngineMultiTenantFree(de_ctx);
     SCFree(de_ctx);
     //DetectAddressGroupPrintMemory();
     //DetectSigGroupPrintMemory();
@@ -903,6 +1392,7 @@ static uint8_t DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx) {
     const char *max_uniq_toserver_dp_groups_str = NULL;
 
     char *sgh_mpm_context = NULL;
+    char *rule_load_threads = NULL;
 
     ConfNode *de_ctx_custom = ConfGetNode("detect-engine");
     ConfNode *opt = NULL;
@@ -913,6 +1403,8 @@ static uint8_t DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx) {
                 de_ctx_profile = opt->head.tqh_first->val;
             } else if (strcmp(opt->val, "sgh-mpm-context") == 0) {
                 sgh_mpm_context = opt->head.tqh_first->val;
+            } else if (strcmp(opt->val, "rule-load-threads") == 0) {
+                rule_load_threads = opt->head.tqh_first->val;
             }
         }
     }
@@ -974,6 +1466,18 @@ static uint8_t DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx) {
         de_ctx->sgh_mpm_context = ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL;
     }
 
+    /* detect-engine.rule-load-threads option parsing */
+    if (rule_load_threads == NULL || strcmp(rule_load_threads, "auto") == 0) {
+        de_ctx->rule_load_threads = UtilCpuGetNumProcessorsOnline();
+    } else if (ByteExtractStringUint16(&de_ctx->rule_load_threads, 10,
+                strlen(rule_load_threads), rule_load_threads) <= 0) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "You have supplied an "
+                   "invalid conf value for detect-engine.rule-load-threads-"
+                   "%s", rule_load_threads);
+        exit(EXIT_FAILURE);
+    }
+    SCLogDebug("de_ctx->rule_load_threads: %"PRIu16, de_ctx->rule_load_threads);
+
     opt = NULL;
     switch (profile) {
         case ENGINE_PROFILE_LOW:
@@ -1219,6 +1723,48 @@ static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *
     return TM_ECODE_OK;
 }
 
+/**
+ * \internal
+ * \brief Set up the thread ctxs of the tenant engines of the default
+ *        engine's thread ctx.
+ */
+static TmEcode DetectEngineThreadCtxInitTenants(ThreadVars *tv,
+                                                DetectEngineThreadCtx *det_ctx)
+{
+    DetectEngineCtx *de_ctx = det_ctx->de_ctx;
+    uint32_t i;
+
+    if (de_ctx->tenant_array_cnt == 0)
+        return TM_ECODE_OK;
+
+    det_ctx->tenant_det_ctxs = SCMalloc(de_ctx->tenant_array_cnt *
+                                        sizeof(DetectEngineThreadCtx *));
+    if (unlikely(det_ctx->tenant_det_ctxs == NULL))
+        return TM_ECODE_FAILED;
+    memset(det_ctx->tenant_det_ctxs, 0, de_ctx->tenant_array_cnt *
+           sizeof(DetectEngineThreadCtx *));
+
+    for (i = 0; i < de_ctx->tenant_array_cnt; i++) {
+        DetectEngineThreadCtx *tenant_det_ctx = SCMalloc(sizeof(DetectEngineThreadCtx));
+        if (unlikely(tenant_det_ctx == NULL))
+            return TM_ECODE_FAILED;
+        memset(tenant_det_ctx, 0, sizeof(DetectEngineThreadCtx));
+
+        tenant_det_ctx->tv = tv;
+        tenant_det_ctx->de_ctx = de_ctx->tenant_array[i];
+        det_ctx->tenant_det_ctxs[i] = tenant_det_ctx;
+        det_ctx->tenant_det_ctxs_cnt++;
+
+        if (ThreadCtxDoInit(tenant_det_ctx->de_ctx, tenant_det_ctx) != TM_ECODE_OK)
+            return TM_ECODE_FAILED;
+
+        /* alerts of all tenants go into the same counter */
+        tenant_det_ctx->counter_alerts = det_ctx->counter_alerts;
+    }
+
+    return TM_ECODE_OK;
+}
+
 /** \brief initialize thread specific detection engine context
  *
  *  \note there is a special case when using delayed detect. In this case the
@@ -1265,6 +1811,9 @@ TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data)
     /** alert counter setup */
     det_ctx->counter_alerts = counter_alerts;
 
+    if (DetectEngineThreadCtxInitTenants(tv, det_ctx) != TM_ECODE_OK)
+        return TM_ECODE_FAILED;
+
     /* pass thread data back to caller */
     *data = (void *)det_ctx;
 
@@ -1302,6 +1851,9 @@ static TmEcode DetectEngineThreadCtxInitForLiveRuleSwap(ThreadVars *tv, void *in
                                                       SC_PERF_TYPE_UINT64, "NULL");
     /* no counter creation here */
 
+    if (DetectEngineThreadCtxInitTenants(tv, det_ctx) != TM_ECODE_OK)
+        return TM_ECODE_FAILED;
+
     /* pass thread data back to caller */
     *data = (void *)det_ctx;
 
@@ -1361,6 +1913,13 @@ TmEcode DetectEngineThreadCtxDeinit(ThreadVars *tv, void *data) {
         SCFree(det_ctx->hcbd);
     }
 
+    if (det_ctx->tenant_det_ctxs != NULL) {
+        uint32_t t;
+        for (t = 0; t < det_ctx->tenant_det_ctxs_cnt; t++)
+            DetectEngineThreadCtxDeinit(tv, det_ctx->tenant_det_ctxs[t]);
+        SCFree(det_ctx->tenant_det_ctxs);
+    }
+
     DetectEngineThreadCtxDeinitKeywords(det_ctx->de_ctx, det_ctx);
     SCFree(det_ctx);
 
@@ -1975,6 +2534,289 @@ int DetectEngineTest07(void)
     return result;
 }
 
+/** \test rules of two engines compared on gid/sid/rev */
+static int DetectEngineTest08(void)
+{
+    DetectEngineCtx *de_ctx1 = DetectEngineCtxInit();
+    DetectEngineCtx *de_ctx2 = DetectEngineCtxInit();
+    DetectEngineSigDiff diff;
+    int result = 0;
+
+    if (de_ctx1 == NULL || de_ctx2 == NULL)
+        goto end;
+
+    if (DetectEngineAppendSig(de_ctx1, "alert tcp any any -> any any (content:\"a\"; sid:1; rev:1;)") == NULL ||
+        DetectEngineAppendSig(de_ctx1, "alert tcp any any -> any any (content:\"b\"; sid:2; rev:1;)") == NULL ||
+        DetectEngineAppendSig(de_ctx1, "alert tcp any any -> any any (content:\"c\"; sid:3; rev:1;)") == NULL ||
+        DetectEngineAppendSig(de_ctx1, "alert tcp any any -> any any (content:\"d\"; sid:4; rev:1;)") == NULL)
+        goto end;
+
+    /* sid 1 unchanged, 2 new rev, 3 removed, 4 same sid other gid, 5 new */
+    if (DetectEngineAppendSig(de_ctx2, "alert tcp any any -> any any (content:\"a\"; sid:1; rev:1;)") == NULL ||
+        DetectEngineAppendSig(de_ctx2, "alert tcp any any -> any any (content:\"bb\"; sid:2; rev:2;)") == NULL ||
+        DetectEngineAppendSig(de_ctx2, "alert tcp any any -> any any (content:\"d\"; gid:2; sid:4; rev:1;)") == NULL ||
+        DetectEngineAppendSig(de_ctx2, "alert tcp any any -> any any (content:\"e\"; sid:5; rev:1;)") == NULL)
+        goto end;
+
+    if (DetectEngineCompareSigs(de_ctx1, de_ctx2, &diff) != 0)
+        goto end;
+
+    if (diff.added != 2 || diff.removed != 2 || diff.changed != 1 ||
+        diff.unchanged != 1) {
+        printf("added %u removed %u changed %u unchanged %u: ", diff.added,
+               diff.removed, diff.changed, diff.unchanged);
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (de_ctx1 != NULL)
+        DetectEngineCtxFree(de_ctx1);
+    if (de_ctx2 != NULL)
+        DetectEngineCtxFree(de_ctx2);
+    return result;
+}
+
+/** \internal \brief fast pattern id of the rule with sid 'sid' */
+static int DetectEngineTestFPId(DetectEngineCtx *de_ctx, uint32_t sid)
+{
+    Signature *s;
+    for (s = de_ctx->sig_list; s != NULL; s = s->next) {
+        if (s->id == sid && s->mpm_sm != NULL)
+            return ((DetectContentData *)s->mpm_sm->ctx)->id;
+    }
+    return -1;
+}
+
+/** \test on a reload, fast patterns that are still used keep their id */
+static int DetectEngineTest09(void)
+{
+    DetectEngineCtx *de_ctx1 = DetectEngineCtxInit();
+    DetectEngineCtx *de_ctx2 = DetectEngineCtxInit();
+    int result = 0;
+
+    if (de_ctx1 == NULL || de_ctx2 == NULL)
+        goto end;
+
+    if (DetectEngineAppendSig(de_ctx1, "alert tcp any any -> any any (content:\"one\"; sid:1;)") == NULL ||
+        DetectEngineAppendSig(de_ctx1, "alert tcp any any -> any any (content:\"two\"; sid:2;)") == NULL ||
+        DetectEngineAppendSig(de_ctx1, "alert tcp any any -> any any (content:\"three\"; sid:3;)") == NULL)
+        goto end;
+    SigGroupBuild(de_ctx1);
+
+    de_ctx2->reload_base = de_ctx1;
+    if (DetectEngineAppendSig(de_ctx2, "alert tcp any any -> any any (content:\"new\"; sid:4;)") == NULL ||
+        DetectEngineAppendSig(de_ctx2, "alert tcp any any -> any any (content:\"three\"; sid:3;)") == NULL ||
+        DetectEngineAppendSig(de_ctx2, "alert tcp any any -> any any (content:\"one\"; sid:1;)") == NULL)
+        goto end;
+    SigGroupBuild(de_ctx2);
+    de_ctx2->reload_base = NULL;
+
+    if (DetectEngineTestFPId(de_ctx1, 1) != DetectEngineTestFPId(de_ctx2, 1) ||
+        DetectEngineTestFPId(de_ctx1, 3) != DetectEngineTestFPId(de_ctx2, 3)) {
+        printf("ids changed: ");
+        goto end;
+    }
+    if (DetectEngineTestFPId(de_ctx2, 4) != 3 || de_ctx2->max_fp_id != 4) {
+        printf("new pattern id %d, max %u: ", DetectEngineTestFPId(de_ctx2, 4),
+               de_ctx2->max_fp_id);
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (de_ctx1 != NULL) {
+        SigGroupCleanup(de_ctx1);
+        DetectEngineCtxFree(de_ctx1);
+    }
+    if (de_ctx2 != NULL) {
+        SigGroupCleanup(de_ctx2);
+        DetectEngineCtxFree(de_ctx2);
+    }
+    return result;
+}
+
+/** \test tenant engines read their settings under their config prefix */
+static int DetectEngineTest10(void)
+{
+    char *conf =
+        "%YAML 1.1\n"
+        "---\n"
+        "default-rule-path: /etc/suricata/rules\n"
+        "multi-detect:\n"
+        "  enabled: yes\n"
+        "  tenants:\n"
+        "    - id: 1\n"
+        "      default-rule-path: /etc/suricata/tenant-1\n"
+        "      rule-files:\n"
+        "        - t1.rules\n"
+        "    - id: 2\n"
+        "      threshold-file: /etc/suricata/threshold-2.config\n";
+    DetectEngineCtx de_ctx, tenant1, tenant2;
+    char *path = NULL;
+    char *val = NULL;
+    int result = 0;
+
+    if (DetectEngineInitYamlConf(conf) == -1)
+        return 0;
+
+    memset(&de_ctx, 0, sizeof(de_ctx));
+    memset(&tenant1, 0, sizeof(tenant1));
+    memset(&tenant2, 0, sizeof(tenant2));
+    strlcpy(tenant1.config_prefix, "multi-detect.tenants.0", sizeof(tenant1.config_prefix));
+    strlcpy(tenant2.config_prefix, "multi-detect.tenants.1", sizeof(tenant2.config_prefix));
+
+    path = DetectLoadCompleteSigPath(&tenant1, "t1.rules");
+    if (path == NULL || strcmp(path, "/etc/suricata/tenant-1/t1.rules") != 0) {
+        printf("tenant 1 path %s: ", path ? path : "(null)");
+        goto end;
+    }
+    SCFree(path);
+
+    /* no default-rule-path of its own */
+    path = DetectLoadCompleteSigPath(&tenant2, "t2.rules");
+    if (path == NULL || strcmp(path, "/etc/suricata/rules/t2.rules") != 0) {
+        printf("tenant 2 path %s: ", path ? path : "(null)");
+        goto end;
+    }
+    SCFree(path);
+
+    path = DetectLoadCompleteSigPath(&de_ctx, "default.rules");
+    if (path == NULL || strcmp(path, "/etc/suricata/rules/default.rules") != 0) {
+        printf("default path %s: ", path ? path : "(null)");
+        goto end;
+    }
+    SCFree(path);
+    path = NULL;
+
+    if (DetectEngineConfGetNode(&tenant1, "rule-files") == NULL ||
+        DetectEngineConfGetNode(&tenant2, "rule-files") != NULL ||
+        DetectEngineConfGetNode(&de_ctx, "rule-files") != NULL) {
+        printf("rule-files lookup: ");
+        goto end;
+    }
+
+    if (DetectEngineConfGet(&tenant2, "threshold-file", &val) != 1 ||
+        strcmp(val, "/etc/suricata/threshold-2.config") != 0 ||
+        DetectEngineConfGet(&tenant1, "threshold-file", &val) != 0) {
+        printf("threshold-file lookup: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (path != NULL)
+        SCFree(path);
+    DetectEngineDeInitYamlConf();
+    return result;
+}
+
+/** \test packets are mapped to tenant engines by vlan and interface, flow
+ *        packets by the vlan and interface of the flow */
+static int DetectEngineTest11(void)
+{
+    DetectEngineCtx de_ctx, tenant1, tenant2;
+    DetectEngineCtx *tenants[2] = { &tenant1, &tenant2 };
+    DetectEngineThreadCtx det_ctx, tenant1_det_ctx, tenant2_det_ctx;
+    DetectEngineThreadCtx *tenant_det_ctxs[2] = { &tenant1_det_ctx, &tenant2_det_ctx };
+    DetectEngineTenantIface iface_map[1];
+    LiveDevice eth0, eth1;
+    Flow f;
+    int result = 0;
+
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    if (unlikely(p == NULL))
+        return 0;
+    memset(p, 0, SIZE_OF_PACKET);
+
+    uint16_t *vlan_map = SCMalloc(4096 * sizeof(uint16_t));
+    if (unlikely(vlan_map == NULL)) {
+        SCFree(p);
+        return 0;
+    }
+    memset(vlan_map, 0, 4096 * sizeof(uint16_t));
+    vlan_map[1000] = 1;
+    vlan_map[2000] = 2;
+
+    memset(&de_ctx, 0, sizeof(de_ctx));
+    memset(&tenant1, 0, sizeof(tenant1));
+    memset(&tenant2, 0, sizeof(tenant2));
+    memset(&det_ctx, 0, sizeof(det_ctx));
+    memset(&tenant1_det_ctx, 0, sizeof(tenant1_det_ctx));
+    memset(&tenant2_det_ctx, 0, sizeof(tenant2_det_ctx));
+    memset(&eth0, 0, sizeof(eth0));
+    memset(&eth1, 0, sizeof(eth1));
+    memset(&f, 0, sizeof(f));
+
+    tenant1.tenant_id = 10;
+    tenant2.tenant_id = 20;
+    de_ctx.tenant_array = tenants;
+    de_ctx.tenant_array_cnt = 2;
+    de_ctx.tenant_selector = TENANT_SELECTOR_VLAN;
+    de_ctx.tenant_vlan_map = vlan_map;
+    det_ctx.de_ctx = &de_ctx;
+    det_ctx.tenant_det_ctxs = tenant_det_ctxs;
+    det_ctx.tenant_det_ctxs_cnt = 2;
+
+    p->vlan_id[0] = 2000;
+    p->vlan_idx = 1;
+    if (DetectEngineGetTenantThreadCtx(&det_ctx, p) != &tenant2_det_ctx) {
+        printf("vlan 2000 not tenant 2: ");
+        goto end;
+    }
+    p->vlan_id[0] = 5;
+    if (DetectEngineGetTenantThreadCtx(&det_ctx, p) != &det_ctx) {
+        printf("unmapped vlan not default: ");
+        goto end;
+    }
+    /* pseudo packets have no vlan, the flow has */
+    p->vlan_id[0] = 0;
+    p->vlan_idx = 0;
+    f.vlan_id[0] = 1000;
+    p->flow = &f;
+    if (DetectEngineGetTenantThreadCtx(&det_ctx, p) != &tenant1_det_ctx) {
+        printf("flow vlan 1000 not tenant 1: ");
+        goto end;
+    }
+    p->flow = NULL;
+
+    eth0.dev = "eth0";
+    eth1.dev = "eth1";
+    iface_map[0].iface = "eth1";
+    iface_map[0].idx = 1;
+    de_ctx.tenant_selector = TENANT_SELECTOR_INTERFACE;
+    de_ctx.tenant_iface_map = iface_map;
+    de_ctx.tenant_iface_map_cnt = 1;
+
+    p->livedev = &eth1;
+    if (DetectEngineGetTenantThreadCtx(&det_ctx, p) != &tenant1_det_ctx) {
+        printf("eth1 not tenant 1: ");
+        goto end;
+    }
+    /* again, from the cache */
+    if (DetectEngineGetTenantThreadCtx(&det_ctx, p) != &tenant1_det_ctx) {
+        printf("eth1 not tenant 1 (cached): ");
+        goto end;
+    }
+    p->livedev = &eth0;
+    if (DetectEngineGetTenantThreadCtx(&det_ctx, p) != &det_ctx) {
+        printf("eth0 not default: ");
+        goto end;
+    }
+    p->livedev = NULL;
+    f.livedev = &eth1;
+    p->flow = &f;
+    if (DetectEngineGetTenantThreadCtx(&det_ctx, p) != &tenant1_det_ctx) {
+        printf("flow on eth1 not tenant 1: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    SCFree(vlan_map);
+    SCFree(p);
+    return result;
+}
 #endif
 
 void DetectEngineRegisterTests()
@@ -1988,6 +2830,10 @@ void DetectEngineRegisterTests()
     UtRegisterTest("DetectEngineTest05", DetectEngineTest05, 1);
     UtRegisterTest("DetectEngineTest06", DetectEngineTest06, 1);
     UtRegisterTest("DetectEngineTest07", DetectEngineTest07, 1);
+    UtRegisterTest("DetectEngineTest08", DetectEngineTest08, 1);
+    UtRegisterTest("DetectEngineTest09", DetectEngineTest09, 1);
+    UtRegisterTest("DetectEngineTest10", DetectEngineTest10, 1);
+    UtRegisterTest("DetectEngineTest11", DetectEngineTest11, 1);
 #endif
 
     return;
@@ -26,6 +26,7 @@
 
 #include "detect.h"
 #include "tm-threads.h"
+#include "conf.h"
 
 typedef struct DetectEngineAppInspectionEngine_ {
     uint16_t alproto;
@@ -51,12 +52,26 @@ typedef struct DetectEngineAppInspectionEngine_ {
 
 extern DetectEngineAppInspectionEngine *app_inspection_engine[ALPROTO_MAX][2];
 
+/** result of comparing the rules of two engines */
+typedef struct DetectEngineSigDiff_ {
+    uint32_t added;
+    uint32_t removed;
+    /** same gid/sid, other rev */
+    uint32_t changed;
+    uint32_t unchanged;
+} DetectEngineSigDiff;
+
 /* prototypes */
 void DetectEngineRegisterAppInspectionEngines(void);
 void DetectEngineSpawnLiveRuleSwapMgmtThread(void);
 DetectEngineCtx *DetectEngineCtxInit(void);
 DetectEngineCtx *DetectEngineGetGlobalDeCtx(void);
 void DetectEngineCtxFree(DetectEngineCtx *);
+int DetectEngineCompareSigs(DetectEngineCtx *, DetectEngineCtx *, DetectEngineSigDiff *);
+ConfNode *DetectEngineConfGetNode(const DetectEngineCtx *, const char *);
+int DetectEngineConfGet(const DetectEngineCtx *, const char *, char **);
+int DetectEngineMultiTenantSetup(DetectEngineCtx *, DetectEngineCtx *);
+DetectEngineThreadCtx *DetectEngineGetTenantThreadCtx(DetectEngineThreadCtx *, const Packet *);
 
 TmEcode DetectEngineThreadCtxInit(ThreadVars *, void *, void **);
 TmEcode DetectEngineThreadCtxDeinit(ThreadVars *, void *);
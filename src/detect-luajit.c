@@ -597,7 +597,7 @@ static void DetectLuajitThreadFree(void *ctx) {
  * \retval luajit pointer to DetectLuajitData on success
  * \retval NULL on failure
  */
-static DetectLuajitData *DetectLuajitParse (char *str)
+static DetectLuajitData *DetectLuajitParse (const DetectEngineCtx *de_ctx, char *str)
 {
     DetectLuajitData *luajit = NULL;
 
@@ -614,7 +614,7 @@ static DetectLuajitData *DetectLuajitParse (char *str)
     }
 
     /* get full filename */
-    luajit->filename = DetectLoadCompleteSigPath(str);
+    luajit->filename = DetectLoadCompleteSigPath(de_ctx, str);
     if (luajit->filename == NULL) {
         goto error;
     }
@@ -848,7 +848,7 @@ static int DetectLuajitSetup (DetectEngineCtx *de_ctx, Signature *s, char *str)
     DetectLuajitData *luajit = NULL;
     SigMatch *sm = NULL;
 
-    luajit = DetectLuajitParse(str);
+    luajit = DetectLuajitParse(de_ctx, str);
     if (luajit == NULL)
         goto error;
 
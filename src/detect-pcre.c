@@ -264,15 +264,263 @@ int DetectPcrePayloadMatch(DetectEngineThreadCtx *det_ctx, Signature *s,
     SCReturnInt(ret);
 }
 
-DetectPcreData *DetectPcreParse (DetectEngineCtx *de_ctx, char *regexstr)
+/**
+ *  \brief compile and study a rule regex
+ *
+ *  Doesn't touch any global or engine state, so the rule loader can call
+ *  it from multiple threads.
+ *
+ *  \param re the regex
+ *  \param opts pcre compile options
+ *  \param compiled will hold the compiled regex
+ *  \param sd will hold the study data, may be NULL if pcre had nothing to add
+ *  \param eb error string
+ *  \param eo error offset
+ *
+ *  \retval 0 ok
+ *  \retval -1 compile failed
+ *  \retval -2 study failed, *compiled is set and needs to be freed
+ */
+static int DetectPcreCompile(const char *re, int opts, pcre **compiled,
+        pcre_extra **sd, const char **eb, int *eo)
 {
     int ec;
+
+    /* Try to compile as if all (...) groups had been meant as (?:...),
+     * which is the common case in most rules.
+     * If we fail because a capture group is later referenced (e.g., \1),
+     * PCRE will let us know.
+     */
+    *compiled = pcre_compile2(re, opts | PCRE_NO_AUTO_CAPTURE, &ec, eb, eo, NULL);
+    if (*compiled == NULL && ec == 15) { // reference to non-existent subpattern
+        *compiled = pcre_compile(re, opts, eb, eo, NULL);
+    }
+    if (*compiled == NULL)
+        return -1;
+
+#ifdef PCRE_HAVE_JIT
+    *sd = pcre_study(*compiled, PCRE_STUDY_JIT_COMPILE, eb);
+#else
+    *sd = pcre_study(*compiled, 0, eb);
+#endif /*PCRE_HAVE_JIT*/
+    if (*eb != NULL)
+        return -2;
+
+    return 0;
+}
+
+/**
+ *  \brief get the pcre compile options for a modifier, 0 for modifiers
+ *         that don't affect compilation
+ */
+static int DetectPcreModifierCompileOpt(char c)
+{
+    switch (c) {
+        case 'A':
+            return PCRE_ANCHORED;
+        case 'E':
+            return PCRE_DOLLAR_ENDONLY;
+        case 'G':
+            return PCRE_UNGREEDY;
+        case 'i':
+            return PCRE_CASELESS;
+        case 'm':
+            return PCRE_MULTILINE;
+        case 's':
+            return PCRE_DOTALL;
+        case 'x':
+            return PCRE_EXTENDED;
+    }
+    return 0;
+}
+
+/**
+ *  \brief compile the regex of a pcre keyword value
+ *
+ *  Only does the part of DetectPcreParse that is expensive and that
+ *  doesn't depend on the detection engine. Errors are not reported here,
+ *  DetectPcreParse will run into them again when the rule is parsed.
+ *
+ *  \retval pc precompiled regex or NULL
+ */
+static DetectPcrePrecompiled *DetectPcrePrecompileValue(const char *regexstr)
+{
+    int ov[MAX_SUBSTRINGS];
+    const char *str_ptr = NULL;
+    const char *op = NULL;
+    const char *eb = NULL;
+    int eo = 0;
+    int opts = 0;
+    int ret;
+
+    while (isspace((unsigned char)*regexstr))
+        regexstr++;
+    if (*regexstr == '!')
+        regexstr++;
+
+    ret = pcre_exec(parse_regex, parse_regex_study, regexstr, strlen(regexstr),
+                    0, 0, ov, MAX_SUBSTRINGS);
+    if (ret <= 0)
+        return NULL;
+
+    if (ret > 2) {
+        if (pcre_get_substring(regexstr, ov, MAX_SUBSTRINGS, 2, &op) < 0)
+            return NULL;
+        const char *o;
+        for (o = op; *o != '\0'; o++)
+            opts |= DetectPcreModifierCompileOpt(*o);
+        pcre_free_substring(op);
+    }
+
+    if (pcre_get_substring(regexstr, ov, MAX_SUBSTRINGS, 1, &str_ptr) < 0)
+        return NULL;
+
+    DetectPcrePrecompiled *pc = SCMalloc(sizeof(DetectPcrePrecompiled));
+    if (unlikely(pc == NULL))
+        goto error;
+    memset(pc, 0, sizeof(DetectPcrePrecompiled));
+
+    pc->re = SCStrdup(str_ptr);
+    if (unlikely(pc->re == NULL))
+        goto error;
+    pc->opts = opts;
+
+    if (DetectPcreCompile(pc->re, opts, &pc->compiled, &pc->sd, &eb, &eo) != 0)
+        goto error;
+
+    pcre_free_substring(str_ptr);
+    return pc;
+
+error:
+    pcre_free_substring(str_ptr);
+    DetectPcrePrecompiledFree(pc);
+    return NULL;
+}
+
+/**
+ *  \brief compile the regexes of all pcre keywords in a rule
+ *
+ *  Splits the options the same way the rule parser does: on ';' that are
+ *  not escaped. Thread safe, used by the rule loader threads.
+ *
+ *  \param sigstr the rule
+ *
+ *  \retval list of precompiled regexes in rule order, NULL if none
+ */
+DetectPcrePrecompiled *DetectPcrePrecompile(const char *sigstr)
+{
+    DetectPcrePrecompiled *head = NULL, *tail = NULL;
+    const char *p = strchr(sigstr, '(');
+
+    if (p == NULL)
+        return NULL;
+    p++;
+
+    while (*p != '\0') {
+        while (isspace((unsigned char)*p))
+            p++;
+
+        const char *name = p;
+        while (*p != '\0' && *p != ':' && *p != ';')
+            p++;
+        size_t name_len = p - name;
+        while (name_len > 0 && isspace((unsigned char)name[name_len - 1]))
+            name_len--;
+
+        const char *value = NULL;
+        size_t value_len = 0;
+        if (*p == ':') {
+            value = ++p;
+            while (*p != '\0' && !(*p == ';' && *(p - 1) != '\\'))
+                p++;
+            value_len = p - value;
+        }
+        if (*p == ';')
+            p++;
+
+        if (value == NULL || name_len != 4 || strncmp(name, "pcre", 4) != 0)
+            continue;
+
+        char *str = SCMalloc(value_len + 1);
+        if (unlikely(str == NULL))
+            break;
+        memcpy(str, value, value_len);
+        str[value_len] = '\0';
+
+        DetectPcrePrecompiled *pc = DetectPcrePrecompileValue(str);
+        SCFree(str);
+        if (pc == NULL)
+            continue;
+
+        if (tail == NULL)
+            head = pc;
+        else
+            tail->next = pc;
+        tail = pc;
+    }
+
+    return head;
+}
+
+void DetectPcrePrecompiledFree(DetectPcrePrecompiled *pc)
+{
+    while (pc != NULL) {
+        DetectPcrePrecompiled *next = pc->next;
+
+        if (pc->re != NULL)
+            SCFree(pc->re);
+        if (pc->compiled != NULL)
+            pcre_free(pc->compiled);
+        if (pc->sd != NULL)
+            pcre_free(pc->sd);
+        SCFree(pc);
+
+        pc = next;
+    }
+}
+
+/**
+ *  \brief take a regex compiled by the rule loader threads for the rule
+ *         that is being parsed
+ *
+ *  \retval 0 found, *compiled and *sd are now owned by the caller
+ *  \retval -1 not found
+ */
+static int DetectPcrePrecompiledGet(DetectEngineCtx *de_ctx, const char *re,
+        int opts, pcre **compiled, pcre_extra **sd)
+{
+    DetectPcrePrecompiled *pc, *prev = NULL;
+
+    if (de_ctx == NULL)
+        return -1;
+
+    for (pc = de_ctx->pcre_precompiled; pc != NULL; prev = pc, pc = pc->next) {
+        if (pc->opts != opts || strcmp(pc->re, re) != 0)
+            continue;
+
+        if (prev == NULL)
+            de_ctx->pcre_precompiled = pc->next;
+        else
+            prev->next = pc->next;
+
+        *compiled = pc->compiled;
+        *sd = pc->sd;
+        pc->compiled = NULL;
+        pc->sd = NULL;
+        pc->next = NULL;
+        DetectPcrePrecompiledFree(pc);
+        return 0;
+    }
+    return -1;
+}
+
+DetectPcreData *DetectPcreParse (DetectEngineCtx *de_ctx, char *regexstr)
+{
     const char *eb;
     int eo;
     int opts = 0;
     DetectPcreData *pd = NULL;
     char *re = NULL, *op_ptr = NULL, *op = NULL;
-#define MAX_SUBSTRINGS 30
     int ret = 0, res = 0;
     int ov[MAX_SUBSTRINGS];
 
@@ -503,27 +751,19 @@ DetectPcreData *DetectPcreParse (DetectEngineCtx *de_ctx, char *regexstr)
         }
     }
 
-    /* Try to compile as if all (...) groups had been meant as (?:...),
-     * which is the common case in most rules.
-     * If we fail because a capture group is later referenced (e.g., \1),
-     * PCRE will let us know.
-     */
-    pd->re = pcre_compile2(re, opts | PCRE_NO_AUTO_CAPTURE, &ec, &eb, &eo, NULL);
-    if (pd->re == NULL && ec == 15) { // reference to non-existent subpattern
-      pd->re = pcre_compile(re, opts, &eb, &eo, NULL);
-    }
-
-    if(pd->re == NULL)  {
-        SCLogError(SC_ERR_PCRE_COMPILE, "pcre compile of \"%s\" failed at offset %" PRId32 ": %s", regexstr, eo, eb);
-        goto error;
+    if (DetectPcrePrecompiledGet(de_ctx, re, opts, &pd->re, &pd->sd) == 0) {
+        SCLogDebug("using precompiled regex \"%s\"", re);
+    } else {
+        ret = DetectPcreCompile(re, opts, &pd->re, &pd->sd, &eb, &eo);
+        if (ret == -1) {
+            SCLogError(SC_ERR_PCRE_COMPILE, "pcre compile of \"%s\" failed at offset %" PRId32 ": %s", regexstr, eo, eb);
+            goto error;
+        } else if (ret == -2) {
+            SCLogError(SC_ERR_PCRE_STUDY, "pcre study failed : %s", eb);
+            goto error;
+        }
     }
 #ifdef PCRE_HAVE_JIT
-    pd->sd = pcre_study(pd->re, PCRE_STUDY_JIT_COMPILE, &eb);
-    if(eb != NULL)  {
-        SCLogError(SC_ERR_PCRE_STUDY, "pcre study failed : %s", eb);
-        goto error;
-    }
-
     int jit = 0;
     ret = pcre_fullinfo(pd->re, pd->sd, PCRE_INFO_JIT, &jit);
     if (ret != 0 || jit != 1) {
@@ -534,12 +774,6 @@ DetectPcreData *DetectPcreParse (DetectEngineCtx *de_ctx, char *regexstr)
                 "Falling back to regular PCRE handling (%s:%d)",
                 regexstr, de_ctx->rule_file, de_ctx->rule_line);
     }
-#else
-    pd->sd = pcre_study(pd->re, 0, &eb);
-    if(eb != NULL)  {
-        SCLogError(SC_ERR_PCRE_STUDY, "pcre study failed : %s", eb);
-        goto error;
-    }
 #endif /*PCRE_HAVE_JIT*/
 
     if(pd->sd == NULL)
@@ -3992,6 +4226,81 @@ end:
     return result;
 }
 
+/** \test regexes of a rule are precompiled in order, escaped ';' in other
+ *        options don't confuse the option splitting */
+static int DetectPcrePrecompileTest01(void)
+{
+    int result = 0;
+    DetectPcrePrecompiled *head = DetectPcrePrecompile("alert tcp any any -> "
+            "any any (msg:\"pcre:\\\"/x/\\\"\\;\"; content:\"a\\;b\"; "
+            "pcre:\"/one/i\"; pcre: !\"/tw[o]/smU\" ; pcre:\"/(/\"; "
+            "pcre:\"/three/\"; sid:1;)");
+    DetectPcrePrecompiled *pc = head;
+
+    if (pc == NULL || strcmp(pc->re, "one") != 0 ||
+            pc->opts != PCRE_CASELESS || pc->compiled == NULL) {
+        printf("first regex: ");
+        goto end;
+    }
+    pc = pc->next;
+    if (pc == NULL || strcmp(pc->re, "tw[o]") != 0 ||
+            pc->opts != (PCRE_DOTALL|PCRE_MULTILINE) || pc->compiled == NULL) {
+        printf("second regex: ");
+        goto end;
+    }
+    pc = pc->next;
+    if (pc == NULL || strcmp(pc->re, "three") != 0 || pc->opts != 0) {
+        printf("third regex: ");
+        goto end;
+    }
+    if (pc->next != NULL) {
+        printf("too many regexes: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    DetectPcrePrecompiledFree(head);
+    return result;
+}
+
+/** \test a precompiled regex is picked up by the parser */
+static int DetectPcrePrecompileTest02(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    DetectPcreData *pd = NULL;
+    int result = 0;
+
+    if (de_ctx == NULL)
+        return 0;
+
+    de_ctx->pcre_precompiled = DetectPcrePrecompile("alert tcp any any -> "
+            "any any (pcre:\"/abc/iR\"; pcre:\"/def/\"; sid:1;)");
+    if (de_ctx->pcre_precompiled == NULL)
+        goto end;
+    pcre *compiled = de_ctx->pcre_precompiled->compiled;
+
+    pd = DetectPcreParse(de_ctx, "/abc/iR");
+    if (pd == NULL || pd->re != compiled || pd->sd == NULL) {
+        printf("precompiled regex not used: ");
+        goto end;
+    }
+    if (de_ctx->pcre_precompiled == NULL ||
+            strcmp(de_ctx->pcre_precompiled->re, "def") != 0 ||
+            de_ctx->pcre_precompiled->next != NULL) {
+        printf("list not updated: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    DetectPcreFree(pd);
+    DetectPcrePrecompiledFree(de_ctx->pcre_precompiled);
+    de_ctx->pcre_precompiled = NULL;
+    DetectEngineCtxFree(de_ctx);
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 /**
@@ -4057,6 +4366,8 @@ void DetectPcreRegisterTests(void) {
     UtRegisterTest("DetectPcreFlowvarCapture01 -- capture for http_header", DetectPcreFlowvarCapture01, 1);
     UtRegisterTest("DetectPcreFlowvarCapture02 -- capture for http_header", DetectPcreFlowvarCapture02, 1);
     UtRegisterTest("DetectPcreFlowvarCapture03 -- capture for http_header", DetectPcreFlowvarCapture03, 1);
+    UtRegisterTest("DetectPcrePrecompileTest01", DetectPcrePrecompileTest01, 1);
+    UtRegisterTest("DetectPcrePrecompileTest02", DetectPcrePrecompileTest02, 1);
 
 #endif /* UNITTESTS */
 }
@@ -62,6 +62,15 @@ typedef struct DetectPcreData_ {
     char *capname;
 } DetectPcreData;
 
+/** regex compiled ahead of rule parsing by the rule loader threads */
+typedef struct DetectPcrePrecompiled_ {
+    char *re;
+    int opts;
+    pcre *compiled;
+    pcre_extra *sd;
+    struct DetectPcrePrecompiled_ *next;
+} DetectPcrePrecompiled;
+
 /* prototypes */
 int DetectPcrePayloadMatch(DetectEngineThreadCtx *, Signature *, SigMatch *, Packet *, Flow *, uint8_t *, uint32_t);
 int DetectPcrePacketPayloadMatch(DetectEngineThreadCtx *, Packet *, Signature *, SigMatch *);
@@ -69,5 +78,8 @@ int DetectPcrePayloadDoMatch(DetectEngineThreadCtx *, Signature *, SigMatch *,
                              Packet *, uint8_t *, uint16_t);
 void DetectPcreRegister (void);
 
+DetectPcrePrecompiled *DetectPcrePrecompile(const char *);
+void DetectPcrePrecompiledFree(DetectPcrePrecompiled *);
+
 #endif /* __DETECT_PCRE_H__ */
 
@@ -32,8 +32,13 @@
 
 /* Included into detect.c */
 
-#if defined(__SSE3__)
+#if defined(__SSE3__) || defined(DETECT_SIMD_AVX2)
+
+#ifdef DETECT_SIMD_AVX2
+#include <immintrin.h>
+#endif
 
+#if defined(__SSE3__)
 /**
  *  \brief SIMD implementation of mask prefiltering.
  *
@@ -44,8 +49,9 @@
  *  On 64 bit systems we inspect in 64 sig batches, creating a u64 with flags.
  *  The size of a register is leading here.
  */
-void SigMatchSignaturesBuildMatchArray(DetectEngineThreadCtx *det_ctx,
-                                       Packet *p, SignatureMask mask, uint16_t alproto)
+static void SigMatchSignaturesBuildMatchArraySSE3(DetectEngineThreadCtx *det_ctx,
+                                                  Packet *p, SignatureMask mask,
+                                                  uint16_t alproto)
 {
     uint32_t u;
     SigIntId x;
@@ -180,7 +186,168 @@ void SigMatchSignaturesBuildMatchArray(DetectEngineThreadCtx *det_ctx,
 #error Wordsize (__WORDSIZE) neither 32 or 64.
 #endif
 }
- /* end defined(__SSE3__) */
+
+#define SigMatchSignaturesBuildMatchArrayBase SigMatchSignaturesBuildMatchArraySSE3
+#define DETECT_SIMD_BASE_NAME "SSE3"
+
+#else /* !__SSE3__ */
+
+/**
+ *  \brief Scalar mask prefiltering over the mask_array, used when the
+ *         build isn't for SSE3 and the cpu has no AVX2.
+ */
+static void SigMatchSignaturesBuildMatchArrayScalar(DetectEngineThreadCtx *det_ctx,
+                                                    Packet *p, SignatureMask mask,
+                                                    uint16_t alproto)
+{
+    uint32_t u;
+    SignatureMask *mask_array = det_ctx->sgh->mask_array;
+
+    /* reset previous run */
+    det_ctx->match_array_cnt = 0;
+
+    for (u = 0; u < det_ctx->sgh->sig_cnt; u++) {
+        if ((mask & mask_array[u]) != mask_array[u])
+            continue;
+
+        SignatureHeader *s = &det_ctx->sgh->head_array[u];
+        if (SigMatchSignaturesBuildMatchArrayAddSignature(det_ctx, p, s, alproto) == 1) {
+            /* okay, store it */
+            det_ctx->match_array[det_ctx->match_array_cnt] = s->full_sig;
+            det_ctx->match_array_cnt++;
+        }
+    }
+}
+
+#define SigMatchSignaturesBuildMatchArrayBase SigMatchSignaturesBuildMatchArrayScalar
+#define DETECT_SIMD_BASE_NAME "scalar"
+
+#endif /* __SSE3__ */
+
+#ifdef DETECT_SIMD_AVX2
+/**
+ *  \brief Add the signatures of a 64 sig batch that passed the mask check
+ *         to the match array.
+ */
+static inline void SigMatchSignaturesBuildMatchArrayBatch(DetectEngineThreadCtx *det_ctx,
+        Packet *p, uint16_t alproto, uint32_t u, uint64_t bm)
+{
+    while (bm) {
+        uint32_t x = u + __builtin_ctzll(bm);
+        if (x >= det_ctx->sgh->sig_cnt)
+            break;
+        bm &= bm - 1;
+
+        SignatureHeader *s = &det_ctx->sgh->head_array[x];
+        if (SigMatchSignaturesBuildMatchArrayAddSignature(det_ctx, p, s, alproto) == 1) {
+            /* okay, store it */
+            det_ctx->match_array[det_ctx->match_array_cnt] = s->full_sig;
+            det_ctx->match_array_cnt++;
+        }
+    }
+}
+
+/**
+ *  \brief AVX2 implementation of mask prefiltering, 32 masks per vector.
+ */
+static __attribute__((target("avx2")))
+void SigMatchSignaturesBuildMatchArrayAVX2(DetectEngineThreadCtx *det_ctx,
+                                           Packet *p, SignatureMask mask,
+                                           uint16_t alproto)
+{
+    uint32_t u;
+    SignatureMask *mask_array = det_ctx->sgh->mask_array;
+    /* load the packet mask into each byte of the vector */
+    __m256i pm = _mm256_set1_epi8(mask);
+
+    /* reset previous run */
+    det_ctx->match_array_cnt = 0;
+
+    for (u = 0; u < det_ctx->sgh->sig_cnt; u += 64) {
+        /* a sig passes if mask & sig mask == sig mask */
+        __m256i sm = _mm256_loadu_si256((const __m256i *)&mask_array[u]);
+        uint64_t bm = (uint32_t)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(sm, _mm256_and_si256(pm, sm)));
+
+        sm = _mm256_loadu_si256((const __m256i *)&mask_array[u + 32]);
+        bm |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(sm, _mm256_and_si256(pm, sm))) << 32;
+
+        if (bm == 0)
+            continue;
+
+        SigMatchSignaturesBuildMatchArrayBatch(det_ctx, p, alproto, u, bm);
+    }
+}
+#endif /* DETECT_SIMD_AVX2 */
+
+#ifdef DETECT_SIMD_AVX512
+/**
+ *  \brief AVX-512 implementation of mask prefiltering, 64 masks per vector.
+ */
+static __attribute__((target("avx512bw")))
+void SigMatchSignaturesBuildMatchArrayAVX512(DetectEngineThreadCtx *det_ctx,
+                                             Packet *p, SignatureMask mask,
+                                             uint16_t alproto)
+{
+    uint32_t u;
+    SignatureMask *mask_array = det_ctx->sgh->mask_array;
+    /* load the packet mask into each byte of the vector */
+    __m512i pm = _mm512_set1_epi8(mask);
+
+    /* reset previous run */
+    det_ctx->match_array_cnt = 0;
+
+    for (u = 0; u < det_ctx->sgh->sig_cnt; u += 64) {
+        /* a sig passes if mask & sig mask == sig mask */
+        __m512i sm = _mm512_loadu_si512((const void *)&mask_array[u]);
+        uint64_t bm = _mm512_cmpeq_epi8_mask(sm, _mm512_and_si512(pm, sm));
+
+        if (bm == 0)
+            continue;
+
+        SigMatchSignaturesBuildMatchArrayBatch(det_ctx, p, alproto, u, bm);
+    }
+}
+#endif /* DETECT_SIMD_AVX512 */
+
+static void (*SigMatchSignaturesBuildMatchArrayFunc)(DetectEngineThreadCtx *,
+        Packet *, SignatureMask, uint16_t) = SigMatchSignaturesBuildMatchArrayBase;
+
+void SigMatchSignaturesBuildMatchArray(DetectEngineThreadCtx *det_ctx,
+                                       Packet *p, SignatureMask mask, uint16_t alproto)
+{
+    SigMatchSignaturesBuildMatchArrayFunc(det_ctx, p, mask, alproto);
+}
+
+/**
+ *  \brief Select the fastest mask prefilter the cpu supports.
+ */
+void SigMatchSignaturesBuildMatchArraySetup(void)
+{
+    static int logged = 0;
+    const char *name = DETECT_SIMD_BASE_NAME;
+
+    SigMatchSignaturesBuildMatchArrayFunc = SigMatchSignaturesBuildMatchArrayBase;
+#if defined(DETECT_SIMD_AVX2)
+    __builtin_cpu_init();
+#if defined(DETECT_SIMD_AVX512)
+    if (__builtin_cpu_supports("avx512bw")) {
+        SigMatchSignaturesBuildMatchArrayFunc = SigMatchSignaturesBuildMatchArrayAVX512;
+        name = "AVX-512";
+    } else
+#endif
+    if (__builtin_cpu_supports("avx2")) {
+        SigMatchSignaturesBuildMatchArrayFunc = SigMatchSignaturesBuildMatchArrayAVX2;
+        name = "AVX2";
+    }
+#endif
+    if (!logged) {
+        SCLogInfo("using %s signature mask prefilter", name);
+        logged = 1;
+    }
+}
+/* end defined(__SSE3__) || defined(DETECT_SIMD_AVX2) */
 #elif defined(__tile__)
 
 /**
@@ -241,6 +408,10 @@ void SigMatchSignaturesBuildMatchArray(DetectEngineThreadCtx *det_ctx,
     }
     det_ctx->match_array_cnt = match_count;
 }
+
+void SigMatchSignaturesBuildMatchArraySetup(void)
+{
+}
 #endif /* defined(__tile__) */
 
 
@@ -562,6 +733,105 @@ static int SigTestSIMDMask04(void)
     return 1;
 #endif
 }
+
+#if defined(__SSE3__) || defined(DETECT_SIMD_AVX2)
+static int SigTestSIMDMaskCheck(DetectEngineThreadCtx *det_ctx, Packet *p,
+        void (*Func)(DetectEngineThreadCtx *, Packet *, SignatureMask, uint16_t))
+{
+    SigGroupHead *sgh = det_ctx->sgh;
+    uint32_t m, x;
+
+    for (m = 0; m < 256; m++) {
+        uint32_t cnt = 0;
+
+        Func(det_ctx, p, (SignatureMask)m, ALPROTO_UNKNOWN);
+
+        for (x = 0; x < sgh->sig_cnt; x++) {
+            if ((m & sgh->mask_array[x]) != sgh->mask_array[x])
+                continue;
+            if (cnt >= det_ctx->match_array_cnt ||
+                det_ctx->match_array[cnt] != sgh->head_array[x].full_sig) {
+                printf("mask %02x: sig %u missing: ", m, x);
+                return 0;
+            }
+            cnt++;
+        }
+        if (cnt != det_ctx->match_array_cnt) {
+            printf("mask %02x: %u != %u: ", m, cnt, det_ctx->match_array_cnt);
+            return 0;
+        }
+    }
+    return 1;
+}
+#endif
+
+/**
+ *  \test all prefilter implementations the cpu supports give the same
+ *         result as a plain mask check, with a sig count that isn't a
+ *         multiple of the batch size.
+ */
+static int SigTestSIMDMask05(void)
+{
+#if defined(__SSE3__) || defined(DETECT_SIMD_AVX2)
+    int result = 0;
+    SigGroupHead sgh;
+    DetectEngineThreadCtx det_ctx;
+    uint32_t x, seed = 1;
+    const uint32_t sig_cnt = 200;
+
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    if (unlikely(p == NULL))
+        return 0;
+    memset(p, 0, SIZE_OF_PACKET);
+    memset(&sgh, 0, sizeof(sgh));
+    memset(&det_ctx, 0, sizeof(det_ctx));
+
+    sgh.sig_cnt = sig_cnt;
+    sgh.mask_array = SCMallocAligned(256 * sizeof(SignatureMask), 64);
+    sgh.head_array = SCMalloc(sig_cnt * sizeof(SignatureHeader));
+    det_ctx.match_array = SCMalloc(sig_cnt * sizeof(Signature *));
+    if (sgh.mask_array == NULL || sgh.head_array == NULL ||
+        det_ctx.match_array == NULL)
+        goto end;
+    memset(sgh.mask_array, 0, 256 * sizeof(SignatureMask));
+    memset(sgh.head_array, 0, sig_cnt * sizeof(SignatureHeader));
+    det_ctx.sgh = &sgh;
+
+    for (x = 0; x < sig_cnt; x++) {
+        seed = seed * 1103515245 + 12345;
+        /* sparse masks, so that most packet masks pass some sigs */
+        sgh.mask_array[x] = (seed >> 16) & (seed >> 24) & 0xff;
+        /* only used as a value */
+        sgh.head_array[x].full_sig = (Signature *)(uintptr_t)(x + 1);
+    }
+
+    if (!SigTestSIMDMaskCheck(&det_ctx, p, SigMatchSignaturesBuildMatchArrayBase))
+        goto end;
+#ifdef DETECT_SIMD_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") &&
+        !SigTestSIMDMaskCheck(&det_ctx, p, SigMatchSignaturesBuildMatchArrayAVX2))
+        goto end;
+#endif
+#ifdef DETECT_SIMD_AVX512
+    if (__builtin_cpu_supports("avx512bw") &&
+        !SigTestSIMDMaskCheck(&det_ctx, p, SigMatchSignaturesBuildMatchArrayAVX512))
+        goto end;
+#endif
+    result = 1;
+end:
+    if (sgh.mask_array != NULL)
+        SCFreeAligned(sgh.mask_array);
+    if (sgh.head_array != NULL)
+        SCFree(sgh.head_array);
+    if (det_ctx.match_array != NULL)
+        SCFree(det_ctx.match_array);
+    SCFree(p);
+    return result;
+#else
+    return 1;
+#endif
+}
 #endif /* UNITTESTS */
 
 void DetectSimdRegisterTests(void)
@@ -571,5 +841,6 @@ void DetectSimdRegisterTests(void)
     UtRegisterTest("SigTestSIMDMask02", SigTestSIMDMask02, 1);
     UtRegisterTest("SigTestSIMDMask03", SigTestSIMDMask03, 1);
     UtRegisterTest("SigTestSIMDMask04", SigTestSIMDMask04, 1);
+    UtRegisterTest("SigTestSIMDMask05", SigTestSIMDMask05, 1);
 #endif /* UNITTESTS */
 }
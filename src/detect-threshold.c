@@ -1491,6 +1491,72 @@ end:
     return result;
 }
 
+/**
+ * \test tenants with the same sid on the same host have their own
+ *       threshold state
+ */
+static int DetectThresholdTestSig13(void)
+{
+    Packet *p = NULL;
+    ThreadVars th_v;
+    DetectEngineCtx *de_ctx[2] = { NULL, NULL };
+    DetectEngineThreadCtx *det_ctx[2] = { NULL, NULL };
+    int result = 0;
+    int i;
+
+    HostInitConfig(HOST_QUIET);
+
+    memset(&th_v, 0, sizeof(th_v));
+
+    p = UTHBuildPacketReal((uint8_t *)"A",1,IPPROTO_TCP, "1.1.1.1", "2.2.2.2", 1024, 80);
+
+    for (i = 0; i < 2; i++) {
+        de_ctx[i] = DetectEngineCtxInit();
+        if (de_ctx[i] == NULL)
+            goto end;
+        de_ctx[i]->flags |= DE_QUIET;
+        de_ctx[i]->tenant_id = i + 1;
+
+        de_ctx[i]->sig_list = SigInit(de_ctx[i],"alert tcp any any -> any 80 (msg:\"Threshold limit\"; content:\"A\"; threshold: type limit, track by_dst, count 1, seconds 60; sid:1;)");
+        if (de_ctx[i]->sig_list == NULL)
+            goto end;
+
+        SigGroupBuild(de_ctx[i]);
+        DetectEngineThreadCtxInit(&th_v, (void *)de_ctx[i], (void *)&det_ctx[i]);
+    }
+
+    SigMatchSignatures(&th_v, de_ctx[0], det_ctx[0], p);
+    if (PacketAlertCheck(p, 1) != 1) {
+        printf("tenant 1 didn't alert: ");
+        goto end;
+    }
+    SigMatchSignatures(&th_v, de_ctx[0], det_ctx[0], p);
+    if (PacketAlertCheck(p, 1) != 0) {
+        printf("tenant 1 not limited: ");
+        goto end;
+    }
+    SigMatchSignatures(&th_v, de_ctx[1], det_ctx[1], p);
+    if (PacketAlertCheck(p, 1) != 1) {
+        printf("tenant 2 limited by tenant 1: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    for (i = 0; i < 2; i++) {
+        if (de_ctx[i] == NULL)
+            continue;
+        if (det_ctx[i] != NULL)
+            DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx[i]);
+        SigGroupCleanup(de_ctx[i]);
+        SigCleanSignatures(de_ctx[i]);
+        DetectEngineCtxFree(de_ctx[i]);
+    }
+    UTHFreePackets(&p, 1);
+    HostShutdown();
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 void ThresholdRegisterTests(void)
@@ -1513,6 +1579,7 @@ void ThresholdRegisterTests(void)
     UtRegisterTest("DetectThresholdTestSig10", DetectThresholdTestSig10, 1);
     UtRegisterTest("DetectThresholdTestSig11", DetectThresholdTestSig11, 1);
     UtRegisterTest("DetectThresholdTestSig12", DetectThresholdTestSig12, 1);
+    UtRegisterTest("DetectThresholdTestSig13", DetectThresholdTestSig13, 1);
 #endif /* UNITTESTS */
 }
 
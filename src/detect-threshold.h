@@ -66,6 +66,7 @@ typedef struct DetectThresholdData_ {
 typedef struct DetectThresholdEntry_ {
     uint32_t sid;           /**< Signature id */
     uint32_t gid;           /**< Signature group id */
+    uint32_t tenant_id;     /**< Tenant of the engine the sig is from */
 
     uint32_t tv_timeout;    /**< Timeout for new_action (for rate_filter)
                                  its not "seconds", that define the time interval */
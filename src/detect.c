@@ -234,17 +234,20 @@ void DetectExitPrintStats(ThreadVars *tv, void *data) {
 
 /**
  *  \brief Create the path if default-rule-path was specified
+ *  \param de_ctx detection engine, a tenant engine can have its own
+ *                default-rule-path. May be NULL.
  *  \param sig_file The name of the file
  *  \retval str Pointer to the string path + sig_file
  */
-char *DetectLoadCompleteSigPath(char *sig_file)
+char *DetectLoadCompleteSigPath(const DetectEngineCtx *de_ctx, char *sig_file)
 {
     char *defaultpath = NULL;
     char *path = NULL;
 
     /* Path not specified */
     if (PathIsRelative(sig_file)) {
-        if (ConfGet("default-rule-path", &defaultpath) == 1) {
+        if (DetectEngineConfGet(de_ctx, "default-rule-path", &defaultpath) == 1 ||
+            ConfGet("default-rule-path", &defaultpath) == 1) {
             SCLogDebug("Default path: %s", defaultpath);
             size_t path_len = sizeof(char) * (strlen(defaultpath) +
                           strlen(sig_file) + 2);
@@ -273,6 +276,137 @@ char *DetectLoadCompleteSigPath(char *sig_file)
     return path;
 }
 
+/** a rule as read from a rule file */
+typedef struct DetectLoadSigLine_ {
+    char *line;
+    /** line the rule starts on */
+    int lineno;
+    /** regexes compiled by the rule loader threads */
+    DetectPcrePrecompiled *pcre;
+} DetectLoadSigLine;
+
+/** work shared by the rule loader threads while a file is prepared */
+typedef struct DetectLoadSigThreadCtx_ {
+    SCMutex m;
+    DetectLoadSigLine *lines;
+    uint32_t cnt;
+    /** next rule to prepare, protected by m */
+    uint32_t next;
+} DetectLoadSigThreadCtx;
+
+/** only one file is prepared at a time: the loader threads are joined
+ *  before DetectLoadSigPrepare returns */
+static DetectLoadSigThreadCtx load_sig_ctx = { SCMUTEX_INITIALIZER, NULL, 0, 0 };
+
+/** don't bother with threads for files with less rules than this */
+#define DETECT_LOAD_SIG_THREAD_MIN_RULES    64
+#define DETECT_LOAD_SIG_THREAD_MAX          64
+
+/**
+ *  \brief rule loader thread: does the expensive per rule steps that don't
+ *         depend on the detection engine ctx, currently the pcre compile
+ *         and (jit) study
+ */
+static void *DetectLoadSigThread(void *td)
+{
+    ThreadVars *tv = (ThreadVars *)td;
+    DetectLoadSigThreadCtx *t = &load_sig_ctx;
+    uint32_t i;
+
+    if (SCSetThreadName(tv->name) < 0) {
+        SCLogWarning(SC_ERR_THREAD_INIT, "Unable to set thread name");
+    }
+
+    if (tv->thread_setup_flags != 0)
+        TmThreadSetupOptions(tv);
+
+    /* release TmThreadSpawn */
+    TmThreadsSetFlag(tv, THV_INIT_DONE);
+
+    while (1) {
+        SCMutexLock(&t->m);
+        i = t->next;
+        if (i < t->cnt)
+            t->next++;
+        SCMutexUnlock(&t->m);
+
+        if (i >= t->cnt)
+            break;
+
+        t->lines[i].pcre = DetectPcrePrecompile(t->lines[i].line);
+    }
+
+    TmThreadsSetFlag(tv, THV_RUNNING_DONE);
+    TmThreadsSetFlag(tv, THV_CLOSED);
+    pthread_exit(NULL);
+}
+
+/**
+ *  \brief prepare the rules of a file on the rule loader threads
+ *
+ *  The threads take the next rule that isn't prepared yet and only write
+ *  to that rule's entry, so the result doesn't depend on how the threads
+ *  are scheduled. The rules themselves are added to the engine in file
+ *  order afterwards. Rules no thread prepared, e.g. because none could be
+ *  started, are just parsed w/o the precompiled data.
+ */
+static void DetectLoadSigPrepare(DetectEngineCtx *de_ctx,
+        DetectLoadSigLine *lines, uint32_t cnt)
+{
+    ThreadVars *tvs[DETECT_LOAD_SIG_THREAD_MAX];
+    uint32_t nthreads = de_ctx->rule_load_threads;
+    uint32_t started = 0;
+    uint32_t i;
+
+    if (nthreads <= 1 || cnt < DETECT_LOAD_SIG_THREAD_MIN_RULES)
+        return;
+    if (nthreads > DETECT_LOAD_SIG_THREAD_MAX)
+        nthreads = DETECT_LOAD_SIG_THREAD_MAX;
+    if (nthreads > cnt / (DETECT_LOAD_SIG_THREAD_MIN_RULES / 2))
+        nthreads = cnt / (DETECT_LOAD_SIG_THREAD_MIN_RULES / 2);
+
+    SCMutexLock(&load_sig_ctx.m);
+    load_sig_ctx.lines = lines;
+    load_sig_ctx.cnt = cnt;
+    load_sig_ctx.next = 0;
+    SCMutexUnlock(&load_sig_ctx.m);
+
+    for (i = 0; i < nthreads; i++) {
+        ThreadVars *tv = TmThreadCreateMgmtThread("RuleLoader",
+                DetectLoadSigThread, 0);
+        if (tv == NULL) {
+            SCLogWarning(SC_ERR_THREAD_CREATE, "creating rule loader thread "
+                    "failed");
+            break;
+        }
+        if (TmThreadSpawn(tv) != TM_ECODE_OK) {
+            SCLogWarning(SC_ERR_THREAD_SPAWN, "spawning rule loader thread "
+                    "failed");
+            TmThreadFree(tv);
+            break;
+        }
+        tvs[started++] = tv;
+    }
+
+    for (i = 0; i < started; i++) {
+        pthread_join(tvs[i]->t, NULL);
+        TmThreadRemove(tvs[i], tvs[i]->type);
+        TmThreadFree(tvs[i]);
+    }
+
+    SCMutexLock(&load_sig_ctx.m);
+    load_sig_ctx.lines = NULL;
+    load_sig_ctx.cnt = 0;
+    load_sig_ctx.next = 0;
+    SCMutexUnlock(&load_sig_ctx.m);
+
+    if (started == 0) {
+        SCLogWarning(SC_ERR_THREAD_CREATE, "no rule loader threads could "
+                "be started, rules are prepared while they are parsed");
+    }
+    SCLogDebug("prepared %"PRIu32" rules using %"PRIu32" threads", cnt, started);
+}
+
 /**
  *  \brief Load a file with signatures
  *  \param de_ctx Pointer to the detection engine context
@@ -286,6 +420,9 @@ int DetectLoadSigFile(DetectEngineCtx *de_ctx, char *sig_file, int *sigs_tot) {
     char line[8192] = "";
     size_t offset = 0;
     int lineno = 0, multiline = 0;
+    DetectLoadSigLine *lines = NULL;
+    uint32_t lines_cnt = 0, lines_size = 0;
+    uint32_t i;
 
     if (sig_file == NULL) {
         SCLogError(SC_ERR_INVALID_ARGUMENT, "opening rule file null");
@@ -329,40 +466,86 @@ int DetectLoadSigFile(DetectEngineCtx *de_ctx, char *sig_file, int *sigs_tot) {
         /* Reset offset. */
         offset = 0;
 
+        if (lines_cnt == lines_size) {
+            uint32_t size = lines_size ? lines_size * 2 : 256;
+            DetectLoadSigLine *ptr = SCRealloc(lines, size * sizeof(DetectLoadSigLine));
+            if (unlikely(ptr == NULL))
+                goto error;
+            lines = ptr;
+            lines_size = size;
+        }
+        lines[lines_cnt].line = SCStrdup(line);
+        if (unlikely(lines[lines_cnt].line == NULL))
+            goto error;
+        lines[lines_cnt].lineno = lineno - multiline;
+        lines[lines_cnt].pcre = NULL;
+        lines_cnt++;
+
+        multiline = 0;
+    }
+    fclose(fp);
+    fp = NULL;
+
+    DetectLoadSigPrepare(de_ctx, lines, lines_cnt);
+
+    /* add the rules in file order, so that sid ordering, duplicate
+     * handling and errors are the same as w/o the loader threads */
+    for (i = 0; i < lines_cnt; i++) {
         de_ctx->rule_file = sig_file;
-        de_ctx->rule_line = lineno - multiline;
+        de_ctx->rule_line = lines[i].lineno;
+        de_ctx->pcre_precompiled = lines[i].pcre;
+        lines[i].pcre = NULL;
 
-        sig = DetectEngineAppendSig(de_ctx, line);
+        sig = DetectEngineAppendSig(de_ctx, lines[i].line);
         (*sigs_tot)++;
+
+        /* regexes that were not used, e.g. because the rule failed */
+        DetectPcrePrecompiledFree(de_ctx->pcre_precompiled);
+        de_ctx->pcre_precompiled = NULL;
+
         if (sig != NULL) {
             if (rule_engine_analysis_set || fp_engine_analysis_set) {
                 sig->mpm_sm = RetrieveFPForSigV2(sig);
                 if (fp_engine_analysis_set) {
-                    EngineAnalysisFP(sig, line);
+                    EngineAnalysisFP(sig, lines[i].line);
                 }
                 if (rule_engine_analysis_set) {
-                    EngineAnalysisRules(sig, line);
+                    EngineAnalysisRules(sig, lines[i].line);
                 }
             }
             SCLogDebug("signature %"PRIu32" loaded", sig->id);
             good++;
         } else {
             SCLogError(SC_ERR_INVALID_SIGNATURE, "error parsing signature \"%s\" from "
-                 "file %s at line %"PRId32"", line, sig_file, lineno - multiline);
+                 "file %s at line %"PRId32"", lines[i].line, sig_file, lines[i].lineno);
 
             if (rule_engine_analysis_set) {
-                EngineAnalysisRulesFailure(line, sig_file, lineno - multiline);
+                EngineAnalysisRulesFailure(lines[i].line, sig_file, lines[i].lineno);
             }
             if (de_ctx->failure_fatal == 1) {
                 exit(EXIT_FAILURE);
             }
             bad++;
         }
-        multiline = 0;
     }
-    fclose(fp);
+
+    for (i = 0; i < lines_cnt; i++) {
+        SCFree(lines[i].line);
+    }
+    if (lines != NULL)
+        SCFree(lines);
 
     return good;
+
+error:
+    if (fp != NULL)
+        fclose(fp);
+    for (i = 0; i < lines_cnt; i++) {
+        SCFree(lines[i].line);
+    }
+    if (lines != NULL)
+        SCFree(lines);
+    return -1;
 }
 
 /**
@@ -392,10 +575,10 @@ int SigLoadSignatures(DetectEngineCtx *de_ctx, char *sig_file, int sig_file_excl
 
     /* ok, let's load signature files from the general config */
     if (!(sig_file != NULL && sig_file_exclusive == TRUE)) {
-        rule_files = ConfGetNode("rule-files");
+        rule_files = DetectEngineConfGetNode(de_ctx, "rule-files");
         if (rule_files != NULL) {
             TAILQ_FOREACH(file, &rule_files->head, next) {
-                sfile = DetectLoadCompleteSigPath(file->val);
+                sfile = DetectLoadCompleteSigPath(de_ctx, file->val);
                 SCLogDebug("Loading rule file: %s", sfile);
 
                 r = DetectLoadSigFile(de_ctx, sfile, &sigtotal);
@@ -565,7 +748,7 @@ int SigMatchSignaturesBuildMatchArrayAddSignature(DetectEngineThreadCtx *det_ctx
     return 1;
 }
 
-#if defined(__SSE3__) || defined(__tile__)
+#ifdef DETECT_SIMD_MASK_ARRAY
 /* SIMD implementations are in detect-simd.c */
 #else
 /* Non-SIMD implementation */
@@ -600,6 +783,10 @@ void SigMatchSignaturesBuildMatchArray(DetectEngineThreadCtx *det_ctx,
         }
     }
 }
+
+void SigMatchSignaturesBuildMatchArraySetup(void)
+{
+}
 #endif /* No SIMD implementation */
 
 int SigMatchSignaturesRunPostMatch(ThreadVars *tv,
@@ -1703,6 +1890,13 @@ TmEcode Detect(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQue
                   det_ctx, de_ctx);
     }
 
+    /* multi tenancy: let the tenant's engine inspect the packet */
+    if (det_ctx->tenant_det_ctxs_cnt > 0) {
+        det_ctx = DetectEngineGetTenantThreadCtx(det_ctx, p);
+        de_ctx = det_ctx->de_ctx;
+    }
+    p->tenant_id = de_ctx->tenant_id;
+
     /* see if the packet matches one or more of the sigs */
     int r = SigMatchSignatures(tv,de_ctx,det_ctx,p);
     if (r >= 0) {
@@ -3837,6 +4031,7 @@ int SigAddressPrepareStage3(DetectEngineCtx *de_ctx) {
     SigGroupHeadSPortHashFree(de_ctx);
     SigGroupHeadMpmHashFree(de_ctx);
     SigGroupHeadMpmUriHashFree(de_ctx);
+    MpmCtxShareHashFree(de_ctx);
     DetectPortDpHashFree(de_ctx);
     DetectPortSpHashFree(de_ctx);
 
@@ -3856,6 +4051,12 @@ int SigAddressPrepareStage3(DetectEngineCtx *de_ctx) {
         if (de_ctx->mpm_uri_tot_patcnt && de_ctx->mpm_uri_unique)
             SCLogDebug("MPM (URI) max patcnt %" PRIu32 ", avg %" PRIu32 " (%" PRIu32 "/%" PRIu32 ")", de_ctx->mpm_uri_max_patcnt, de_ctx->mpm_uri_tot_patcnt/de_ctx->mpm_uri_unique, de_ctx->mpm_uri_tot_patcnt, de_ctx->mpm_uri_unique);
         SCLogDebug("port maxgroups: %" PRIu32 ", avg %" PRIu32 ", tot %" PRIu32 "", g_groupportlist_maxgroups, g_groupportlist_groupscnt ? g_groupportlist_totgroups/g_groupportlist_groupscnt : 0, g_groupportlist_totgroups);
+        if (de_ctx->mpm_ctx_total > 0) {
+            SCLogInfo("MPM contexts: %" PRIu32 " unique out of %" PRIu32 ", "
+                    "sharing saved %" PRIu64 " bytes",
+                    de_ctx->mpm_ctx_total - de_ctx->mpm_ctx_shared,
+                    de_ctx->mpm_ctx_total, de_ctx->mpm_ctx_shared_memory);
+        }
 
         SCLogInfo("building signature grouping structure, stage 3: building destination address lists... complete");
     }
@@ -4313,6 +4514,9 @@ int SigGroupBuild(DetectEngineCtx *de_ctx)
         s = s->next;
     }
 
+    /* pick the mask prefilter for this cpu */
+    SigMatchSignaturesBuildMatchArraySetup();
+
     if (DetectSetFastPatternAndItsId(de_ctx) < 0)
         return -1;
 
@@ -10080,6 +10284,82 @@ end:
     return result;
 }
 
+/** \test sgh's with different sigs but the same patterns share their
+ *        mpm ctxs */
+static int SigTestSgh06 (void) {
+    ThreadVars th_v;
+    int result = 0;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    memset(&th_v, 0, sizeof(th_v));
+
+    Packet *p = UTHBuildPacketSrcDstPorts((uint8_t *)"a", 1, IPPROTO_TCP, 12345, 80);
+    if (p == NULL)
+        return 0;
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL) {
+        goto end;
+    }
+    de_ctx->flags |= DE_QUIET;
+
+    de_ctx->sig_list = SigInit(de_ctx,"alert tcp any any -> any 80 (msg:\"1\"; content:\"one\"; sid:1;)");
+    if (de_ctx->sig_list == NULL) {
+        goto end;
+    }
+    de_ctx->sig_list->next = SigInit(de_ctx,"alert tcp any any -> any 81 (msg:\"2\"; content:\"one\"; sid:2;)");
+    if (de_ctx->sig_list->next == NULL) {
+        goto end;
+    }
+    de_ctx->sig_list->next->next = SigInit(de_ctx,"alert tcp any any -> any 82 (msg:\"3\"; content:\"two\"; sid:3;)");
+    if (de_ctx->sig_list->next->next == NULL) {
+        goto end;
+    }
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    SigGroupHead *sgh1 = SigMatchSignaturesGetSgh(de_ctx, det_ctx, p);
+    p->dp = 81;
+    SigGroupHead *sgh2 = SigMatchSignaturesGetSgh(de_ctx, det_ctx, p);
+    p->dp = 82;
+    SigGroupHead *sgh3 = SigMatchSignaturesGetSgh(de_ctx, det_ctx, p);
+    if (sgh1 == NULL || sgh2 == NULL || sgh3 == NULL || sgh1 == sgh2) {
+        printf("sgh1 %p sgh2 %p sgh3 %p: ", sgh1, sgh2, sgh3);
+        goto end;
+    }
+
+    if (sgh1->mpm_proto_tcp_ctx_ts == NULL ||
+        sgh1->mpm_proto_tcp_ctx_ts != sgh2->mpm_proto_tcp_ctx_ts) {
+        printf("sgh1 and sgh2 should share the tcp mpm ctx: ");
+        goto end;
+    }
+    if (sgh1->mpm_proto_tcp_ctx_ts->refcnt != 2) {
+        printf("refcnt %"PRIu32", expected 2: ", sgh1->mpm_proto_tcp_ctx_ts->refcnt);
+        goto end;
+    }
+    if (sgh3->mpm_proto_tcp_ctx_ts == sgh1->mpm_proto_tcp_ctx_ts) {
+        printf("sgh3 has other patterns, shouldn't share: ");
+        goto end;
+    }
+    if (de_ctx->mpm_ctx_shared == 0 ||
+        de_ctx->mpm_ctx_shared >= de_ctx->mpm_ctx_total) {
+        printf("shared %"PRIu32" total %"PRIu32": ", de_ctx->mpm_ctx_shared,
+                de_ctx->mpm_ctx_total);
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (de_ctx != NULL) {
+        if (det_ctx != NULL)
+            DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+        SigGroupCleanup(de_ctx);
+        DetectEngineCtxFree(de_ctx);
+    }
+    UTHFreePackets(&p, 1);
+    return result;
+}
+
 static int SigTestContent01Real (int mpm_type) {
     uint8_t *buf = (uint8_t *)"01234567890123456789012345678901";
     uint16_t buflen = strlen((char *)buf);
@@ -11328,6 +11608,86 @@ end:
 
     return result;
 }
+
+/** \brief load a rule file, return the sids in sig_list order */
+static int SigTestLoadThreadsLoad(char *path, uint16_t threads, uint32_t *sids,
+        int *sigs_tot)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    int cnt = 0;
+
+    if (de_ctx == NULL)
+        return -1;
+    de_ctx->rule_load_threads = threads;
+
+    int r = DetectLoadSigFile(de_ctx, path, sigs_tot);
+
+    Signature *s;
+    for (s = de_ctx->sig_list; s != NULL; s = s->next) {
+        SigMatch *sm = s->sm_lists[DETECT_SM_LIST_PMATCH];
+        for ( ; sm != NULL; sm = sm->next) {
+            if (sm->type == DETECT_PCRE &&
+                    ((DetectPcreData *)sm->ctx)->re == NULL)
+                r = -1;
+        }
+        sids[cnt++] = s->id;
+    }
+
+    DetectEngineCtxFree(de_ctx);
+    return r;
+}
+
+/** \test rule file loaded with loader threads gives the same rules in the
+ *        same order as w/o */
+static int SigTestLoadThreads01(void)
+{
+    char path[PATH_MAX];
+    uint32_t sids1[256], sids2[256];
+    int tot1 = 0, tot2 = 0;
+    int result = 0;
+    uint32_t i;
+
+    /* unique file, so parallel test runs don't step on each other */
+    char *tmpdir = getenv("TMPDIR");
+    snprintf(path, sizeof(path), "%s/suricata-rules-XXXXXX",
+            tmpdir != NULL ? tmpdir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return 0;
+    FILE *fp = fdopen(fd, "w");
+    if (fp == NULL) {
+        close(fd);
+        goto end;
+    }
+    for (i = 0; i < 200; i++) {
+        fprintf(fp, "alert tcp any any -> any any (msg:\"test\\; %u\"; "
+                "content:\"abc%u\"; pcre:\"/abc%u[0-9]+x/i\"; "
+                "pcre:\"/^\\d{%u}y/R\"; sid:%u;)\n", i, i, i, i % 7 + 1, i + 1);
+        if (i == 100) {
+            /* bad regex */
+            fprintf(fp, "alert tcp any any -> any any (pcre:\"/(abc/\"; sid:1000;)\n");
+        }
+    }
+    fclose(fp);
+
+    int r1 = SigTestLoadThreadsLoad(path, 1, sids1, &tot1);
+    int r2 = SigTestLoadThreadsLoad(path, 4, sids2, &tot2);
+    if (r1 != 200 || r2 != 200 || tot1 != 201 || tot2 != 201) {
+        printf("r1 %d r2 %d tot1 %d tot2 %d: ", r1, r2, tot1, tot2);
+        goto end;
+    }
+    for (i = 0; i < 200; i++) {
+        if (sids1[i] != sids2[i] || sids1[i] != 200 - i) {
+            printf("sid %u: %u != %u: ", i, sids1[i], sids2[i]);
+            goto end;
+        }
+    }
+
+    result = 1;
+end:
+    unlink(path);
+    return result;
+}
 #endif /* UNITTESTS */
 
 void SigRegisterTests(void) {
@@ -11497,6 +11857,7 @@ void SigRegisterTests(void) {
     UtRegisterTest("SigTestSgh03", SigTestSgh03, 1);
     UtRegisterTest("SigTestSgh04", SigTestSgh04, 1);
     UtRegisterTest("SigTestSgh05", SigTestSgh05, 1);
+    UtRegisterTest("SigTestSgh06", SigTestSgh06, 1);
 
     UtRegisterTest("SigTestContent01B2g -- 32 byte pattern", SigTestContent01B2g, 1);
     UtRegisterTest("SigTestContent01B3g -- 32 byte pattern", SigTestContent01B3g, 1);
@@ -11537,6 +11898,8 @@ void SigRegisterTests(void) {
     UtRegisterTest("SigTestDropFlow03", SigTestDropFlow03, 1);
     UtRegisterTest("SigTestDropFlow04", SigTestDropFlow04, 1);
 
+    UtRegisterTest("SigTestLoadThreads01", SigTestLoadThreads01, 1);
+
     DetectSimdRegisterTests();
 #endif /* UNITTESTS */
 }
@@ -573,6 +573,13 @@ typedef struct DetectEngineThreadKeywordCtxItem_ {
     const char *name; /* keyword name, for error printing */
 } DetectEngineThreadKeywordCtxItem;
 
+/** multi tenancy: packets from an interface go to a tenant engine */
+typedef struct DetectEngineTenantIface_ {
+    char *iface;
+    /** index in DetectEngineCtx::tenant_array */
+    uint32_t idx;
+} DetectEngineTenantIface;
+
 /** \brief main detection engine ctx */
 typedef struct DetectEngineCtx_ {
     uint8_t flags;
@@ -604,6 +611,9 @@ typedef struct DetectEngineCtx_ {
     uint32_t mpm_unique, mpm_reuse, mpm_none,
         mpm_uri_unique, mpm_uri_reuse, mpm_uri_none;
     uint32_t gh_unique, gh_reuse;
+    /* sig group head mpm ctxs: prepared and shared */
+    uint32_t mpm_ctx_total, mpm_ctx_shared;
+    uint64_t mpm_ctx_shared_memory;
 
     uint32_t mpm_max_patcnt, mpm_min_patcnt, mpm_tot_patcnt,
         mpm_uri_max_patcnt, mpm_uri_min_patcnt, mpm_uri_tot_patcnt;
@@ -614,6 +624,8 @@ typedef struct DetectEngineCtx_ {
     HashListTable *sgh_mpm_hash_table;
     HashListTable *sgh_mpm_uri_hash_table;
     HashListTable *sgh_mpm_stream_hash_table;
+    /* sig group head mpm ctxs, by pattern set */
+    HashListTable *mpm_ctx_share_hash_table;
 
     HashListTable *sgh_sport_hash_table;
     HashListTable *sgh_dport_hash_table;
@@ -667,6 +679,15 @@ typedef struct DetectEngineCtx_ {
     MpmPatternIdStore *mpm_pattern_id_store;
     uint16_t max_fp_id;
 
+    /** fast pattern to id mapping (DetectFPAndItsId array sorted on the
+     *  pattern), kept so that a rule reload can give the patterns that are
+     *  still in use the same id. Mpm ctxs with the same patterns and ids
+     *  share their state tables. */
+    uint8_t *fp_id_buf;
+    uint32_t fp_id_cnt;
+    /** set on the engine built by a rule reload: the running engine */
+    struct DetectEngineCtx_ *reload_base;
+
     MpmCtxFactoryContainer *mpm_ctx_factory_container;
 
     /* maximum recursion depth for content inspection */
@@ -709,6 +730,22 @@ typedef struct DetectEngineCtx_ {
     /* id used by every detect engine ctx instance */
     uint32_t id;
 
+    /** multi tenancy: id of the tenant, 0 for the default engine */
+    uint32_t tenant_id;
+    /** config prefix the tenant's rule-files, default-rule-path and
+     *  threshold-file are read from. Empty for the default engine. */
+    char config_prefix[64];
+
+    /** tenant engines, only set on the default engine, which owns them */
+    struct DetectEngineCtx_ **tenant_array;
+    uint32_t tenant_array_cnt;
+    /** how packets are mapped to tenants, TENANT_SELECTOR_* */
+    int tenant_selector;
+    /** vlan id to tenant_array index + 1, 0 for the default engine */
+    uint16_t *tenant_vlan_map;
+    DetectEngineTenantIface *tenant_iface_map;
+    uint32_t tenant_iface_map_cnt;
+
     /** sgh for signatures that match against invalid packets. In those cases
      *  we can't lookup by proto, address, port as we don't have these */
     struct SigGroupHead_ *decoder_event_sgh;
@@ -717,6 +754,12 @@ typedef struct DetectEngineCtx_ {
     char *rule_file;
     int rule_line;
 
+    /** number of threads used to prepare rules while loading rule files */
+    uint16_t rule_load_threads;
+    /** regexes of the rule being parsed that were compiled by the rule
+     *  loader threads (DetectPcrePrecompiled list) */
+    struct DetectPcrePrecompiled_ *pcre_precompiled;
+
     /** Is detect engine using a delayed init */
     int delayed_detect;
     /** Did we load the signatures? */
@@ -752,6 +795,13 @@ enum {
     ENGINE_SGH_MPM_FACTORY_CONTEXT_AUTO
 };
 
+/* multi tenancy: what selects the tenant engine of a packet */
+enum {
+    TENANT_SELECTOR_NONE = 0,
+    TENANT_SELECTOR_VLAN,
+    TENANT_SELECTOR_INTERFACE,
+};
+
 typedef struct HttpReassembledBody_ {
     uint8_t *buffer;
     uint32_t buffer_size;   /**< size of the buffer itself */
@@ -809,6 +859,16 @@ typedef struct DetectionEngineThreadCtx_ {
 
     SC_ATOMIC_DECLARE(int, so_far_used_by_detect);
 
+    /** multi tenancy: thread ctxs of the tenant engines, indexed like
+     *  DetectEngineCtx::tenant_array. Only set on the default engine's
+     *  thread ctx, which owns them. */
+    struct DetectionEngineThreadCtx_ **tenant_det_ctxs;
+    uint32_t tenant_det_ctxs_cnt;
+    /** interface of the last packet and the tenant_array index + 1 it
+     *  mapped to, to avoid the name lookup for every packet */
+    struct LiveDevice_ *tenant_last_dev;
+    uint32_t tenant_last_idx;
+
     /* holds the current recursion depth on content inspection */
     int inspection_recursion_counter;
 
@@ -949,6 +1009,22 @@ typedef struct SigGroupHeadInitData_ {
     struct DetectPort_ *port;
 } SigGroupHeadInitData;
 
+/* On x86_64 the AVX2 and AVX-512 mask prefilters are compiled in with the
+ * target attribute and selected at runtime, so they don't depend on the
+ * build being for SSE3. */
+#if defined(__x86_64__) && __WORDSIZE == 64 && defined(__GNUC__) && \
+        (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define DETECT_SIMD_AVX2
+#if defined(__clang__) || __GNUC__ >= 5
+#define DETECT_SIMD_AVX512
+#endif
+#endif
+
+/** the sgh keeps a mask_array for the SIMD mask prefilter */
+#if defined(__SSE3__) || defined(__tile__) || defined(DETECT_SIMD_AVX2)
+#define DETECT_SIMD_MASK_ARRAY
+#endif
+
 /** \brief Container for matching data for a signature group */
 typedef struct SigGroupHead_ {
     uint32_t flags;
@@ -959,7 +1035,7 @@ typedef struct SigGroupHead_ {
 
     /** array of masks, used to check multiple masks against
      *  a packet using SIMD. */
-#if defined(__SSE3__) || defined(__tile__)
+#ifdef DETECT_SIMD_MASK_ARRAY
     SignatureMask *mask_array;
 #endif
     /** chunk of memory containing the "header" part of each
@@ -1151,6 +1227,7 @@ Signature *SigFindSignatureBySidGid(DetectEngineCtx *, uint32_t, uint32_t);
 void SigMatchSignaturesBuildMatchArray(DetectEngineThreadCtx *,
                                        Packet *, SignatureMask,
                                        uint16_t);
+void SigMatchSignaturesBuildMatchArraySetup(void);
 int SigMatchSignaturesBuildMatchArrayAddSignature(DetectEngineThreadCtx *,
                                                   Packet *, SignatureHeader *,
                                                   uint16_t);
@@ -1166,7 +1243,7 @@ int SigGroupBuild(DetectEngineCtx *);
 int SigGroupCleanup (DetectEngineCtx *de_ctx);
 void SigAddressPrepareBidirectionals (DetectEngineCtx *);
 
-char *DetectLoadCompleteSigPath(char *sig_file);
+char *DetectLoadCompleteSigPath(const DetectEngineCtx *, char *sig_file);
 int SigLoadSignatures (DetectEngineCtx *, char *, int);
 void SigTableList(const char *keyword);
 void SigTableSetup(void);
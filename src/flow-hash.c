@@ -35,6 +35,7 @@
 #include "flow-util.h"
 #include "flow-private.h"
 #include "flow-manager.h"
+#include "flow-wheel.h"
 #include "app-layer-parser.h"
 
 #include "util-time.h"
@@ -521,6 +522,8 @@ Flow *FlowGetFlowFromHash(Packet *p)
         /* got one, now lock, initialize and return */
         FlowInit(f, p);
         f->fb = fb;
+        FlowWheelInsert(f, (uint32_t)p->ts.tv_sec, (uint32_t)p->ts.tv_sec +
+                flow_proto[f->protomap].new_timeout);
 
         FBLOCK_UNLOCK(fb);
         FlowHashCountUpdate;
@@ -559,6 +562,8 @@ Flow *FlowGetFlowFromHash(Packet *p)
                 /* initialize and return */
                 FlowInit(f, p);
                 f->fb = fb;
+                FlowWheelInsert(f, (uint32_t)p->ts.tv_sec, (uint32_t)p->ts.tv_sec +
+                        flow_proto[f->protomap].new_timeout);
 
                 FBLOCK_UNLOCK(fb);
                 FlowHashCountUpdate;
@@ -661,6 +666,7 @@ static Flow *FlowGetUsedFlow(void)
 
         f->hnext = NULL;
         f->hprev = NULL;
+        FlowWheelRemove(f);
         f->fb = NULL;
         FBLOCK_UNLOCK(fb);
 
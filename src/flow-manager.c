@@ -41,6 +41,7 @@
 #include "flow-private.h"
 #include "flow-timeout.h"
 #include "flow-manager.h"
+#include "flow-wheel.h"
 
 #include "stream-tcp-private.h"
 #include "stream-tcp-reassemble.h"
@@ -240,6 +241,55 @@ static int FlowManagerFlowTimedOut(Flow *f, struct timeval *ts) {
     return 1;
 }
 
+/** \internal
+ *  \brief remove a timed out flow from the hash and move it to the spare
+ *         queue.
+ *
+ *  \param f *LOCKED* flow, its flow bucket must be locked as well. The flow
+ *           is unlocked on return.
+ *  \param state flow state
+ *  \param counters ptr to FlowTimeoutCounters structure
+ */
+static void FlowManagerRemoveFlow(Flow *f, int state, FlowTimeoutCounters *counters)
+{
+    /* remove from the hash */
+    if (f->hprev != NULL)
+        f->hprev->hnext = f->hnext;
+    if (f->hnext != NULL)
+        f->hnext->hprev = f->hprev;
+    if (f->fb->head == f)
+        f->fb->head = f->hnext;
+    if (f->fb->tail == f)
+        f->fb->tail = f->hprev;
+
+    f->hnext = NULL;
+    f->hprev = NULL;
+
+    FlowWheelRemove(f);
+
+    FlowClearMemory (f, f->protomap);
+
+    /* no one is referring to this flow, use_cnt 0, removed from hash
+     * so we can unlock it and move it back to the spare queue. */
+    FLOWLOCK_UNLOCK(f);
+
+    /* move to spare list */
+    FlowMoveToSpare(f);
+
+    switch (state) {
+        case FLOW_STATE_NEW:
+        default:
+            counters->new++;
+            break;
+        case FLOW_STATE_ESTABLISHED:
+            counters->est++;
+            break;
+        case FLOW_STATE_CLOSED:
+            counters->clo++;
+            break;
+    }
+}
+
 /**
  *  \internal
  *
@@ -277,42 +327,8 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
         /* check if the flow is fully timed out and
          * ready to be discarded. */
         if (FlowManagerFlowTimedOut(f, ts) == 1) {
-            /* remove from the hash */
-            if (f->hprev != NULL)
-                f->hprev->hnext = f->hnext;
-            if (f->hnext != NULL)
-                f->hnext->hprev = f->hprev;
-            if (f->fb->head == f)
-                f->fb->head = f->hnext;
-            if (f->fb->tail == f)
-                f->fb->tail = f->hprev;
-
-            f->hnext = NULL;
-            f->hprev = NULL;
-
-            FlowClearMemory (f, f->protomap);
-
-            /* no one is referring to this flow, use_cnt 0, removed from hash
-             * so we can unlock it and move it back to the spare queue. */
-            FLOWLOCK_UNLOCK(f);
-
-            /* move to spare list */
-            FlowMoveToSpare(f);
-
+            FlowManagerRemoveFlow(f, state, counters);
             cnt++;
-
-            switch (state) {
-                case FLOW_STATE_NEW:
-                default:
-                    counters->new++;
-                    break;
-                case FLOW_STATE_ESTABLISHED:
-                    counters->est++;
-                    break;
-                case FLOW_STATE_CLOSED:
-                    counters->clo++;
-                    break;
-            }
         } else {
             FLOWLOCK_UNLOCK(f);
         }
@@ -364,6 +380,62 @@ next:
     return cnt;
 }
 
+/**
+ *  \brief time out flows using the timing wheel
+ *
+ *  Only the flows the wheel considers due are inspected. Flows that saw
+ *  packets since they were scheduled, or that can't be removed yet, are
+ *  rescheduled. Not used in emergency mode, as the wheel is keyed on the
+ *  normal timeouts.
+ *
+ *  \param ts timestamp
+ *  \param counters ptr to FlowTimeoutCounters structure
+ *
+ *  \retval cnt number of timed out flow
+ */
+static uint32_t FlowTimeoutWheel(struct timeval *ts, FlowTimeoutCounters *counters)
+{
+    uint32_t cnt = 0;
+    uint32_t now = (uint32_t)ts->tv_sec;
+    Flow *f;
+
+    FlowWheelAdvance(now);
+
+    /* flows are returned with their bucket locked */
+    while ((f = FlowWheelGetPending()) != NULL) {
+        FlowBucket *fb = f->fb;
+
+        if (FLOWLOCK_TRYWRLOCK(f) != 0) {
+            FlowWheelInsert(f, now, now + 1);
+            FBLOCK_UNLOCK(fb);
+            continue;
+        }
+
+        int state = FlowGetFlowState(f);
+
+        if (FlowManagerFlowTimeout(f, state, ts, 0) == 0) {
+            /* flow was active since it was scheduled */
+            FlowWheelInsert(f, now, (uint32_t)f->lastts_sec +
+                    FlowGetFlowTimeout(f, state, 0) + 1);
+            FLOWLOCK_UNLOCK(f);
+            FBLOCK_UNLOCK(fb);
+            continue;
+        }
+
+        if (FlowManagerFlowTimedOut(f, ts) == 1) {
+            FlowManagerRemoveFlow(f, state, counters);
+            cnt++;
+        } else {
+            /* in use or pending reassembly, check again next round */
+            FlowWheelInsert(f, now, now + 1);
+            FLOWLOCK_UNLOCK(f);
+        }
+        FBLOCK_UNLOCK(fb);
+    }
+
+    return cnt;
+}
+
 /** \brief Thread that manages the flow table and times out flows.
  *
  *  \param td ThreadVars casted to void ptr
@@ -475,9 +547,13 @@ void *FlowManagerThread(void *td)
         /* see if we still have enough spare flows */
         FlowUpdateSpareFlows();
 
-        /* try to time out flows */
+        /* try to time out flows. In emergency mode the timeouts are lower
+         * than what the wheel was scheduled with, so scan the whole hash. */
         FlowTimeoutCounters counters = { 0, 0, 0, };
-        FlowTimeoutHash(&ts, 0 /* check all */, &counters);
+        if (emerg == TRUE)
+            FlowTimeoutHash(&ts, 0 /* check all */, &counters);
+        else
+            FlowTimeoutWheel(&ts, &counters);
 
 
         DefragTimeoutHash(&ts);
@@ -57,7 +57,9 @@ Flow *FlowAlloc(void)
 
     (void) SC_ATOMIC_ADD(flow_memuse, size);
 
-    f = SCMalloc(size);
+    /* cache line aligned, so the hot part of the flow is in a single
+     * cache line */
+    f = SCMallocAligned(size, CLS);
     if (unlikely(f == NULL)) {
         (void)SC_ATOMIC_SUB(flow_memuse, size);
         return NULL;
@@ -77,9 +79,9 @@ Flow *FlowAlloc(void)
 void FlowFree(Flow *f)
 {
     FLOW_DESTROY(f);
-    SCFree(f);
+    SCFreeAligned(f);
 
-    (void) SC_ATOMIC_SUB(flow_memuse, sizeof(Flow));
+    (void) SC_ATOMIC_SUB(flow_memuse, (sizeof(Flow) + FlowStorageSize()));
 }
 
 /**
@@ -115,6 +117,7 @@ void FlowInit(Flow *f, Packet *p)
     f->recursion_level = p->recursion_level;
     f->vlan_id[0] = p->vlan_id[0];
     f->vlan_id[1] = p->vlan_id[1];
+    f->livedev = p->livedev;
 
     if (PKT_IS_IPV4(p)) {
         FLOW_SET_IPV4_SRC_ADDR_FROM_PACKET(p, &f->src);
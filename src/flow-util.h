@@ -55,6 +55,7 @@
         (f)->data_al_so_far[0] = 0; \
         (f)->data_al_so_far[1] = 0; \
         (f)->de_ctx_id = 0; \
+        (f)->livedev = NULL; \
         (f)->alparser = NULL; \
         (f)->alstate = NULL; \
         (f)->de_state = NULL; \
@@ -66,6 +67,10 @@
         (f)->hprev = NULL; \
         (f)->lnext = NULL; \
         (f)->lprev = NULL; \
+        (f)->wnext = NULL; \
+        (f)->wprev = NULL; \
+        (f)->wslot = NULL; \
+        (f)->wexpire = 0; \
         SC_ATOMIC_INIT((f)->autofp_tmqh_flow_qid);  \
         (void) SC_ATOMIC_SET((f)->autofp_tmqh_flow_qid, -1);  \
         RESET_COUNTERS((f)); \
@@ -74,7 +79,8 @@
 /** \brief macro to recycle a flow before it goes into the spare queue for reuse.
  *
  *  Note that the lnext, lprev, hnext, hprev fields are untouched, those are
- *  managed by the queueing code. Same goes for fb (FlowBucket ptr) field.
+ *  managed by the queueing code. Same goes for fb (FlowBucket ptr) field and
+ *  the timing wheel fields wnext, wprev, wslot.
  */
 #define FLOW_RECYCLE(f) do { \
         (f)->sp = 0; \
@@ -94,6 +100,7 @@
         (f)->data_al_so_far[0] = 0; \
         (f)->data_al_so_far[1] = 0; \
         (f)->de_ctx_id = 0; \
+        (f)->livedev = NULL; \
         if ((f)->de_state != NULL) { \
             DetectEngineStateReset((f)->de_state, (STREAM_TOSERVER | STREAM_TOCLIENT)); \
         } \
@@ -0,0 +1,567 @@
+/* Copyright (C) 2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * \author agent <agent@local>
+ *
+ * Hierarchical timing wheel used by the flow manager to find the flows
+ * that are (possibly) timing out, without scanning the entire flow hash.
+ *
+ * Level 0 has a slot per second for the next 256 seconds, level 1 a slot
+ * per 256 seconds for the next ~4.5 hours. Flows scheduled even further
+ * out are kept on an overflow list that is redistributed every time the
+ * wheel wraps.
+ *
+ * There are FLOW_WHEEL_PARTS wheels, each with its own lock. A flow goes
+ * into the wheel of its hash row, so that packet threads creating flows
+ * in different rows don't serialize on a single wheel lock. The flow
+ * manager advances and drains all of them.
+ */
+
+#include "suricata-common.h"
+#include "threads.h"
+
+#include "flow.h"
+#include "flow-hash.h"
+#include "flow-util.h"
+#include "flow-wheel.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+
+static FlowWheel flow_wheels[FLOW_WHEEL_PARTS];
+
+/** \internal
+ *  \brief add a flow to the head of a slot list
+ *
+ *  \warning wheel lock must be held */
+static inline void FlowWheelLink(Flow **slot, Flow *f)
+{
+    f->wprev = NULL;
+    f->wnext = *slot;
+    if (*slot != NULL)
+        (*slot)->wprev = f;
+    *slot = f;
+    f->wslot = slot;
+}
+
+/** \internal
+ *  \brief remove a flow from the slot list it's in
+ *
+ *  \warning wheel lock must be held */
+static inline void FlowWheelUnlink(Flow *f)
+{
+    if (f->wprev != NULL)
+        f->wprev->wnext = f->wnext;
+    else
+        *f->wslot = f->wnext;
+    if (f->wnext != NULL)
+        f->wnext->wprev = f->wprev;
+
+    f->wnext = NULL;
+    f->wprev = NULL;
+    f->wslot = NULL;
+}
+
+/** \internal
+ *  \brief put a flow in the slot matching the expire time
+ *
+ *  Expire times that are already passed are scheduled for the next second.
+ *
+ *  \warning wheel lock must be held */
+static void FlowWheelSchedule(FlowWheel *w, Flow *f, uint32_t expire)
+{
+    Flow **slot;
+
+    if (expire <= w->cur)
+        expire = w->cur + 1;
+    f->wexpire = expire;
+
+    uint32_t diff = expire - w->cur;
+    if (diff < FLOW_WHEEL_L0_SIZE) {
+        slot = &w->l0[expire & FLOW_WHEEL_L0_MASK];
+    } else if (diff < FLOW_WHEEL_SPAN) {
+        slot = &w->l1[(expire >> FLOW_WHEEL_L0_BITS) & FLOW_WHEEL_L1_MASK];
+    } else {
+        slot = &w->overflow;
+    }
+
+    FlowWheelLink(slot, f);
+}
+
+/** \internal
+ *  \brief redistribute the flows of a slot over the lower levels
+ *
+ *  \warning wheel lock must be held */
+static void FlowWheelCascade(FlowWheel *w, Flow **slot)
+{
+    Flow *f = *slot;
+    *slot = NULL;
+
+    while (f != NULL) {
+        Flow *next = f->wnext;
+        f->wnext = NULL;
+        f->wprev = NULL;
+        f->wslot = NULL;
+
+        FlowWheelSchedule(w, f, f->wexpire);
+        f = next;
+    }
+}
+
+/** \internal
+ *  \brief move all flows of a slot to the pending list
+ *
+ *  \retval cnt number of flows moved
+ *
+ *  \warning wheel lock must be held */
+static uint32_t FlowWheelExpireSlot(FlowWheel *w, Flow **slot)
+{
+    uint32_t cnt = 0;
+    Flow *f = *slot;
+    *slot = NULL;
+
+    while (f != NULL) {
+        Flow *next = f->wnext;
+        FlowWheelLink(&w->pending, f);
+        cnt++;
+        f = next;
+    }
+    return cnt;
+}
+
+/** \internal
+ *  \brief get the wheel of a flow
+ *
+ *  The partition is picked from the flow bucket on insert. It doesn't
+ *  change while the flow is in the hash, and is protected by the bucket
+ *  lock like the bucket pointer itself. */
+static inline FlowWheel *FlowWheelGet(Flow *f)
+{
+    return &flow_wheels[f->wpart];
+}
+
+void FlowWheelInit(void)
+{
+    int i;
+
+    memset(&flow_wheels, 0x00, sizeof(flow_wheels));
+    for (i = 0; i < FLOW_WHEEL_PARTS; i++)
+        SCMutexInit(&flow_wheels[i].m, NULL);
+}
+
+/** \brief reset the wheels
+ *
+ *  Flows are owned by the flow hash, so they are not freed here. */
+void FlowWheelDestroy(void)
+{
+    int i;
+
+    for (i = 0; i < FLOW_WHEEL_PARTS; i++)
+        SCMutexDestroy(&flow_wheels[i].m);
+    memset(&flow_wheels, 0x00, sizeof(flow_wheels));
+}
+
+/**
+ *  \brief Schedule a new flow
+ *
+ *  \param f flow that was just added to the flow hash
+ *  \param now current time in seconds
+ *  \param expire time in seconds the flow is expected to time out
+ *
+ *  \note flow bucket of the flow should be locked
+ */
+void FlowWheelInsert(Flow *f, uint32_t now, uint32_t expire)
+{
+    /* buckets are CLS aligned, so neighbouring rows get neighbouring
+     * partitions */
+    f->wpart = (uint8_t)(((uintptr_t)f->fb / sizeof(FlowBucket)) % FLOW_WHEEL_PARTS);
+    FlowWheel *w = FlowWheelGet(f);
+
+    SCMutexLock(&w->m);
+#ifdef DEBUG
+    BUG_ON(f->wslot != NULL);
+#endif
+    if (w->started == 0) {
+        w->cur = now;
+        w->started = 1;
+    }
+
+    FlowWheelSchedule(w, f, expire);
+    w->cnt++;
+    SCMutexUnlock(&w->m);
+}
+
+/**
+ *  \brief Remove a flow from the wheel, if it's in it
+ *
+ *  \param f flow that is being removed from the flow hash
+ *
+ *  \note flow bucket of the flow should be locked
+ */
+void FlowWheelRemove(Flow *f)
+{
+    FlowWheel *w = FlowWheelGet(f);
+
+    SCMutexLock(&w->m);
+    if (f->wslot != NULL) {
+        FlowWheelUnlink(f);
+        w->cnt--;
+    }
+    SCMutexUnlock(&w->m);
+}
+
+/**
+ *  \brief Move a flow to an earlier slot
+ *
+ *  Used when the flow changed to a state with a shorter timeout, e.g. when
+ *  a TCP session is closed. Flows scheduled for an earlier time, already
+ *  pending or currently handled by the flow manager are left alone.
+ *
+ *  \param f flow
+ *  \param expire new expire time in seconds
+ */
+void FlowWheelExpedite(Flow *f, uint32_t expire)
+{
+    FlowWheel *w = FlowWheelGet(f);
+
+    SCMutexLock(&w->m);
+    if (f->wslot != NULL && f->wslot != &w->pending &&
+        expire < f->wexpire)
+    {
+        FlowWheelUnlink(f);
+        FlowWheelSchedule(w, f, expire);
+    }
+    SCMutexUnlock(&w->m);
+}
+
+/** \internal
+ *  \brief Advance a single wheel to 'now'
+ *
+ *  \retval cnt number of flows that became pending
+ */
+static uint32_t FlowWheelAdvancePart(FlowWheel *w, uint32_t now)
+{
+    uint32_t cnt = 0;
+
+    SCMutexLock(&w->m);
+    if (w->started == 0 || now <= w->cur) {
+        SCMutexUnlock(&w->m);
+        return 0;
+    }
+
+    if (now - w->cur >= FLOW_WHEEL_SPAN) {
+        /* we've been away for longer than the wheel covers (e.g. a time
+         * jump in a pcap file), so everything is due. */
+        int i;
+        for (i = 0; i < FLOW_WHEEL_L0_SIZE; i++)
+            cnt += FlowWheelExpireSlot(w, &w->l0[i]);
+        for (i = 0; i < FLOW_WHEEL_L1_SIZE; i++)
+            cnt += FlowWheelExpireSlot(w, &w->l1[i]);
+        cnt += FlowWheelExpireSlot(w, &w->overflow);
+
+        w->cur = now;
+    } else {
+        while (w->cur != now) {
+            w->cur++;
+
+            if ((w->cur & FLOW_WHEEL_L0_MASK) == 0) {
+                if ((w->cur & (FLOW_WHEEL_SPAN - 1)) == 0)
+                    FlowWheelCascade(w, &w->overflow);
+
+                FlowWheelCascade(w, &w->l1[(w->cur >> FLOW_WHEEL_L0_BITS) &
+                                           FLOW_WHEEL_L1_MASK]);
+            }
+
+            cnt += FlowWheelExpireSlot(w, &w->l0[w->cur & FLOW_WHEEL_L0_MASK]);
+        }
+    }
+    SCMutexUnlock(&w->m);
+
+    return cnt;
+}
+
+/**
+ *  \brief Advance the wheels to 'now'
+ *
+ *  All flows scheduled up to and including 'now' are moved to the pending
+ *  lists, where they can be picked up using FlowWheelGetPending().
+ *
+ *  \param now current time in seconds
+ *
+ *  \retval cnt number of flows that became pending
+ */
+uint32_t FlowWheelAdvance(uint32_t now)
+{
+    uint32_t cnt = 0;
+    int i;
+
+    for (i = 0; i < FLOW_WHEEL_PARTS; i++)
+        cnt += FlowWheelAdvancePart(&flow_wheels[i], now);
+
+    SCLogDebug("%"PRIu32" flows pending at %"PRIu32, cnt, now);
+    return cnt;
+}
+
+/**
+ *  \brief Get the next pending flow
+ *
+ *  The flow is removed from the wheel and returned with its flow bucket
+ *  *LOCKED*, so it can't be removed from the hash by anyone else. The caller
+ *  either removes it from the hash or reinserts it using FlowWheelInsert().
+ *
+ *  Flows for which the bucket is busy are rescheduled for the next second.
+ *
+ *  \retval f flow with the bucket locked or NULL if none are pending
+ */
+Flow *FlowWheelGetPending(void)
+{
+    Flow *f = NULL;
+    int i;
+
+    for (i = 0; i < FLOW_WHEEL_PARTS && f == NULL; i++) {
+        FlowWheel *w = &flow_wheels[i];
+
+        SCMutexLock(&w->m);
+        while ((f = w->pending) != NULL) {
+            FlowWheelUnlink(f);
+
+            if (f->fb != NULL && FBLOCK_TRYLOCK(f->fb) == 0) {
+                w->cnt--;
+                break;
+            }
+
+            FlowWheelSchedule(w, f, w->cur + 1);
+        }
+        SCMutexUnlock(&w->m);
+    }
+
+    return f;
+}
+
+/** \brief get the number of flows in the wheels */
+uint32_t FlowWheelGetCount(void)
+{
+    uint32_t cnt = 0;
+    int i;
+
+    for (i = 0; i < FLOW_WHEEL_PARTS; i++) {
+        SCMutexLock(&flow_wheels[i].m);
+        cnt += flow_wheels[i].cnt;
+        SCMutexUnlock(&flow_wheels[i].m);
+    }
+
+    return cnt;
+}
+
+#ifdef UNITTESTS
+
+/** \internal
+ *  \brief advance the wheel in small steps until the flow is pending
+ *
+ *  \retval ts time the flow became pending or 0 if it never did
+ */
+static uint32_t FlowWheelTestRun(uint32_t start, uint32_t end, uint32_t step)
+{
+    uint32_t ts;
+
+    for (ts = start; ts <= end; ts += step) {
+        if (FlowWheelAdvance(ts) > 0)
+            return ts;
+    }
+    return 0;
+}
+
+/** \test flow in the first level */
+static int FlowWheelTest01 (void)
+{
+    Flow f;
+    FlowBucket fb;
+    int result = 0;
+
+    memset(&f, 0x00, sizeof(f));
+    memset(&fb, 0x00, sizeof(fb));
+    FBLOCK_INIT(&fb);
+    f.fb = &fb;
+
+    FlowWheelInit();
+    FlowWheelInsert(&f, 1000, 1010);
+
+    if (FlowWheelGetCount() != 1)
+        goto end;
+    if (FlowWheelTestRun(1001, 1100, 1) != 1010)
+        goto end;
+    if (FlowWheelGetPending() != &f)
+        goto end;
+    FBLOCK_UNLOCK(&fb);
+    if (FlowWheelGetPending() != NULL)
+        goto end;
+    if (FlowWheelGetCount() != 0)
+        goto end;
+
+    result = 1;
+end:
+    FlowWheelDestroy();
+    FBLOCK_DESTROY(&fb);
+    return result;
+}
+
+/** \test flows in the second level and the overflow list */
+static int FlowWheelTest02 (void)
+{
+    Flow f1, f2;
+    FlowBucket fb;
+    int result = 0;
+
+    memset(&f1, 0x00, sizeof(f1));
+    memset(&f2, 0x00, sizeof(f2));
+    memset(&fb, 0x00, sizeof(fb));
+    FBLOCK_INIT(&fb);
+    f1.fb = &fb;
+    f2.fb = &fb;
+
+    FlowWheelInit();
+    FlowWheelInsert(&f1, 1000, 1600);
+    FlowWheelInsert(&f2, 1000, 1000 + FLOW_WHEEL_SPAN + 1000);
+
+    if (FlowWheelTestRun(1001, 2000, 1) != 1600)
+        goto end;
+    if (FlowWheelGetPending() != &f1)
+        goto end;
+    FBLOCK_UNLOCK(&fb);
+
+    if (FlowWheelTestRun(2000, 2000 + FLOW_WHEEL_SPAN, 8) != 1000 + FLOW_WHEEL_SPAN + 1000)
+        goto end;
+    if (FlowWheelGetPending() != &f2)
+        goto end;
+    FBLOCK_UNLOCK(&fb);
+
+    result = 1;
+end:
+    FlowWheelDestroy();
+    FBLOCK_DESTROY(&fb);
+    return result;
+}
+
+/** \test remove and expedite */
+static int FlowWheelTest03 (void)
+{
+    Flow f1, f2;
+    FlowBucket fb;
+    int result = 0;
+
+    memset(&f1, 0x00, sizeof(f1));
+    memset(&f2, 0x00, sizeof(f2));
+    memset(&fb, 0x00, sizeof(fb));
+    FBLOCK_INIT(&fb);
+    f1.fb = &fb;
+    f2.fb = &fb;
+
+    FlowWheelInit();
+    FlowWheelInsert(&f1, 1000, 1300);
+    FlowWheelInsert(&f2, 1000, 1300);
+
+    FlowWheelRemove(&f1);
+    if (FlowWheelGetCount() != 1)
+        goto end;
+
+    FlowWheelExpedite(&f2, 1005);
+    if (FlowWheelTestRun(1001, 1400, 1) != 1005)
+        goto end;
+    if (FlowWheelGetPending() != &f2)
+        goto end;
+    FBLOCK_UNLOCK(&fb);
+
+    /* busy bucket: flow is rescheduled */
+    FlowWheelInsert(&f2, 1005, 1010);
+    FBLOCK_LOCK(&fb);
+    if (FlowWheelTestRun(1006, 1100, 1) != 1010)
+        goto end;
+    if (FlowWheelGetPending() != NULL)
+        goto end;
+    FBLOCK_UNLOCK(&fb);
+    if (FlowWheelGetCount() != 1)
+        goto end;
+    if (FlowWheelTestRun(1011, 1020, 1) != 1011)
+        goto end;
+    if (FlowWheelGetPending() != &f2)
+        goto end;
+    FBLOCK_UNLOCK(&fb);
+
+    result = 1;
+end:
+    FlowWheelDestroy();
+    FBLOCK_DESTROY(&fb);
+    return result;
+}
+
+/** \test flows of neighbouring rows use different wheels */
+static int FlowWheelTest04 (void)
+{
+    Flow f1, f2;
+    FlowBucket fb[2];
+    Flow *p1, *p2;
+    int result = 0;
+
+    memset(&f1, 0x00, sizeof(f1));
+    memset(&f2, 0x00, sizeof(f2));
+    memset(&fb, 0x00, sizeof(fb));
+    FBLOCK_INIT(&fb[0]);
+    FBLOCK_INIT(&fb[1]);
+    f1.fb = &fb[0];
+    f2.fb = &fb[1];
+
+    FlowWheelInit();
+    FlowWheelInsert(&f1, 1000, 1010);
+    FlowWheelInsert(&f2, 1000, 1010);
+
+    if (f1.wpart == f2.wpart || FlowWheelGetCount() != 2)
+        goto end;
+    if (FlowWheelTestRun(1001, 1100, 1) != 1010)
+        goto end;
+    p1 = FlowWheelGetPending();
+    p2 = FlowWheelGetPending();
+    if (p1 == NULL || p2 == NULL || p1 == p2)
+        goto end;
+    FBLOCK_UNLOCK(p1->fb);
+    FBLOCK_UNLOCK(p2->fb);
+    if (FlowWheelGetPending() != NULL)
+        goto end;
+    if (FlowWheelGetCount() != 0)
+        goto end;
+
+    result = 1;
+end:
+    FlowWheelDestroy();
+    FBLOCK_DESTROY(&fb[0]);
+    FBLOCK_DESTROY(&fb[1]);
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void FlowWheelRegisterTests (void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FlowWheelTest01", FlowWheelTest01, 1);
+    UtRegisterTest("FlowWheelTest02", FlowWheelTest02, 1);
+    UtRegisterTest("FlowWheelTest03", FlowWheelTest03, 1);
+    UtRegisterTest("FlowWheelTest04", FlowWheelTest04, 1);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,87 @@
+/* Copyright (C) 2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * \author agent <agent@local>
+ */
+
+#ifndef __FLOW_WHEEL_H__
+#define __FLOW_WHEEL_H__
+
+#include "suricata-common.h"
+#include "flow.h"
+
+/** level 0: 256 slots of one second each */
+#define FLOW_WHEEL_L0_BITS      8
+#define FLOW_WHEEL_L0_SIZE      (1 << FLOW_WHEEL_L0_BITS)
+#define FLOW_WHEEL_L0_MASK      (FLOW_WHEEL_L0_SIZE - 1)
+/** level 1: 64 slots of 256 seconds each */
+#define FLOW_WHEEL_L1_BITS      6
+#define FLOW_WHEEL_L1_SIZE      (1 << FLOW_WHEEL_L1_BITS)
+#define FLOW_WHEEL_L1_MASK      (FLOW_WHEEL_L1_SIZE - 1)
+/** time span covered by the wheel. Flows expiring later than this live
+ *  on the overflow list. */
+#define FLOW_WHEEL_SPAN         (FLOW_WHEEL_L0_SIZE * FLOW_WHEEL_L1_SIZE)
+/** number of wheels, flows are spread over them by hash row */
+#define FLOW_WHEEL_PARTS        16
+
+/**
+ *  \brief Hierarchical timing wheel for flow timeouts.
+ *
+ *  Each flow in the flow hash is also linked into one wheel slot, keyed on
+ *  the time it is expected to time out. The flow manager only visits the
+ *  flows of the slots that are due, instead of walking the whole hash.
+ *
+ *  Slots are not updated for every packet. A flow that saw packets after it
+ *  was scheduled is simply rescheduled based on its lastts when its slot
+ *  comes due.
+ *
+ *  A flow always uses the wheel of its hash row, see FLOW_WHEEL_PARTS.
+ *
+ *  Lock order: fb -> (f) -> wheel. The flow manager takes the wheel lock
+ *  first only with a trylock on the flow bucket.
+ */
+typedef struct FlowWheel_ {
+    Flow *l0[FLOW_WHEEL_L0_SIZE];
+    Flow *l1[FLOW_WHEEL_L1_SIZE];
+    Flow *overflow;
+    /** flows that are due and wait for the flow manager */
+    Flow *pending;
+
+    uint32_t cur;       /**< last second that was processed */
+    uint32_t cnt;       /**< number of flows in the wheel */
+    uint8_t started;    /**< cur has been initialized */
+
+    SCMutex m;
+} __attribute__((aligned(CLS))) FlowWheel;
+
+void FlowWheelInit(void);
+void FlowWheelDestroy(void);
+
+void FlowWheelInsert(Flow *, uint32_t, uint32_t);
+void FlowWheelRemove(Flow *);
+void FlowWheelExpedite(Flow *, uint32_t);
+
+uint32_t FlowWheelAdvance(uint32_t);
+Flow *FlowWheelGetPending(void);
+uint32_t FlowWheelGetCount(void);
+
+void FlowWheelRegisterTests(void);
+
+#endif /* __FLOW_WHEEL_H__ */
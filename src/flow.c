@@ -42,6 +42,7 @@
 #include "flow-private.h"
 #include "flow-timeout.h"
 #include "flow-manager.h"
+#include "flow-wheel.h"
 #include "flow-storage.h"
 
 #include "stream-tcp-private.h"
@@ -299,6 +300,7 @@ void FlowInitConfig(char quiet)
     SC_ATOMIC_INIT(flow_memuse);
     SC_ATOMIC_INIT(flow_prune_idx);
     FlowQueueInit(&flow_spare_q);
+    FlowWheelInit();
 
     unsigned int seed = RandomTimePreseed();
     /* set defaults */
@@ -465,6 +467,7 @@ void FlowShutdown(void)
     }
     (void) SC_ATOMIC_SUB(flow_memuse, flow_config.hash_size * sizeof(FlowBucket));
     FlowQueueDestroy(&flow_spare_q);
+    FlowWheelDestroy();
 
     SC_ATOMIC_DESTROY(flow_prune_idx);
     SC_ATOMIC_DESTROY(flow_memuse);
@@ -1047,6 +1050,37 @@ static int FlowTest09 (void)
     return result;
 }
 
+/**
+ *  \test   Test that the fields used in the hash lookup are in the first
+ *          cache line of the flow.
+ *
+ *  \retval On success it returns 1 and on failure 0.
+ */
+static int FlowTest10 (void)
+{
+    if (FLOW_HOT_SIZE > CLS) {
+        printf("hot part of the flow is %"PRIuMAX" bytes, more than a cache "
+                "line (%d): ", (uintmax_t)FLOW_HOT_SIZE, CLS);
+        return 0;
+    }
+    if (offsetof(Flow, hnext) >= CLS || offsetof(Flow, vlan_id) >= CLS) {
+        printf("lookup fields not in the first cache line: ");
+        return 0;
+    }
+    if (sizeof(Flow) % CLS != 0) {
+        printf("flow size %"PRIuMAX" not a multiple of the cache line size: ",
+                (uintmax_t)sizeof(Flow));
+        return 0;
+    }
+
+    Flow *f = FlowAlloc();
+    if (f == NULL)
+        return 0;
+    int result = (((uintptr_t)f % CLS) == 0);
+    FlowFree(f);
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 /**
@@ -1060,8 +1094,10 @@ void FlowRegisterTests (void)
     UtRegisterTest("FlowTest07 -- Test flow Allocations when it reach memcap", FlowTest07, 1);
     UtRegisterTest("FlowTest08 -- Test flow Allocations when it reach memcap", FlowTest08, 1);
     UtRegisterTest("FlowTest09 -- Test flow Allocations when it reach memcap", FlowTest09, 1);
+    UtRegisterTest("FlowTest10 -- Test flow hot fields cache line layout", FlowTest10, 1);
 
     FlowMgrRegisterTests();
+    FlowWheelRegisterTests();
     RegisterFlowStorageTests();
 #endif /* UNITTESTS */
 }
@@ -266,6 +266,13 @@ typedef unsigned short FlowRefCount;
  *  The flow "header" (addresses, ports, proto, recursion level) are static
  *  after the initialization and remain read-only throughout the entire live
  *  of a flow. This is why we can access those without protection of the lock.
+ *
+ *  Layout
+ *
+ *  The flow is cache line aligned. The header, the hash list 'next' ptr and
+ *  the fields updated for every packet fit in the first cache line, so that
+ *  the hash lookup doesn't pull in the rest of the flow for the flows in
+ *  the hash row that don't match. Rarely used fields are at the end.
  */
 
 typedef struct Flow_
@@ -295,17 +302,22 @@ typedef struct Flow_
      */
     SC_ATOMIC_DECLARE(FlowRefCount, use_cnt);
 
-    /** flow queue id, used with autofp */
-    SC_ATOMIC_DECLARE(int, autofp_tmqh_flow_qid);
-
-    uint32_t probing_parser_toserver_al_proto_masks;
-    uint32_t probing_parser_toclient_al_proto_masks;
+    /** hash list pointer, protected by fb->s. Kept in the first cache line
+     *  together with the header, so walking a hash row only touches a
+     *  single cache line per flow. */
+    struct Flow_ *hnext; /* hash list */
 
     uint32_t flags;
 
     /* ts of flow init and last update */
     int32_t lastts_sec;
 
+    /* end of the "hot" part of the flow, see FLOW_HOT_SIZE. Below are the
+     * fields used once the flow is found. */
+
+    struct Flow_ *hprev;
+    struct FlowBucket_ *fb;
+
 #ifdef FLOWLOCK_RWLOCK
     SCRWLock r;
 #elif defined FLOWLOCK_MUTEX
@@ -326,13 +338,6 @@ typedef struct Flow_
     uint16_t alproto_ts;
     uint16_t alproto_tc;
 
-    uint32_t data_al_so_far[2];
-
-    /** detection engine ctx id used to inspect this flow. Set at initial
-     *  inspection. If it doesn't match the currently in use de_ctx, the
-     *  de_state and stored sgh ptrs are reset. */
-    uint32_t de_ctx_id;
-
     /** application level storage ptrs.
      *
      */
@@ -349,26 +354,51 @@ typedef struct Flow_
      *  has been set. */
     struct SigGroupHead_ *sgh_toserver;
 
+    /** flow queue id, used with autofp */
+    SC_ATOMIC_DECLARE(int, autofp_tmqh_flow_qid);
+
+    /* rarely used fields below */
+
+    uint32_t probing_parser_toserver_al_proto_masks;
+    uint32_t probing_parser_toclient_al_proto_masks;
+
+    uint32_t data_al_so_far[2];
+
+    /** detection engine ctx id used to inspect this flow. Set at initial
+     *  inspection. If it doesn't match the currently in use de_ctx, the
+     *  de_state and stored sgh ptrs are reset. */
+    uint32_t de_ctx_id;
+
+    /** interface the flow was first seen on, used to select the tenant
+     *  engine for all packets of the flow, including pseudo packets */
+    struct LiveDevice_ *livedev;
+
     /* pointer to the var list */
     GenericVar *flowvar;
 
     SCMutex de_state_m;          /**< mutex lock for the de_state object */
 
-    /** hash list pointers, protected by fb->s */
-    struct Flow_ *hnext; /* hash list */
-    struct Flow_ *hprev;
-    struct FlowBucket_ *fb;
-
     /** queue list pointers, protected by queue mutex */
     struct Flow_ *lnext; /* list */
     struct Flow_ *lprev;
+
+    /** timing wheel list pointers, protected by the wheel lock */
+    struct Flow_ *wnext;
+    struct Flow_ *wprev;
+    struct Flow_ **wslot;   /**< list head of the wheel slot we're in */
+    uint32_t wexpire;       /**< time (sec) we're scheduled to expire */
+    uint8_t wpart;          /**< wheel partition, set on insert */
+
     struct timeval startts;
 #ifdef DEBUG
     uint32_t todstpktcnt;
     uint32_t tosrcpktcnt;
     uint64_t bytecnt;
 #endif
-} Flow;
+} __attribute__((aligned(CLS))) Flow;
+
+/** size of the part of the flow that is used during the hash lookup */
+#define FLOW_HOT_SIZE (offsetof(Flow, lastts_sec) + sizeof(int32_t))
 
 enum {
     FLOW_STATE_NEW = 0,
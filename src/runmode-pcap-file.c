@@ -23,6 +23,8 @@
 #include "log-httplog.h"
 #include "output.h"
 #include "source-pfring.h"
+#include "source-pcap-file.h"
+#include "tmqh-flow.h"
 #include "detect-engine-mpm.h"
 
 #include "alert-fastlog.h"
@@ -60,6 +62,11 @@ void RunModeFilePcapRegister(void)
                               "the same flow can be processed by any detect "
                               "thread",
                               RunModeFilePcapAutoFp);
+    RunModeRegisterNewRunMode(RUNMODE_PCAP_FILE, "workers",
+                              "Workers pcap file mode, each thread reads the "
+                              "file and handles the flows that hash to it, "
+                              "from decoding to output",
+                              RunModeFilePcapWorkers);
 
     return;
 }
@@ -361,12 +368,15 @@ int RunModeFilePcapAutoFp(DetectEngineCtx *de_ctx)
     }
     TmSlotSetFuncAppend(tv_receivepcap, tm_module, file);
 
-    tm_module = TmModuleGetByName("DecodePcapFile");
-    if (tm_module == NULL) {
-        SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName DecodePcap failed");
-        exit(EXIT_FAILURE);
+    /* with rss the packets are decoded by the detect threads */
+    if (!TmqhFlowIsRss()) {
+        tm_module = TmModuleGetByName("DecodePcapFile");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName DecodePcap failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_receivepcap, tm_module, NULL);
     }
-    TmSlotSetFuncAppend(tv_receivepcap, tm_module, NULL);
 
     TmThreadSetCPU(tv_receivepcap, RECEIVE_CPU_SET);
 
@@ -397,6 +407,14 @@ int RunModeFilePcapAutoFp(DetectEngineCtx *de_ctx)
             SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
             exit(EXIT_FAILURE);
         }
+        if (TmqhFlowIsRss()) {
+            tm_module = TmModuleGetByName("DecodePcapFile");
+            if (tm_module == NULL) {
+                SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName DecodePcapFile failed");
+                exit(EXIT_FAILURE);
+            }
+            TmSlotSetFuncAppend(tv_detect_ncpu, tm_module, NULL);
+        }
         tm_module = TmModuleGetByName("StreamTcp");
         if (tm_module == NULL) {
             SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName StreamTcp failed");
@@ -437,3 +455,107 @@ int RunModeFilePcapAutoFp(DetectEngineCtx *de_ctx)
 
     return 0;
 }
+
+/**
+ * \brief RunModeFilePcapWorkers set up the following thread packet handlers:
+ *        - Worker threads that each read the (mmap'd) pcap file and handle
+ *          the packets of the flows that hash to them, from decoding to
+ *          output.
+ *
+ *        There is no single reader thread that the other threads depend on,
+ *        so decoding scales with the number of threads as well.
+ *
+ * \param de_ctx Pointer to the Detection Engine
+ *
+ * \retval 0 If all goes well. (If any problem is detected the engine will
+ *           exit()).
+ */
+int RunModeFilePcapWorkers(DetectEngineCtx *de_ctx)
+{
+    SCEnter();
+    char tname[TM_THREAD_NAME_MAX];
+    int thread;
+
+    RunModeInitialize();
+
+    char *file = NULL;
+    if (ConfGet("pcap-file.file", &file) == 0) {
+        SCLogError(SC_ERR_RUNMODE, "Failed retrieving pcap-file from Conf");
+        exit(EXIT_FAILURE);
+    }
+    SCLogDebug("file %s", file);
+
+    TimeModeSetOffline();
+
+    /* Available cpus */
+    uint16_t ncpus = UtilCpuGetNumProcessorsOnline();
+
+    /* always create at least one thread */
+    int thread_max = TmThreadGetNbThreads(DETECT_CPU_SET);
+    if (thread_max == 0)
+        thread_max = ncpus * threading_detect_ratio;
+    if (thread_max < 1)
+        thread_max = 1;
+
+    ReceivePcapFileMmapSetThreads(thread_max);
+
+    for (thread = 0; thread < thread_max; thread++) {
+        snprintf(tname, sizeof(tname), "PcapFileWorker%"PRIu16, thread+1);
+
+        char *thread_name = SCStrdup(tname);
+        if (unlikely(thread_name == NULL)) {
+            SCLogError(SC_ERR_RUNMODE, "failed to strdup thread name");
+            exit(EXIT_FAILURE);
+        }
+
+        ThreadVars *tv =
+            TmThreadCreatePacketHandler(thread_name,
+                                        "packetpool", "packetpool",
+                                        "packetpool", "packetpool",
+                                        "pktacqloop");
+        if (tv == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
+            exit(EXIT_FAILURE);
+        }
+
+        TmModule *tm_module = TmModuleGetByName("ReceivePcapFileMmap");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName failed for ReceivePcapFileMmap");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv, tm_module, file);
+
+        tm_module = TmModuleGetByName("DecodePcapFile");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName DecodePcapFile failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv, tm_module, NULL);
+
+        tm_module = TmModuleGetByName("StreamTcp");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName StreamTcp failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv, tm_module, NULL);
+
+        tm_module = TmModuleGetByName("Detect");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName Detect failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv, tm_module, (void *)de_ctx);
+
+        /* add outputs as well */
+        SetupOutputs(tv);
+
+        TmThreadSetCPU(tv, DETECT_CPU_SET);
+
+        if (TmThreadSpawn(tv) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return 0;
+}
@@ -77,6 +77,7 @@
 #include "util-radix-tree.h"
 #include "util-host-os-info.h"
 #include "util-cidr.h"
+#include "util-rss.h"
 #include "util-unittest-helper.h"
 #include "util-time.h"
 #include "util-rule-vars.h"
@@ -207,6 +208,7 @@ int RunUnittests(int list_unittests, char *regex_arg)
     ConfRegisterTests();
     ConfYamlRegisterTests();
     TmqhFlowRegisterTests();
+    RssRegisterTests();
     FlowRegisterTests();
     SCSigRegisterSignatureOrderingTests();
     SCRadixRegisterTests();
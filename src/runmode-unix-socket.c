@@ -42,6 +42,9 @@
 #include "output.h"
 #include "host.h"
 #include "defrag.h"
+#include "runmode-unix-socket.h"
+
+#include <dirent.h>
 
 static const char *default_mode = NULL;
 
@@ -58,8 +61,25 @@ typedef struct PcapCommand_ {
     TAILQ_HEAD(, PcapFiles_) files;
     int running;
     char *currentfile;
+
+    /** directory watched for new files in continuous mode */
+    char *dir;
+    char *dir_output;
+    /** name of the last file taken from dir. Files are picked up in name
+     *  order, so only names sorting after this one are new. */
+    char *dir_last;
+    time_t dir_scan;        /**< time of the last scan */
+
+    /** protects files and currentfile, as the pcap reader thread takes
+     *  files from the queue in continuous mode. */
+    SCMutex m;
 } PcapCommand;
 
+/** a file is only picked up from the watched directory if it wasn't
+ *  modified for this many seconds, so we don't read a file that is still
+ *  being written. */
+#define PCAP_DIR_SETTLE_TIME    2
+
 const char *RunModeUnixSocketGetDefaultMode(void)
 {
     return default_mode;
@@ -69,6 +89,7 @@ const char *RunModeUnixSocketGetDefaultMode(void)
 
 static int unix_manager_file_task_running = 0;
 static int unix_manager_file_task_failed = 0;
+static PcapCommand *unix_pcapcmd = NULL;
 
 /**
  * \brief return list of files in the queue
@@ -96,10 +117,12 @@ static TmEcode UnixSocketPcapFilesList(json_t *cmd, json_t* answer, void *data)
                             json_string("internal error at json object creation"));
         return TM_ECODE_FAILED;
     }
+    SCMutexLock(&this->m);
     TAILQ_FOREACH(file, &this->files, next) {
         json_array_append_new(jarray, json_string(file->filename));
         i++;
     }
+    SCMutexUnlock(&this->m);
     json_object_set_new(jdata, "count", json_integer(i));
     json_object_set_new(jdata, "files", jarray);
     json_object_set_new(answer, "message", jdata);
@@ -112,9 +135,11 @@ static TmEcode UnixSocketPcapFilesNumber(json_t *cmd, json_t* answer, void *data
     int i = 0;
     PcapFiles *file;
 
+    SCMutexLock(&this->m);
     TAILQ_FOREACH(file, &this->files, next) {
         i++;
     }
+    SCMutexUnlock(&this->m);
     json_object_set_new(answer, "message", json_integer(i));
     return TM_ECODE_OK;
 }
@@ -123,11 +148,13 @@ static TmEcode UnixSocketPcapCurrent(json_t *cmd, json_t* answer, void *data)
 {
     PcapCommand *this = (PcapCommand *) data;
 
+    SCMutexLock(&this->m);
     if (this->currentfile) {
         json_object_set_new(answer, "message", json_string(this->currentfile));
     } else {
         json_object_set_new(answer, "message", json_string("None"));
     }
+    SCMutexUnlock(&this->m);
     return TM_ECODE_OK;
 }
 
@@ -182,7 +209,9 @@ TmEcode UnixListAddFile(PcapCommand *this, const char *filename, const char *out
         }
     }
 
+    SCMutexLock(&this->m);
     TAILQ_INSERT_TAIL(&this->files, cfile, next);
+    SCMutexUnlock(&this->m);
     return TM_ECODE_OK;
 }
 
@@ -257,6 +286,150 @@ TmEcode UnixSocketAddPcapFile(json_t *cmd, json_t* answer, void *data)
     return TM_ECODE_OK;
 }
 
+/**
+ * \brief Start reading a file into the page cache
+ *
+ * Used to read the next file in the queue ahead while the current one is
+ * being processed.
+ */
+static void UnixSocketPcapFilePrefetch(const char *filename)
+{
+#ifdef POSIX_FADV_WILLNEED
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        return;
+    (void)posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+#endif
+}
+
+/**
+ * \brief Queue the new files of the watched directory
+ *
+ * Files are taken in name order, as rotated capture files are named
+ * sequentially. A file that was modified recently may still be written
+ * to, so it and the files after it are left for a later scan.
+ *
+ * \param this a UnixCommand:: structure
+ */
+static void UnixSocketPcapDirScan(PcapCommand *this)
+{
+    struct dirent **names = NULL;
+    time_t now = time(NULL);
+    int stop = 0;
+    int n, i;
+
+    n = scandir(this->dir, &names, NULL, alphasort);
+    if (n < 0) {
+        SCLogWarning(SC_ERR_FOPEN, "Unable to scan directory '%s': %s",
+                     this->dir, strerror(errno));
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        char path[PATH_MAX];
+        struct stat st;
+        const char *name = names[i]->d_name;
+
+        if (stop || name[0] == '.')
+            goto next;
+        if (this->dir_last != NULL && strcmp(name, this->dir_last) <= 0)
+            goto next;
+
+        snprintf(path, sizeof(path), "%s/%s", this->dir, name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+            goto next;
+        if (st.st_mtime + PCAP_DIR_SETTLE_TIME > now) {
+            stop = 1;
+            goto next;
+        }
+
+        if (UnixListAddFile(this, path, this->dir_output) != TM_ECODE_OK) {
+            stop = 1;
+            goto next;
+        }
+        SCLogInfo("Added file '%s' to list", path);
+
+        if (this->dir_last != NULL)
+            SCFree(this->dir_last);
+        this->dir_last = SCStrdup(name);
+        if (unlikely(this->dir_last == NULL))
+            stop = 1;
+next:
+        free(names[i]);
+    }
+    free(names);
+}
+
+/**
+ * \brief Command to watch a directory for new files
+ *
+ * The engine is not restarted between the files of the directory, so
+ * flow and stream state are kept across rotated capture files. All files
+ * are logged to the output dir of the first run.
+ *
+ * \param cmd the content of command Arguments as a json_t object
+ * \param answer the json_t object that has to be used to answer
+ * \param data pointer to data defining the context here a PcapCommand::
+ */
+TmEcode UnixSocketAddPcapDir(json_t *cmd, json_t* answer, void *data)
+{
+    PcapCommand *this = (PcapCommand *) data;
+    const char *dirname;
+    const char *output_dir;
+    struct stat st;
+
+    if (this->dir != NULL) {
+        json_object_set_new(answer, "message", json_string("A directory is already watched"));
+        return TM_ECODE_FAILED;
+    }
+
+    json_t *jarg = json_object_get(cmd, "directory");
+    if(!json_is_string(jarg)) {
+        SCLogInfo("error: directory is not a string");
+        json_object_set_new(answer, "message", json_string("directory is not a string"));
+        return TM_ECODE_FAILED;
+    }
+    dirname = json_string_value(jarg);
+    if (stat(dirname, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        json_object_set_new(answer, "message", json_string("Directory does not exist"));
+        return TM_ECODE_FAILED;
+    }
+
+    json_t *oarg = json_object_get(cmd, "output-dir");
+    if(!json_is_string(oarg)) {
+        SCLogInfo("error: can't get output-dir");
+        json_object_set_new(answer, "message", json_string("output dir param is mandatory"));
+        return TM_ECODE_FAILED;
+    }
+    output_dir = json_string_value(oarg);
+    if (stat(output_dir, &st) != 0) {
+        json_object_set_new(answer, "message", json_string("Output directory does not exist"));
+        return TM_ECODE_FAILED;
+    }
+
+    this->dir_output = SCStrdup(output_dir);
+    if (unlikely(this->dir_output == NULL)) {
+        json_object_set_new(answer, "message", json_string("Unable to add directory"));
+        return TM_ECODE_FAILED;
+    }
+    /* set last, the pcap reader thread checks it */
+    this->dir = SCStrdup(dirname);
+    if (unlikely(this->dir == NULL)) {
+        SCFree(this->dir_output);
+        this->dir_output = NULL;
+        json_object_set_new(answer, "message", json_string("Unable to add directory"));
+        return TM_ECODE_FAILED;
+    }
+
+    SCLogInfo("Watching directory '%s' for pcap files", dirname);
+    UnixSocketPcapDirScan(this);
+    this->dir_scan = time(NULL);
+
+    json_object_set_new(answer, "message", json_string("Successfully added directory"));
+    return TM_ECODE_OK;
+}
+
 /**
  * \brief Handle the file queue
  *
@@ -273,6 +446,12 @@ TmEcode UnixSocketAddPcapFile(json_t *cmd, json_t* answer, void *data)
 TmEcode UnixSocketPcapFilesCheck(void *data)
 {
     PcapCommand *this = (PcapCommand *) data;
+
+    if (this->dir != NULL && this->dir_scan != time(NULL)) {
+        UnixSocketPcapDirScan(this);
+        this->dir_scan = time(NULL);
+    }
+
     if (unix_manager_file_task_running == 1) {
         return TM_ECODE_OK;
     }
@@ -282,10 +461,12 @@ TmEcode UnixSocketPcapFilesCheck(void *data)
         }
         unix_manager_file_task_failed = 0;
         this->running = 0;
+        SCMutexLock(&this->m);
         if (this->currentfile) {
             SCFree(this->currentfile);
         }
         this->currentfile = NULL;
+        SCMutexUnlock(&this->m);
         TmThreadKillThreadsFamily(TVT_MGMT);
         TmThreadClearThreadsFamily(TVT_MGMT);
         TmThreadDisableThreadsWithTMS(TM_FLAG_RECEIVE_TM | TM_FLAG_DECODE_TM);
@@ -301,9 +482,15 @@ TmEcode UnixSocketPcapFilesCheck(void *data)
         DefragDestroy();
         TmqResetQueues();
     }
-    if (!TAILQ_EMPTY(&this->files)) {
-        PcapFiles *cfile = TAILQ_FIRST(&this->files);
+    SCMutexLock(&this->m);
+    PcapFiles *cfile = TAILQ_FIRST(&this->files);
+    if (cfile != NULL) {
         TAILQ_REMOVE(&this->files, cfile, next);
+        if (TAILQ_FIRST(&this->files) != NULL)
+            UnixSocketPcapFilePrefetch(TAILQ_FIRST(&this->files)->filename);
+    }
+    SCMutexUnlock(&this->m);
+    if (cfile != NULL) {
         SCLogInfo("Starting run for '%s'", cfile->filename);
         unix_manager_file_task_running = 1;
         this->running = 1;
@@ -319,7 +506,9 @@ TmEcode UnixSocketPcapFilesCheck(void *data)
                 return TM_ECODE_FAILED;
             }
         }
+        SCMutexLock(&this->m);
         this->currentfile = SCStrdup(cfile->filename);
+        SCMutexUnlock(&this->m);
         PcapFilesFree(cfile);
         SCPerfInitCounterApi();
         DefragInit();
@@ -376,9 +565,12 @@ int RunModeUnixSocketSingle(DetectEngineCtx *de_ctx)
         SCLogError(SC_ERR_MEM_ALLOC, "Can not allocate pcap command");
         return 1;
     }
+    memset(pcapcmd, 0, sizeof(PcapCommand));
     pcapcmd->de_ctx = de_ctx;
     TAILQ_INIT(&pcapcmd->files);
     pcapcmd->currentfile = NULL;
+    SCMutexInit(&pcapcmd->m, NULL);
+    unix_pcapcmd = pcapcmd;
 
     UnixManagerThreadSpawn(de_ctx, 1);
 
@@ -388,6 +580,7 @@ int RunModeUnixSocketSingle(DetectEngineCtx *de_ctx)
     UnixManagerRegisterCommand("pcap-file-number", UnixSocketPcapFilesNumber, pcapcmd, 0);
     UnixManagerRegisterCommand("pcap-file-list", UnixSocketPcapFilesList, pcapcmd, 0);
     UnixManagerRegisterCommand("pcap-current", UnixSocketPcapCurrent, pcapcmd, 0);
+    UnixManagerRegisterCommand("pcap-dir", UnixSocketAddPcapDir, pcapcmd, UNIX_CMD_TAKE_ARGS);
 
     UnixManagerRegisterBackgroundTask(UnixSocketPcapFilesCheck, pcapcmd);
 #endif
@@ -400,6 +593,55 @@ int RunModeUnixSocketIsActive(void)
     return unix_socket_mode_is_running;
 }
 
+/**
+ * \brief check if files are processed without restarting the engine
+ *
+ * \retval 1 a directory is watched, the pcap reader should continue with
+ *           the next queued file at the end of a file
+ * \retval 0 the engine is restarted for each file
+ */
+int UnixSocketPcapFileIsContinuous(void)
+{
+#ifdef BUILD_UNIX_SOCKET
+    if (unix_pcapcmd != NULL && unix_pcapcmd->dir != NULL)
+        return 1;
+#endif
+    return 0;
+}
+
+/**
+ * \brief take the next queued file for the running pcap reader
+ *
+ * Only used in continuous mode. Starts reading ahead the file after it.
+ *
+ * \retval filename to be freed by the caller, NULL if the queue is empty
+ */
+char *UnixSocketPcapFileGetNext(void)
+{
+    char *filename = NULL;
+#ifdef BUILD_UNIX_SOCKET
+    PcapCommand *this = unix_pcapcmd;
+    if (this == NULL)
+        return NULL;
+
+    SCMutexLock(&this->m);
+    PcapFiles *cfile = TAILQ_FIRST(&this->files);
+    if (cfile != NULL) {
+        TAILQ_REMOVE(&this->files, cfile, next);
+        if (TAILQ_FIRST(&this->files) != NULL)
+            UnixSocketPcapFilePrefetch(TAILQ_FIRST(&this->files)->filename);
+
+        filename = SCStrdup(cfile->filename);
+        if (this->currentfile)
+            SCFree(this->currentfile);
+        this->currentfile = SCStrdup(cfile->filename);
+        PcapFilesFree(cfile);
+    }
+    SCMutexUnlock(&this->m);
+#endif
+    return filename;
+}
+
 
 
 
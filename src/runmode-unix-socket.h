@@ -30,5 +30,7 @@ const char *RunModeUnixSocketGetDefaultMode(void);
 int RunModeUnixSocketIsActive(void);
 
 void UnixSocketPcapFile(TmEcode tm);
+int UnixSocketPcapFileIsContinuous(void);
+char *UnixSocketPcapFileGetNext(void);
 
 #endif /* __RUNMODE_UNIX_SOCKET_H__ */
@@ -43,6 +43,11 @@
 #include "util-profiling.h"
 #include "runmode-unix-socket.h"
 #include "global-hashmap-redirection.h"
+#include "util-byte.h"
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #ifdef __SC_CUDA_SUPPORT__
 
@@ -90,11 +95,20 @@ typedef struct PcapFileThreadVars_
 
 static PcapFileGlobalVars pcap_g;
 
+/** packet time in usec we last woke up the flow manager for. With the
+ *  mmap runmode all reader threads decode, so it's only updated through
+ *  a CAS. */
+SC_ATOMIC_DECLARE(uint64_t, prev_signaled_ts);
+
+/** wake up the flow manager every 60 seconds of packet time */
+#define PCAP_FILE_FM_WAKEUP_USEC    (60ULL * 1000000ULL)
+
 TmEcode ReceivePcapFileLoop(ThreadVars *, void *, void *);
 
 TmEcode ReceivePcapFileThreadInit(ThreadVars *, void *, void **);
 void ReceivePcapFileThreadExitStats(ThreadVars *, void *);
 TmEcode ReceivePcapFileThreadDeinit(ThreadVars *, void *);
+static int PcapFileContinue(void);
 
 TmEcode DecodePcapFile(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
 TmEcode DecodePcapFileThreadInit(ThreadVars *, void *, void **);
@@ -122,6 +136,41 @@ void TmModuleDecodePcapFileRegister (void) {
     tmm_modules[TMM_DECODEPCAPFILE].RegisterTests = NULL;
     tmm_modules[TMM_DECODEPCAPFILE].cap_flags = 0;
     tmm_modules[TMM_DECODEPCAPFILE].flags = TM_FLAG_DECODE_TM;
+
+    SC_ATOMIC_INIT(prev_signaled_ts);
+}
+
+/**
+ *  \brief set the datalink type and matching decoder for the file
+ *
+ *  \retval 0 ok
+ *  \retval -1 datalink not supported
+ */
+static int PcapFileSetDecoder(int datalink)
+{
+    pcap_g.datalink = datalink;
+    SCLogDebug("datalink %" PRId32 "", pcap_g.datalink);
+
+    switch(pcap_g.datalink) {
+        case LINKTYPE_LINUX_SLL:
+            pcap_g.Decoder = DecodeSll;
+            break;
+        case LINKTYPE_ETHERNET:
+            pcap_g.Decoder = DecodeEthernet;
+            break;
+        case LINKTYPE_PPP:
+            pcap_g.Decoder = DecodePPP;
+            break;
+        case LINKTYPE_RAW:
+            pcap_g.Decoder = DecodeRaw;
+            break;
+
+        default:
+            SCLogError(SC_ERR_UNIMPLEMENTED, "datalink type %" PRId32 " not "
+                      "(yet) supported in module PcapFile.\n", pcap_g.datalink);
+            return -1;
+    }
+    return 0;
 }
 
 void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt) {
@@ -195,7 +244,11 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
         if (unlikely(r == -1)) {
             SCLogError(SC_ERR_PCAP_DISPATCH, "error code %" PRId32 " %s",
                        r, pcap_geterr(pcap_g.pcap_handle));
-            if (! RunModeUnixSocketIsActive()) {
+            if (UnixSocketPcapFileIsContinuous()) {
+                if (PcapFileContinue() < 0)
+                    SCReturnInt(TM_ECODE_OK);
+                continue;
+            } else if (! RunModeUnixSocketIsActive()) {
                 /* in the error state we just kill the engine */
                 EngineKill();
                 SCReturnInt(TM_ECODE_FAILED);
@@ -208,7 +261,11 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
         } else if (unlikely(r == 0)) {
             //TempRaiseAlertHeuristic10();
             SCLogInfo("pcap file end of file reached (pcap err code %" PRId32 ")", r);
-            if (! RunModeUnixSocketIsActive()) {
+            if (UnixSocketPcapFileIsContinuous()) {
+                if (PcapFileContinue() < 0)
+                    SCReturnInt(TM_ECODE_OK);
+                continue;
+            } else if (! RunModeUnixSocketIsActive()) {
                 EngineStop();
             } else {
                 pcap_close(pcap_g.pcap_handle);
@@ -236,9 +293,91 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
     SCReturnInt(TM_ECODE_OK);
 }
 
+/**
+ *  \brief compile and set the bpf filter, if any, on the current handle
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+static int PcapFileSetFilter(void)
+{
+    char *tmpbpfstring = NULL;
+
+    if (ConfGet("bpf-filter", &tmpbpfstring) != 1) {
+        SCLogDebug("could not get bpf or none specified");
+        return 0;
+    }
+    SCLogInfo("using bpf-filter \"%s\"", tmpbpfstring);
+
+    if(pcap_compile(pcap_g.pcap_handle,&pcap_g.filter,tmpbpfstring,1,0) < 0) {
+        SCLogError(SC_ERR_BPF,"bpf compilation error %s",pcap_geterr(pcap_g.pcap_handle));
+        return -1;
+    }
+
+    if(pcap_setfilter(pcap_g.pcap_handle,&pcap_g.filter) < 0) {
+        SCLogError(SC_ERR_BPF,"could not set bpf filter %s",pcap_geterr(pcap_g.pcap_handle));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ *  \brief close the current file and continue with the next queued one
+ *
+ *  Used in the unix socket continuous mode, where the engine and with it
+ *  the flow and stream state are kept between files. Waits for a file to
+ *  be queued if there is none.
+ *
+ *  \retval 0 next file is open
+ *  \retval -1 engine is shutting down
+ */
+static int PcapFileContinue(void)
+{
+    if (pcap_g.pcap_handle != NULL) {
+        pcap_close(pcap_g.pcap_handle);
+        pcap_g.pcap_handle = NULL;
+    }
+    pcap_freecode(&pcap_g.filter);
+
+    while (!(suricata_ctl_flags & (SURICATA_STOP | SURICATA_KILL))) {
+        char *filename = UnixSocketPcapFileGetNext();
+        if (filename == NULL) {
+            usleep(100000);
+            continue;
+        }
+
+        char errbuf[PCAP_ERRBUF_SIZE] = "";
+        pcap_g.pcap_handle = pcap_open_offline(filename, errbuf);
+        if (pcap_g.pcap_handle == NULL) {
+            SCLogError(SC_ERR_FOPEN, "%s, skipping it", errbuf);
+            SCFree(filename);
+            continue;
+        }
+
+        /* packets of the previous file may still be in the pipeline, so
+         * the decoder can't be changed */
+        if (pcap_datalink(pcap_g.pcap_handle) != pcap_g.datalink ||
+                PcapFileSetFilter() < 0) {
+            SCLogError(SC_ERR_UNIMPLEMENTED, "datalink type %" PRId32 " of "
+                    "%s differs from the previous file or filter setup "
+                    "failed, skipping it", pcap_datalink(pcap_g.pcap_handle),
+                    filename);
+            pcap_close(pcap_g.pcap_handle);
+            pcap_g.pcap_handle = NULL;
+            pcap_freecode(&pcap_g.filter);
+            SCFree(filename);
+            continue;
+        }
+
+        SCLogInfo("continuing with pcap file %s", filename);
+        SCFree(filename);
+        return 0;
+    }
+    return -1;
+}
+
 TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, void *initdata, void **data) {
     SCEnter();
-    char *tmpbpfstring = NULL;
     if (initdata == NULL) {
         SCLogError(SC_ERR_INVALID_ARGUMENT, "error: initdata == NULL");
         SCReturnInt(TM_ECODE_FAILED);
@@ -264,78 +403,561 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, void *initdata, void **data) {
         }
     }
 
-    if (ConfGet("bpf-filter", &tmpbpfstring) != 1) {
-        SCLogDebug("could not get bpf or none specified");
-    } else {
-        SCLogInfo("using bpf-filter \"%s\"", tmpbpfstring);
+    if (PcapFileSetFilter() < 0) {
+        SCFree(ptv);
+        return TM_ECODE_FAILED;
+    }
 
-        if(pcap_compile(pcap_g.pcap_handle,&pcap_g.filter,tmpbpfstring,1,0) < 0) {
-            SCLogError(SC_ERR_BPF,"bpf compilation error %s",pcap_geterr(pcap_g.pcap_handle));
-            SCFree(ptv);
-            return TM_ECODE_FAILED;
+    if (PcapFileSetDecoder(pcap_datalink(pcap_g.pcap_handle)) < 0) {
+        SCFree(ptv);
+        if (! RunModeUnixSocketIsActive()) {
+            SCReturnInt(TM_ECODE_FAILED);
+        } else {
+            pcap_close(pcap_g.pcap_handle);
+            pcap_g.pcap_handle = NULL;
+            UnixSocketPcapFile(TM_ECODE_DONE);
+            SCReturnInt(TM_ECODE_DONE);
         }
+    }
 
-        if(pcap_setfilter(pcap_g.pcap_handle,&pcap_g.filter) < 0) {
-            SCLogError(SC_ERR_BPF,"could not set bpf filter %s",pcap_geterr(pcap_g.pcap_handle));
-            SCFree(ptv);
-            return TM_ECODE_FAILED;
-        }
+    ptv->tv = tv;
+    *data = (void *)ptv;
+    SCReturnInt(TM_ECODE_OK);
+}
+
+void ReceivePcapFileThreadExitStats(ThreadVars *tv, void *data) {
+    SCEnter();
+    PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
+
+    SCLogInfo("Pcap-file module read %" PRIu32 " packets, %" PRIu64 " bytes", ptv->pkts, ptv->bytes);
+    return;
+}
+
+TmEcode ReceivePcapFileThreadDeinit(ThreadVars *tv, void *data) {
+    SCEnter();
+    PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
+    if (ptv) {
+        SCFree(ptv);
     }
+    SCReturnInt(TM_ECODE_OK);
+}
 
-    pcap_g.datalink = pcap_datalink(pcap_g.pcap_handle);
-    SCLogDebug("datalink %" PRId32 "", pcap_g.datalink);
+/**
+ *  \defgroup pcapfilemmap Multi threaded pcap file reading
+ *
+ *  The file is mmap'd once and walked by all reader threads. Each thread
+ *  walks all record headers, but only processes the records of which the
+ *  address pair hashes to it. The hash is symmetric, so both directions of
+ *  a flow are handled by the same thread and packets of a flow are
+ *  processed in file order. The port numbers are not part of the hash so
+ *  that IP fragments end up with the rest of their flow.
+ *
+ *  To keep the engine time and the flow timeouts sane, a thread is not
+ *  allowed to run ahead of the slowest thread by more than
+ *  PCAP_FILE_MMAP_MAX_SKEW seconds of packet time.
+ *
+ *  @{
+ */
 
-    switch(pcap_g.datalink) {
-        case LINKTYPE_LINUX_SLL:
-            pcap_g.Decoder = DecodeSll;
-            break;
+/** pcap file format magic numbers */
+#define PCAP_FILE_MAGIC             0xa1b2c3d4
+#define PCAP_FILE_MAGIC_NSEC        0xa1b23c4d
+/** file and record header sizes */
+#define PCAP_FILE_HDR_LEN           24
+#define PCAP_FILE_REC_HDR_LEN       16
+/** largest caplen we accept, also used if the file header has no
+ *  snaplen. Same as libpcap's max snaplen */
+#define PCAP_FILE_MAX_CAPLEN        262144
+/** max number of seconds a thread may run ahead of the others */
+#define PCAP_FILE_MMAP_MAX_SKEW     1
+
+typedef struct PcapFileMmapGlobalVars_ {
+    SCMutex m;              /**< protects the setup and teardown */
+
+    int fd;
+    uint8_t *map;
+    uint64_t size;
+    uint8_t swapped;        /**< file was written on a host with the
+                                 other byte order */
+    uint8_t nsec;           /**< timestamps in nanoseconds */
+    uint32_t max_caplen;    /**< larger records are skipped */
+    uint8_t filter_set;
+    struct bpf_program filter;
+
+    int threads;            /**< number of reader threads, set by the runmode */
+    int users;              /**< threads that still use the map */
+    SC_ATOMIC_DECLARE(int, thread_id);
+    SC_ATOMIC_DECLARE(int, active);
+
+    /** per thread: second of the record the thread is at */
+    volatile uint32_t *ts;
+} PcapFileMmapGlobalVars;
+
+typedef struct PcapFileMmapThreadVars_
+{
+    /* counters */
+    uint32_t pkts;
+    uint64_t bytes;
+
+    ThreadVars *tv;
+    TmSlot *slot;
+
+    int id;
+} PcapFileMmapThreadVars;
+
+static PcapFileMmapGlobalVars pcap_mmap_g;
+
+TmEcode ReceivePcapFileMmapLoop(ThreadVars *, void *, void *);
+TmEcode ReceivePcapFileMmapThreadInit(ThreadVars *, void *, void **);
+void ReceivePcapFileMmapThreadExitStats(ThreadVars *, void *);
+TmEcode ReceivePcapFileMmapThreadDeinit(ThreadVars *, void *);
+
+void TmModuleReceivePcapFileMmapRegister (void) {
+    memset(&pcap_mmap_g, 0x00, sizeof(pcap_mmap_g));
+    pcap_mmap_g.fd = -1;
+    SCMutexInit(&pcap_mmap_g.m, NULL);
+    SC_ATOMIC_INIT(pcap_mmap_g.thread_id);
+    SC_ATOMIC_INIT(pcap_mmap_g.active);
+
+    tmm_modules[TMM_RECEIVEPCAPFILEMMAP].name = "ReceivePcapFileMmap";
+    tmm_modules[TMM_RECEIVEPCAPFILEMMAP].ThreadInit = ReceivePcapFileMmapThreadInit;
+    tmm_modules[TMM_RECEIVEPCAPFILEMMAP].Func = NULL;
+    tmm_modules[TMM_RECEIVEPCAPFILEMMAP].PktAcqLoop = ReceivePcapFileMmapLoop;
+    tmm_modules[TMM_RECEIVEPCAPFILEMMAP].ThreadExitPrintStats = ReceivePcapFileMmapThreadExitStats;
+    tmm_modules[TMM_RECEIVEPCAPFILEMMAP].ThreadDeinit = ReceivePcapFileMmapThreadDeinit;
+    tmm_modules[TMM_RECEIVEPCAPFILEMMAP].RegisterTests = NULL;
+    tmm_modules[TMM_RECEIVEPCAPFILEMMAP].cap_flags = 0;
+    tmm_modules[TMM_RECEIVEPCAPFILEMMAP].flags = TM_FLAG_RECEIVE_TM;
+}
+
+/**
+ *  \brief set the number of threads that will read the file
+ *
+ *  Must be called by the runmode before the threads are created.
+ */
+void ReceivePcapFileMmapSetThreads(int threads)
+{
+    pcap_mmap_g.threads = threads;
+}
+
+static inline uint32_t PcapFileMmapGetU32(const uint8_t *data)
+{
+    uint32_t v;
+    memcpy(&v, data, sizeof(v));
+    return pcap_mmap_g.swapped ? SCByteSwap32(v) : v;
+}
+
+/** \brief get 4 bytes of packet data, in whatever byte order */
+static inline uint32_t PcapFileMmapGetRaw32(const uint8_t *data)
+{
+    uint32_t v;
+    memcpy(&v, data, sizeof(v));
+    return v;
+}
+
+/**
+ *  \brief symmetric hash of the address pair of a packet
+ *
+ *  Only the outer layers are looked at, tunneled traffic is balanced on
+ *  the tunnel end points. Packets that are not IP all hash to 0.
+ */
+static uint32_t PcapFileMmapHash(const uint8_t *pkt, uint32_t len)
+{
+    uint32_t off = 0;
+    uint16_t proto = 0;
+    uint32_t h = 0;
+
+    switch (pcap_g.datalink) {
         case LINKTYPE_ETHERNET:
-            pcap_g.Decoder = DecodeEthernet;
+            if (len < ETHERNET_HEADER_LEN)
+                return 0;
+            proto = (pkt[12] << 8) | pkt[13];
+            off = ETHERNET_HEADER_LEN;
+            /* skip vlan and q-in-q tags */
+            while ((proto == ETHERNET_TYPE_8021Q || proto == 0x88a8) &&
+                    len >= off + 4) {
+                proto = (pkt[off + 2] << 8) | pkt[off + 3];
+                off += 4;
+            }
+            break;
+        case LINKTYPE_LINUX_SLL:
+            if (len < SLL_HEADER_LEN)
+                return 0;
+            proto = (pkt[14] << 8) | pkt[15];
+            off = SLL_HEADER_LEN;
             break;
         case LINKTYPE_PPP:
-            pcap_g.Decoder = DecodePPP;
+            if (len < PPP_HEADER_LEN)
+                return 0;
+            switch ((pkt[2] << 8) | pkt[3]) {
+                case PPP_IP:
+                    proto = ETHERNET_TYPE_IP;
+                    break;
+                case PPP_IPV6:
+                    proto = ETHERNET_TYPE_IPV6;
+                    break;
+            }
+            off = PPP_HEADER_LEN;
             break;
         case LINKTYPE_RAW:
-            pcap_g.Decoder = DecodeRaw;
+            if (len < 1)
+                return 0;
+            if ((pkt[0] >> 4) == 4)
+                proto = ETHERNET_TYPE_IP;
+            else if ((pkt[0] >> 4) == 6)
+                proto = ETHERNET_TYPE_IPV6;
             break;
-
         default:
-            SCLogError(SC_ERR_UNIMPLEMENTED, "datalink type %" PRId32 " not "
-                      "(yet) supported in module PcapFile.\n", pcap_g.datalink);
-            SCFree(ptv);
-            if (! RunModeUnixSocketIsActive()) {
-                SCReturnInt(TM_ECODE_FAILED);
-            } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
-                UnixSocketPcapFile(TM_ECODE_DONE);
-                SCReturnInt(TM_ECODE_DONE);
+            return 0;
+    }
+
+    if (proto == ETHERNET_TYPE_IP && len >= off + IPV4_HEADER_LEN) {
+        h = PcapFileMmapGetRaw32(pkt + off + 12) ^
+            PcapFileMmapGetRaw32(pkt + off + 16);
+    } else if (proto == ETHERNET_TYPE_IPV6 && len >= off + IPV6_HEADER_LEN) {
+        int i;
+        for (i = 0; i < 16; i += 4) {
+            h ^= PcapFileMmapGetRaw32(pkt + off + 8 + i) ^
+                 PcapFileMmapGetRaw32(pkt + off + 24 + i);
+        }
+    } else {
+        return 0;
+    }
+
+    /* the xor of the addresses keeps most of its entropy in a few bits,
+     * so mix it before it's used as a modulo */
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+/**
+ *  \brief map the file and parse the pcap file header
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+static int PcapFileMmapOpen(char *file)
+{
+    struct stat st;
+    char *tmpbpfstring = NULL;
+
+    pcap_mmap_g.fd = open(file, O_RDONLY);
+    if (pcap_mmap_g.fd == -1) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", file, strerror(errno));
+        return -1;
+    }
+    if (fstat(pcap_mmap_g.fd, &st) != 0) {
+        SCLogError(SC_ERR_FOPEN, "failed to stat %s: %s", file, strerror(errno));
+        goto error;
+    }
+    if (st.st_size < PCAP_FILE_HDR_LEN || (uint64_t)st.st_size > SIZE_MAX) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "%s: invalid file size %"PRIuMAX,
+                file, (uintmax_t)st.st_size);
+        goto error;
+    }
+    pcap_mmap_g.size = (uint64_t)st.st_size;
+
+    void *map = mmap(NULL, (size_t)pcap_mmap_g.size, PROT_READ, MAP_PRIVATE,
+            pcap_mmap_g.fd, 0);
+    if (map == MAP_FAILED) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to mmap %s: %s", file, strerror(errno));
+        goto error;
+    }
+    pcap_mmap_g.map = (uint8_t *)map;
+#ifdef MADV_SEQUENTIAL
+    (void)madvise(map, (size_t)pcap_mmap_g.size, MADV_SEQUENTIAL);
+#endif
+
+    uint32_t magic = PcapFileMmapGetRaw32(pcap_mmap_g.map);
+    if (magic == PCAP_FILE_MAGIC) {
+        ;
+    } else if (magic == PCAP_FILE_MAGIC_NSEC) {
+        pcap_mmap_g.nsec = 1;
+    } else if (magic == SCByteSwap32(PCAP_FILE_MAGIC)) {
+        pcap_mmap_g.swapped = 1;
+    } else if (magic == SCByteSwap32(PCAP_FILE_MAGIC_NSEC)) {
+        pcap_mmap_g.swapped = 1;
+        pcap_mmap_g.nsec = 1;
+    } else {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "%s is not a pcap file (magic "
+                "0x%08x). Pcap-ng files are only supported by the single and "
+                "autofp runmodes.", file, magic);
+        goto error;
+    }
+
+    if (PcapFileSetDecoder((int)PcapFileMmapGetU32(pcap_mmap_g.map + 20)) < 0)
+        goto error;
+
+    /* records can't be larger than the snaplen the file was written with */
+    pcap_mmap_g.max_caplen = PcapFileMmapGetU32(pcap_mmap_g.map + 16);
+    if (pcap_mmap_g.max_caplen == 0 ||
+            pcap_mmap_g.max_caplen > PCAP_FILE_MAX_CAPLEN)
+        pcap_mmap_g.max_caplen = PCAP_FILE_MAX_CAPLEN;
+
+    if (ConfGet("bpf-filter", &tmpbpfstring) != 1) {
+        SCLogDebug("could not get bpf or none specified");
+    } else {
+        SCLogInfo("using bpf-filter \"%s\"", tmpbpfstring);
+
+        pcap_t *dead = pcap_open_dead(pcap_g.datalink, 65535);
+        if (dead == NULL) {
+            SCLogError(SC_ERR_BPF, "could not set up bpf filter");
+            goto error;
+        }
+        if (pcap_compile(dead, &pcap_mmap_g.filter, tmpbpfstring, 1, 0) < 0) {
+            SCLogError(SC_ERR_BPF, "bpf compilation error %s", pcap_geterr(dead));
+            pcap_close(dead);
+            goto error;
+        }
+        pcap_close(dead);
+        pcap_mmap_g.filter_set = 1;
+    }
+
+    pcap_mmap_g.ts = SCMalloc(pcap_mmap_g.threads * sizeof(uint32_t));
+    if (unlikely(pcap_mmap_g.ts == NULL))
+        goto error;
+    memset((void *)pcap_mmap_g.ts, 0x00, pcap_mmap_g.threads * sizeof(uint32_t));
+    SC_ATOMIC_SET(pcap_mmap_g.active, pcap_mmap_g.threads);
+
+    SCLogInfo("reading pcap file %s (%"PRIu64" bytes) with %d threads",
+            file, pcap_mmap_g.size, pcap_mmap_g.threads);
+    return 0;
+
+error:
+    if (pcap_mmap_g.map != NULL) {
+        munmap(pcap_mmap_g.map, (size_t)pcap_mmap_g.size);
+        pcap_mmap_g.map = NULL;
+    }
+    close(pcap_mmap_g.fd);
+    pcap_mmap_g.fd = -1;
+    return -1;
+}
+
+static void PcapFileMmapClose(void)
+{
+    if (pcap_mmap_g.map != NULL) {
+        munmap(pcap_mmap_g.map, (size_t)pcap_mmap_g.size);
+        pcap_mmap_g.map = NULL;
+    }
+    if (pcap_mmap_g.fd != -1) {
+        close(pcap_mmap_g.fd);
+        pcap_mmap_g.fd = -1;
+    }
+    if (pcap_mmap_g.filter_set) {
+        pcap_freecode(&pcap_mmap_g.filter);
+        pcap_mmap_g.filter_set = 0;
+    }
+    if (pcap_mmap_g.ts != NULL) {
+        SCFree((void *)pcap_mmap_g.ts);
+        pcap_mmap_g.ts = NULL;
+    }
+}
+
+/**
+ *  \brief publish our packet time and wait for the other threads if we
+ *         are too far ahead of them.
+ */
+static void PcapFileMmapSyncTime(PcapFileMmapThreadVars *ptv, uint32_t sec)
+{
+    pcap_mmap_g.ts[ptv->id] = sec;
+
+    while (!(suricata_ctl_flags & (SURICATA_STOP | SURICATA_KILL))) {
+        uint32_t min = UINT32_MAX;
+        int i;
+
+        for (i = 0; i < pcap_mmap_g.threads; i++) {
+            if (i != ptv->id && pcap_mmap_g.ts[i] < min)
+                min = pcap_mmap_g.ts[i];
+        }
+        if (min == UINT32_MAX || sec <= min + PCAP_FILE_MMAP_MAX_SKEW)
+            break;
+
+        usleep(10);
+    }
+}
+
+/**
+ *  \brief Main loop of a pcap file mmap reader thread
+ */
+TmEcode ReceivePcapFileMmapLoop(ThreadVars *tv, void *data, void *slot)
+{
+    SCEnter();
+
+    PcapFileMmapThreadVars *ptv = (PcapFileMmapThreadVars *)data;
+    TmSlot *s = (TmSlot *)slot;
+    uint64_t offset = PCAP_FILE_HDR_LEN;
+    uint64_t cnt = 0;
+    uint32_t cur_sec = 0;
+
+    ptv->slot = s->slot_next;
+
+    while (offset + PCAP_FILE_REC_HDR_LEN <= pcap_mmap_g.size) {
+        if (suricata_ctl_flags & (SURICATA_STOP | SURICATA_KILL))
+            break;
+
+        uint8_t *rec = pcap_mmap_g.map + offset;
+        uint32_t sec = PcapFileMmapGetU32(rec);
+        uint32_t frac = PcapFileMmapGetU32(rec + 4);
+        uint32_t caplen = PcapFileMmapGetU32(rec + 8);
+        uint32_t len = PcapFileMmapGetU32(rec + 12);
+
+        if (caplen > pcap_mmap_g.size - offset - PCAP_FILE_REC_HDR_LEN) {
+            SCLogWarning(SC_ERR_PCAP_DISPATCH, "pcap file is truncated at "
+                    "record %"PRIu64, cnt + 1);
+            break;
+        }
+        uint8_t *pkt = rec + PCAP_FILE_REC_HDR_LEN;
+        offset += PCAP_FILE_REC_HDR_LEN + caplen;
+        cnt++;
+
+        /* larger than the snaplen, skip the record but keep reading */
+        if (caplen > pcap_mmap_g.max_caplen) {
+            if (ptv->id == 0) {
+                SCLogWarning(SC_ERR_PCAP_DISPATCH, "skipping record %"PRIu64
+                        ": caplen %"PRIu32" exceeds the snaplen %"PRIu32,
+                        cnt, caplen, pcap_mmap_g.max_caplen);
             }
+            continue;
+        }
+
+        if (cnt == 1 || sec != cur_sec) {
+            cur_sec = sec;
+            PcapFileMmapSyncTime(ptv, sec);
+        }
+
+        if (PcapFileMmapHash(pkt, caplen) % pcap_mmap_g.threads != (uint32_t)ptv->id)
+            continue;
+
+        struct timeval ts;
+        ts.tv_sec = sec;
+        ts.tv_usec = pcap_mmap_g.nsec ? frac / 1000 : frac;
+
+        if (pcap_mmap_g.filter_set) {
+            struct pcap_pkthdr h;
+            h.ts = ts;
+            h.caplen = caplen;
+            h.len = len;
+            if (pcap_offline_filter(&pcap_mmap_g.filter, &h, pkt) == 0)
+                continue;
+        }
+
+        /* make sure we have at least one packet in the packet pool, to prevent
+         * us from alloc'ing packets at line rate */
+        while (PacketPoolSize() == 0) {
+            PacketPoolWait();
+        }
+
+        Packet *p = PacketGetFromQueueOrAlloc();
+        if (unlikely(p == NULL))
+            continue;
+        PACKET_PROFILING_TMM_START(p, TMM_RECEIVEPCAPFILEMMAP);
+
+        PKT_SET_SRC(p, PKT_SRC_WIRE);
+        p->ts = ts;
+        p->datalink = pcap_g.datalink;
+        /* number the packets in file order, like the single reader does */
+        p->pcap_cnt = cnt;
+
+        ptv->pkts++;
+        ptv->bytes += caplen;
+
+        /* the map lives until all readers are done, so no need to copy */
+        if (unlikely(PacketSetData(p, pkt, (int)caplen))) {
+            TmqhOutputPacketpool(ptv->tv, p);
+            PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILEMMAP);
+            continue;
+        }
+        PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILEMMAP);
+
+        if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_PCAP_DISPATCH, "pcap file packet processing failed");
+            EngineKill();
+            pcap_mmap_g.ts[ptv->id] = UINT32_MAX;
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+
+        SCPerfSyncCountersIfSignalled(tv);
+    }
+
+    /* don't hold back the others anymore */
+    pcap_mmap_g.ts[ptv->id] = UINT32_MAX;
+
+    if (SC_ATOMIC_SUB(pcap_mmap_g.active, 1) == 0) {
+        SCLogInfo("pcap file end of file reached");
+        EngineStop();
+    }
+    SCReturnInt(TM_ECODE_DONE);
+}
+
+TmEcode ReceivePcapFileMmapThreadInit(ThreadVars *tv, void *initdata, void **data) {
+    SCEnter();
+
+    if (initdata == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "error: initdata == NULL");
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+    if (RunModeUnixSocketIsActive()) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "multi threaded pcap file reading "
+                "is not supported in unix socket mode");
+        SCReturnInt(TM_ECODE_FAILED);
     }
 
+    PcapFileMmapThreadVars *ptv = SCMalloc(sizeof(PcapFileMmapThreadVars));
+    if (unlikely(ptv == NULL))
+        SCReturnInt(TM_ECODE_FAILED);
+    memset(ptv, 0, sizeof(PcapFileMmapThreadVars));
+
+    SCMutexLock(&pcap_mmap_g.m);
+    if (pcap_mmap_g.threads <= 0)
+        pcap_mmap_g.threads = 1;
+    if (pcap_mmap_g.map == NULL && PcapFileMmapOpen((char *)initdata) < 0) {
+        SCMutexUnlock(&pcap_mmap_g.m);
+        SCFree(ptv);
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+    pcap_mmap_g.users++;
+    SCMutexUnlock(&pcap_mmap_g.m);
+
+    ptv->id = SC_ATOMIC_ADD(pcap_mmap_g.thread_id, 1) - 1;
+    BUG_ON(ptv->id >= pcap_mmap_g.threads);
+
     ptv->tv = tv;
     *data = (void *)ptv;
     SCReturnInt(TM_ECODE_OK);
 }
 
-void ReceivePcapFileThreadExitStats(ThreadVars *tv, void *data) {
+void ReceivePcapFileMmapThreadExitStats(ThreadVars *tv, void *data) {
     SCEnter();
-    PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
+    PcapFileMmapThreadVars *ptv = (PcapFileMmapThreadVars *)data;
 
-    SCLogInfo("Pcap-file module read %" PRIu32 " packets, %" PRIu64 " bytes", ptv->pkts, ptv->bytes);
+    SCLogInfo("Pcap-file mmap reader %d read %" PRIu32 " packets, %" PRIu64 " bytes",
+            ptv->id, ptv->pkts, ptv->bytes);
     return;
 }
 
-TmEcode ReceivePcapFileThreadDeinit(ThreadVars *tv, void *data) {
+TmEcode ReceivePcapFileMmapThreadDeinit(ThreadVars *tv, void *data) {
     SCEnter();
-    PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
+    PcapFileMmapThreadVars *ptv = (PcapFileMmapThreadVars *)data;
     if (ptv) {
         SCFree(ptv);
     }
+
+    /* last one out unmaps the file */
+    SCMutexLock(&pcap_mmap_g.m);
+    if (--pcap_mmap_g.users == 0)
+        PcapFileMmapClose();
+    SCMutexUnlock(&pcap_mmap_g.m);
+
     SCReturnInt(TM_ECODE_OK);
 }
 
-double prev_signaled_ts = 0;
+/**
+ *  @}
+ */
 
 TmEcode DecodePcapFile(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postpq)
 {
@@ -355,10 +977,14 @@ TmEcode DecodePcapFile(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, P
     SCPerfCounterAddUI64(dtv->counter_avg_pkt_size, tv->sc_perf_pca, GET_PKT_LEN(p));
     SCPerfCounterSetUI64(dtv->counter_max_pkt_size, tv->sc_perf_pca, GET_PKT_LEN(p));
 
-    double curr_ts = p->ts.tv_sec + p->ts.tv_usec / 1000.0;
-    if (curr_ts < prev_signaled_ts || (curr_ts - prev_signaled_ts) > 60.0) {
-        prev_signaled_ts = curr_ts;
-        FlowWakeupFlowManagerThread();
+    /* the readers can be up to PCAP_FILE_MMAP_MAX_SKEW apart, so only a
+     * big jump back (e.g. a new file) resets the wakeup time */
+    uint64_t curr_ts = (uint64_t)p->ts.tv_sec * 1000000ULL + p->ts.tv_usec;
+    uint64_t prev_ts = SC_ATOMIC_GET(prev_signaled_ts);
+    if (curr_ts > prev_ts + PCAP_FILE_FM_WAKEUP_USEC ||
+        curr_ts + PCAP_FILE_FM_WAKEUP_USEC < prev_ts) {
+        if (SC_ATOMIC_CAS(&prev_signaled_ts, prev_ts, curr_ts))
+            FlowWakeupFlowManagerThread();
     }
 
     /* update the engine time representation based on the timestamp
@@ -26,6 +26,9 @@
 
 void TmModuleReceivePcapFileRegister (void);
 void TmModuleDecodePcapFileRegister (void);
+void TmModuleReceivePcapFileMmapRegister (void);
+
+void ReceivePcapFileMmapSetThreads(int);
 
 #endif /* __SOURCE_PCAP_FILE_H__ */
 
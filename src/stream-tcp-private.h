@@ -57,6 +57,12 @@ typedef struct TcpSegment_ {
     uint32_t seq;
     struct TcpSegment_ *next;
     struct TcpSegment_ *prev;
+    /* seq ordered red-black tree over the segment list, see
+     * stream-tcp-tree.c */
+    struct TcpSegment_ *rb_parent;
+    struct TcpSegment_ *rb_left;
+    struct TcpSegment_ *rb_right;
+    uint8_t rb_color;
     /* coccinelle: TcpSegment:flags:SEGMENTTCP_FLAG */
     uint8_t flags;
 } TcpSegment;
@@ -83,6 +89,7 @@ typedef struct TcpStream_ {
 
     TcpSegment *seg_list;           /**< list of TCP segments that are not yet (fully) used in reassembly */
     TcpSegment *seg_list_tail;      /**< Last segment in the reassembled stream seg list*/
+    TcpSegment *seg_tree;           /**< root of the tree index of seg_list */
 
     StreamTcpSackRecord *sack_head; /**< head of list of SACK records */
     StreamTcpSackRecord *sack_tail; /**< tail of list of SACK records */
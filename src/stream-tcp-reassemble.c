@@ -48,6 +48,7 @@
 #include "stream-tcp-private.h"
 #include "stream-tcp-reassemble.h"
 #include "stream-tcp-inline.h"
+#include "stream-tcp-tree.h"
 #include "stream-tcp-util.h"
 
 #include "stream.h"
@@ -72,18 +73,23 @@ static uint64_t segment_pool_memcnt = 0;
  * payloads. We do this to prevent having to do an SCMalloc call for every
  * data segment we receive, which would be a large performance penalty.
  * The cost is in memory of course. */
-#define segment_pool_num 8
+#define segment_pool_num STREAM_TCP_SEGMENT_POOLS
+/* size of the segments that in-order data is appended to if
+ * stream.reassembly.segment-append is enabled. */
+#define SEGMENT_APPEND_SIZE 8192
 static uint16_t segment_pool_pktsizes[segment_pool_num] = {4, 16, 112, 248, 512,
-                                                           768, 1448, 0xffff};
+                                                           768, 1448,
+                                                           SEGMENT_APPEND_SIZE,
+                                                           0xffff};
 //static uint16_t segment_pool_poolsizes[segment_pool_num] = {2048, 3072, 3072,
 //                                                            3072, 3072, 8192,
 //                                                            8192, 512};
 static uint16_t segment_pool_poolsizes[segment_pool_num] = {0, 0, 0,
                                                             0, 0, 0,
-                                                            0, 0};
+                                                            0, 0, 0};
 static uint16_t segment_pool_poolsizes_prealloc[segment_pool_num] = {256, 512, 512,
                                                             512, 512, 1024,
-                                                            1024, 128};
+                                                            1024, 128, 128};
 static Pool *segment_pool[segment_pool_num];
 static SCMutex segment_pool_mutex[segment_pool_num];
 #ifdef DEBUG
@@ -92,6 +98,10 @@ static uint64_t segment_pool_cnt = 0;
 #endif
 /* index to the right pool for all packet sizes. */
 static uint16_t segment_pool_idx[65536]; /* O(1) lookups of the pool */
+/* number of segments moved between a thread cache and the global pool at
+ * once, per pool. Smaller for the large segments so that the caches don't
+ * hold on to too much memory. The caches hold up to twice this. */
+static uint16_t segment_cache_batch[segment_pool_num];
 static int check_overlap_different_data = 0;
 
 /* Memory use counter */
@@ -271,6 +281,92 @@ void StreamTcpReturnStreamSegments (TcpStream *stream)
 
     stream->seg_list = NULL;
     stream->seg_list_tail = NULL;
+    stream->seg_tree = NULL;
+}
+
+/**
+ *  \internal
+ *  \brief return segments from the thread cache to the global pool
+ *
+ *  \param idx pool index
+ *  \param cnt number of segments to return
+ */
+static void StreamTcpSegmentCacheFlush(TcpReassemblyThreadCtx *ra_ctx,
+        uint16_t idx, uint16_t cnt)
+{
+    SCMutexLock(&segment_pool_mutex[idx]);
+    while (cnt > 0 && ra_ctx->segment_cache[idx] != NULL) {
+        TcpSegment *seg = ra_ctx->segment_cache[idx];
+        ra_ctx->segment_cache[idx] = seg->next;
+        ra_ctx->segment_cache_cnt[idx]--;
+        seg->next = NULL;
+        PoolReturn(segment_pool[idx], (void *)seg);
+        cnt--;
+    }
+    SCMutexUnlock(&segment_pool_mutex[idx]);
+}
+
+/**
+ *  \internal
+ *  \brief fill the thread cache from the global pool
+ *
+ *  Only the first segment may be a new allocation, the others are taken
+ *  only if the pool has them available already.
+ */
+static void StreamTcpSegmentCacheRefill(TcpReassemblyThreadCtx *ra_ctx,
+        uint16_t idx)
+{
+    uint16_t cnt = 0;
+
+    SCMutexLock(&segment_pool_mutex[idx]);
+    do {
+        TcpSegment *seg = (TcpSegment *)PoolGet(segment_pool[idx]);
+        if (seg == NULL)
+            break;
+
+        seg->next = ra_ctx->segment_cache[idx];
+        ra_ctx->segment_cache[idx] = seg;
+        ra_ctx->segment_cache_cnt[idx]++;
+        cnt++;
+    } while (cnt < segment_cache_batch[idx] &&
+             segment_pool[idx]->empty_list_size > 0);
+
+    SCLogDebug("segment_pool[%u]->empty_list_size %u, segment_pool[%u]->alloc_"
+               "list_size %u, alloc %u", idx, segment_pool[idx]->empty_list_size,
+               idx, segment_pool[idx]->alloc_list_size,
+               segment_pool[idx]->allocated);
+    SCMutexUnlock(&segment_pool_mutex[idx]);
+}
+
+/**
+ *  \brief Return a segment to the cache of the thread
+ *
+ *  If the cache is full, half of it is flushed to the global pool.
+ *
+ *  \param ra_ctx reassembly thread ctx of the thread owning the segment
+ *  \param seg Segment which will be returned
+ */
+void StreamTcpSegmentReturntoCache(TcpReassemblyThreadCtx *ra_ctx, TcpSegment *seg)
+{
+    if (seg == NULL)
+        return;
+
+    uint16_t idx = segment_pool_idx[seg->pool_size];
+
+    seg->prev = NULL;
+    seg->next = ra_ctx->segment_cache[idx];
+    ra_ctx->segment_cache[idx] = seg;
+    ra_ctx->segment_cache_cnt[idx]++;
+
+    if (ra_ctx->segment_cache_cnt[idx] > 2 * segment_cache_batch[idx]) {
+        StreamTcpSegmentCacheFlush(ra_ctx, idx, segment_cache_batch[idx]);
+    }
+
+#ifdef DEBUG
+    SCMutexLock(&segment_pool_cnt_mutex);
+    segment_pool_cnt--;
+    SCMutexUnlock(&segment_pool_cnt_mutex);
+#endif
 }
 
 int StreamTcpReassembleInit(char quiet)
@@ -286,10 +382,17 @@ int StreamTcpReassembleInit(char quiet)
     uint16_t u16 = 0;
     for (u16 = 0; u16 < segment_pool_num; u16++)
     {
+        uint16_t prealloc = segment_pool_poolsizes_prealloc[u16];
+        /* the append segments are only used a lot with segment-append,
+         * don't pin 1MB of them otherwise */
+        if (segment_pool_pktsizes[u16] == SEGMENT_APPEND_SIZE &&
+            !(stream_config.flags & STREAMTCP_INIT_FLAG_SEGMENT_APPEND))
+            prealloc = 0;
+
         SCMutexInit(&segment_pool_mutex[u16], NULL);
         SCMutexLock(&segment_pool_mutex[u16]);
         segment_pool[u16] = PoolInit(segment_pool_poolsizes[u16],
-                                     segment_pool_poolsizes_prealloc[u16],
+                                     prealloc,
                                      sizeof (TcpSegment),
                                      TcpSegmentPoolAlloc, TcpSegmentPoolInit,
                                      (void *) &segment_pool_pktsizes[u16],
@@ -297,6 +400,15 @@ int StreamTcpReassembleInit(char quiet)
         SCMutexUnlock(&segment_pool_mutex[u16]);
     }
 
+    for (u16 = 0; u16 < segment_pool_num; u16++) {
+        uint32_t batch = 16384 / segment_pool_pktsizes[u16];
+        if (batch > 16)
+            batch = 16;
+        else if (batch == 0)
+            batch = 1;
+        segment_cache_batch[u16] = (uint16_t)batch;
+    }
+
     uint16_t idx = 0;
     u16 = 0;
     while (1) {
@@ -386,6 +498,12 @@ void StreamTcpReassembleFreeThreadCtx(TcpReassemblyThreadCtx *ra_ctx)
     }
 
     ra_ctx->stream_q = NULL;
+
+    uint16_t idx;
+    for (idx = 0; idx < segment_pool_num; idx++) {
+        StreamTcpSegmentCacheFlush(ra_ctx, idx, ra_ctx->segment_cache_cnt[idx]);
+    }
+
     AlpProtoDeFinalize2Thread(&ra_ctx->dp_ctx);
     SCFree(ra_ctx);
     SCReturn;
@@ -566,6 +684,7 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
         stream->seg_list = seg;
         seg->prev = NULL;
         stream->seg_list_tail = seg;
+        StreamTcpSegmentTreeInsert(stream, seg);
         goto end;
     }
 
@@ -577,6 +696,7 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
         stream->seg_list_tail->next = seg;
         seg->prev = stream->seg_list_tail;
         stream->seg_list_tail = seg;
+        StreamTcpSegmentTreeInsert(stream, seg);
 
         goto end;
     }
@@ -586,6 +706,19 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
         StreamTcpSetOSPolicy(stream, p);
     }
 
+    /* find the place to start looking in the list: segments that start
+     * before the segment closest before us end before it, so they can't
+     * overlap with us. Step back anyway if they do. */
+    TcpSegment *start_seg = StreamTcpSegmentTreeFindLE(stream, seg->seq);
+    if (start_seg != NULL) {
+        while (start_seg->prev != NULL && SEQ_GT((start_seg->prev->seq +
+                        start_seg->prev->payload_len), seg->seq))
+        {
+            start_seg = start_seg->prev;
+        }
+        list_seg = start_seg;
+    }
+
     for (; list_seg != NULL; list_seg = next_list_seg) {
         next_list_seg = list_seg->next;
 
@@ -612,6 +745,7 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
                     seg->prev = list_seg->prev;
                 }
                 list_seg->prev = seg;
+                StreamTcpSegmentTreeInsert(stream, seg);
 
                 goto end;
 
@@ -660,6 +794,7 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
                     list_seg->next = seg;
                     seg->prev = list_seg;
                     stream->seg_list_tail = seg;
+                    StreamTcpSegmentTreeInsert(stream, seg);
                     goto end;
                 }
             } else {
@@ -680,7 +815,7 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
 
 end:
     if (return_seg == TRUE && seg != NULL) {
-        StreamTcpSegmentReturntoPool(seg);
+        StreamTcpSegmentReturntoCache(ra_ctx, seg);
     }
 
 #ifdef DEBUG
@@ -804,6 +939,7 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
             new_seg->prev = list_seg->prev;
             list_seg->prev->next = new_seg;
             list_seg->prev = new_seg;
+            StreamTcpSegmentTreeInsert(stream, new_seg);
 
             /* create a new seg, copy the list_seg data over */
             StreamTcpSegmentDataCopy(new_seg, seg);
@@ -864,7 +1000,8 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
             if (stream->seg_list_tail == list_seg)
                 stream->seg_list_tail = new_seg;
 
-            StreamTcpSegmentReturntoPool(list_seg);
+            StreamTcpSegmentTreeReplace(stream, list_seg, new_seg);
+            StreamTcpSegmentReturntoCache(ra_ctx, list_seg);
             list_seg = new_seg;
             if (new_seg->prev != NULL) {
                 new_seg->prev->next = new_seg;
@@ -927,7 +1064,8 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
                 if (stream->seg_list_tail == list_seg)
                     stream->seg_list_tail = new_seg;
 
-                StreamTcpSegmentReturntoPool(list_seg);
+                StreamTcpSegmentTreeReplace(stream, list_seg, new_seg);
+                StreamTcpSegmentReturntoCache(ra_ctx, list_seg);
                 list_seg = new_seg;
                 if (new_seg->prev != NULL) {
                     new_seg->prev->next = new_seg;
@@ -999,7 +1137,8 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
                     if (stream->seg_list_tail == list_seg)
                         stream->seg_list_tail = new_seg;
 
-                    StreamTcpSegmentReturntoPool(list_seg);
+                    StreamTcpSegmentTreeReplace(stream, list_seg, new_seg);
+                    StreamTcpSegmentReturntoCache(ra_ctx, list_seg);
                     list_seg = new_seg;
                     return_after = TRUE;
                 }
@@ -1067,7 +1206,8 @@ static int HandleSegmentStartsBeforeListSegment(ThreadVars *tv, TcpReassemblyThr
                 if (stream->seg_list_tail == list_seg)
                     stream->seg_list_tail = new_seg;
 
-                StreamTcpSegmentReturntoPool(list_seg);
+                StreamTcpSegmentTreeReplace(stream, list_seg, new_seg);
+                StreamTcpSegmentReturntoCache(ra_ctx, list_seg);
                 list_seg = new_seg;
                 return_after = TRUE;
             }
@@ -1259,6 +1399,7 @@ static int HandleSegmentStartsAtSameListSegment(ThreadVars *tv, TcpReassemblyThr
                     new_seg->next->prev = new_seg;
                 new_seg->prev = list_seg;
                 list_seg->next = new_seg;
+                StreamTcpSegmentTreeInsert(stream, new_seg);
                 SCLogDebug("new_seg %p, new_seg->next %p, new_seg->prev %p, "
                            "list_seg->next %p", new_seg, new_seg->next,
                            new_seg->prev, list_seg->next);
@@ -1463,6 +1604,7 @@ static int HandleSegmentStartsAfterListSegment(ThreadVars *tv, TcpReassemblyThre
                     new_seg->next->prev = new_seg;
                 new_seg->prev = list_seg;
                 list_seg->next = new_seg;
+                StreamTcpSegmentTreeInsert(stream, new_seg);
 
                 SCLogDebug("new_seg %p, new_seg->next %p, new_seg->prev %p, "
                            "list_seg->next %p new_seg->seq %"PRIu32"", new_seg,
@@ -1615,6 +1757,44 @@ static uint32_t StreamTcpReassembleCheckDepth(TcpStream *stream,
     SCReturnUInt(0);
 }
 
+/**
+ *  \internal
+ *  \brief Check if the packet's data continues the tail segment of the
+ *         stream, and if the tail can still take more data.
+ *
+ *  The tail can't be extended once app layer or raw reassembly have marked
+ *  it processed, as the new data would then be considered processed too.
+ *
+ *  Merging data into the tail changes the segment boundaries the overlap
+ *  handling sees. Only the first, last and vista policies resolve overlaps
+ *  the same way wherever the boundaries are, so for the other policies
+ *  every packet keeps its own segment.
+ *
+ *  \retval 1 data can be appended to the tail
+ *  \retval 0 data needs its own segment
+ */
+static int StreamTcpReassembleTailIsAppendable(TcpStream *stream, Packet *p)
+{
+    TcpSegment *tail = stream->seg_list_tail;
+
+    if (tail == NULL)
+        return 0;
+
+    if (stream->os_policy == 0) {
+        StreamTcpSetOSPolicy(stream, p);
+    }
+    if (stream->os_policy != OS_POLICY_FIRST &&
+            stream->os_policy != OS_POLICY_LAST &&
+            stream->os_policy != OS_POLICY_VISTA)
+        return 0;
+    if (tail->flags & (SEGMENTTCP_FLAG_RAW_PROCESSED|SEGMENTTCP_FLAG_APPLAYER_PROCESSED))
+        return 0;
+    if (!(SEQ_EQ(TCP_GET_SEQ(p), (tail->seq + tail->payload_len))))
+        return 0;
+
+    return 1;
+}
+
 /**
  *  \brief Insert a packets TCP data into the stream reassembly engine.
  *
@@ -1663,9 +1843,31 @@ int StreamTcpReassembleHandleSegmentHandleData(ThreadVars *tv, TcpReassemblyThre
         size = p->payload_len;
 #endif
 
-    TcpSegment *seg = StreamTcpGetSegment(tv, ra_ctx, size);
+    uint16_t alloc_size = size;
+
+    /* in-order data is added to the tail segment if it has room for it.
+     * If it hasn't, get a segment that is large enough to take the data
+     * of the next packets as well. */
+    if ((stream_config.flags & STREAMTCP_INIT_FLAG_SEGMENT_APPEND) &&
+            !(StreamTcpInlineMode()) &&
+            StreamTcpReassembleTailIsAppendable(stream, p))
+    {
+        TcpSegment *tail = stream->seg_list_tail;
+        if ((uint32_t)(tail->pool_size - tail->payload_len) >= size) {
+            SCLogDebug("appending %"PRIu16" bytes to tail seg %p seq %"PRIu32
+                    " len %"PRIu16, size, tail, tail->seq, tail->payload_len);
+            memcpy(tail->payload + tail->payload_len, p->payload, size);
+            tail->payload_len += size;
+            SCReturnInt(0);
+        }
+
+        if (size < SEGMENT_APPEND_SIZE)
+            alloc_size = SEGMENT_APPEND_SIZE;
+    }
+
+    TcpSegment *seg = StreamTcpGetSegment(tv, ra_ctx, alloc_size);
     if (seg == NULL) {
-        SCLogDebug("segment_pool[%"PRIu16"] is empty", segment_pool_idx[size]);
+        SCLogDebug("segment_pool[%"PRIu16"] is empty", segment_pool_idx[alloc_size]);
 
         StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
         SCReturnInt(-1);
@@ -1810,6 +2012,8 @@ static int StreamTcpReassembleRawCheckLimit(TcpSession *ssn, TcpStream *stream,
 }
 
 static void StreamTcpRemoveSegmentFromStream(TcpStream *stream, TcpSegment *seg) {
+    StreamTcpSegmentTreeRemove(stream, seg);
+
     if (seg->prev == NULL) {
         stream->seg_list = seg->next;
         if (stream->seg_list != NULL)
@@ -1919,7 +2123,7 @@ int StreamTcpReassembleInlineAppLayer(ThreadVars *tv,
 
                 TcpSegment *next_seg = seg->next;
                 StreamTcpRemoveSegmentFromStream(stream, seg);
-                StreamTcpSegmentReturntoPool(seg);
+                StreamTcpSegmentReturntoCache(ra_ctx, seg);
                 seg = next_seg;
                 continue;
             } else {
@@ -1935,7 +2139,7 @@ int StreamTcpReassembleInlineAppLayer(ThreadVars *tv,
                     " so return it to pool", seg, seg->payload_len);
             TcpSegment *next_seg = seg->next;
             StreamTcpRemoveSegmentFromStream(stream, seg);
-            StreamTcpSegmentReturntoPool(seg);
+            StreamTcpSegmentReturntoCache(ra_ctx, seg);
             seg = next_seg;
             continue;
         }
@@ -2040,6 +2244,40 @@ int StreamTcpReassembleInlineAppLayer(ThreadVars *tv,
                 break;
             }
 
+            /* once the protocol is known the parsers don't need the data
+             * in one buffer, so hand them the payload of segments of at
+             * least a chunk directly instead of copying it into the chunk
+             * buffer first. Smaller segments are still coalesced, so the
+             * parsers aren't called more often than before. */
+            if (StreamTcpIsSetStreamFlagAppProtoDetectionCompleted(stream) &&
+                payload_len >= sizeof(data)) {
+                /* pass on what is left in the buffer first */
+                if (data_len > 0) {
+                    STREAM_SET_INLINE_FLAGS(ssn, stream, p, flags);
+                    AppLayerHandleTCPData(tv, ra_ctx, p->flow, ssn, stream,
+                                          data, data_len, p, flags);
+                    PACKET_PROFILING_APP_STORE(&ra_ctx->dp_ctx, p);
+                    data_sent += data_len;
+                    data_len = 0;
+                }
+
+                SCLogDebug("segment view: payload_offset %"PRIu16", "
+                           "payload_len %"PRIu16, payload_offset, payload_len);
+                STREAM_SET_INLINE_FLAGS(ssn, stream, p, flags);
+                AppLayerHandleTCPData(tv, ra_ctx, p->flow, ssn, stream,
+                                      seg->payload + payload_offset,
+                                      payload_len, p, flags);
+                PACKET_PROFILING_APP_STORE(&ra_ctx->dp_ctx, p);
+                data_sent += payload_len;
+                ra_base_seq += payload_len;
+
+                TcpSegment *next_seg = seg->next;
+                next_seq = seg->seq + seg->payload_len;
+                seg->flags |= SEGMENTTCP_FLAG_APPLAYER_PROCESSED;
+                seg = next_seg;
+                continue;
+            }
+
             /* copy the data into the smsg */
             uint16_t copy_size = sizeof(data) - data_len;
             if (copy_size > payload_len) {
@@ -2250,7 +2488,7 @@ static int StreamTcpReassembleInlineRaw (TcpReassemblyThreadCtx *ra_ctx,
             if (StreamTcpAppLayerSegmentProcessed(stream, seg)) {
                 TcpSegment *next_seg = seg->next;
                 StreamTcpRemoveSegmentFromStream(stream, seg);
-                StreamTcpSegmentReturntoPool(seg);
+                StreamTcpSegmentReturntoCache(ra_ctx, seg);
                 seg = next_seg;
             /* otherwise, just flag it for removal */
             } else {
@@ -2272,7 +2510,7 @@ static int StreamTcpReassembleInlineRaw (TcpReassemblyThreadCtx *ra_ctx,
                     " so return it to pool", seg, seg->payload_len);
             TcpSegment *next_seg = seg->next;
             StreamTcpRemoveSegmentFromStream(stream, seg);
-            StreamTcpSegmentReturntoPool(seg);
+            StreamTcpSegmentReturntoCache(ra_ctx, seg);
             seg = next_seg;
             continue;
         }
@@ -2456,7 +2694,7 @@ static int StreamTcpReassembleInlineRaw (TcpReassemblyThreadCtx *ra_ctx,
             if (seg->flags & SEGMENTTCP_FLAG_APPLAYER_PROCESSED) {
                 StreamTcpRemoveSegmentFromStream(stream, seg);
                 SCLogDebug("removing seg %p, seg->next %p", seg, seg->next);
-                StreamTcpSegmentReturntoPool(seg);
+                StreamTcpSegmentReturntoCache(ra_ctx, seg);
             } else {
                 seg->flags |= SEGMENTTCP_FLAG_RAW_PROCESSED;
             }
@@ -2483,7 +2721,7 @@ static int StreamTcpReassembleInlineRaw (TcpReassemblyThreadCtx *ra_ctx,
         if (StreamTcpAppLayerSegmentProcessed(stream, seg)) {
             TcpSegment *next_seg = seg->next;
             StreamTcpRemoveSegmentFromStream(stream, seg);
-            StreamTcpSegmentReturntoPool(seg);
+            StreamTcpSegmentReturntoCache(ra_ctx, seg);
             seg = next_seg;
         } else {
             break;
@@ -2679,7 +2917,7 @@ int StreamTcpReassembleAppLayer (ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
 
                 TcpSegment *next_seg = seg->next;
                 StreamTcpRemoveSegmentFromStream(stream, seg);
-                StreamTcpSegmentReturntoPool(seg);
+                StreamTcpSegmentReturntoCache(ra_ctx, seg);
                 seg = next_seg;
                 continue;
             } else {
@@ -2701,7 +2939,7 @@ int StreamTcpReassembleAppLayer (ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
 
             TcpSegment *next_seg = seg->next;
             StreamTcpRemoveSegmentFromStream(stream, seg);
-            StreamTcpSegmentReturntoPool(seg);
+            StreamTcpSegmentReturntoCache(ra_ctx, seg);
             seg = next_seg;
             continue;
         }
@@ -2841,6 +3079,40 @@ int StreamTcpReassembleAppLayer (ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
                 break;
             }
 
+            /* once the protocol is known the parsers don't need the data
+             * in one buffer, so hand them the payload of segments of at
+             * least a chunk directly instead of copying it into the chunk
+             * buffer first. Smaller segments are still coalesced, so the
+             * parsers aren't called more often than before. */
+            if (StreamTcpIsSetStreamFlagAppProtoDetectionCompleted(stream) &&
+                payload_len >= sizeof(data)) {
+                /* pass on what is left in the buffer first */
+                if (data_len > 0) {
+                    STREAM_SET_FLAGS(ssn, stream, p, flags);
+                    AppLayerHandleTCPData(tv, ra_ctx, p->flow, ssn, stream,
+                                          data, data_len, p, flags);
+                    PACKET_PROFILING_APP_STORE(&ra_ctx->dp_ctx, p);
+                    data_len = 0;
+                }
+
+                SCLogDebug("segment view: payload_offset %"PRIu16", "
+                           "payload_len %"PRIu16, payload_offset, payload_len);
+                STREAM_SET_FLAGS(ssn, stream, p, flags);
+                AppLayerHandleTCPData(tv, ra_ctx, p->flow, ssn, stream,
+                                      seg->payload + payload_offset,
+                                      payload_len, p, flags);
+                PACKET_PROFILING_APP_STORE(&ra_ctx->dp_ctx, p);
+                ra_base_seq += payload_len;
+
+                TcpSegment *next_seg = seg->next;
+                next_seq = seg->seq + seg->payload_len;
+                if (partial == FALSE) {
+                    seg->flags |= SEGMENTTCP_FLAG_APPLAYER_PROCESSED;
+                }
+                seg = next_seg;
+                continue;
+            }
+
             /* copy the data into the smsg */
             uint16_t copy_size = sizeof(data) - data_len;
             if (copy_size > payload_len) {
@@ -3064,7 +3336,7 @@ static int StreamTcpReassembleRaw (TcpReassemblyThreadCtx *ra_ctx,
 
             TcpSegment *next_seg = seg->next;
             StreamTcpRemoveSegmentFromStream(stream, seg);
-            StreamTcpSegmentReturntoPool(seg);
+            StreamTcpSegmentReturntoCache(ra_ctx, seg);
             seg = next_seg;
             continue;
         }
@@ -3603,14 +3875,15 @@ TcpSegment* StreamTcpGetSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
     SCLogDebug("segment_pool_idx %" PRIu32 " for payload_len %" PRIu32 "",
                 idx, len);
 
-    SCMutexLock(&segment_pool_mutex[idx]);
-    TcpSegment *seg = (TcpSegment *) PoolGet(segment_pool[idx]);
+    if (ra_ctx->segment_cache[idx] == NULL) {
+        StreamTcpSegmentCacheRefill(ra_ctx, idx);
+    }
 
-    SCLogDebug("segment_pool[%u]->empty_list_size %u, segment_pool[%u]->alloc_"
-               "list_size %u, alloc %u", idx, segment_pool[idx]->empty_list_size,
-               idx, segment_pool[idx]->alloc_list_size,
-               segment_pool[idx]->allocated);
-    SCMutexUnlock(&segment_pool_mutex[idx]);
+    TcpSegment *seg = ra_ctx->segment_cache[idx];
+    if (seg != NULL) {
+        ra_ctx->segment_cache[idx] = seg->next;
+        ra_ctx->segment_cache_cnt[idx]--;
+    }
 
     SCLogDebug("seg we return is %p", seg);
     if (seg == NULL) {
@@ -3624,6 +3897,9 @@ TcpSegment* StreamTcpGetSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
         seg->flags = 0;
         seg->next = NULL;
         seg->prev = NULL;
+        seg->rb_parent = NULL;
+        seg->rb_left = NULL;
+        seg->rb_right = NULL;
     }
 
 #ifdef DEBUG
@@ -3662,6 +3938,8 @@ void StreamTcpReassembleTriggerRawReassembly(TcpSession *ssn) {
 #ifdef UNITTESTS
 /** unit tests and it's support functions below */
 
+#include "app-layer-htp.h"
+
 /** \brief  The Function tests the reassembly engine working for different
  *          OSes supported. It includes all the OS cases and send
  *          crafted packets to test the reassembly.
@@ -8695,6 +8973,134 @@ end:
     return ret;
 }
 
+/** \test after protocol detection small segments are still coalesced into
+ *        one parser call, while a segment of more than a chunk is passed
+ *        on as is. Either way the http request body is unchanged. */
+static int StreamTcpReassembleInlineTest11(void) {
+    int ret = 0;
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+    Flow *f = NULL;
+    Packet *p = NULL;
+    uint8_t body[1000 + 5000];
+    uint32_t seq, i;
+
+    memset(&tv, 0x00, sizeof(tv));
+
+    AppLayerHtpEnableRequestBodyCallback();
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.server, 1);
+
+    f = UTHBuildFlow(AF_INET, "1.1.1.1", "2.2.2.2", 1024, 80);
+    if (f == NULL)
+        goto end;
+    f->protoctx = &ssn;
+
+    uint8_t header[] = "POST / HTTP/1.0\r\nContent-Length: 6000\r\n\r\n";
+    uint16_t header_len = sizeof(header) - 1;
+    for (i = 0; i < sizeof(body); i++)
+        body[i] = (uint8_t)('a' + (i % 26));
+
+    p = UTHBuildPacketReal(header, header_len, IPPROTO_TCP, "1.1.1.1", "2.2.2.2", 1024, 80);
+    if (p == NULL) {
+        printf("couldn't get a packet: ");
+        goto end;
+    }
+    p->tcph->th_seq = htonl(2);
+    p->flow = f;
+    p->flowflags |= FLOW_PKT_TOSERVER;
+
+    SCMutexLock(&f->m);
+    if (StreamTcpUTAddSegmentWithPayload(&tv, ra_ctx, &ssn.server, 2, header, header_len) == -1) {
+        printf("failed to add header segment: ");
+        goto end;
+    }
+    seq = 2 + header_len;
+    ssn.server.next_seq = seq;
+
+    if (StreamTcpReassembleInlineAppLayer(&tv, ra_ctx, &ssn, &ssn.server, p) < 0) {
+        printf("StreamTcpReassembleInlineAppLayer failed: ");
+        goto end;
+    }
+    if (f->alproto != ALPROTO_HTTP ||
+        !StreamTcpIsSetStreamFlagAppProtoDetectionCompleted(&ssn.server)) {
+        printf("http not detected: ");
+        goto end;
+    }
+
+    /* 100 segments of 10 bytes */
+    for (i = 0; i < 100; i++) {
+        if (StreamTcpUTAddSegmentWithPayload(&tv, ra_ctx, &ssn.server, seq,
+                    body + i * 10, 10) == -1) {
+            printf("failed to add body segment %u: ", i);
+            goto end;
+        }
+        seq += 10;
+    }
+    ssn.server.next_seq = seq;
+    if (StreamTcpReassembleInlineAppLayer(&tv, ra_ctx, &ssn, &ssn.server, p) < 0) {
+        printf("StreamTcpReassembleInlineAppLayer failed: ");
+        goto end;
+    }
+
+    /* then one segment larger than the chunk buffer */
+    if (StreamTcpUTAddSegmentWithPayload(&tv, ra_ctx, &ssn.server, seq,
+                body + 1000, 5000) == -1) {
+        printf("failed to add large body segment: ");
+        goto end;
+    }
+    seq += 5000;
+    ssn.server.next_seq = seq;
+    if (StreamTcpReassembleInlineAppLayer(&tv, ra_ctx, &ssn, &ssn.server, p) < 0) {
+        printf("StreamTcpReassembleInlineAppLayer failed: ");
+        goto end;
+    }
+
+    HtpState *hstate = f->alstate;
+    if (hstate == NULL || hstate->conn == NULL) {
+        printf("no http state: ");
+        goto end;
+    }
+    htp_tx_t *tx = htp_list_get(hstate->conn->transactions, 0);
+    HtpTxUserData *htud = tx ? (HtpTxUserData *)htp_tx_get_user_data(tx) : NULL;
+    if (htud == NULL) {
+        printf("no tx or tx user data: ");
+        goto end;
+    }
+
+    /* one chunk for the small segments, one for the large one */
+    HtpBodyChunk *chunk = htud->request_body.first;
+    uint32_t chunks = 0, offset = 0;
+    for ( ; chunk != NULL; chunk = chunk->next) {
+        if (offset + chunk->len > sizeof(body) ||
+            memcmp(chunk->data, body + offset, chunk->len) != 0) {
+            printf("body data differs at offset %u: ", offset);
+            goto end;
+        }
+        offset += chunk->len;
+        chunks++;
+    }
+    if (offset != sizeof(body)) {
+        printf("expected %u body bytes, got %u: ", (uint32_t)sizeof(body), offset);
+        goto end;
+    }
+    if (chunks != 2) {
+        printf("expected 2 parser calls with body data, got %u: ", chunks);
+        goto end;
+    }
+
+    ret = 1;
+end:
+    UTHFreePacket(p);
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    SCMutexUnlock(&f->m);
+    UTHFreeFlow(f);
+    return ret;
+}
+
 /** \test test insert with overlap
  */
 static int StreamTcpReassembleInsertTest01(void) {
@@ -8867,6 +9273,275 @@ end:
     return ret;
 }
 
+/** \test in-order data is appended to the tail segment when
+ *        stream.reassembly.segment-append is enabled */
+static int StreamTcpReassembleAppendTest01(void) {
+    int ret = 0;
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+    uint8_t payload[100];
+    uint32_t seqs[5] = { 2, 102, 202, 402, 302 };
+    uint8_t bytes[5] = { 'A', 'B', 'C', 'E', 'D' };
+    int i;
+
+    memset(&tv, 0x00, sizeof(tv));
+
+    StreamTcpUTInit(&ra_ctx);
+    stream_config.flags |= STREAMTCP_INIT_FLAG_SEGMENT_APPEND;
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 1);
+    ssn.client.os_policy = OS_POLICY_FIRST;
+
+    for (i = 0; i < 5; i++) {
+        memset(payload, bytes[i], sizeof(payload));
+        Packet *p = UTHBuildPacketReal(payload, sizeof(payload), IPPROTO_TCP,
+                "1.1.1.1", "2.2.2.2", 1024, 80);
+        if (p == NULL)
+            goto end;
+        p->tcph->th_seq = htonl(seqs[i]);
+
+        int r = StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn,
+                &ssn.client, p);
+        UTHFreePacket(p);
+        if (r != 0) {
+            printf("failed to add segment %d: ", i);
+            goto end;
+        }
+    }
+
+    /* A in its own segment, B and C share a large one, E and D are
+     * inserted normally as D doesn't continue the tail */
+    TcpSegment *seg = ssn.client.seg_list;
+    if (seg == NULL || seg->seq != 2 || seg->payload_len != 100) {
+        printf("first seg wrong: ");
+        goto end;
+    }
+    seg = seg->next;
+    if (seg == NULL || seg->seq != 102 || seg->payload_len != 200 ||
+            seg->pool_size != SEGMENT_APPEND_SIZE) {
+        printf("second seg wrong: ");
+        goto end;
+    }
+    if (seg->payload[99] != 'B' || seg->payload[100] != 'C') {
+        printf("appended data wrong: ");
+        goto end;
+    }
+    seg = seg->next;
+    if (seg == NULL || seg->seq != 302 || seg->payload[0] != 'D') {
+        printf("third seg wrong: ");
+        goto end;
+    }
+    seg = seg->next;
+    if (seg == NULL || seg->seq != 402 || seg->next != NULL ||
+            ssn.client.seg_list_tail != seg) {
+        printf("fourth seg wrong: ");
+        goto end;
+    }
+
+    /* once the tail is processed nothing is appended to it anymore */
+    seg->flags |= SEGMENTTCP_FLAG_RAW_PROCESSED;
+    memset(payload, 'F', sizeof(payload));
+    Packet *p = UTHBuildPacketReal(payload, sizeof(payload), IPPROTO_TCP,
+            "1.1.1.1", "2.2.2.2", 1024, 80);
+    if (p == NULL)
+        goto end;
+    p->tcph->th_seq = htonl(502);
+    int r = StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn,
+            &ssn.client, p);
+    UTHFreePacket(p);
+    if (r != 0 || seg->payload_len != 100 || seg->next == NULL ||
+            seg->next->seq != 502) {
+        printf("data appended to processed segment: ");
+        goto end;
+    }
+
+    ret = 1;
+end:
+    stream_config.flags &= ~STREAMTCP_INIT_FLAG_SEGMENT_APPEND;
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    return ret;
+}
+
+/**
+ *  \internal
+ *  \brief Feed in-order data followed by overlapping retransmissions with
+ *         different data to a stream using 'policy', and copy the
+ *         reassembled data of seq 2 to 422 to 'buf'.
+ *
+ *  \param append set to use segment-append
+ *  \param appended set to 1 if any data was appended to a segment
+ *
+ *  \retval 1 ok
+ *  \retval 0 error
+ */
+static int StreamTcpReassembleAppendOverlapRun(uint8_t policy, int append,
+        uint8_t *buf, int *appended)
+{
+    int ret = 0;
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+    uint8_t payload[100];
+    /* A-D are in-order, E-J overlap one or more of them in every way the
+     * overlap handlers distinguish */
+    uint32_t seqs[10]   = { 2, 102, 202, 302, 152, 202, 52, 302, 250, 380 };
+    uint16_t lens[10]   = { 100, 100, 100, 100, 100, 50, 100, 100, 100, 40 };
+    uint8_t bytes[10]   = { 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J' };
+    int i;
+
+    memset(&tv, 0x00, sizeof(tv));
+    memset(buf, 0x00, 420);
+    *appended = 0;
+
+    StreamTcpUTInit(&ra_ctx);
+    if (append)
+        stream_config.flags |= STREAMTCP_INIT_FLAG_SEGMENT_APPEND;
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 1);
+    ssn.client.os_policy = policy;
+
+    for (i = 0; i < 10; i++) {
+        memset(payload, bytes[i], sizeof(payload));
+        Packet *p = UTHBuildPacketReal(payload, lens[i], IPPROTO_TCP,
+                "1.1.1.1", "2.2.2.2", 1024, 80);
+        if (p == NULL)
+            goto end;
+        p->tcph->th_seq = htonl(seqs[i]);
+
+        int r = StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn,
+                &ssn.client, p);
+        UTHFreePacket(p);
+        if (r != 0) {
+            printf("failed to add segment %d: ", i);
+            goto end;
+        }
+    }
+
+    TcpSegment *seg = ssn.client.seg_list;
+    for ( ; seg != NULL; seg = seg->next) {
+        if (seg->payload_len > 100)
+            *appended = 1;
+        if (SEQ_LT(seg->seq, 2) || SEQ_GT(seg->seq + seg->payload_len, 422)) {
+            printf("seg %"PRIu32" len %"PRIu16" out of range: ",
+                    seg->seq, seg->payload_len);
+            goto end;
+        }
+        memcpy(buf + (seg->seq - 2), seg->payload, seg->payload_len);
+    }
+
+    ret = 1;
+end:
+    stream_config.flags &= ~STREAMTCP_INIT_FLAG_SEGMENT_APPEND;
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    return ret;
+}
+
+/** \test overlapping retransmissions are reassembled the same with and
+ *        without segment-append, for every os policy */
+static int StreamTcpReassembleAppendTest02(void) {
+    uint8_t plain[420];
+    uint8_t merged[420];
+    int appended = 0;
+    uint8_t policy;
+
+    for (policy = OS_POLICY_BSD; policy <= OS_POLICY_LAST; policy++) {
+        if (StreamTcpReassembleAppendOverlapRun(policy, 0, plain, &appended) == 0)
+            return 0;
+        if (appended) {
+            printf("policy %"PRIu8": data appended without segment-append: ",
+                    policy);
+            return 0;
+        }
+        if (StreamTcpReassembleAppendOverlapRun(policy, 1, merged, &appended) == 0)
+            return 0;
+        if (appended != (policy == OS_POLICY_FIRST ||
+                    policy == OS_POLICY_LAST || policy == OS_POLICY_VISTA)) {
+            printf("policy %"PRIu8": appended %d: ", policy, appended);
+            return 0;
+        }
+        if (memcmp(plain, merged, sizeof(plain)) != 0) {
+            printf("policy %"PRIu8": reassembled data differs: ", policy);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/** \test segments are handed out from and returned to the thread cache,
+ *        which is flushed to the global pool when it gets too large */
+static int StreamTcpReassembleCacheTest01(void) {
+    int ret = 0;
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSegment *segs[64];
+    int i;
+
+    memset(&tv, 0x00, sizeof(tv));
+    memset(&segs, 0x00, sizeof(segs));
+
+    StreamTcpUTInit(&ra_ctx);
+
+    uint16_t idx = segment_pool_idx[100];
+    uint16_t batch = segment_cache_batch[idx];
+    if (batch != 16) {
+        printf("batch %u, expected 16: ", batch);
+        goto end;
+    }
+
+    /* the first get refills the cache with a batch */
+    segs[0] = StreamTcpGetSegment(&tv, ra_ctx, 100);
+    if (segs[0] == NULL || segs[0]->pool_size != 112) {
+        printf("no segment: ");
+        goto end;
+    }
+    if (ra_ctx->segment_cache_cnt[idx] != batch - 1) {
+        printf("cache cnt %u, expected %u: ",
+                ra_ctx->segment_cache_cnt[idx], batch - 1);
+        goto end;
+    }
+
+    for (i = 1; i < 64; i++) {
+        segs[i] = StreamTcpGetSegment(&tv, ra_ctx, 100);
+        if (segs[i] == NULL) {
+            printf("no segment %d: ", i);
+            goto end;
+        }
+    }
+
+    /* returning them all keeps the cache at at most 2 batches */
+    for (i = 0; i < 64; i++) {
+        StreamTcpSegmentReturntoCache(ra_ctx, segs[i]);
+        segs[i] = NULL;
+        if (ra_ctx->segment_cache_cnt[idx] > 2 * batch) {
+            printf("cache cnt %u after return %d: ",
+                    ra_ctx->segment_cache_cnt[idx], i);
+            goto end;
+        }
+    }
+
+    /* the last returned segment is handed out first */
+    TcpSegment *head = ra_ctx->segment_cache[idx];
+    TcpSegment *seg = StreamTcpGetSegment(&tv, ra_ctx, 50);
+    if (seg != head || seg->next != NULL || seg->flags != 0) {
+        printf("cache not used: ");
+        goto end;
+    }
+    StreamTcpSegmentReturntoCache(ra_ctx, seg);
+
+    ret = 1;
+end:
+    for (i = 0; i < 64; i++) {
+        if (segs[i] != NULL)
+            StreamTcpSegmentReturntoPool(segs[i]);
+    }
+    StreamTcpUTDeinit(ra_ctx);
+    return ret;
+}
+
 #endif /* UNITTESTS */
 
 /** \brief  The Function Register the Unit tests to test the reassembly engine
@@ -8932,12 +9607,18 @@ void StreamTcpReassembleRegisterTests(void) {
     UtRegisterTest("StreamTcpReassembleInlineTest09 -- inline RAW ra 9 GAP cleanup", StreamTcpReassembleInlineTest09, 1);
 
     UtRegisterTest("StreamTcpReassembleInlineTest10 -- inline APP ra 10", StreamTcpReassembleInlineTest10, 1);
+    UtRegisterTest("StreamTcpReassembleInlineTest11 -- inline APP ra 11", StreamTcpReassembleInlineTest11, 1);
 
     UtRegisterTest("StreamTcpReassembleInsertTest01 -- insert with overlap", StreamTcpReassembleInsertTest01, 1);
     UtRegisterTest("StreamTcpReassembleInsertTest02 -- insert with overlap", StreamTcpReassembleInsertTest02, 1);
     UtRegisterTest("StreamTcpReassembleInsertTest03 -- insert with overlap", StreamTcpReassembleInsertTest03, 1);
 
+    UtRegisterTest("StreamTcpReassembleAppendTest01 -- segment append", StreamTcpReassembleAppendTest01, 1);
+    UtRegisterTest("StreamTcpReassembleAppendTest02 -- segment append overlaps", StreamTcpReassembleAppendTest02, 1);
+    UtRegisterTest("StreamTcpReassembleCacheTest01 -- thread segment cache", StreamTcpReassembleCacheTest01, 1);
+
     StreamTcpInlineRegisterTests();
     StreamTcpUtilRegisterTests();
+    StreamTcpTreeRegisterTests();
 #endif /* UNITTESTS */
 }
@@ -51,6 +51,9 @@ enum
     OS_POLICY_LAST
 };
 
+/** number of segment pools, see segment_pool_pktsizes */
+#define STREAM_TCP_SEGMENT_POOLS    9
+
 typedef struct TcpReassemblyThreadCtx_ {
     StreamMsgQueue *stream_q;
     AlpProtoDetectThreadCtx dp_ctx;   /**< proto detection thread data */
@@ -62,6 +65,12 @@ typedef struct TcpReassemblyThreadCtx_ {
     uint16_t counter_tcp_reass_memuse;
     /** count number of streams with a unrecoverable stream gap (missing pkts) */
     uint16_t counter_tcp_reass_gap;
+
+    /** per thread cache of free segments for each segment pool, linked
+     *  through seg->next. Refilled from and flushed to the global pools
+     *  in batches, so that we don't take the pool lock per segment. */
+    TcpSegment *segment_cache[STREAM_TCP_SEGMENT_POOLS];
+    uint16_t segment_cache_cnt[STREAM_TCP_SEGMENT_POOLS];
 } TcpReassemblyThreadCtx;
 
 #define OS_POLICY_DEFAULT   OS_POLICY_BSD
@@ -95,6 +104,7 @@ TcpSegment* StreamTcpGetSegment(ThreadVars *, TcpReassemblyThreadCtx *, uint16_t
 
 void StreamTcpReturnStreamSegments(TcpStream *);
 void StreamTcpSegmentReturntoPool(TcpSegment *);
+void StreamTcpSegmentReturntoCache(TcpReassemblyThreadCtx *, TcpSegment *);
 
 void StreamTcpReassembleTriggerRawReassembly(TcpSession *);
 
@@ -0,0 +1,619 @@
+/* Copyright (C) 2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * \author agent <agent@local>
+ *
+ * Red-black tree index over the segment list of a stream.
+ *
+ * The segment list stays the primary storage: reassembly and the overlap
+ * handling walk it through seg->next/prev. The tree only indexes the same
+ * segments on their sequence number, so that the insertion code can find
+ * the place of an out of order segment in O(log n) instead of walking the
+ * list from its head.
+ *
+ * The nodes are embedded in the segments, so the tree doesn't allocate.
+ * Sequence numbers are compared with SEQ_LT so wrap around is handled.
+ */
+
+#include "suricata-common.h"
+#include "stream-tcp-private.h"
+#include "stream-tcp-tree.h"
+#include "stream-tcp.h"
+#include "stream-tcp-reassemble.h"
+#include "stream-tcp-util.h"
+
+#include "util-unittest.h"
+
+#define RB_RED      0
+#define RB_BLACK    1
+
+#define IS_RED(n)   ((n) != NULL && (n)->rb_color == RB_RED)
+
+/** segment is in the tree if it has a parent or is the root */
+#define IN_TREE(stream, seg) \
+    ((seg)->rb_parent != NULL || (stream)->seg_tree == (seg))
+
+static void StreamTcpSegmentTreeClearNode(TcpSegment *seg)
+{
+    seg->rb_parent = NULL;
+    seg->rb_left = NULL;
+    seg->rb_right = NULL;
+    seg->rb_color = RB_RED;
+}
+
+/** \internal
+ *  \brief make 'new' take the place of 'old' as child of old's parent */
+static void StreamTcpSegmentTreeReplaceChild(TcpStream *stream,
+        TcpSegment *old, TcpSegment *new)
+{
+    TcpSegment *parent = old->rb_parent;
+
+    if (parent == NULL)
+        stream->seg_tree = new;
+    else if (parent->rb_left == old)
+        parent->rb_left = new;
+    else
+        parent->rb_right = new;
+}
+
+static void StreamTcpSegmentTreeRotateLeft(TcpStream *stream, TcpSegment *x)
+{
+    TcpSegment *y = x->rb_right;
+
+    x->rb_right = y->rb_left;
+    if (y->rb_left != NULL)
+        y->rb_left->rb_parent = x;
+
+    y->rb_parent = x->rb_parent;
+    StreamTcpSegmentTreeReplaceChild(stream, x, y);
+
+    y->rb_left = x;
+    x->rb_parent = y;
+}
+
+static void StreamTcpSegmentTreeRotateRight(TcpStream *stream, TcpSegment *x)
+{
+    TcpSegment *y = x->rb_left;
+
+    x->rb_left = y->rb_right;
+    if (y->rb_right != NULL)
+        y->rb_right->rb_parent = x;
+
+    y->rb_parent = x->rb_parent;
+    StreamTcpSegmentTreeReplaceChild(stream, x, y);
+
+    y->rb_right = x;
+    x->rb_parent = y;
+}
+
+static void StreamTcpSegmentTreeInsertFixup(TcpStream *stream, TcpSegment *z)
+{
+    TcpSegment *p;
+
+    while ((p = z->rb_parent) != NULL && p->rb_color == RB_RED) {
+        /* p is red so it's not the root, g exists */
+        TcpSegment *g = p->rb_parent;
+
+        if (p == g->rb_left) {
+            TcpSegment *u = g->rb_right;
+            if (IS_RED(u)) {
+                p->rb_color = RB_BLACK;
+                u->rb_color = RB_BLACK;
+                g->rb_color = RB_RED;
+                z = g;
+                continue;
+            }
+            if (z == p->rb_right) {
+                StreamTcpSegmentTreeRotateLeft(stream, p);
+                z = p;
+                p = z->rb_parent;
+            }
+            p->rb_color = RB_BLACK;
+            g->rb_color = RB_RED;
+            StreamTcpSegmentTreeRotateRight(stream, g);
+        } else {
+            TcpSegment *u = g->rb_left;
+            if (IS_RED(u)) {
+                p->rb_color = RB_BLACK;
+                u->rb_color = RB_BLACK;
+                g->rb_color = RB_RED;
+                z = g;
+                continue;
+            }
+            if (z == p->rb_left) {
+                StreamTcpSegmentTreeRotateRight(stream, p);
+                z = p;
+                p = z->rb_parent;
+            }
+            p->rb_color = RB_BLACK;
+            g->rb_color = RB_RED;
+            StreamTcpSegmentTreeRotateLeft(stream, g);
+        }
+    }
+
+    stream->seg_tree->rb_color = RB_BLACK;
+}
+
+/**
+ *  \brief add a segment to the tree of the stream
+ *
+ *  \param stream stream the segment was added to
+ *  \param seg segment, must already be linked in stream->seg_list
+ */
+void StreamTcpSegmentTreeInsert(TcpStream *stream, TcpSegment *seg)
+{
+    TcpSegment *parent = NULL;
+    TcpSegment *cur = stream->seg_tree;
+
+    while (cur != NULL) {
+        parent = cur;
+        if (SEQ_LT(seg->seq, cur->seq))
+            cur = cur->rb_left;
+        else
+            cur = cur->rb_right;
+    }
+
+    StreamTcpSegmentTreeClearNode(seg);
+    seg->rb_parent = parent;
+
+    if (parent == NULL)
+        stream->seg_tree = seg;
+    else if (SEQ_LT(seg->seq, parent->seq))
+        parent->rb_left = seg;
+    else
+        parent->rb_right = seg;
+
+    StreamTcpSegmentTreeInsertFixup(stream, seg);
+}
+
+static void StreamTcpSegmentTreeRemoveFixup(TcpStream *stream, TcpSegment *x,
+        TcpSegment *parent)
+{
+    TcpSegment *w;
+
+    while (x != stream->seg_tree && !IS_RED(x)) {
+        if (x == parent->rb_left) {
+            w = parent->rb_right;
+            if (IS_RED(w)) {
+                w->rb_color = RB_BLACK;
+                parent->rb_color = RB_RED;
+                StreamTcpSegmentTreeRotateLeft(stream, parent);
+                w = parent->rb_right;
+            }
+            if (!IS_RED(w->rb_left) && !IS_RED(w->rb_right)) {
+                w->rb_color = RB_RED;
+                x = parent;
+                parent = x->rb_parent;
+            } else {
+                if (!IS_RED(w->rb_right)) {
+                    w->rb_left->rb_color = RB_BLACK;
+                    w->rb_color = RB_RED;
+                    StreamTcpSegmentTreeRotateRight(stream, w);
+                    w = parent->rb_right;
+                }
+                w->rb_color = parent->rb_color;
+                parent->rb_color = RB_BLACK;
+                if (w->rb_right != NULL)
+                    w->rb_right->rb_color = RB_BLACK;
+                StreamTcpSegmentTreeRotateLeft(stream, parent);
+                x = stream->seg_tree;
+                break;
+            }
+        } else {
+            w = parent->rb_left;
+            if (IS_RED(w)) {
+                w->rb_color = RB_BLACK;
+                parent->rb_color = RB_RED;
+                StreamTcpSegmentTreeRotateRight(stream, parent);
+                w = parent->rb_left;
+            }
+            if (!IS_RED(w->rb_left) && !IS_RED(w->rb_right)) {
+                w->rb_color = RB_RED;
+                x = parent;
+                parent = x->rb_parent;
+            } else {
+                if (!IS_RED(w->rb_left)) {
+                    w->rb_right->rb_color = RB_BLACK;
+                    w->rb_color = RB_RED;
+                    StreamTcpSegmentTreeRotateLeft(stream, w);
+                    w = parent->rb_left;
+                }
+                w->rb_color = parent->rb_color;
+                parent->rb_color = RB_BLACK;
+                if (w->rb_left != NULL)
+                    w->rb_left->rb_color = RB_BLACK;
+                StreamTcpSegmentTreeRotateRight(stream, parent);
+                x = stream->seg_tree;
+                break;
+            }
+        }
+    }
+
+    if (x != NULL)
+        x->rb_color = RB_BLACK;
+}
+
+/**
+ *  \brief remove a segment from the tree of the stream
+ *
+ *  Segments that are not in the tree are ignored, e.g. lists that are
+ *  set up by hand in the unittests.
+ */
+void StreamTcpSegmentTreeRemove(TcpStream *stream, TcpSegment *z)
+{
+    TcpSegment *child, *parent;
+    uint8_t color;
+
+    if (!(IN_TREE(stream, z)))
+        return;
+
+    if (z->rb_left != NULL && z->rb_right != NULL) {
+        /* replace z by its successor y, then fix up where y was */
+        TcpSegment *y = z->rb_right;
+        while (y->rb_left != NULL)
+            y = y->rb_left;
+
+        child = y->rb_right;
+        parent = y->rb_parent;
+        color = y->rb_color;
+
+        if (parent == z) {
+            parent = y;
+        } else {
+            if (child != NULL)
+                child->rb_parent = parent;
+            parent->rb_left = child;
+            y->rb_right = z->rb_right;
+            z->rb_right->rb_parent = y;
+        }
+
+        y->rb_parent = z->rb_parent;
+        y->rb_color = z->rb_color;
+        y->rb_left = z->rb_left;
+        z->rb_left->rb_parent = y;
+        StreamTcpSegmentTreeReplaceChild(stream, z, y);
+    } else {
+        child = (z->rb_left != NULL) ? z->rb_left : z->rb_right;
+        parent = z->rb_parent;
+        color = z->rb_color;
+
+        if (child != NULL)
+            child->rb_parent = parent;
+        StreamTcpSegmentTreeReplaceChild(stream, z, child);
+    }
+
+    if (color == RB_BLACK)
+        StreamTcpSegmentTreeRemoveFixup(stream, child, parent);
+
+    StreamTcpSegmentTreeClearNode(z);
+}
+
+/**
+ *  \brief put segment 'new' in the place of 'old' in the tree
+ *
+ *  Used when the overlap handling replaces a list segment by a new one
+ *  at the same position in the list, so the order is unchanged.
+ */
+void StreamTcpSegmentTreeReplace(TcpStream *stream, TcpSegment *old,
+        TcpSegment *new)
+{
+    if (!(IN_TREE(stream, old))) {
+        StreamTcpSegmentTreeInsert(stream, new);
+        return;
+    }
+
+    new->rb_parent = old->rb_parent;
+    new->rb_left = old->rb_left;
+    new->rb_right = old->rb_right;
+    new->rb_color = old->rb_color;
+
+    if (new->rb_left != NULL)
+        new->rb_left->rb_parent = new;
+    if (new->rb_right != NULL)
+        new->rb_right->rb_parent = new;
+    StreamTcpSegmentTreeReplaceChild(stream, old, new);
+
+    StreamTcpSegmentTreeClearNode(old);
+}
+
+/**
+ *  \brief find the segment with the highest seq that is <= seq
+ *
+ *  \retval seg or NULL if all segments start after seq
+ */
+TcpSegment *StreamTcpSegmentTreeFindLE(TcpStream *stream, uint32_t seq)
+{
+    TcpSegment *cur = stream->seg_tree;
+    TcpSegment *found = NULL;
+
+    while (cur != NULL) {
+        if (SEQ_LEQ(cur->seq, seq)) {
+            found = cur;
+            cur = cur->rb_right;
+        } else {
+            cur = cur->rb_left;
+        }
+    }
+
+    return found;
+}
+
+#ifdef UNITTESTS
+
+/** \internal
+ *  \brief check the red-black properties and the order of a (sub)tree
+ *
+ *  \param depth set to the max depth of the subtree
+ *
+ *  \retval black height of the subtree or -1 if the tree is broken
+ */
+static int StreamTcpSegmentTreeCheck(TcpSegment *n, int *depth)
+{
+    int ld = 0, rd = 0;
+
+    *depth = 0;
+    if (n == NULL)
+        return 1;
+
+    if (n->rb_left != NULL &&
+            (n->rb_left->rb_parent != n || SEQ_GT(n->rb_left->seq, n->seq)))
+        return -1;
+    if (n->rb_right != NULL &&
+            (n->rb_right->rb_parent != n || SEQ_LT(n->rb_right->seq, n->seq)))
+        return -1;
+    if (IS_RED(n) && (IS_RED(n->rb_left) || IS_RED(n->rb_right)))
+        return -1;
+
+    int lh = StreamTcpSegmentTreeCheck(n->rb_left, &ld);
+    int rh = StreamTcpSegmentTreeCheck(n->rb_right, &rd);
+    if (lh == -1 || rh == -1 || lh != rh)
+        return -1;
+
+    *depth = 1 + (ld > rd ? ld : rd);
+    return lh + (n->rb_color == RB_BLACK ? 1 : 0);
+}
+
+static uint32_t StreamTcpSegmentTreeCount(TcpSegment *n)
+{
+    if (n == NULL)
+        return 0;
+    return 1 + StreamTcpSegmentTreeCount(n->rb_left) +
+        StreamTcpSegmentTreeCount(n->rb_right);
+}
+
+/** \internal
+ *  \brief check that the tree is valid, holds exactly the list segments
+ *         and that its depth is within the red-black bound of
+ *         2 * log2(n + 1)
+ *
+ *  \retval 1 ok
+ *  \retval 0 broken
+ */
+static int StreamTcpSegmentTreeValidate(TcpStream *stream)
+{
+    int depth = 0;
+    uint32_t cnt = 0;
+    TcpSegment *seg;
+
+    if (stream->seg_tree != NULL &&
+            (stream->seg_tree->rb_parent != NULL || IS_RED(stream->seg_tree))) {
+        printf("bad root: ");
+        return 0;
+    }
+    if (StreamTcpSegmentTreeCheck(stream->seg_tree, &depth) == -1) {
+        printf("tree properties violated: ");
+        return 0;
+    }
+
+    for (seg = stream->seg_list; seg != NULL; seg = seg->next) {
+        if (!(IN_TREE(stream, seg))) {
+            printf("list seg %u not in tree: ", seg->seq);
+            return 0;
+        }
+        if (StreamTcpSegmentTreeFindLE(stream, seg->seq) != seg) {
+            printf("lookup of %u failed: ", seg->seq);
+            return 0;
+        }
+        cnt++;
+    }
+
+    if (StreamTcpSegmentTreeCount(stream->seg_tree) != cnt) {
+        printf("tree has %u segments, list %u: ",
+                StreamTcpSegmentTreeCount(stream->seg_tree), cnt);
+        return 0;
+    }
+
+    /* bound: depth <= 2 * log2(n + 1) */
+    uint32_t log2 = 0;
+    while ((1U << (log2 + 1)) <= cnt + 1)
+        log2++;
+    if ((uint32_t)depth > 2 * (log2 + 1)) {
+        printf("depth %d for %u segments: ", depth, cnt);
+        return 0;
+    }
+    return 1;
+}
+
+/** \test insert and remove in random order, check the tree after each
+ *        operation */
+static int StreamTcpTreeTest01(void)
+{
+    TcpSegment segs[512];
+    TcpStream stream;
+    uint32_t order[512];
+    uint32_t i, r = 12345;
+
+    memset(&segs, 0, sizeof(segs));
+    memset(&stream, 0, sizeof(stream));
+
+    for (i = 0; i < 512; i++) {
+        segs[i].seq = 1000 + i * 10;
+        order[i] = i;
+    }
+    /* shuffle */
+    for (i = 511; i > 0; i--) {
+        r = r * 1103515245 + 12345;
+        uint32_t j = (r >> 16) % (i + 1);
+        uint32_t t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    for (i = 0; i < 512; i++) {
+        StreamTcpSegmentTreeInsert(&stream, &segs[order[i]]);
+        int depth = 0;
+        if (StreamTcpSegmentTreeCheck(stream.seg_tree, &depth) == -1) {
+            printf("tree broken after insert %u: ", i);
+            return 0;
+        }
+    }
+
+    if (StreamTcpSegmentTreeFindLE(&stream, 999) != NULL ||
+            StreamTcpSegmentTreeFindLE(&stream, 1000) != &segs[0] ||
+            StreamTcpSegmentTreeFindLE(&stream, 1015) != &segs[1] ||
+            StreamTcpSegmentTreeFindLE(&stream, 100000) != &segs[511]) {
+        printf("lookup failed: ");
+        return 0;
+    }
+
+    /* remove every other segment, in shuffled order */
+    for (i = 0; i < 512; i++) {
+        if (order[i] % 2)
+            continue;
+        StreamTcpSegmentTreeRemove(&stream, &segs[order[i]]);
+        int depth = 0;
+        if (StreamTcpSegmentTreeCheck(stream.seg_tree, &depth) == -1) {
+            printf("tree broken after remove %u: ", i);
+            return 0;
+        }
+    }
+    if (StreamTcpSegmentTreeFindLE(&stream, 1005) != NULL ||
+            StreamTcpSegmentTreeFindLE(&stream, 1025) != &segs[1]) {
+        printf("lookup after remove failed: ");
+        return 0;
+    }
+
+    /* removing a segment twice is a noop */
+    StreamTcpSegmentTreeRemove(&stream, &segs[0]);
+
+    for (i = 0; i < 512; i++) {
+        if (order[i] % 2)
+            StreamTcpSegmentTreeRemove(&stream, &segs[order[i]]);
+    }
+    if (stream.seg_tree != NULL) {
+        printf("tree not empty: ");
+        return 0;
+    }
+    return 1;
+}
+
+/** \internal
+ *  \brief add segments in the order of a generator through the normal
+ *         insertion code, including the overlap handling, and check the
+ *         tree after each segment
+ *
+ *  \param mode 0: random seq and size, overlaps; 1: descending, no
+ *              overlaps (worst case for the list walk); 2: ascending with
+ *              a gap at the start, then filling the gaps
+ */
+static int StreamTcpTreeStress(int mode, uint32_t cnt)
+{
+    int ret = 0;
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+    uint32_t i, r = 54321;
+
+    memset(&tv, 0x00, sizeof(tv));
+
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 1);
+
+    for (i = 0; i < cnt; i++) {
+        uint32_t seq;
+        uint16_t len;
+
+        r = r * 1103515245 + 12345;
+        switch (mode) {
+            case 0:
+                seq = 2 + ((r >> 8) % (cnt * 10));
+                len = 1 + ((r >> 4) % 20);
+                break;
+            case 1:
+                seq = 2 + (cnt - i) * 10;
+                len = 5;
+                break;
+            default:
+                if (i < cnt / 2)
+                    seq = 12 + i * 20;
+                else
+                    seq = 2 + (i - cnt / 2) * 20;
+                len = 10;
+                break;
+        }
+
+        if (StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client, seq,
+                    (uint8_t)('A' + (i % 26)), len) == -1) {
+            printf("failed to add segment %u: ", i);
+            goto end;
+        }
+        if (StreamTcpSegmentTreeValidate(&ssn.client) == 0) {
+            printf("after segment %u (seq %u len %u): ", i, seq, len);
+            goto end;
+        }
+    }
+
+    ret = 1;
+end:
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    return ret;
+}
+
+/** \test randomized segment order with overlaps */
+static int StreamTcpTreeTest02(void)
+{
+    return StreamTcpTreeStress(0, 2000);
+}
+
+/** \test descending segment order, every segment goes before the head */
+static int StreamTcpTreeTest03(void)
+{
+    return StreamTcpTreeStress(1, 4000);
+}
+
+/** \test every other segment missing, then the gaps are filled */
+static int StreamTcpTreeTest04(void)
+{
+    return StreamTcpTreeStress(2, 4000);
+}
+
+#endif /* UNITTESTS */
+
+void StreamTcpTreeRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("StreamTcpTreeTest01", StreamTcpTreeTest01, 1);
+    UtRegisterTest("StreamTcpTreeTest02 -- random order stress", StreamTcpTreeTest02, 1);
+    UtRegisterTest("StreamTcpTreeTest03 -- descending order stress", StreamTcpTreeTest03, 1);
+    UtRegisterTest("StreamTcpTreeTest04 -- gap fill stress", StreamTcpTreeTest04, 1);
+#endif /* UNITTESTS */
+}
@@ -35,6 +35,8 @@
 
 #include "flow.h"
 #include "flow-util.h"
+#include "flow-private.h"
+#include "flow-wheel.h"
 
 #include "conf.h"
 #include "conf-yaml-loader.h"
@@ -575,6 +577,17 @@ void StreamTcpInitConfig(char quiet)
             stream_config.reassembly_toclient_chunk_size);
     }
 
+    int append = 0;
+    if ((ConfGetBool("stream.reassembly.segment-append", &append)) == 1) {
+        if (append == 1)
+            stream_config.flags |= STREAMTCP_INIT_FLAG_SEGMENT_APPEND;
+    }
+    if (!quiet) {
+        SCLogInfo("stream.reassembly \"segment-append\": %s",
+            stream_config.flags & STREAMTCP_INIT_FLAG_SEGMENT_APPEND ?
+            "enabled" : "disabled");
+    }
+
     /* init the memcap/use tracking */
     SC_ATOMIC_INIT(st_memuse);
 
@@ -656,6 +669,13 @@ static void StreamTcpPacketSetState(Packet *p, TcpSession *ssn,
         return;
 
     ssn->state = state;
+
+    /* closed sessions have a much lower timeout than the one the flow
+     * was scheduled with in the timing wheel */
+    if (p->flow != NULL && StreamTcpGetFlowState(ssn) == FLOW_STATE_CLOSED) {
+        FlowWheelExpedite(p->flow, (uint32_t)p->ts.tv_sec +
+                flow_proto[FLOW_PROTO_TCP].closed_timeout + 1);
+    }
 }
 
 /**
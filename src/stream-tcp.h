@@ -38,6 +38,9 @@
 /* Flag to indicate that the checksum validation for the stream engine
    has been enabled */
 #define STREAMTCP_INIT_FLAG_CHECKSUM_VALIDATION    0x01
+/* Flag to indicate that in-order data is appended to the tail segment of
+   a stream instead of getting a segment per packet */
+#define STREAMTCP_INIT_FLAG_SEGMENT_APPEND         0x02
 
 /*global flow data*/
 typedef struct TcpStreamCnf_ {
@@ -62,6 +62,7 @@
 #include "detect-engine-address.h"
 #include "detect-engine-port.h"
 #include "detect-engine-mpm.h"
+#include "detect-engine-state.h"
 
 #include "tm-queuehandlers.h"
 #include "tm-queues.h"
@@ -718,6 +719,7 @@ void RegisterAllModules()
     /* pcap file */
     TmModuleReceivePcapFileRegister();
     TmModuleDecodePcapFileRegister();
+    TmModuleReceivePcapFileMmapRegister();
 #ifdef HAVE_MPIPE
     /* mpipe */
     TmModuleReceiveMpipeRegister();
@@ -1743,6 +1745,11 @@ static int LoadSignatures(DetectEngineCtx *de_ctx, SCInstance *suri)
     }
 
     SCThresholdConfInitContext(de_ctx, NULL);
+
+    if (DetectEngineMultiTenantSetup(de_ctx, NULL) < 0) {
+        SCLogError(SC_ERR_NO_RULES_LOADED, "Loading tenant engines failed.");
+        return TM_ECODE_FAILED;
+    }
     return TM_ECODE_OK;
 }
 
@@ -2227,6 +2234,7 @@ int main(int argc, char **argv)
     if (suri.run_mode != RUNMODE_UNIX_SOCKET) {
         SCPerfReleaseResources();
         FlowShutdown();
+        DetectEngineStatePoolCleanup();
         StreamTcpFreeConfig(STREAM_VERBOSE);
     }
     HostShutdown();
@@ -37,16 +37,21 @@
 #include "tm-queuehandlers.h"
 
 #include "conf.h"
+#include "util-rss.h"
 #include "util-unittest.h"
 
 Packet *TmqhInputFlow(ThreadVars *t);
 void TmqhOutputFlowHash(ThreadVars *t, Packet *p);
 void TmqhOutputFlowActivePackets(ThreadVars *t, Packet *p);
 void TmqhOutputFlowRoundRobin(ThreadVars *t, Packet *p);
+void TmqhOutputFlowRss(ThreadVars *t, Packet *p);
 void *TmqhOutputFlowSetupCtx(char *queue_str);
 void TmqhOutputFlowFreeCtx(void *ctx);
 void TmqhFlowRegisterTests(void);
 
+/** set if packets are balanced before they are decoded */
+static int tmqh_flow_rss = 0;
+
 void TmqhFlowRegister(void)
 {
     tmqh_table[TMQH_FLOW].name = "flow";
@@ -66,6 +71,11 @@ void TmqhFlowRegister(void)
         } else if (strcasecmp(scheduler, "hash") == 0) {
             SCLogInfo("AutoFP mode using \"Hash\" flow load balancer");
             tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
+        } else if (strcasecmp(scheduler, "rss") == 0) {
+            SCLogInfo("AutoFP mode using \"RSS\" flow load balancer");
+            RssInit();
+            tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowRss;
+            tmqh_flow_rss = 1;
         } else {
             SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid entry \"%s\" "
                        "for autofp-scheduler in conf.  Killing engine.",
@@ -80,6 +90,19 @@ void TmqhFlowRegister(void)
     return;
 }
 
+/**
+ * \brief check if the flow queue handler balances raw packets
+ *
+ * In that case the runmodes have to decode in the threads that read from
+ * the flow queues instead of in the capture threads.
+ *
+ * \retval 1 yes, 0 no
+ */
+int TmqhFlowIsRss(void)
+{
+    return tmqh_flow_rss;
+}
+
 /* same as 'simple' */
 Packet *TmqhInputFlow(ThreadVars *tv)
 {
@@ -353,6 +376,32 @@ void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
     return;
 }
 
+/**
+ * \brief select the queue to output to based on a symmetric hash of the
+ *        raw packet. This is done before the packet is decoded, so the
+ *        capture thread only has to do the capture.
+ *
+ * \param tv thread vars.
+ * \param p packet.
+ */
+void TmqhOutputFlowRss(ThreadVars *tv, Packet *p)
+{
+    int32_t qid = 0;
+
+    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+
+    qid = RssHashRaw(p->datalink, GET_PKT_DATA(p), GET_PKT_LEN(p)) % ctx->size;
+    (void) SC_ATOMIC_ADD(ctx->queues[qid].total_packets, 1);
+
+    PacketQueue *q = ctx->queues[qid].q;
+    SCMutexLock(&q->mutex_q);
+    PacketEnqueue(q, p);
+    SCCondSignal(&q->cond_q);
+    SCMutexUnlock(&q->mutex_q);
+
+    return;
+}
+
 #ifdef UNITTESTS
 
 static int TmqhOutputFlowSetupCtxTest01(void)
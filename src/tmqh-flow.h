@@ -44,6 +44,7 @@ typedef struct TmqhFlowCtx_ {
 } TmqhFlowCtx;
 
 void TmqhFlowRegister (void);
+int TmqhFlowIsRss(void);
 void TmqhFlowRegisterTests(void);
 
 #endif /* __TMQH_FLOW_H__ */
@@ -36,12 +36,14 @@
 #include "mm_malloc.h"
 #endif
 
-#if defined(__tile__)
+#if defined(__tile__) || !(defined(__SSE__) || defined(_WIN32) || defined(__WIN32))
 /* Need to define __mm_ function alternatives, since these are SSE only.
  */
 #include <malloc.h>
 #define _mm_malloc(a,b) memalign((b),(a))
 #define _mm_free(a) free((a))
+#elif defined(__SSE__)
+#include <mm_malloc.h>
 #endif /* defined(__tile__) */
 
 SC_ATOMIC_EXTERN(unsigned int, engine_stage);
@@ -0,0 +1,967 @@
+/* Copyright (C) 2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * \author agent <agent@local>
+ *
+ * Aho-Corasick with a compressed state table.
+ *
+ * The automaton is built by the regular AC code, after which its delta
+ * table (a full 256 wide row per state) is converted:
+ *
+ *  - Alphabet compression: bytes that are not used by any pattern share
+ *    class 0, every other (lower case) byte gets a class of its own, and
+ *    upper case bytes map to the class of their lower case version. Rows
+ *    are alphabet_size wide instead of 256, and the search loop doesn't
+ *    need the tolower.
+ *  - The root and its children get a dense row. These are the states
+ *    most of the input is spent in.
+ *  - Deeper states get a sparse row that only holds the transitions that
+ *    differ from the root's. Those are the goto transitions of the state
+ *    and of the states in its failure chain, so usually just a few. States
+ *    that end up with many entries get a dense row anyway.
+ *  - States are renumbered in breadth first order, dense states first, so
+ *    that the rows that are used together are close together.
+ *
+ * With this the tables of most rule groups fit in L2, so it's possible to
+ * use "full" sgh-mpm-context where "ac" would need "single".
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-memcmp.h"
+#include "util-mpm-ac.h"
+#include "util-mpm-ac-ks.h"
+
+void SCACKsInitCtx(MpmCtx *);
+void SCACKsInitThreadCtx(MpmCtx *, MpmThreadCtx *, uint32_t);
+void SCACKsDestroyCtx(MpmCtx *);
+void SCACKsDestroyThreadCtx(MpmCtx *, MpmThreadCtx *);
+int SCACKsAddPatternCI(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                       uint32_t, uint32_t, uint8_t);
+int SCACKsAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                       uint32_t, uint32_t, uint8_t);
+int SCACKsPreparePatterns(MpmCtx *mpm_ctx);
+uint32_t SCACKsSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                      PatternMatcherQueue *pmq, uint8_t *buf, uint16_t buflen);
+void SCACKsPrintInfo(MpmCtx *mpm_ctx);
+void SCACKsPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
+void SCACKsRegisterTests(void);
+
+/**
+ * \internal
+ * \brief Get a transition from the ac delta table, in our encoding.
+ */
+static inline uint32_t SCACKsGetACNext(SCACCtx *ac, uint32_t state, uint8_t c)
+{
+    if (ac->state_count < 32767) {
+        SC_AC_STATE_TYPE_U16 v = ac->state_table_u16[state][c];
+        return (v & 0x7FFF) | ((v & 0x8000) ? SC_AC_KS_OUTPUT : 0);
+    } else {
+        SC_AC_STATE_TYPE_U32 v = ac->state_table_u32[state][c];
+        return (v & 0x00FFFFFF) | ((v & 0xFF000000) ? SC_AC_KS_OUTPUT : 0);
+    }
+}
+
+/**
+ * \internal
+ * \brief Build the alphabet classes from the columns of the delta table
+ *        that are in use.
+ *
+ * \param rep filled with a byte of each class
+ */
+static void SCACKsInitTranslateTable(SCACKsCtx *ctx, SCACCtx *ac, uint8_t *rep)
+{
+    uint8_t class_of[256];
+    uint32_t s;
+    int c;
+
+    memset(class_of, 0, sizeof(class_of));
+    ctx->alphabet_size = 1;
+
+    /* the ac table is only filled for lower case, so only those columns
+     * can be in use */
+    for (c = 0; c < 256; c++) {
+        for (s = 0; s < ac->state_count; s++) {
+            if (SCACKsGetACNext(ac, s, (uint8_t)c) != 0) {
+                rep[ctx->alphabet_size] = (uint8_t)c;
+                class_of[c] = (uint8_t)ctx->alphabet_size++;
+                break;
+            }
+        }
+    }
+
+    /* class 0's rows are built from the column of its representative, so
+     * that has to be a byte no pattern uses. 0x00 can be in a pattern, but
+     * upper case columns are always unused. */
+    for (c = 0; c < 256 && class_of[c] != 0; c++)
+        ;
+    BUG_ON(c == 256);
+    rep[0] = (uint8_t)c;
+
+    for (c = 0; c < 256; c++)
+        ctx->translate_table[c] = class_of[u8_tolower(c)];
+
+    SCLogDebug("alphabet size %u", ctx->alphabet_size);
+}
+
+/**
+ * \internal
+ * \brief Convert the ac delta table into dense and sparse rows.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+static int SCACKsPrepareStateTable(MpmCtx *mpm_ctx)
+{
+    SCACKsCtx *ctx = (SCACKsCtx *)mpm_ctx->ctx;
+    SCACCtx *ac = (SCACCtx *)ctx->ac->ctx;
+    uint32_t state_count = ac->state_count;
+    uint8_t rep[256];
+    uint32_t *order = NULL;
+    uint32_t *depth = NULL;
+    uint32_t *renum = NULL;
+    uint8_t *dense = NULL;
+    SCACOutputTable *output_table = NULL;
+    uint32_t i, s, k, head, tail;
+    int r = -1;
+
+    ctx->state_count = state_count;
+    SCACKsInitTranslateTable(ctx, ac, rep);
+
+    order = SCMalloc(state_count * sizeof(uint32_t));
+    depth = SCMalloc(state_count * sizeof(uint32_t));
+    renum = SCMalloc(state_count * sizeof(uint32_t));
+    dense = SCMalloc(state_count);
+    if (order == NULL || depth == NULL || renum == NULL || dense == NULL)
+        goto end;
+
+    /* breadth first walk of the automaton. As every transition goes at
+     * most one level deeper, the first visit is at the trie depth. */
+    memset(renum, 0xff, state_count * sizeof(uint32_t));
+    order[0] = 0;
+    depth[0] = 0;
+    renum[0] = 0;
+    head = 0;
+    tail = 1;
+    while (head < tail) {
+        s = order[head++];
+        for (k = 1; k < ctx->alphabet_size; k++) {
+            uint32_t n = SCACKsGetACNext(ac, s, rep[k]) & ~SC_AC_KS_OUTPUT;
+            if (renum[n] == 0xffffffff) {
+                renum[n] = 0;
+                depth[n] = depth[s] + 1;
+                order[tail++] = n;
+            }
+        }
+    }
+    BUG_ON(tail != state_count);
+
+    /* pick the states that get a dense row */
+    ctx->dense_cnt = 0;
+    ctx->sparse_entries = 0;
+    for (s = 0; s < state_count; s++) {
+        uint32_t nnz = 0;
+        if (depth[s] > SC_AC_KS_DENSE_DEPTH) {
+            for (k = 1; k < ctx->alphabet_size; k++) {
+                if (SCACKsGetACNext(ac, s, rep[k]) != SCACKsGetACNext(ac, 0, rep[k]))
+                    nnz++;
+            }
+        }
+        dense[s] = (depth[s] <= SC_AC_KS_DENSE_DEPTH || nnz > SC_AC_KS_SPARSE_MAX);
+        if (dense[s])
+            ctx->dense_cnt++;
+        else
+            ctx->sparse_entries += nnz;
+    }
+
+    /* renumber: dense states first, each group in breadth first order */
+    k = 0;
+    for (i = 0; i < state_count; i++) {
+        if (dense[order[i]])
+            renum[order[i]] = k++;
+    }
+    for (i = 0; i < state_count; i++) {
+        if (!dense[order[i]])
+            renum[order[i]] = k++;
+    }
+
+    uint32_t sparse_cnt = state_count - ctx->dense_cnt;
+    ctx->dense = SCMalloc(ctx->dense_cnt * ctx->alphabet_size * sizeof(uint32_t));
+    ctx->sparse_offset = SCMalloc((sparse_cnt + 1) * sizeof(uint32_t));
+    ctx->sparse_class = SCMalloc(ctx->sparse_entries + 1);
+    ctx->sparse_next = SCMalloc((ctx->sparse_entries + 1) * sizeof(uint32_t));
+    output_table = SCMalloc(state_count * sizeof(SCACOutputTable));
+    if (ctx->dense == NULL || ctx->sparse_offset == NULL ||
+        ctx->sparse_class == NULL || ctx->sparse_next == NULL ||
+        output_table == NULL)
+        goto end;
+    mpm_ctx->memory_cnt += 4;
+    mpm_ctx->memory_size += ctx->dense_cnt * ctx->alphabet_size * sizeof(uint32_t) +
+        (sparse_cnt + 1) * sizeof(uint32_t) +
+        (ctx->sparse_entries + 1) * (1 + sizeof(uint32_t));
+
+    /* fill the rows, in the new numbering */
+    uint32_t entry = 0;
+    for (i = 0; i < state_count; i++) {
+        uint32_t ns;
+        s = order[i];
+        if (!dense[s])
+            continue;
+        ns = renum[s];
+        for (k = 0; k < ctx->alphabet_size; k++) {
+            uint32_t n = SCACKsGetACNext(ac, s, rep[k]);
+            ctx->dense[ns * ctx->alphabet_size + k] =
+                renum[n & ~SC_AC_KS_OUTPUT] | (n & SC_AC_KS_OUTPUT);
+        }
+    }
+    for (i = 0; i < state_count; i++) {
+        s = order[i];
+        if (dense[s])
+            continue;
+        ctx->sparse_offset[renum[s] - ctx->dense_cnt] = entry;
+        for (k = 1; k < ctx->alphabet_size; k++) {
+            uint32_t n = SCACKsGetACNext(ac, s, rep[k]);
+            if (n == SCACKsGetACNext(ac, 0, rep[k]))
+                continue;
+            ctx->sparse_class[entry] = (uint8_t)k;
+            ctx->sparse_next[entry] = renum[n & ~SC_AC_KS_OUTPUT] | (n & SC_AC_KS_OUTPUT);
+            entry++;
+        }
+    }
+    ctx->sparse_offset[sparse_cnt] = entry;
+    BUG_ON(entry != ctx->sparse_entries);
+
+    /* move the output table over to the new numbering */
+    for (s = 0; s < state_count; s++)
+        output_table[renum[s]] = ac->output_table[s];
+    SCFree(ac->output_table);
+    ac->output_table = output_table;
+    output_table = NULL;
+
+    /* we have our own table now */
+    SCACFreeStateTable(ctx->ac);
+
+    SCLogDebug("%"PRIu32" states, alphabet %u, %"PRIu32" dense, %"PRIu32
+               " sparse with %"PRIu32" entries", state_count,
+               ctx->alphabet_size, ctx->dense_cnt, sparse_cnt,
+               ctx->sparse_entries);
+    r = 0;
+end:
+    if (order != NULL)
+        SCFree(order);
+    if (depth != NULL)
+        SCFree(depth);
+    if (renum != NULL)
+        SCFree(renum);
+    if (dense != NULL)
+        SCFree(dense);
+    if (output_table != NULL)
+        SCFree(output_table);
+    return r;
+}
+
+/**
+ * \brief Process the patterns added to the mpm, and create the internal
+ *        tables.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+int SCACKsPreparePatterns(MpmCtx *mpm_ctx)
+{
+    SCACKsCtx *ctx = (SCACKsCtx *)mpm_ctx->ctx;
+
+    if (mpm_ctx->pattern_cnt == 0) {
+        SCLogDebug("no patterns supplied to this mpm_ctx");
+        return 0;
+    }
+
+    if (mpm_table[MPM_AC].Prepare(ctx->ac) != 0)
+        return -1;
+
+    if (SCACKsPrepareStateTable(mpm_ctx) != 0) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Init the mpm thread context.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param matchsize      We don't need this.
+ */
+void SCACKsInitThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx, uint32_t matchsize)
+{
+    memset(mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+
+    mpm_thread_ctx->ctx = SCMalloc(sizeof(SCACKsThreadCtx));
+    if (mpm_thread_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_thread_ctx->ctx, 0, sizeof(SCACKsThreadCtx));
+    mpm_thread_ctx->memory_cnt++;
+    mpm_thread_ctx->memory_size += sizeof(SCACKsThreadCtx);
+
+    return;
+}
+
+/**
+ * \brief Initialize the AC-KS context.
+ *
+ * \param mpm_ctx       Mpm context.
+ */
+void SCACKsInitCtx(MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx->ctx != NULL)
+        return;
+
+    mpm_ctx->ctx = SCMalloc(sizeof(SCACKsCtx));
+    if (mpm_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->ctx, 0, sizeof(SCACKsCtx));
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCACKsCtx);
+
+    SCACKsCtx *ctx = (SCACKsCtx *)mpm_ctx->ctx;
+    ctx->ac = SCMalloc(sizeof(MpmCtx));
+    if (ctx->ac == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(ctx->ac, 0, sizeof(MpmCtx));
+    MpmInitCtx(ctx->ac, MPM_AC);
+    /* we renumber the output table */
+    ((SCACCtx *)ctx->ac->ctx)->flags |= SC_AC_FLAG_NO_SHARE;
+
+    SCReturn;
+}
+
+/**
+ * \brief Destroy the mpm thread context.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ */
+void SCACKsDestroyThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+    SCACKsPrintSearchStats(mpm_thread_ctx);
+
+    if (mpm_thread_ctx->ctx != NULL) {
+        SCFree(mpm_thread_ctx->ctx);
+        mpm_thread_ctx->ctx = NULL;
+        mpm_thread_ctx->memory_cnt--;
+        mpm_thread_ctx->memory_size -= sizeof(SCACKsThreadCtx);
+    }
+
+    return;
+}
+
+/**
+ * \brief Destroy the mpm context.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+void SCACKsDestroyCtx(MpmCtx *mpm_ctx)
+{
+    SCACKsCtx *ctx = (SCACKsCtx *)mpm_ctx->ctx;
+    if (ctx == NULL)
+        return;
+
+    if (ctx->dense != NULL) {
+        uint32_t sparse_cnt = ctx->state_count - ctx->dense_cnt;
+
+        SCFree(ctx->dense);
+        SCFree(ctx->sparse_offset);
+        SCFree(ctx->sparse_class);
+        SCFree(ctx->sparse_next);
+        mpm_ctx->memory_cnt -= 4;
+        mpm_ctx->memory_size -= ctx->dense_cnt * ctx->alphabet_size * sizeof(uint32_t) +
+            (sparse_cnt + 1) * sizeof(uint32_t) +
+            (ctx->sparse_entries + 1) * (1 + sizeof(uint32_t));
+    }
+
+    if (ctx->ac != NULL) {
+        mpm_table[MPM_AC].DestroyCtx(ctx->ac);
+        SCFree(ctx->ac);
+    }
+
+    SCFree(mpm_ctx->ctx);
+    mpm_ctx->ctx = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= sizeof(SCACKsCtx);
+
+    return;
+}
+
+/**
+ * \internal
+ * \brief Get the next state.
+ *
+ * \param state current state, without the output flag
+ * \param c     alphabet class of the input byte
+ */
+static inline uint32_t SCACKsNext(SCACKsCtx *ctx, uint32_t state, uint8_t c)
+{
+    if (state < ctx->dense_cnt)
+        return ctx->dense[state * ctx->alphabet_size + c];
+
+    uint32_t o = ctx->sparse_offset[state - ctx->dense_cnt];
+    uint32_t e = ctx->sparse_offset[state - ctx->dense_cnt + 1];
+    for ( ; o < e; o++) {
+        if (ctx->sparse_class[o] == c)
+            return ctx->sparse_next[o];
+        if (ctx->sparse_class[o] > c)
+            break;
+    }
+    /* same as the root */
+    return ctx->dense[c];
+}
+
+/**
+ * \brief The AC-KS search function.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param buf            Buffer to be searched.
+ * \param buflen         Buffer length.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCACKsSearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                      PatternMatcherQueue *pmq, uint8_t *buf, uint16_t buflen)
+{
+    SCACKsCtx *ctx = (SCACKsCtx *)mpm_ctx->ctx;
+    int i = 0;
+    int matches = 0;
+    uint32_t state = 0;
+
+    if (ctx->dense == NULL)
+        return 0;
+
+    SCACCtx *ac = (SCACCtx *)ctx->ac->ctx;
+    SCACPatternList *pid_pat_list = ac->pid_pat_list;
+
+    for (i = 0; i < buflen; i++) {
+        state = SCACKsNext(ctx, state, ctx->translate_table[buf[i]]);
+        if (state & SC_AC_KS_OUTPUT) {
+            state &= ~SC_AC_KS_OUTPUT;
+
+            uint32_t no_of_entries = ac->output_table[state].no_of_entries;
+            uint32_t *pids = ac->output_table[state].pids;
+            uint32_t k;
+            for (k = 0; k < no_of_entries; k++) {
+                uint32_t pid = pids[k] & 0x0000FFFF;
+                if (pids[k] & 0xFFFF0000) {
+                    if (SCMemcmp(pid_pat_list[pid].cs,
+                                 buf + i - pid_pat_list[pid].patlen + 1,
+                                 pid_pat_list[pid].patlen) != 0) {
+                        if (pid_pat_list[pid].case_state != 3) {
+                            continue;
+                        }
+                    }
+                } else {
+                    pid = pids[k];
+                }
+                if (!(pmq->pattern_id_bitarray[pid / 8] & (1 << (pid % 8)))) {
+                    pmq->pattern_id_bitarray[pid / 8] |= (1 << (pid % 8));
+                    pmq->pattern_id_array[pmq->pattern_id_array_cnt++] = pid;
+                }
+                matches++;
+            }
+        }
+    }
+
+    return matches;
+}
+
+/**
+ * \internal
+ * \brief Keep the pattern stats of our ctx in sync with the ac ctx, the
+ *        detection engine looks at those.
+ */
+static void SCACKsUpdateStats(MpmCtx *mpm_ctx)
+{
+    SCACKsCtx *ctx = (SCACKsCtx *)mpm_ctx->ctx;
+
+    mpm_ctx->pattern_cnt = ctx->ac->pattern_cnt;
+    mpm_ctx->minlen = ctx->ac->minlen;
+    mpm_ctx->maxlen = ctx->ac->maxlen;
+}
+
+/**
+ * \brief Add a case insensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  Ignored.
+ * \param depth   Ignored.
+ * \param pid     The pattern id.
+ * \param sid     Ignored.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCACKsAddPatternCI(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                       uint16_t offset, uint16_t depth, uint32_t pid,
+                       uint32_t sid, uint8_t flags)
+{
+    SCACKsCtx *ctx = (SCACKsCtx *)mpm_ctx->ctx;
+
+    int r = mpm_table[MPM_AC].AddPatternNocase(ctx->ac, pat, patlen, offset,
+                                               depth, pid, sid, flags);
+    SCACKsUpdateStats(mpm_ctx);
+    return r;
+}
+
+/**
+ * \brief Add a case sensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  Ignored.
+ * \param depth   Ignored.
+ * \param pid     The pattern id.
+ * \param sid     Ignored.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCACKsAddPatternCS(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                       uint16_t offset, uint16_t depth, uint32_t pid,
+                       uint32_t sid, uint8_t flags)
+{
+    SCACKsCtx *ctx = (SCACKsCtx *)mpm_ctx->ctx;
+
+    int r = mpm_table[MPM_AC].AddPattern(ctx->ac, pat, patlen, offset,
+                                         depth, pid, sid, flags);
+    SCACKsUpdateStats(mpm_ctx);
+    return r;
+}
+
+void SCACKsPrintSearchStats(MpmThreadCtx *mpm_thread_ctx)
+{
+#ifdef SC_AC_KS_COUNTERS
+    SCACKsThreadCtx *ctx = (SCACKsThreadCtx *)mpm_thread_ctx->ctx;
+    printf("AC-KS Thread Search stats (ctx %p)\n", ctx);
+    printf("Total calls: %" PRIu32 "\n", ctx->total_calls);
+    printf("Total matches: %" PRIu64 "\n", ctx->total_matches);
+#endif /* SC_AC_KS_COUNTERS */
+
+    return;
+}
+
+void SCACKsPrintInfo(MpmCtx *mpm_ctx)
+{
+    SCACKsCtx *ctx = (SCACKsCtx *)mpm_ctx->ctx;
+    uint64_t full = (uint64_t)ctx->state_count * 256 *
+        (ctx->state_count < 32767 ? sizeof(SC_AC_STATE_TYPE_U16) :
+                                    sizeof(SC_AC_STATE_TYPE_U32));
+
+    printf("MPM AC-KS Information:\n");
+    printf("Memory allocs:   %" PRIu32 "\n", mpm_ctx->memory_cnt);
+    printf("Memory alloced:  %" PRIu32 "\n", mpm_ctx->memory_size);
+    printf(" Sizeof:\n");
+    printf("  MpmCtx         %" PRIuMAX "\n", (uintmax_t)sizeof(MpmCtx));
+    printf("  SCACKsCtx:     %" PRIuMAX "\n", (uintmax_t)sizeof(SCACKsCtx));
+    printf("Unique Patterns: %" PRIu32 "\n", mpm_ctx->pattern_cnt);
+    printf("Smallest:        %" PRIu32 "\n", mpm_ctx->minlen);
+    printf("Largest:         %" PRIu32 "\n", mpm_ctx->maxlen);
+    printf("Total states:    %" PRIu32 "\n", ctx->state_count);
+    printf("Alphabet size:   %" PRIu32 "\n", ctx->alphabet_size);
+    printf("Dense states:    %" PRIu32 "\n", ctx->dense_cnt);
+    printf("Sparse entries:  %" PRIu32 "\n", ctx->sparse_entries);
+    printf("Table size:      %" PRIu32 " (ac: %" PRIu64 ")\n",
+           (uint32_t)(ctx->dense_cnt * ctx->alphabet_size * sizeof(uint32_t) +
+           (ctx->state_count - ctx->dense_cnt + 1) * sizeof(uint32_t) +
+           (ctx->sparse_entries + 1) * (1 + sizeof(uint32_t))), full);
+    printf("\n");
+
+    return;
+}
+
+/************************** Mpm Registration ***************************/
+
+/**
+ * \brief Register the aho-corasick mpm with the compressed state table.
+ */
+void MpmACKsRegister(void)
+{
+    mpm_table[MPM_AC_KS].name = "ac-ks";
+    mpm_table[MPM_AC_KS].max_pattern_length = 0;
+
+    mpm_table[MPM_AC_KS].InitCtx = SCACKsInitCtx;
+    mpm_table[MPM_AC_KS].InitThreadCtx = SCACKsInitThreadCtx;
+    mpm_table[MPM_AC_KS].DestroyCtx = SCACKsDestroyCtx;
+    mpm_table[MPM_AC_KS].DestroyThreadCtx = SCACKsDestroyThreadCtx;
+    mpm_table[MPM_AC_KS].AddPattern = SCACKsAddPatternCS;
+    mpm_table[MPM_AC_KS].AddPatternNocase = SCACKsAddPatternCI;
+    mpm_table[MPM_AC_KS].Prepare = SCACKsPreparePatterns;
+    mpm_table[MPM_AC_KS].Search = SCACKsSearch;
+    mpm_table[MPM_AC_KS].Cleanup = NULL;
+    mpm_table[MPM_AC_KS].PrintCtx = SCACKsPrintInfo;
+    mpm_table[MPM_AC_KS].PrintThreadCtx = SCACKsPrintSearchStats;
+    mpm_table[MPM_AC_KS].RegisterUnittests = SCACKsRegisterTests;
+
+    return;
+}
+
+/*************************************Unittests********************************/
+
+#ifdef UNITTESTS
+
+static int SCACKsTest01(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_KS);
+    SCACKsInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCACKsAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    /* 1 match */
+    SCACKsAddPatternCS(&mpm_ctx, (uint8_t *)"bcde", 4, 0, 0, 1, 0, 0);
+    /* 1 match */
+    SCACKsAddPatternCS(&mpm_ctx, (uint8_t *)"fghj", 4, 0, 0, 2, 0, 0);
+    PmqSetup(&pmq, 0, 3);
+
+    SCACKsPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCACKsSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 3)
+        result = 1;
+    else
+        printf("3 != %" PRIu32 " ",cnt);
+
+    SCACKsDestroyCtx(&mpm_ctx);
+    SCACKsDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACKsTest02(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_KS);
+    SCACKsInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCACKsAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    SCACKsAddPatternCS(&mpm_ctx, (uint8_t *)"bcdegh", 6, 0, 0, 1, 0, 0);
+    SCACKsAddPatternCS(&mpm_ctx, (uint8_t *)"fghjxyz", 7, 0, 0, 2, 0, 0);
+    PmqSetup(&pmq, 0, 3);
+
+    SCACKsPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCACKsSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACKsDestroyCtx(&mpm_ctx);
+    SCACKsDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACKsTest03(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_KS);
+    SCACKsInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 */
+    char *pat = "AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AA";
+    SCACKsAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, 0, 0, 0);
+    PmqSetup(&pmq, 0, 1);
+
+    SCACKsPreparePatterns(&mpm_ctx);
+
+    char *buf = "AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AAAAA""AA";
+    uint32_t cnt = SCACKsSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCACKsDestroyCtx(&mpm_ctx);
+    SCACKsDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCACKsTest04(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0x00, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_KS);
+    SCACKsInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCACKsAddPatternCI(&mpm_ctx, (uint8_t *)"ABCD", 4, 0, 0, 0, 0, 0);
+    SCACKsAddPatternCI(&mpm_ctx, (uint8_t *)"bCdEfG", 6, 0, 0, 1, 0, 0);
+    SCACKsAddPatternCI(&mpm_ctx, (uint8_t *)"fghiJkl", 7, 0, 0, 2, 0, 0);
+    PmqSetup(&pmq, 0, 3);
+
+    SCACKsPreparePatterns(&mpm_ctx);
+
+    char *buf = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    uint32_t cnt = SCACKsSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 3)
+        result = 1;
+    else
+        printf("3 != %" PRIu32 " ",cnt);
+
+    SCACKsDestroyCtx(&mpm_ctx);
+    SCACKsDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+/** \test same match counts as ac for a few hundred patterns with shared
+ *        prefixes, which gives both dense and sparse deep states, and a
+ *        table that is a fraction of the size */
+static int SCACKsTest05(void)
+{
+    int result = 0;
+    MpmCtx ks_ctx, ac_ctx;
+    MpmThreadCtx ks_thread_ctx, ac_thread_ctx;
+    PatternMatcherQueue ks_pmq, ac_pmq;
+    uint8_t buf[1500];
+    uint32_t i, n, seed = 1;
+    const char *alpha = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJ/.-_ \r\n";
+    const uint32_t npats = 400;
+
+    memset(&ks_ctx, 0, sizeof(MpmCtx));
+    memset(&ac_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(&ks_ctx, MPM_AC_KS);
+    MpmInitCtx(&ac_ctx, MPM_AC);
+    SCACKsInitThreadCtx(&ks_ctx, &ks_thread_ctx, 0);
+    mpm_table[MPM_AC].InitThreadCtx(&ac_ctx, &ac_thread_ctx, 0);
+
+    for (i = 0; i < npats; i++) {
+        uint8_t pat[16];
+        uint16_t len;
+        seed = seed * 1103515245 + 12345;
+        len = 2 + ((seed >> 16) % 12);
+        /* a shared prefix for part of the patterns */
+        for (n = 0; n < len; n++) {
+            seed = seed * 1103515245 + 12345;
+            pat[n] = (n < 2 && (i & 1)) ? "GE"[n] :
+                (uint8_t)alpha[(seed >> 16) % strlen(alpha)];
+        }
+        if (i % 3 == 0) {
+            SCACKsAddPatternCI(&ks_ctx, pat, len, 0, 0, i, 0, 0);
+            mpm_table[MPM_AC].AddPatternNocase(&ac_ctx, pat, len, 0, 0, i, 0, 0);
+        } else {
+            SCACKsAddPatternCS(&ks_ctx, pat, len, 0, 0, i, 0, 0);
+            mpm_table[MPM_AC].AddPattern(&ac_ctx, pat, len, 0, 0, i, 0, 0);
+        }
+    }
+    PmqSetup(&ks_pmq, 0, npats);
+    PmqSetup(&ac_pmq, 0, npats);
+
+    if (SCACKsPreparePatterns(&ks_ctx) != 0 ||
+        mpm_table[MPM_AC].Prepare(&ac_ctx) != 0)
+        goto end;
+
+    SCACKsCtx *ctx = (SCACKsCtx *)ks_ctx.ctx;
+    if (ctx->dense_cnt == ctx->state_count || ctx->sparse_entries == 0) {
+        printf("no sparse states: ");
+        goto end;
+    }
+    if (ks_ctx.memory_size * 4 > ac_ctx.memory_size) {
+        printf("table not compressed: %"PRIu32" vs %"PRIu32": ",
+               ks_ctx.memory_size, ac_ctx.memory_size);
+        goto end;
+    }
+
+    for (n = 0; n < 20; n++) {
+        for (i = 0; i < sizeof(buf); i++) {
+            seed = seed * 1103515245 + 12345;
+            buf[i] = (uint8_t)alpha[(seed >> 16) % strlen(alpha)];
+        }
+        PmqReset(&ks_pmq);
+        PmqReset(&ac_pmq);
+        uint32_t ks_cnt = SCACKsSearch(&ks_ctx, &ks_thread_ctx, &ks_pmq,
+                                       buf, sizeof(buf));
+        uint32_t ac_cnt = mpm_table[MPM_AC].Search(&ac_ctx, &ac_thread_ctx,
+                                                   &ac_pmq, buf, sizeof(buf));
+        if (ks_cnt != ac_cnt ||
+            ks_pmq.pattern_id_array_cnt != ac_pmq.pattern_id_array_cnt) {
+            printf("%"PRIu32" != %"PRIu32": ", ks_cnt, ac_cnt);
+            goto end;
+        }
+    }
+
+    result = 1;
+end:
+    SCACKsDestroyCtx(&ks_ctx);
+    SCACKsDestroyThreadCtx(&ks_ctx, &ks_thread_ctx);
+    mpm_table[MPM_AC].DestroyCtx(&ac_ctx);
+    mpm_table[MPM_AC].DestroyThreadCtx(&ac_ctx, &ac_thread_ctx);
+    PmqFree(&ks_pmq);
+    PmqFree(&ac_pmq);
+    return result;
+}
+
+/** \test patterns with 0x00 and other binary bytes, over random binary
+ *        text that also has bytes no pattern uses: same matches as ac */
+static int SCACKsTest06(void)
+{
+    int result = 0;
+    MpmCtx ks_ctx, ac_ctx;
+    MpmThreadCtx ks_thread_ctx, ac_thread_ctx;
+    PatternMatcherQueue ks_pmq, ac_pmq;
+    uint8_t buf[1500];
+    uint32_t i, n, seed = 1, total = 0;
+    /* bytes the patterns are made of */
+    const uint8_t alpha[] = { 0x00, 0x00, 0x01, 0x80, 'a', 'b', 'Z' };
+    const uint32_t npats = 100;
+
+    memset(&ks_ctx, 0, sizeof(MpmCtx));
+    memset(&ac_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(&ks_ctx, MPM_AC_KS);
+    MpmInitCtx(&ac_ctx, MPM_AC);
+    SCACKsInitThreadCtx(&ks_ctx, &ks_thread_ctx, 0);
+    mpm_table[MPM_AC].InitThreadCtx(&ac_ctx, &ac_thread_ctx, 0);
+
+    for (i = 0; i < npats; i++) {
+        uint8_t pat[8];
+        uint16_t len;
+        seed = seed * 1103515245 + 12345;
+        len = 2 + ((seed >> 16) % 5);
+        for (n = 0; n < len; n++) {
+            seed = seed * 1103515245 + 12345;
+            pat[n] = alpha[(seed >> 16) % sizeof(alpha)];
+        }
+        if (i % 2 == 0) {
+            SCACKsAddPatternCI(&ks_ctx, pat, len, 0, 0, i, 0, 0);
+            mpm_table[MPM_AC].AddPatternNocase(&ac_ctx, pat, len, 0, 0, i, 0, 0);
+        } else {
+            SCACKsAddPatternCS(&ks_ctx, pat, len, 0, 0, i, 0, 0);
+            mpm_table[MPM_AC].AddPattern(&ac_ctx, pat, len, 0, 0, i, 0, 0);
+        }
+    }
+    PmqSetup(&ks_pmq, 0, npats);
+    PmqSetup(&ac_pmq, 0, npats);
+
+    if (SCACKsPreparePatterns(&ks_ctx) != 0 ||
+        mpm_table[MPM_AC].Prepare(&ac_ctx) != 0)
+        goto end;
+
+    for (n = 0; n < 20; n++) {
+        /* half pattern bytes, half any byte, e.g. 0xff */
+        for (i = 0; i < sizeof(buf); i++) {
+            seed = seed * 1103515245 + 12345;
+            buf[i] = (seed & 0x10000) ? alpha[(seed >> 17) % sizeof(alpha)] :
+                (uint8_t)(seed >> 17);
+        }
+        PmqReset(&ks_pmq);
+        PmqReset(&ac_pmq);
+        uint32_t ks_cnt = SCACKsSearch(&ks_ctx, &ks_thread_ctx, &ks_pmq,
+                                       buf, sizeof(buf));
+        uint32_t ac_cnt = mpm_table[MPM_AC].Search(&ac_ctx, &ac_thread_ctx,
+                                                   &ac_pmq, buf, sizeof(buf));
+        if (ks_cnt != ac_cnt ||
+            ks_pmq.pattern_id_array_cnt != ac_pmq.pattern_id_array_cnt) {
+            printf("%"PRIu32" != %"PRIu32": ", ks_cnt, ac_cnt);
+            goto end;
+        }
+        total += ac_cnt;
+    }
+    if (total == 0) {
+        printf("no matches at all: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    SCACKsDestroyCtx(&ks_ctx);
+    SCACKsDestroyThreadCtx(&ks_ctx, &ks_thread_ctx);
+    mpm_table[MPM_AC].DestroyCtx(&ac_ctx);
+    mpm_table[MPM_AC].DestroyThreadCtx(&ac_ctx, &ac_thread_ctx);
+    PmqFree(&ks_pmq);
+    PmqFree(&ac_pmq);
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void SCACKsRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SCACKsTest01", SCACKsTest01, 1);
+    UtRegisterTest("SCACKsTest02", SCACKsTest02, 1);
+    UtRegisterTest("SCACKsTest03", SCACKsTest03, 1);
+    UtRegisterTest("SCACKsTest04", SCACKsTest04, 1);
+    UtRegisterTest("SCACKsTest05", SCACKsTest05, 1);
+    UtRegisterTest("SCACKsTest06", SCACKsTest06, 1);
+#endif /* UNITTESTS */
+
+    return;
+}
@@ -0,0 +1,74 @@
+/* Copyright (C) 2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * \author agent <agent@local>
+ */
+
+#ifndef __UTIL_MPM_AC_KS__H__
+#define __UTIL_MPM_AC_KS__H__
+
+#include "util-mpm.h"
+
+/** set in a transition if the state it leads to has output */
+#define SC_AC_KS_OUTPUT         0x80000000U
+/** states up to this depth always get a dense row */
+#define SC_AC_KS_DENSE_DEPTH    1
+/** deeper states with more sparse entries than this get a dense row */
+#define SC_AC_KS_SPARSE_MAX     16
+
+typedef struct SCACKsCtx_ {
+    /* used at search time */
+
+    /** input byte to alphabet class. Class 0 is for all bytes not used
+     *  by any pattern, upper case maps to the lower case class. */
+    uint8_t translate_table[256];
+    /** number of classes, i.e. the width of a dense row */
+    uint16_t alphabet_size;
+
+    /** states [0, dense_cnt) have a dense row, state 0 is the root */
+    uint32_t dense_cnt;
+    /** dense rows, dense_cnt * alphabet_size transitions */
+    uint32_t *dense;
+
+    /** sparse rows: the entries of sparse state s (s >= dense_cnt) are
+     *  [sparse_offset[s - dense_cnt], sparse_offset[s - dense_cnt + 1]),
+     *  sorted on class. Classes without an entry go where the root goes. */
+    uint32_t *sparse_offset;
+    uint8_t *sparse_class;
+    uint32_t *sparse_next;
+    uint32_t sparse_entries;
+
+    uint32_t state_count;
+
+    /** ac ctx used to build the automaton. After prepare it only holds
+     *  the output table (renumbered to our states) and the pattern list */
+    MpmCtx *ac;
+} SCACKsCtx;
+
+typedef struct SCACKsThreadCtx_ {
+    /* the total calls we make to the search function */
+    uint32_t total_calls;
+    /* the total patterns that we ended up matching against */
+    uint64_t total_matches;
+} SCACKsThreadCtx;
+
+void MpmACKsRegister(void);
+
+#endif /* __UTIL_MPM_AC_KS__H__ */
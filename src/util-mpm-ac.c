@@ -59,6 +59,13 @@
 #include "util-memcmp.h"
 #include "util-mpm-ac.h"
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef UNITTESTS
+#include <dirent.h>
+#endif
+
 #ifdef __SC_CUDA_SUPPORT__
 
 #include "util-mpm.h"
@@ -93,6 +100,9 @@ void SCACRegisterTests(void);
 
 static int construct_both_16_and_32_state_tables = 0;
 
+/* directory the state tables are cached in, NULL if disabled */
+static char *ac_cache_dir = NULL;
+
 /**
  * \brief Helper structure used by AC during state table creation
  */
@@ -115,6 +125,9 @@ static void SCACGetConfig()
 
     //ConfNode *pm = ConfGetNode("pattern-matcher");
 
+    if (ConfGet("mpm-cache-dir", &ac_cache_dir) != 1)
+        ac_cache_dir = NULL;
+
     return;
 }
 
@@ -966,6 +979,587 @@ static inline void SCACPrepareStateTable(MpmCtx *mpm_ctx)
     return;
 }
 
+/************************** Shared state tables ******************************/
+
+/* Ctxs with the same patterns (and pattern ids) end up with the same state
+ * and output tables, so those are built once and shared. On a rule reload
+ * the new detection engine is built while the old one is still running,
+ * so every ctx whose patterns were not touched by the reload gets the
+ * tables of the old engine instead of building them again, and the
+ * memory use doesn't double. Tables are read only after prepare, the
+ * detect threads of the old engine can keep using them. */
+
+typedef struct SCACSharedTable_ {
+    uint64_t hash;
+    uint32_t pattern_cnt;
+    uint32_t refcnt;
+    /* the patterns the tables were built for, see SCACCachePatterns */
+    uint8_t *patterns;
+    uint32_t patterns_len;
+
+    uint32_t state_count;
+    SC_AC_STATE_TYPE_U16 (*state_table_u16)[256];
+    SC_AC_STATE_TYPE_U32 (*state_table_u32)[256];
+    SCACOutputTable *output_table;
+    void *cache_map;
+    size_t cache_map_size;
+
+    struct SCACSharedTable_ *next;
+} SCACSharedTable;
+
+static SCACSharedTable *ac_shared_tables = NULL;
+static SCMutex ac_shared_tables_lock = SCMUTEX_INITIALIZER;
+/* tables built and reused since the last SCACSharedTableStats call */
+static uint32_t ac_shared_built = 0;
+static uint32_t ac_shared_reused = 0;
+
+/**
+ * \internal
+ * \brief Use the tables of another ctx with the same patterns.
+ *
+ * \retval  0 tables found, ctx uses them
+ * \retval -1 not found
+ */
+static int SCACSharedTableGet(MpmCtx *mpm_ctx, uint64_t hash,
+                              const uint8_t *patterns, uint32_t patterns_len)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    SCACSharedTable *t;
+
+    SCMutexLock(&ac_shared_tables_lock);
+    for (t = ac_shared_tables; t != NULL; t = t->next) {
+        if (t->hash == hash && t->pattern_cnt == mpm_ctx->pattern_cnt &&
+            t->patterns_len == patterns_len &&
+            memcmp(t->patterns, patterns, patterns_len) == 0)
+            break;
+    }
+    if (t == NULL) {
+        SCMutexUnlock(&ac_shared_tables_lock);
+        return -1;
+    }
+    t->refcnt++;
+    ac_shared_reused++;
+    SCMutexUnlock(&ac_shared_tables_lock);
+
+    ctx->state_count = t->state_count;
+    ctx->state_table_u16 = t->state_table_u16;
+    ctx->state_table_u32 = t->state_table_u32;
+    ctx->output_table = t->output_table;
+    ctx->shared = t;
+
+    mpm_ctx->memory_cnt++;
+    if (ctx->state_table_u16 != NULL)
+        mpm_ctx->memory_size += ctx->state_count * sizeof(SC_AC_STATE_TYPE_U16) * 256;
+    else
+        mpm_ctx->memory_size += ctx->state_count * sizeof(SC_AC_STATE_TYPE_U32) * 256;
+
+    SCLogDebug("ctx %p: using shared table %p, %"PRIu32" users", mpm_ctx,
+               t, t->refcnt);
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Hand the tables of a freshly prepared ctx to the shared tables.
+ *
+ * The ctx keeps using them. If the allocation fails the tables simply
+ * stay private to the ctx.
+ */
+static void SCACSharedTableAdd(MpmCtx *mpm_ctx, uint64_t hash,
+                               const uint8_t *patterns, uint32_t patterns_len)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+
+    SCACSharedTable *t = SCMalloc(sizeof(SCACSharedTable));
+    if (unlikely(t == NULL))
+        return;
+    memset(t, 0, sizeof(SCACSharedTable));
+    t->patterns = SCMalloc(patterns_len);
+    if (unlikely(t->patterns == NULL)) {
+        SCFree(t);
+        return;
+    }
+    memcpy(t->patterns, patterns, patterns_len);
+    t->patterns_len = patterns_len;
+
+    t->hash = hash;
+    t->pattern_cnt = mpm_ctx->pattern_cnt;
+    t->refcnt = 1;
+    t->state_count = ctx->state_count;
+    t->state_table_u16 = ctx->state_table_u16;
+    t->state_table_u32 = ctx->state_table_u32;
+    t->output_table = ctx->output_table;
+    t->cache_map = ctx->cache_map;
+    t->cache_map_size = ctx->cache_map_size;
+    ctx->cache_map = NULL;
+    ctx->cache_map_size = 0;
+    ctx->shared = t;
+
+    SCMutexLock(&ac_shared_tables_lock);
+    t->next = ac_shared_tables;
+    ac_shared_tables = t;
+    ac_shared_built++;
+    SCMutexUnlock(&ac_shared_tables_lock);
+}
+
+/**
+ * \internal
+ * \brief Drop the reference of a ctx to its shared tables, the last user
+ *        frees them.
+ */
+static void SCACSharedTableRelease(SCACCtx *ctx)
+{
+    SCACSharedTable *t = ctx->shared, **prev;
+    uint32_t s;
+
+    ctx->shared = NULL;
+
+    SCMutexLock(&ac_shared_tables_lock);
+    if (--t->refcnt > 0) {
+        SCMutexUnlock(&ac_shared_tables_lock);
+        return;
+    }
+    for (prev = &ac_shared_tables; *prev != NULL; prev = &(*prev)->next) {
+        if (*prev == t) {
+            *prev = t->next;
+            break;
+        }
+    }
+    SCMutexUnlock(&ac_shared_tables_lock);
+
+    if (t->cache_map != NULL) {
+#ifdef HAVE_SYS_MMAN_H
+        munmap(t->cache_map, t->cache_map_size);
+#endif
+    } else {
+        if (t->state_table_u16 != NULL)
+            SCFree(t->state_table_u16);
+        if (t->state_table_u32 != NULL)
+            SCFree(t->state_table_u32);
+    }
+    if (t->output_table != NULL) {
+        for (s = 0; s < t->state_count; s++) {
+            if (t->output_table[s].pids != NULL)
+                SCFree(t->output_table[s].pids);
+        }
+        SCFree(t->output_table);
+    }
+    SCFree(t->patterns);
+    SCFree(t);
+}
+
+/**
+ * \brief Get the number of state tables that were built and that were
+ *        shared since the last call, and reset the counters.
+ *
+ * \param built  number of tables that were built or loaded from the cache
+ * \param reused number of times an existing table was used
+ */
+void SCACSharedTableStats(uint32_t *built, uint32_t *reused)
+{
+    SCMutexLock(&ac_shared_tables_lock);
+    *built = ac_shared_built;
+    *reused = ac_shared_reused;
+    ac_shared_built = 0;
+    ac_shared_reused = 0;
+    SCMutexUnlock(&ac_shared_tables_lock);
+}
+
+/*************************** State table cache *****************************/
+
+/* The delta table is the expensive part of building the automaton. With
+ * "mpm-cache-dir" set, it's written to a file named after a hash of the
+ * patterns of the ctx, together with the output table. On the next start
+ * or rule reload a ctx with the same patterns maps the file instead of
+ * building the table again.
+ *
+ * File layout: SCACCacheHeader, padded to SC_AC_CACHE_HDR_SIZE, the state
+ * table, the number of pids of each state (uint32_t), the pids of all
+ * states and then the patterns as written by SCACCachePatterns. Numbers
+ * are in host order, a file from another platform won't pass the header
+ * check. The file is only used if the patterns match those of the ctx,
+ * and its transitions and pids are checked before SCACSearch gets to use
+ * them. */
+
+#define SC_AC_CACHE_MAGIC       0x53434143  /* "SCAC" */
+#define SC_AC_CACHE_VERSION     2
+#define SC_AC_CACHE_HDR_SIZE    64
+/* smaller tables are cheap to build, don't litter the dir with them */
+#define SC_AC_CACHE_MIN_STATES  1024
+
+typedef struct SCACCacheHeader_ {
+    uint32_t magic;
+    uint16_t version;
+    /* sizeof a state table entry, 2 or 4 */
+    uint16_t state_size;
+    uint64_t hash;
+    uint32_t state_count;
+    uint32_t pattern_cnt;
+    /* total number of pids in the output table */
+    uint32_t output_cnt;
+    /* size of the pattern list at the end of the file */
+    uint32_t patterns_len;
+    /* total file size */
+    uint64_t size;
+} SCACCacheHeader;
+
+/**
+ * \internal
+ * \brief Memory used by the output table of a prepared ctx.
+ */
+static uint32_t SCACOutputTableMemory(SCACCtx *ctx)
+{
+    uint32_t size = 0, s;
+
+    if (ctx->output_table == NULL)
+        return 0;
+
+    size = ctx->state_count * sizeof(SCACOutputTable);
+    for (s = 0; s < ctx->state_count; s++)
+        size += ctx->output_table[s].no_of_entries * sizeof(uint32_t);
+    return size;
+}
+
+/**
+ * \internal
+ * \brief Free the state table, or unmap it if it came from the cache.
+ */
+static void SCACFreeStateTableInternal(MpmCtx *mpm_ctx)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+
+    if (ctx->shared != NULL) {
+        mpm_ctx->memory_size -= SCACOutputTableMemory(ctx);
+        mpm_ctx->memory_cnt--;
+        if (ctx->state_table_u16 != NULL)
+            mpm_ctx->memory_size -= ctx->state_count * sizeof(SC_AC_STATE_TYPE_U16) * 256;
+        else
+            mpm_ctx->memory_size -= ctx->state_count * sizeof(SC_AC_STATE_TYPE_U32) * 256;
+
+        SCACSharedTableRelease(ctx);
+        ctx->state_table_u16 = NULL;
+        ctx->state_table_u32 = NULL;
+        ctx->output_table = NULL;
+        return;
+    }
+
+    if (ctx->state_table_u16 != NULL) {
+        if (ctx->cache_map == NULL)
+            SCFree(ctx->state_table_u16);
+        ctx->state_table_u16 = NULL;
+
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= (ctx->state_count *
+                                 sizeof(SC_AC_STATE_TYPE_U16) * 256);
+    }
+    if (ctx->state_table_u32 != NULL) {
+        if (ctx->cache_map == NULL)
+            SCFree(ctx->state_table_u32);
+        ctx->state_table_u32 = NULL;
+
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= (ctx->state_count *
+                                 sizeof(SC_AC_STATE_TYPE_U32) * 256);
+    }
+#ifdef HAVE_SYS_MMAN_H
+    if (ctx->cache_map != NULL) {
+        munmap(ctx->cache_map, ctx->cache_map_size);
+        ctx->cache_map = NULL;
+        ctx->cache_map_size = 0;
+    }
+#endif
+}
+
+/**
+ * \brief Free the state table of a prepared ctx. For users of the ac ctx
+ *        that convert the table into their own format.
+ */
+void SCACFreeStateTable(MpmCtx *mpm_ctx)
+{
+    SCACFreeStateTableInternal(mpm_ctx);
+}
+
+/**
+ * \internal
+ * \brief Put the patterns of the ctx in a buffer, in parray order.
+ *
+ * Each pattern is written as its id (uint32_t), length (uint16_t) and
+ * flags (uint8_t), followed by the pattern bytes. The buffer is stored
+ * with the tables and compared on lookup, so that a hash collision can't
+ * hand a ctx the tables of other patterns.
+ *
+ * \param len set to the size of the buffer
+ *
+ * \retval buf buffer to be freed by the caller, or NULL on error
+ */
+static uint8_t *SCACCachePatterns(MpmCtx *mpm_ctx, uint32_t *len)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    uint32_t i, size = 0;
+
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++)
+        size += sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint8_t) +
+                ctx->parray[i]->len;
+
+    uint8_t *buf = SCMalloc(size > 0 ? size : 1);
+    if (unlikely(buf == NULL))
+        return NULL;
+
+    uint8_t *ptr = buf;
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        SCACPattern *p = ctx->parray[i];
+        memcpy(ptr, &p->id, sizeof(uint32_t));
+        ptr += sizeof(uint32_t);
+        memcpy(ptr, &p->len, sizeof(uint16_t));
+        ptr += sizeof(uint16_t);
+        memcpy(ptr, &p->flags, sizeof(uint8_t));
+        ptr += sizeof(uint8_t);
+        memcpy(ptr, p->original_pat, p->len);
+        ptr += p->len;
+    }
+
+    *len = size;
+    return buf;
+}
+
+/**
+ * \internal
+ * \brief FNV-1a hash over the patterns buffer of SCACCachePatterns.
+ */
+static uint64_t SCACCacheHash(const uint8_t *patterns, uint32_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint32_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= patterns[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int SCACCacheFileName(char *path, size_t size, uint64_t hash)
+{
+    int r = snprintf(path, size, "%s/ac-%016"PRIx64".bin", ac_cache_dir, hash);
+    return (r > 0 && (size_t)r < size) ? 0 : -1;
+}
+
+/**
+ * \internal
+ * \brief Map the state table from the cache.
+ *
+ * \retval  0 table loaded
+ * \retval -1 no (valid) cache file, the table needs to be built
+ */
+static int SCACCacheLoad(MpmCtx *mpm_ctx, uint64_t hash,
+                         const uint8_t *patterns, uint32_t patterns_len)
+{
+#ifdef HAVE_SYS_MMAN_H
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    char path[PATH_MAX];
+    struct stat st;
+    uint32_t s, c, out = 0;
+
+    if (ac_cache_dir == NULL || construct_both_16_and_32_state_tables)
+        return -1;
+    if (SCACCacheFileName(path, sizeof(path), hash) != 0)
+        return -1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) != 0 || st.st_size < SC_AC_CACHE_HDR_SIZE) {
+        close(fd);
+        return -1;
+    }
+    uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    SCACCacheHeader *hdr = (SCACCacheHeader *)map;
+    size_t state_size = hdr->state_count < 32767 ?
+        sizeof(SC_AC_STATE_TYPE_U16) : sizeof(SC_AC_STATE_TYPE_U32);
+    if (hdr->magic != SC_AC_CACHE_MAGIC || hdr->version != SC_AC_CACHE_VERSION ||
+        hdr->hash != hash || hdr->pattern_cnt != mpm_ctx->pattern_cnt ||
+        hdr->state_size != state_size || hdr->size != (uint64_t)st.st_size ||
+        hdr->state_count == 0 || hdr->patterns_len != patterns_len ||
+        hdr->size != SC_AC_CACHE_HDR_SIZE +
+            (uint64_t)hdr->state_count * 256 * state_size +
+            (uint64_t)hdr->state_count * sizeof(uint32_t) +
+            (uint64_t)hdr->output_cnt * sizeof(uint32_t) +
+            (uint64_t)hdr->patterns_len) {
+        SCLogDebug("cache file %s is invalid", path);
+        goto error;
+    }
+    if (memcmp(map + hdr->size - hdr->patterns_len, patterns, patterns_len) != 0) {
+        SCLogDebug("cache file %s is for other patterns", path);
+        goto error;
+    }
+
+    uint8_t *table = map + SC_AC_CACHE_HDR_SIZE;
+    uint32_t *counts = (uint32_t *)(table + (size_t)hdr->state_count * 256 * state_size);
+    uint32_t *pids = counts + hdr->state_count;
+
+    /* SCACSearch uses the transitions and pids as indexes without checks */
+    if (state_size == sizeof(SC_AC_STATE_TYPE_U16)) {
+        SC_AC_STATE_TYPE_U16 *t = (SC_AC_STATE_TYPE_U16 *)table;
+        for (s = 0; s < hdr->state_count * 256; s++) {
+            if ((uint32_t)(t[s] & 0x7FFF) >= hdr->state_count) {
+                SCLogDebug("cache file %s has an invalid transition", path);
+                goto error;
+            }
+        }
+    } else {
+        SC_AC_STATE_TYPE_U32 *t = (SC_AC_STATE_TYPE_U32 *)table;
+        size_t e;
+        for (e = 0; e < (size_t)hdr->state_count * 256; e++) {
+            if ((t[e] & 0x00FFFFFF) >= hdr->state_count) {
+                SCLogDebug("cache file %s has an invalid transition", path);
+                goto error;
+            }
+        }
+    }
+    for (c = 0; c < hdr->output_cnt; c++) {
+        /* case sensitive pids have bit 16 set, see
+         * SCACInsertCaseSensitiveEntriesForPatterns */
+        if ((pids[c] & 0xFFFF0000) > (1 << 16) ||
+            (pids[c] & 0x0000FFFF) > ctx->max_pat_id ||
+            ((pids[c] & 0xFFFF0000) &&
+             ctx->pid_pat_list[pids[c] & 0x0000FFFF].cs == NULL)) {
+            SCLogDebug("cache file %s has an invalid pid", path);
+            goto error;
+        }
+    }
+
+    ctx->output_table = SCMalloc(hdr->state_count * sizeof(SCACOutputTable));
+    if (ctx->output_table == NULL)
+        goto error;
+    memset(ctx->output_table, 0, hdr->state_count * sizeof(SCACOutputTable));
+    for (s = 0; s < hdr->state_count; s++) {
+        if (counts[s] == 0)
+            continue;
+        if (counts[s] > hdr->output_cnt - out)
+            goto error;
+        ctx->output_table[s].pids = SCMalloc(counts[s] * sizeof(uint32_t));
+        if (ctx->output_table[s].pids == NULL)
+            goto error;
+        memcpy(ctx->output_table[s].pids, pids + out, counts[s] * sizeof(uint32_t));
+        ctx->output_table[s].no_of_entries = counts[s];
+        out += counts[s];
+    }
+
+    ctx->state_count = hdr->state_count;
+    if (state_size == sizeof(SC_AC_STATE_TYPE_U16))
+        ctx->state_table_u16 = (SC_AC_STATE_TYPE_U16 (*)[256])table;
+    else
+        ctx->state_table_u32 = (SC_AC_STATE_TYPE_U32 (*)[256])table;
+    ctx->cache_map = map;
+    ctx->cache_map_size = st.st_size;
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += ctx->state_count * state_size * 256;
+
+    SCLogDebug("loaded %"PRIu32" states from %s", ctx->state_count, path);
+    return 0;
+
+error:
+    if (ctx->output_table != NULL) {
+        for (s = 0; s < hdr->state_count; s++) {
+            if (ctx->output_table[s].pids != NULL)
+                SCFree(ctx->output_table[s].pids);
+        }
+        SCFree(ctx->output_table);
+        ctx->output_table = NULL;
+    }
+    munmap(map, st.st_size);
+#endif /* HAVE_SYS_MMAN_H */
+    return -1;
+}
+
+/**
+ * \internal
+ * \brief Write the state table to the cache.
+ *
+ * The file is written under a temporary name and then renamed, so that
+ * another instance never sees a partial file.
+ */
+static void SCACCacheStore(MpmCtx *mpm_ctx, uint64_t hash,
+                           const uint8_t *patterns, uint32_t patterns_len)
+{
+#ifdef HAVE_SYS_MMAN_H
+    static int warned = 0;
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    SCACCacheHeader hdr;
+    uint8_t pad[SC_AC_CACHE_HDR_SIZE];
+    uint32_t s;
+    int ok = 1;
+
+    if (ac_cache_dir == NULL || construct_both_16_and_32_state_tables ||
+        ctx->state_count < SC_AC_CACHE_MIN_STATES)
+        return;
+    if (SCACCacheFileName(path, sizeof(path), hash) != 0)
+        return;
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+
+    size_t state_size = ctx->state_count < 32767 ?
+        sizeof(SC_AC_STATE_TYPE_U16) : sizeof(SC_AC_STATE_TYPE_U32);
+    void *table = ctx->state_count < 32767 ?
+        (void *)ctx->state_table_u16 : (void *)ctx->state_table_u32;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = SC_AC_CACHE_MAGIC;
+    hdr.version = SC_AC_CACHE_VERSION;
+    hdr.state_size = state_size;
+    hdr.hash = hash;
+    hdr.state_count = ctx->state_count;
+    hdr.pattern_cnt = mpm_ctx->pattern_cnt;
+    for (s = 0; s < ctx->state_count; s++)
+        hdr.output_cnt += ctx->output_table[s].no_of_entries;
+    hdr.patterns_len = patterns_len;
+    hdr.size = SC_AC_CACHE_HDR_SIZE +
+        (uint64_t)hdr.state_count * 256 * state_size +
+        (uint64_t)hdr.state_count * sizeof(uint32_t) +
+        (uint64_t)hdr.output_cnt * sizeof(uint32_t) +
+        (uint64_t)hdr.patterns_len;
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        if (!warned) {
+            SCLogWarning(SC_ERR_FOPEN, "can't write to mpm-cache-dir %s: %s",
+                         ac_cache_dir, strerror(errno));
+            warned = 1;
+        }
+        return;
+    }
+
+    memset(pad, 0, sizeof(pad));
+    memcpy(pad, &hdr, sizeof(hdr));
+    ok &= (fwrite(pad, sizeof(pad), 1, fp) == 1);
+    ok &= (fwrite(table, state_size * 256, ctx->state_count, fp) == ctx->state_count);
+    for (s = 0; s < ctx->state_count; s++)
+        ok &= (fwrite(&ctx->output_table[s].no_of_entries, sizeof(uint32_t), 1, fp) == 1);
+    for (s = 0; s < ctx->state_count; s++) {
+        uint32_t n = ctx->output_table[s].no_of_entries;
+        if (n > 0)
+            ok &= (fwrite(ctx->output_table[s].pids, sizeof(uint32_t), n, fp) == n);
+    }
+    if (patterns_len > 0)
+        ok &= (fwrite(patterns, patterns_len, 1, fp) == 1);
+    if (fclose(fp) != 0)
+        ok = 0;
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        SCLogDebug("writing %s failed", path);
+        unlink(tmp_path);
+        return;
+    }
+    SCLogDebug("stored %"PRIu32" states in %s", ctx->state_count, path);
+#endif /* HAVE_SYS_MMAN_H */
+}
+
 /**
  * \brief Process the patterns added to the mpm, and create the internal tables.
  *
@@ -1046,8 +1640,28 @@ int SCACPreparePatterns(MpmCtx *mpm_ctx)
         }
     }
 
-    /* prepare the state table required by AC */
-    SCACPrepareStateTable(mpm_ctx);
+    /* prepare the state table required by AC. Use the table of a ctx with
+     * the same patterns if there is one, or get it from the cache */
+    uint32_t patterns_len = 0;
+    uint8_t *patterns = SCACCachePatterns(mpm_ctx, &patterns_len);
+    if (patterns == NULL) {
+        SCACPrepareStateTable(mpm_ctx);
+    } else {
+        uint64_t hash = SCACCacheHash(patterns, patterns_len);
+        int share = (mpm_ctx->mpm_type == MPM_AC &&
+                     !(ctx->flags & SC_AC_FLAG_NO_SHARE) &&
+                     !construct_both_16_and_32_state_tables);
+        if (!share || SCACSharedTableGet(mpm_ctx, hash, patterns, patterns_len) != 0) {
+            if (SCACCacheLoad(mpm_ctx, hash, patterns, patterns_len) != 0) {
+                SCACPrepareStateTable(mpm_ctx);
+                SCACCacheStore(mpm_ctx, hash, patterns, patterns_len);
+            }
+            if (share)
+                SCACSharedTableAdd(mpm_ctx, hash, patterns, patterns_len);
+        }
+        SCFree(patterns);
+    }
+    mpm_ctx->memory_size += SCACOutputTableMemory(ctx);
 
 #ifdef __SC_CUDA_SUPPORT__
     if (mpm_ctx->mpm_type == MPM_AC_CUDA) {
@@ -1193,24 +1807,10 @@ void SCACDestroyCtx(MpmCtx *mpm_ctx)
         mpm_ctx->memory_size -= (mpm_ctx->pattern_cnt * sizeof(SCACPattern *));
     }
 
-    if (ctx->state_table_u16 != NULL) {
-        SCFree(ctx->state_table_u16);
-        ctx->state_table_u16 = NULL;
-
-        mpm_ctx->memory_cnt++;
-        mpm_ctx->memory_size -= (ctx->state_count *
-                                 sizeof(SC_AC_STATE_TYPE_U16) * 256);
-    }
-    if (ctx->state_table_u32 != NULL) {
-        SCFree(ctx->state_table_u32);
-        ctx->state_table_u32 = NULL;
-
-        mpm_ctx->memory_cnt++;
-        mpm_ctx->memory_size -= (ctx->state_count *
-                                 sizeof(SC_AC_STATE_TYPE_U32) * 256);
-    }
+    SCACFreeStateTable(mpm_ctx);
 
     if (ctx->output_table != NULL) {
+        mpm_ctx->memory_size -= SCACOutputTableMemory(ctx);
         uint32_t state_count;
         for (state_count = 0; state_count < ctx->state_count; state_count++) {
             if (ctx->output_table[state_count].pids != NULL) {
@@ -3220,6 +3820,319 @@ end:
     return result;
 }
 
+#ifdef HAVE_SYS_MMAN_H
+static uint32_t SCACTestCacheBuild(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                                   PatternMatcherQueue *pmq)
+{
+    char pat[32];
+    uint32_t i;
+
+    memset(mpm_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(mpm_ctx, MPM_AC);
+    SCACInitThreadCtx(mpm_ctx, mpm_thread_ctx, 0);
+
+    /* enough states to be worth caching */
+    for (i = 0; i < 100; i++) {
+        snprintf(pat, sizeof(pat), "%05u-abcdefghijklmnop", i * 7919);
+        if (i & 1)
+            SCACAddPatternCI(mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, i, 0, 0);
+        else
+            SCACAddPatternCS(mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, i, 0, 0);
+    }
+    PmqSetup(pmq, 0, 100);
+    SCACPreparePatterns(mpm_ctx);
+
+    char *buf = "xx00000-abcdefghijklmnopxx07919-ABCDEFGHIJKLMNOPxx"
+                "15838-ABCDEFGHIJKLMNOPxx23757-abcdefghijklmnop";
+    return SCACSearch(mpm_ctx, mpm_thread_ctx, pmq, (uint8_t *)buf, strlen(buf));
+}
+#endif
+
+/** \test a state table written to the mpm-cache-dir is used by the next
+ *        ctx with the same patterns */
+static int SCACTestCache01(void)
+{
+#ifdef HAVE_SYS_MMAN_H
+    int result = 0;
+    MpmCtx mpm_ctx1, mpm_ctx2;
+    MpmThreadCtx mpm_thread_ctx1, mpm_thread_ctx2;
+    PatternMatcherQueue pmq1, pmq2;
+    char dir[] = "/tmp/suricata-mpm-cache-XXXXXX";
+    char path[PATH_MAX];
+
+    if (mkdtemp(dir) == NULL)
+        return 0;
+
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfSet("mpm-cache-dir", dir, 1);
+
+    /* 1st: built and stored. It's destroyed before the 2nd is built, so
+     * that the 2nd can't share its table and has to load it */
+    uint32_t cnt1 = SCACTestCacheBuild(&mpm_ctx1, &mpm_thread_ctx1, &pmq1);
+    SCACCtx *ctx1 = (SCACCtx *)mpm_ctx1.ctx;
+    uint32_t state_count1 = ctx1->state_count;
+    uint32_t pmq_cnt1 = pmq1.pattern_id_array_cnt;
+    int mapped1 = (ctx1->shared == NULL || ctx1->shared->cache_map != NULL);
+    SCACDestroyCtx(&mpm_ctx1);
+    SCACDestroyThreadCtx(&mpm_ctx1, &mpm_thread_ctx1);
+    PmqFree(&pmq1);
+
+    uint32_t cnt2 = SCACTestCacheBuild(&mpm_ctx2, &mpm_thread_ctx2, &pmq2);
+    SCACCtx *ctx2 = (SCACCtx *)mpm_ctx2.ctx;
+
+    if (state_count1 < SC_AC_CACHE_MIN_STATES) {
+        printf("only %u states: ", state_count1);
+        goto end;
+    }
+    if (mapped1 || ctx2->shared == NULL || ctx2->shared->cache_map == NULL) {
+        printf("cache not used: ");
+        goto end;
+    }
+    if (cnt1 != 3 || cnt2 != cnt1 || state_count1 != ctx2->state_count ||
+        pmq_cnt1 != pmq2.pattern_id_array_cnt) {
+        printf("%u != %u: ", cnt1, cnt2);
+        goto end;
+    }
+    result = 1;
+end:
+    SCACDestroyCtx(&mpm_ctx2);
+    SCACDestroyThreadCtx(&mpm_ctx2, &mpm_thread_ctx2);
+    PmqFree(&pmq2);
+
+    DIR *d = opendir(dir);
+    if (d != NULL) {
+        struct dirent *de;
+        while ((de = readdir(d)) != NULL) {
+            if (de->d_name[0] == '.')
+                continue;
+            snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+            unlink(path);
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    ac_cache_dir = NULL;
+    return result;
+#else
+    return 1;
+#endif
+}
+
+#ifdef HAVE_SYS_MMAN_H
+/**
+ * \brief Store a cache file, damage it at offset and check that the next
+ *        ctx with the same patterns doesn't use it.
+ *
+ * \param offset offset in the file, negative counts from the end
+ */
+static int SCACTestCacheDamaged(const char *dir, int64_t offset, const void *data,
+                                uint32_t size)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    char path[PATH_MAX] = "";
+    struct stat st;
+    uint32_t cnt;
+
+    cnt = SCACTestCacheBuild(&mpm_ctx, &mpm_thread_ctx, &pmq);
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    if (cnt != 3)
+        return 0;
+
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] != '.')
+            snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+    }
+    closedir(d);
+
+    int fd = open(path, O_RDWR);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &st) != 0 ||
+        pwrite(fd, data, size, offset < 0 ? st.st_size + offset : offset) != (ssize_t)size) {
+        close(fd);
+        return 0;
+    }
+    close(fd);
+
+    cnt = SCACTestCacheBuild(&mpm_ctx, &mpm_thread_ctx, &pmq);
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx.ctx;
+    if (ctx->shared != NULL && ctx->shared->cache_map != NULL) {
+        printf("damaged cache file at %"PRIi64" used: ", offset);
+        goto end;
+    }
+    if (cnt != 3) {
+        printf("%u != 3: ", cnt);
+        goto end;
+    }
+    result = 1;
+end:
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+#endif
+
+/** \test a cache file with an out of range transition or pid, or with
+ *        other patterns, is not used */
+static int SCACTestCache02(void)
+{
+#ifdef HAVE_SYS_MMAN_H
+    int result = 0;
+    char dir[] = "/tmp/suricata-mpm-cache-XXXXXX";
+    char path[PATH_MAX];
+    SCACCacheHeader hdr;
+
+    if (mkdtemp(dir) == NULL)
+        return 0;
+
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfSet("mpm-cache-dir", dir, 1);
+
+    /* get the layout of the file the test patterns give */
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    SCACTestCacheBuild(&mpm_ctx, &mpm_thread_ctx, &pmq);
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx.ctx;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.state_count = ctx->state_count;
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    if (hdr.state_count < SC_AC_CACHE_MIN_STATES || hdr.state_count >= 32767) {
+        printf("%u states: ", hdr.state_count);
+        goto end;
+    }
+    int64_t pids = SC_AC_CACHE_HDR_SIZE +
+        (int64_t)hdr.state_count * 256 * sizeof(SC_AC_STATE_TYPE_U16) +
+        (int64_t)hdr.state_count * sizeof(uint32_t);
+
+    /* transition of state 0 to a state that doesn't exist */
+    SC_AC_STATE_TYPE_U16 state = 0x7ffe;
+    if (!SCACTestCacheDamaged(dir, SC_AC_CACHE_HDR_SIZE, &state, sizeof(state)))
+        goto end;
+    /* pid beyond max_pat_id */
+    uint32_t pid = 0xffff;
+    if (!SCACTestCacheDamaged(dir, pids, &pid, sizeof(pid)))
+        goto end;
+    /* last byte of the last pattern differs */
+    uint8_t c = 'X';
+    if (!SCACTestCacheDamaged(dir, -1, &c, sizeof(c)))
+        goto end;
+
+    result = 1;
+end:
+    {
+        DIR *d = opendir(dir);
+        if (d != NULL) {
+            struct dirent *de;
+            while ((de = readdir(d)) != NULL) {
+                if (de->d_name[0] == '.')
+                    continue;
+                snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+                unlink(path);
+            }
+            closedir(d);
+        }
+    }
+    rmdir(dir);
+
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    ac_cache_dir = NULL;
+    return result;
+#else
+    return 1;
+#endif
+}
+
+/** \test ctxs with the same patterns share their tables, the tables stay
+ *        valid until the last user is destroyed */
+static int SCACTestShare01(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx1, mpm_ctx2, mpm_ctx3;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    uint32_t built, reused, cnt;
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+
+    memset(&mpm_ctx1, 0, sizeof(MpmCtx));
+    memset(&mpm_ctx2, 0, sizeof(MpmCtx));
+    memset(&mpm_ctx3, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx1, MPM_AC);
+    MpmInitCtx(&mpm_ctx2, MPM_AC);
+    MpmInitCtx(&mpm_ctx3, MPM_AC);
+    SCACInitThreadCtx(&mpm_ctx1, &mpm_thread_ctx, 0);
+    PmqSetup(&pmq, 0, 3);
+
+    SCACSharedTableStats(&built, &reused);
+
+    SCACAddPatternCS(&mpm_ctx1, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    SCACAddPatternCI(&mpm_ctx1, (uint8_t *)"JIKL", 4, 0, 0, 1, 0, 0);
+    SCACAddPatternCS(&mpm_ctx2, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    SCACAddPatternCI(&mpm_ctx2, (uint8_t *)"JIKL", 4, 0, 0, 1, 0, 0);
+    /* same pattern, different id */
+    SCACAddPatternCS(&mpm_ctx3, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    SCACAddPatternCI(&mpm_ctx3, (uint8_t *)"JIKL", 4, 0, 0, 2, 0, 0);
+
+    SCACPreparePatterns(&mpm_ctx1);
+    SCACPreparePatterns(&mpm_ctx2);
+    SCACPreparePatterns(&mpm_ctx3);
+
+    SCACCtx *ctx1 = (SCACCtx *)mpm_ctx1.ctx;
+    SCACCtx *ctx2 = (SCACCtx *)mpm_ctx2.ctx;
+    SCACCtx *ctx3 = (SCACCtx *)mpm_ctx3.ctx;
+    if (ctx1->shared == NULL || ctx1->shared != ctx2->shared ||
+        ctx1->state_table_u16 != ctx2->state_table_u16 ||
+        ctx1->output_table != ctx2->output_table) {
+        printf("tables not shared: ");
+        goto end;
+    }
+    if (ctx3->shared == NULL || ctx3->shared == ctx1->shared) {
+        printf("ctx with other pattern ids shares the table: ");
+        goto end;
+    }
+    SCACSharedTableStats(&built, &reused);
+    if (built != 2 || reused != 1) {
+        printf("built %u reused %u: ", built, reused);
+        goto end;
+    }
+
+    /* 2nd ctx still works after the 1st is gone */
+    SCACDestroyCtx(&mpm_ctx1);
+    mpm_ctx1.ctx = NULL;
+    cnt = SCACSearch(&mpm_ctx2, &mpm_thread_ctx, &pmq, (uint8_t *)buf, strlen(buf));
+    if (cnt != 2) {
+        printf("%u != 2: ", cnt);
+        goto end;
+    }
+
+    result = 1;
+end:
+    SCACDestroyCtx(&mpm_ctx1);
+    SCACDestroyCtx(&mpm_ctx2);
+    SCACDestroyCtx(&mpm_ctx3);
+    SCACDestroyThreadCtx(&mpm_ctx1, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
 #endif /* UNITTESTS */
 
 void SCACRegisterTests(void)
@@ -3255,6 +4168,9 @@ void SCACRegisterTests(void)
     UtRegisterTest("SCACTest27", SCACTest27, 1);
     UtRegisterTest("SCACTest28", SCACTest28, 1);
     UtRegisterTest("SCACTest29", SCACTest29, 1);
+    UtRegisterTest("SCACTestCache01", SCACTestCache01, 1);
+    UtRegisterTest("SCACTestCache02", SCACTestCache02, 1);
+    UtRegisterTest("SCACTestShare01", SCACTestShare01, 1);
 #endif
 
     return;
@@ -64,6 +64,9 @@ typedef struct SCACOutputTable_ {
     uint32_t no_of_entries;
 } SCACOutputTable;
 
+/* don't share the tables of this ctx, for users that modify them */
+#define SC_AC_FLAG_NO_SHARE     0x01
+
 typedef struct SCACCtx_ {
     /* hash used during ctx initialization */
     SCACPattern **init_hash;
@@ -89,6 +92,14 @@ typedef struct SCACCtx_ {
     uint16_t single_state_size;
     uint16_t max_pat_id;
 
+    /* set if the state table is mapped from the mpm-cache-dir */
+    void *cache_map;
+    size_t cache_map_size;
+
+    /* set if the state and output tables are shared with other ctxs */
+    struct SCACSharedTable_ *shared;
+    uint8_t flags;
+
 #ifdef __SC_CUDA_SUPPORT__
     CUdeviceptr state_table_u16_cuda;
     CUdeviceptr state_table_u32_cuda;
@@ -103,6 +114,8 @@ typedef struct SCACThreadCtx_ {
 } SCACThreadCtx;
 
 void MpmACRegister(void);
+void SCACFreeStateTable(MpmCtx *);
+void SCACSharedTableStats(uint32_t *, uint32_t *);
 
 
 #ifdef __SC_CUDA_SUPPORT__
@@ -0,0 +1,988 @@
+/* Copyright (C) 2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * \author agent <agent@local>
+ *
+ * "Teddy" SIMD multi pattern matcher for small pattern groups.
+ *
+ * The patterns are spread over 8 buckets. For the first 1 to 3 bytes of
+ * the patterns (the prefix) two 16 byte tables are built, indexed on the
+ * low and the high nibble of the byte. Each table entry holds the set of
+ * buckets that have a pattern with that nibble at that position.
+ *
+ * The search looks up both nibbles of 16 (SSSE3) or 32 (AVX2) input bytes
+ * at once with pshufb and ANDs the results for all prefix positions. A
+ * bit that survives means the patterns of that bucket may start at that
+ * offset, and those are then verified with a compare.
+ *
+ * Groups with more than SC_TEDDY_MAX_PATTERNS patterns would have too many
+ * false positives per bucket, so those are handed over to AC.
+ *
+ * Without SSSE3 the same filter is done one byte at a time.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-mpm-teddy.h"
+#include "util-mpm-ac.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+void SCTeddyInitCtx(MpmCtx *);
+void SCTeddyInitThreadCtx(MpmCtx *, MpmThreadCtx *, uint32_t);
+void SCTeddyDestroyCtx(MpmCtx *);
+void SCTeddyDestroyThreadCtx(MpmCtx *, MpmThreadCtx *);
+int SCTeddyAddPatternCI(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                        uint32_t, uint32_t, uint8_t);
+int SCTeddyAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                        uint32_t, uint32_t, uint8_t);
+int SCTeddyPreparePatterns(MpmCtx *mpm_ctx);
+uint32_t SCTeddySearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                       PatternMatcherQueue *pmq, uint8_t *buf, uint16_t buflen);
+void SCTeddyPrintInfo(MpmCtx *mpm_ctx);
+void SCTeddyPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
+void SCTeddyRegisterTests(void);
+
+static inline void memcpy_tolower(uint8_t *d, uint8_t *s, uint16_t len)
+{
+    uint16_t i;
+    for (i = 0; i < len; i++)
+        d[i] = u8_tolower(s[i]);
+}
+
+static void SCTeddyFreePattern(MpmCtx *mpm_ctx, SCTeddyPattern *p)
+{
+    if (p->original_pat != NULL) {
+        SCFree(p->original_pat);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= p->len;
+    }
+    if (p->ci != NULL) {
+        SCFree(p->ci);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= p->len;
+    }
+}
+
+/**
+ * \internal
+ * \brief Add a pattern to the mpm context.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+static int SCTeddyAddPattern(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                             uint16_t offset, uint16_t depth, uint32_t pid,
+                             uint32_t sid, uint8_t flags)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    uint32_t i;
+
+    if (patlen == 0) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENTS, "pattern length 0");
+        return 0;
+    }
+
+    /* check if we have already inserted this pattern. Larger groups go to
+     * AC, which does its own duplicate check. */
+    if (ctx->parray_size <= SC_TEDDY_MAX_PATTERNS) {
+        for (i = 0; i < ctx->parray_size; i++) {
+            SCTeddyPattern *p = &ctx->parray[i];
+            if (p->id == pid && p->len == patlen && p->flags == flags &&
+                    memcmp(p->original_pat, pat, patlen) == 0)
+                return 0;
+        }
+    }
+
+    SCTeddyPattern *parray = SCRealloc(ctx->parray,
+            (ctx->parray_size + 1) * sizeof(SCTeddyPattern));
+    if (parray == NULL)
+        return -1;
+    ctx->parray = parray;
+    mpm_ctx->memory_size += sizeof(SCTeddyPattern);
+
+    SCTeddyPattern *p = &ctx->parray[ctx->parray_size];
+    memset(p, 0, sizeof(*p));
+    p->len = patlen;
+    p->flags = flags;
+    p->id = pid;
+
+    p->original_pat = SCMalloc(patlen);
+    if (p->original_pat == NULL)
+        goto error;
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += patlen;
+    memcpy(p->original_pat, pat, patlen);
+
+    p->ci = SCMalloc(patlen);
+    if (p->ci == NULL)
+        goto error;
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += patlen;
+    memcpy_tolower(p->ci, pat, patlen);
+
+    ctx->parray_size++;
+    mpm_ctx->pattern_cnt++;
+
+    if (mpm_ctx->maxlen < patlen)
+        mpm_ctx->maxlen = patlen;
+    if (mpm_ctx->minlen == 0 || mpm_ctx->minlen > patlen)
+        mpm_ctx->minlen = patlen;
+    if (pid > ctx->max_pat_id)
+        ctx->max_pat_id = pid;
+
+    return 0;
+
+error:
+    SCTeddyFreePattern(mpm_ctx, p);
+    return -1;
+}
+
+static int SCTeddyPatternCmp(const void *a, const void *b)
+{
+    const SCTeddyPattern *p1 = (const SCTeddyPattern *)a;
+    const SCTeddyPattern *p2 = (const SCTeddyPattern *)b;
+    uint16_t len = (p1->len < p2->len) ? p1->len : p2->len;
+
+    int r = memcmp(p1->ci, p2->ci, len);
+    if (r != 0)
+        return r;
+    return (int)p1->len - (int)p2->len;
+}
+
+/**
+ * \internal
+ * \brief Set the nibble masks for a byte of a pattern at a prefix position.
+ */
+static void SCTeddySetMask(SCTeddyCtx *ctx, int pos, uint8_t c, uint8_t bucket)
+{
+    ctx->lo[pos][c & 0x0f] |= (1 << bucket);
+    ctx->hi[pos][c >> 4] |= (1 << bucket);
+}
+
+/**
+ * \internal
+ * \brief Hand a group that is too large for the filter over to AC.
+ */
+static int SCTeddyPrepareAC(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    uint32_t i;
+
+    ctx->ac = SCMalloc(sizeof(MpmCtx));
+    if (ctx->ac == NULL)
+        return -1;
+    memset(ctx->ac, 0, sizeof(MpmCtx));
+    MpmInitCtx(ctx->ac, MPM_AC);
+
+    for (i = 0; i < ctx->parray_size; i++) {
+        SCTeddyPattern *p = &ctx->parray[i];
+        int r;
+        if (p->flags & MPM_PATTERN_FLAG_NOCASE) {
+            r = mpm_table[MPM_AC].AddPatternNocase(ctx->ac, p->original_pat,
+                    p->len, 0, 0, p->id, 0, p->flags);
+        } else {
+            r = mpm_table[MPM_AC].AddPattern(ctx->ac, p->original_pat,
+                    p->len, 0, 0, p->id, 0, p->flags);
+        }
+        if (r != 0)
+            return -1;
+    }
+    if (mpm_table[MPM_AC].Prepare(ctx->ac) != 0)
+        return -1;
+
+    /* the patterns now live in the AC ctx */
+    for (i = 0; i < ctx->parray_size; i++)
+        SCTeddyFreePattern(mpm_ctx, &ctx->parray[i]);
+    SCFree(ctx->parray);
+    mpm_ctx->memory_size -= ctx->parray_size * sizeof(SCTeddyPattern);
+    ctx->parray = NULL;
+    ctx->parray_size = 0;
+
+    SCLogDebug("%"PRIu32" patterns, using ac", mpm_ctx->pattern_cnt);
+    return 0;
+}
+
+/**
+ * \brief Process the patterns added to the mpm, and create the nibble
+ *        masks and buckets.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+int SCTeddyPreparePatterns(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    uint32_t i, b;
+    int j;
+
+    if (ctx->parray_size == 0) {
+        SCLogDebug("no patterns supplied to this mpm_ctx");
+        return 0;
+    }
+
+    if (ctx->parray_size > SC_TEDDY_MAX_PATTERNS)
+        return SCTeddyPrepareAC(mpm_ctx);
+
+    ctx->prefix = (mpm_ctx->minlen < SC_TEDDY_MAX_PREFIX) ?
+        (uint8_t)mpm_ctx->minlen : SC_TEDDY_MAX_PREFIX;
+
+    /* sort so that patterns with the same prefix end up in the same
+     * bucket, which keeps the masks selective */
+    qsort(ctx->parray, ctx->parray_size, sizeof(SCTeddyPattern),
+          SCTeddyPatternCmp);
+
+    for (b = 0; b <= SC_TEDDY_BUCKETS; b++)
+        ctx->bucket[b] = (b * ctx->parray_size) / SC_TEDDY_BUCKETS;
+
+    memset(ctx->lo, 0, sizeof(ctx->lo));
+    memset(ctx->hi, 0, sizeof(ctx->hi));
+    for (b = 0; b < SC_TEDDY_BUCKETS; b++) {
+        for (i = ctx->bucket[b]; i < ctx->bucket[b + 1]; i++) {
+            SCTeddyPattern *p = &ctx->parray[i];
+            for (j = 0; j < ctx->prefix; j++) {
+                uint8_t c = p->original_pat[j];
+                if (p->flags & MPM_PATTERN_FLAG_NOCASE) {
+                    SCTeddySetMask(ctx, j, u8_tolower(c), (uint8_t)b);
+                    SCTeddySetMask(ctx, j, toupper(c), (uint8_t)b);
+                } else {
+                    SCTeddySetMask(ctx, j, c, (uint8_t)b);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Init the mpm thread context.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param matchsize      We don't need this.
+ */
+void SCTeddyInitThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx, uint32_t matchsize)
+{
+    memset(mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+
+    mpm_thread_ctx->ctx = SCMalloc(sizeof(SCTeddyThreadCtx));
+    if (mpm_thread_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_thread_ctx->ctx, 0, sizeof(SCTeddyThreadCtx));
+    mpm_thread_ctx->memory_cnt++;
+    mpm_thread_ctx->memory_size += sizeof(SCTeddyThreadCtx);
+
+    return;
+}
+
+/**
+ * \brief Initialize the Teddy context.
+ *
+ * \param mpm_ctx       Mpm context.
+ */
+void SCTeddyInitCtx(MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx->ctx != NULL)
+        return;
+
+    mpm_ctx->ctx = SCMalloc(sizeof(SCTeddyCtx));
+    if (mpm_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->ctx, 0, sizeof(SCTeddyCtx));
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCTeddyCtx);
+
+    return;
+}
+
+/**
+ * \brief Destroy the mpm thread context.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ */
+void SCTeddyDestroyThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+    SCTeddyPrintSearchStats(mpm_thread_ctx);
+
+    if (mpm_thread_ctx->ctx != NULL) {
+        SCFree(mpm_thread_ctx->ctx);
+        mpm_thread_ctx->ctx = NULL;
+        mpm_thread_ctx->memory_cnt--;
+        mpm_thread_ctx->memory_size -= sizeof(SCTeddyThreadCtx);
+    }
+
+    return;
+}
+
+/**
+ * \brief Destroy the mpm context.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+void SCTeddyDestroyCtx(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    uint32_t i;
+
+    if (ctx == NULL)
+        return;
+
+    if (ctx->parray != NULL) {
+        for (i = 0; i < ctx->parray_size; i++)
+            SCTeddyFreePattern(mpm_ctx, &ctx->parray[i]);
+        SCFree(ctx->parray);
+        mpm_ctx->memory_size -= ctx->parray_size * sizeof(SCTeddyPattern);
+    }
+
+    if (ctx->ac != NULL) {
+        mpm_table[MPM_AC].DestroyCtx(ctx->ac);
+        SCFree(ctx->ac);
+    }
+
+    SCFree(mpm_ctx->ctx);
+    mpm_ctx->ctx = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= sizeof(SCTeddyCtx);
+
+    return;
+}
+
+static inline int SCTeddyCmpLowercase(const uint8_t *pat, const uint8_t *buf, uint16_t len)
+{
+    uint16_t i;
+    for (i = 0; i < len; i++) {
+        if (pat[i] != u8_tolower(buf[i]))
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Verify the patterns of the buckets that passed the filter at
+ *        an offset.
+ *
+ * \retval matches Match count.
+ */
+static inline uint32_t SCTeddyVerify(SCTeddyCtx *ctx, PatternMatcherQueue *pmq,
+                                     uint8_t *buf, uint16_t buflen,
+                                     uint16_t offset, uint8_t buckets)
+{
+    uint32_t matches = 0;
+
+    while (buckets != 0) {
+        int b = __builtin_ctz(buckets);
+        buckets &= buckets - 1;
+
+        uint32_t i;
+        for (i = ctx->bucket[b]; i < ctx->bucket[b + 1]; i++) {
+            SCTeddyPattern *p = &ctx->parray[i];
+
+            if (p->len > buflen - offset)
+                continue;
+
+            if (p->flags & MPM_PATTERN_FLAG_NOCASE) {
+                if (SCTeddyCmpLowercase(p->ci, buf + offset, p->len) != 0)
+                    continue;
+            } else {
+                if (memcmp(p->original_pat, buf + offset, p->len) != 0)
+                    continue;
+            }
+
+            if (!(pmq->pattern_id_bitarray[p->id / 8] & (1 << (p->id % 8)))) {
+                pmq->pattern_id_bitarray[p->id / 8] |= (1 << (p->id % 8));
+                pmq->pattern_id_array[pmq->pattern_id_array_cnt++] = p->id;
+            }
+            matches++;
+        }
+    }
+
+    return matches;
+}
+
+/**
+ * \internal
+ * \brief Run the filter for a single offset.
+ *
+ * \retval buckets that may have a pattern starting at buf
+ */
+static inline uint8_t SCTeddyFilterByte(SCTeddyCtx *ctx, const uint8_t *buf)
+{
+    uint8_t r = 0xff;
+    int j;
+
+    for (j = 0; j < ctx->prefix; j++)
+        r &= ctx->lo[j][buf[j] & 0x0f] & ctx->hi[j][buf[j] >> 4];
+    return r;
+}
+
+/**
+ * \brief The Teddy search function.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param buf            Buffer to be searched.
+ * \param buflen         Buffer length.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCTeddySearch(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                       PatternMatcherQueue *pmq, uint8_t *buf, uint16_t buflen)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    uint32_t matches = 0;
+    uint32_t i = 0;
+
+    if (ctx->ac != NULL)
+        return mpm_table[MPM_AC].Search(ctx->ac, mpm_thread_ctx, pmq, buf, buflen);
+
+    if (ctx->parray_size == 0 || buflen < ctx->prefix)
+        return 0;
+
+    /* last offset a pattern can start at */
+    uint32_t end = buflen - ctx->prefix + 1;
+
+#if defined(__AVX2__)
+    {
+        const __m256i nibble = _mm256_set1_epi8(0x0f);
+        __m256i lo[SC_TEDDY_MAX_PREFIX], hi[SC_TEDDY_MAX_PREFIX];
+        int j;
+
+        for (j = 0; j < ctx->prefix; j++) {
+            lo[j] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)ctx->lo[j]));
+            hi[j] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)ctx->hi[j]));
+        }
+
+        /* the loads at offset j read up to i + 31 + j */
+        for ( ; i + 32 <= end; i += 32) {
+            __m256i r = _mm256_set1_epi8((char)0xff);
+            for (j = 0; j < ctx->prefix; j++) {
+                __m256i in = _mm256_loadu_si256((const __m256i *)(buf + i + j));
+                __m256i l = _mm256_and_si256(in, nibble);
+                __m256i h = _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble);
+                r = _mm256_and_si256(r, _mm256_and_si256(
+                            _mm256_shuffle_epi8(lo[j], l),
+                            _mm256_shuffle_epi8(hi[j], h)));
+            }
+
+            uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(
+                    _mm256_cmpeq_epi8(r, _mm256_setzero_si256()));
+            if (mask == 0)
+                continue;
+
+            uint8_t res[32];
+            _mm256_storeu_si256((__m256i *)res, r);
+            while (mask != 0) {
+                int k = __builtin_ctz(mask);
+                mask &= mask - 1;
+                matches += SCTeddyVerify(ctx, pmq, buf, buflen, i + k, res[k]);
+            }
+        }
+    }
+#elif defined(__SSSE3__)
+    {
+        const __m128i nibble = _mm_set1_epi8(0x0f);
+        __m128i lo[SC_TEDDY_MAX_PREFIX], hi[SC_TEDDY_MAX_PREFIX];
+        int j;
+
+        for (j = 0; j < ctx->prefix; j++) {
+            lo[j] = _mm_loadu_si128((const __m128i *)ctx->lo[j]);
+            hi[j] = _mm_loadu_si128((const __m128i *)ctx->hi[j]);
+        }
+
+        /* the loads at offset j read up to i + 15 + j */
+        for ( ; i + 16 <= end; i += 16) {
+            __m128i r = _mm_set1_epi8((char)0xff);
+            for (j = 0; j < ctx->prefix; j++) {
+                __m128i in = _mm_loadu_si128((const __m128i *)(buf + i + j));
+                __m128i l = _mm_and_si128(in, nibble);
+                __m128i h = _mm_and_si128(_mm_srli_epi16(in, 4), nibble);
+                r = _mm_and_si128(r, _mm_and_si128(_mm_shuffle_epi8(lo[j], l),
+                                                   _mm_shuffle_epi8(hi[j], h)));
+            }
+
+            uint32_t mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(r, _mm_setzero_si128())) & 0xffff;
+            if (mask == 0)
+                continue;
+
+            uint8_t res[16];
+            _mm_storeu_si128((__m128i *)res, r);
+            while (mask != 0) {
+                int k = __builtin_ctz(mask);
+                mask &= mask - 1;
+                matches += SCTeddyVerify(ctx, pmq, buf, buflen, i + k, res[k]);
+            }
+        }
+    }
+#endif
+
+    /* tail, or all of the buffer without simd */
+    for ( ; i < end; i++) {
+        uint8_t r = SCTeddyFilterByte(ctx, buf + i);
+        if (r != 0)
+            matches += SCTeddyVerify(ctx, pmq, buf, buflen, i, r);
+    }
+
+    return matches;
+}
+
+/**
+ * \brief Add a case insensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  Ignored.
+ * \param depth   Ignored.
+ * \param pid     The pattern id.
+ * \param sid     Ignored.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCTeddyAddPatternCI(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                        uint16_t offset, uint16_t depth, uint32_t pid,
+                        uint32_t sid, uint8_t flags)
+{
+    flags |= MPM_PATTERN_FLAG_NOCASE;
+    return SCTeddyAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+/**
+ * \brief Add a case sensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  Ignored.
+ * \param depth   Ignored.
+ * \param pid     The pattern id.
+ * \param sid     Ignored.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCTeddyAddPatternCS(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                        uint16_t offset, uint16_t depth, uint32_t pid,
+                        uint32_t sid, uint8_t flags)
+{
+    return SCTeddyAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+void SCTeddyPrintSearchStats(MpmThreadCtx *mpm_thread_ctx)
+{
+#ifdef SC_TEDDY_COUNTERS
+    SCTeddyThreadCtx *ctx = (SCTeddyThreadCtx *)mpm_thread_ctx->ctx;
+    printf("Teddy Thread Search stats (ctx %p)\n", ctx);
+    printf("Total calls: %" PRIu32 "\n", ctx->total_calls);
+    printf("Total matches: %" PRIu64 "\n", ctx->total_matches);
+#endif /* SC_TEDDY_COUNTERS */
+
+    return;
+}
+
+void SCTeddyPrintInfo(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+
+    printf("MPM Teddy Information:\n");
+    printf("Memory allocs:   %" PRIu32 "\n", mpm_ctx->memory_cnt);
+    printf("Memory alloced:  %" PRIu32 "\n", mpm_ctx->memory_size);
+    printf(" Sizeof:\n");
+    printf("  MpmCtx         %" PRIuMAX "\n", (uintmax_t)sizeof(MpmCtx));
+    printf("  SCTeddyCtx:      %" PRIuMAX "\n", (uintmax_t)sizeof(SCTeddyCtx));
+    printf("  SCTeddyPattern   %" PRIuMAX "\n", (uintmax_t)sizeof(SCTeddyPattern));
+    printf("Unique Patterns: %" PRIu32 "\n", mpm_ctx->pattern_cnt);
+    printf("Smallest:        %" PRIu32 "\n", mpm_ctx->minlen);
+    printf("Largest:         %" PRIu32 "\n", mpm_ctx->maxlen);
+    printf("Prefix length:   %" PRIu32 "\n", ctx->prefix);
+    printf("Using AC:        %s\n", ctx->ac ? "yes" : "no");
+    printf("\n");
+
+    return;
+}
+
+/************************** Mpm Registration ***************************/
+
+/**
+ * \brief Register the teddy mpm.
+ */
+void MpmTeddyRegister(void)
+{
+    mpm_table[MPM_TEDDY].name = "teddy";
+    mpm_table[MPM_TEDDY].max_pattern_length = 0;
+
+    mpm_table[MPM_TEDDY].InitCtx = SCTeddyInitCtx;
+    mpm_table[MPM_TEDDY].InitThreadCtx = SCTeddyInitThreadCtx;
+    mpm_table[MPM_TEDDY].DestroyCtx = SCTeddyDestroyCtx;
+    mpm_table[MPM_TEDDY].DestroyThreadCtx = SCTeddyDestroyThreadCtx;
+    mpm_table[MPM_TEDDY].AddPattern = SCTeddyAddPatternCS;
+    mpm_table[MPM_TEDDY].AddPatternNocase = SCTeddyAddPatternCI;
+    mpm_table[MPM_TEDDY].Prepare = SCTeddyPreparePatterns;
+    mpm_table[MPM_TEDDY].Search = SCTeddySearch;
+    mpm_table[MPM_TEDDY].Cleanup = NULL;
+    mpm_table[MPM_TEDDY].PrintCtx = SCTeddyPrintInfo;
+    mpm_table[MPM_TEDDY].PrintThreadCtx = SCTeddyPrintSearchStats;
+    mpm_table[MPM_TEDDY].RegisterUnittests = SCTeddyRegisterTests;
+
+    return;
+}
+
+/*************************************Unittests********************************/
+
+#ifdef UNITTESTS
+
+static int SCTeddyTest01(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 1 match */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    PmqSetup(&pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                 (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+static int SCTeddyTest02(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    /* 0 match */
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"abce", 4, 0, 0, 0, 0, 0);
+    PmqSetup(&pmq, 0, 1);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                 (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 0)
+        result = 1;
+    else
+        printf("0 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+/** \test multiple patterns of different lengths, matches in the simd part
+ *        and in the tail of the buffer, and repeated matches */
+static int SCTeddyTest03(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"bcdefgh", 7, 0, 0, 1, 0, 0);
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"xyz", 3, 0, 0, 2, 0, 0);
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"GET /", 5, 0, 0, 3, 0, 0);
+    PmqSetup(&pmq, 0, 4);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    /* abcd x3, bcdefgh x2, xyz x2 (one at the very end), no GET */
+    char *buf = "abcdefghjiklmnopqrstuvwxyz0123456789abcdefgh--abcd--get /--xyz";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                 (uint8_t *)buf, strlen(buf));
+
+    if (cnt != 7) {
+        printf("7 != %" PRIu32 " ",cnt);
+        goto end;
+    }
+    if (pmq.pattern_id_array_cnt != 3) {
+        printf("3 != %" PRIu32 " ", pmq.pattern_id_array_cnt);
+        goto end;
+    }
+    result = 1;
+end:
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+/** \test nocase patterns match any case, case sensitive ones only their
+ *        own case */
+static int SCTeddyTest04(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCTeddyAddPatternCI(&mpm_ctx, (uint8_t *)"User-Agent", 10, 0, 0, 0, 0, 0);
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"Host", 4, 0, 0, 1, 0, 0);
+    PmqSetup(&pmq, 0, 2);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "GET / HTTP/1.1\r\nHOST: a\r\nuser-agent: b\r\nUSER-AGENT: c\r\n\r\n";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                 (uint8_t *)buf, strlen(buf));
+
+    if (cnt != 2) {
+        printf("2 != %" PRIu32 " ",cnt);
+        goto end;
+    }
+    if (pmq.pattern_id_array_cnt != 1 || pmq.pattern_id_array[0] != 0) {
+        printf("only pattern 0 should have matched: ");
+        goto end;
+    }
+    result = 1;
+end:
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+/** \test single byte patterns and a buffer shorter than a simd block */
+static int SCTeddyTest05(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"A", 1, 0, 0, 0, 0, 0);
+    SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)"AA", 2, 0, 0, 1, 0, 0);
+    PmqSetup(&pmq, 0, 2);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "AAAA";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                 (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 7)
+        result = 1;
+    else
+        printf("7 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+/** \test large groups are handed to ac and still match */
+static int SCTeddyTest06(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    uint32_t i;
+    char pat[16];
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+    for (i = 0; i < SC_TEDDY_MAX_PATTERNS * 2; i++) {
+        snprintf(pat, sizeof(pat), "pat%04u", i);
+        SCTeddyAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, i, 0, 0);
+    }
+    PmqSetup(&pmq, 0, SC_TEDDY_MAX_PATTERNS * 2);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+    if (((SCTeddyCtx *)mpm_ctx.ctx)->ac == NULL) {
+        printf("not using ac: ");
+        goto end;
+    }
+
+    char *buf = "xxpat0001xxpat0100xxpat9999";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                 (uint8_t *)buf, strlen(buf));
+    if (cnt != 2) {
+        printf("2 != %" PRIu32 " ",cnt);
+        goto end;
+    }
+    result = 1;
+end:
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+/** \test compare with a naive search over many pattern sets, buffer
+ *        lengths and offsets */
+static int SCTeddyTest07(void)
+{
+    uint8_t buf[200];
+    uint32_t i, n, len;
+    uint32_t seed = 1;
+
+    for (i = 0; i < sizeof(buf); i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = "abcdABCD"[(seed >> 16) & 7];
+    }
+
+    for (n = 1; n <= 24; n++) {
+        MpmCtx mpm_ctx;
+        MpmThreadCtx mpm_thread_ctx;
+        PatternMatcherQueue pmq;
+        uint8_t pats[24][4];
+        uint16_t plen[24];
+
+        memset(&mpm_ctx, 0, sizeof(MpmCtx));
+        memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+        MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+        SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx, 0);
+
+        for (i = 0; i < n; i++) {
+            seed = seed * 1103515245 + 12345;
+            plen[i] = 1 + ((seed >> 16) % 4);
+            uint32_t k;
+            for (k = 0; k < plen[i]; k++) {
+                seed = seed * 1103515245 + 12345;
+                pats[i][k] = "abcdABCD"[(seed >> 16) & 7];
+            }
+            if (i & 1)
+                SCTeddyAddPatternCI(&mpm_ctx, pats[i], plen[i], 0, 0, i, 0, 0);
+            else
+                SCTeddyAddPatternCS(&mpm_ctx, pats[i], plen[i], 0, 0, i, 0, 0);
+        }
+        PmqSetup(&pmq, 0, n);
+        SCTeddyPreparePatterns(&mpm_ctx);
+
+        for (len = 0; len < sizeof(buf); len += 13) {
+            uint32_t expect = 0;
+            uint32_t o;
+            for (i = 0; i < n; i++) {
+                for (o = 0; o + plen[i] <= len; o++) {
+                    if (i & 1) {
+                        uint8_t low[4];
+                        memcpy_tolower(low, pats[i], plen[i]);
+                        if (SCTeddyCmpLowercase(low, buf + o, plen[i]) == 0)
+                            expect++;
+                    } else if (memcmp(pats[i], buf + o, plen[i]) == 0) {
+                        expect++;
+                    }
+                }
+            }
+
+            PmqReset(&pmq);
+            uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                         buf, (uint16_t)len);
+            if (cnt != expect) {
+                printf("patterns %u, len %u: %u != %u: ", n, len, cnt, expect);
+                SCTeddyDestroyCtx(&mpm_ctx);
+                SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+                PmqFree(&pmq);
+                return 0;
+            }
+        }
+
+        SCTeddyDestroyCtx(&mpm_ctx);
+        SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+        PmqFree(&pmq);
+    }
+    return 1;
+}
+
+#endif /* UNITTESTS */
+
+void SCTeddyRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SCTeddyTest01", SCTeddyTest01, 1);
+    UtRegisterTest("SCTeddyTest02", SCTeddyTest02, 1);
+    UtRegisterTest("SCTeddyTest03", SCTeddyTest03, 1);
+    UtRegisterTest("SCTeddyTest04", SCTeddyTest04, 1);
+    UtRegisterTest("SCTeddyTest05", SCTeddyTest05, 1);
+    UtRegisterTest("SCTeddyTest06", SCTeddyTest06, 1);
+    UtRegisterTest("SCTeddyTest07", SCTeddyTest07, 1);
+#endif /* UNITTESTS */
+
+    return;
+}
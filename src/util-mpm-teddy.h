@@ -0,0 +1,78 @@
+/* Copyright (C) 2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * \author agent <agent@local>
+ */
+
+#ifndef __UTIL_MPM_TEDDY_H__
+#define __UTIL_MPM_TEDDY_H__
+
+#include "util-mpm.h"
+
+/** number of buckets, one bit each in the nibble masks */
+#define SC_TEDDY_BUCKETS        8
+/** max number of prefix bytes used by the filter */
+#define SC_TEDDY_MAX_PREFIX     3
+/** groups with more patterns than this are handed to AC */
+#define SC_TEDDY_MAX_PATTERNS   64
+
+typedef struct SCTeddyPattern_ {
+    /* length of the pattern */
+    uint16_t len;
+    /* flags decribing the pattern */
+    uint8_t flags;
+    /* holds the original pattern that was added */
+    uint8_t *original_pat;
+    /* lowercase version, used for nocase patterns and for sorting */
+    uint8_t *ci;
+    /* pattern id */
+    uint32_t id;
+} SCTeddyPattern;
+
+typedef struct SCTeddyCtx_ {
+    /** nibble masks: bit b set in lo[j][n] means a pattern of bucket b
+     *  has a byte with low nibble n at prefix position j */
+    uint8_t lo[SC_TEDDY_MAX_PREFIX][16];
+    uint8_t hi[SC_TEDDY_MAX_PREFIX][16];
+    /** number of prefix bytes used, <= minlen */
+    uint8_t prefix;
+
+    /** patterns, sorted so that the patterns of a bucket are adjacent */
+    SCTeddyPattern *parray;
+    uint32_t parray_size;
+    /** first pattern of each bucket, the last entry is the pattern count */
+    uint32_t bucket[SC_TEDDY_BUCKETS + 1];
+
+    uint32_t max_pat_id;
+
+    /** set for groups that are too large, search is done by this ctx */
+    MpmCtx *ac;
+} SCTeddyCtx;
+
+typedef struct SCTeddyThreadCtx_ {
+    /* the total calls we make to the search function */
+    uint32_t total_calls;
+    /* the total patterns that we ended up matching against */
+    uint64_t total_matches;
+} SCTeddyThreadCtx;
+
+void MpmTeddyRegister(void);
+
+#endif /* __UTIL_MPM_TEDDY_H__ */
@@ -37,6 +37,8 @@
 #include "util-mpm-ac-gfbs.h"
 #include "util-mpm-ac-bs.h"
 #include "util-mpm-ac-tile.h"
+#include "util-mpm-ac-ks.h"
+#include "util-mpm-teddy.h"
 #include "util-hashlist.h"
 
 #include "detect-engine.h"
@@ -233,6 +235,8 @@ void MpmFactoryReClaimMpmCtx(DetectEngineCtx *de_ctx, MpmCtx *mpm_ctx)
         return;
 
     if (!MpmFactoryIsMpmCtxAvailable(de_ctx, mpm_ctx)) {
+        if (mpm_ctx->pattern_keys != NULL)
+            SCFree(mpm_ctx->pattern_keys);
         if (mpm_ctx->mpm_type != MPM_NOTSET)
             mpm_table[mpm_ctx->mpm_type].DestroyCtx(mpm_ctx);
         SCFree(mpm_ctx);
@@ -591,6 +595,8 @@ void MpmTableSetup(void) {
     MpmACBSRegister();
     MpmACGfbsRegister();
     MpmACTileRegister();
+    MpmTeddyRegister();
+    MpmACKsRegister();
 #ifdef __SC_CUDA_SUPPORT__
     MpmACCudaRegister();
 #endif /* __SC_CUDA_SUPPORT__ */
@@ -72,6 +72,10 @@ enum {
     MPM_AC_GFBS,
     MPM_AC_BS,
     MPM_AC_TILE,
+    /* simd nibble filter for small groups */
+    MPM_TEDDY,
+    /* aho-corasick with a compressed state table */
+    MPM_AC_KS,
     /* table size */
     MPM_TABLE_SIZE,
 };
@@ -123,6 +127,15 @@ typedef struct MpmCtx_ {
 
     uint32_t memory_cnt;
     uint32_t memory_size;
+
+    /* number of sig group heads using this ctx when it is shared */
+    uint32_t refcnt;
+
+    /* id and flags of each pattern added, used to find sig group heads
+     * with the same patterns. Only set while building the sig groups */
+    uint32_t *pattern_keys;
+    uint32_t pattern_keys_cnt;
+    uint32_t pattern_keys_size;
 } MpmCtx;
 
 /* if we want to retrieve an unique mpm context from the mpm context factory
@@ -0,0 +1,325 @@
+/* Copyright (C) 2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * \author agent <agent@local>
+ *
+ * Software RSS: a symmetric Toeplitz hash over the raw packet, so that
+ * packets can be load balanced before they are decoded.
+ *
+ * The hash uses the same input as NIC RSS: source and destination address,
+ * followed by the source and destination port for TCP, UDP and SCTP. IP
+ * fragments and other protocols are hashed on the addresses only.
+ *
+ * The key is the repeating 16 bit pattern 0x6d5a. As the addresses and
+ * ports are at offsets that are a multiple of 16 bits apart, swapping them
+ * doesn't change the hash, so both directions of a flow get the same hash.
+ * It also means the key window at an input byte only depends on whether the
+ * byte offset is odd or even, so two lookup tables cover any input length.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "util-rss.h"
+#include "util-unittest.h"
+
+/** the key as a 64 bit value, so that any 32 bit window of it can be
+ *  taken with a shift */
+#define RSS_KEY         0x6d5a6d5a6d5a6d5aULL
+
+/** max hash input: 2 IPv6 addresses + 2 ports */
+#define RSS_INPUT_MAX   36
+
+static uint32_t rss_table[2][256];
+
+/**
+ *  \brief 32 bit window of the key starting at bit 'offset'
+ */
+static inline uint32_t RssKeyWindow(uint32_t offset)
+{
+    return (uint32_t)(RSS_KEY >> (32 - (offset % 16)));
+}
+
+void RssInit(void)
+{
+    uint32_t pos, v, b;
+
+    for (pos = 0; pos < 2; pos++) {
+        for (v = 0; v < 256; v++) {
+            uint32_t h = 0;
+            for (b = 0; b < 8; b++) {
+                if (v & (0x80 >> b))
+                    h ^= RssKeyWindow(pos * 8 + b);
+            }
+            rss_table[pos][v] = h;
+        }
+    }
+}
+
+static inline uint32_t RssToeplitz(const uint8_t *data, uint32_t len)
+{
+    uint32_t h = 0;
+    uint32_t i;
+
+    for (i = 0; i < len; i++)
+        h ^= rss_table[i & 1][data[i]];
+    return h;
+}
+
+/**
+ *  \brief symmetric hash of a raw packet
+ *
+ *  Only the outer headers are used, tunnels are balanced on their end
+ *  points.
+ *
+ *  \param datalink datalink type of the packet (p->datalink)
+ *  \param pkt raw packet data
+ *  \param len length of the packet data
+ *
+ *  \retval hash, 0 for packets that are not IP
+ */
+uint32_t RssHashRaw(int datalink, const uint8_t *pkt, uint32_t len)
+{
+    uint8_t input[RSS_INPUT_MAX];
+    uint32_t input_len = 0;
+    uint32_t off = 0;
+    uint32_t hlen = 0;
+    uint16_t proto = 0;
+    uint8_t ipproto = 0;
+
+    switch (datalink) {
+        case LINKTYPE_ETHERNET:
+            if (len < ETHERNET_HEADER_LEN)
+                return 0;
+            proto = (pkt[12] << 8) | pkt[13];
+            off = ETHERNET_HEADER_LEN;
+            /* skip vlan and q-in-q tags */
+            while ((proto == ETHERNET_TYPE_8021Q || proto == 0x88a8) &&
+                    len >= off + 4) {
+                proto = (pkt[off + 2] << 8) | pkt[off + 3];
+                off += 4;
+            }
+            break;
+        case LINKTYPE_LINUX_SLL:
+            if (len < SLL_HEADER_LEN)
+                return 0;
+            proto = (pkt[14] << 8) | pkt[15];
+            off = SLL_HEADER_LEN;
+            break;
+        case LINKTYPE_PPP:
+            if (len < PPP_HEADER_LEN)
+                return 0;
+            switch ((pkt[2] << 8) | pkt[3]) {
+                case PPP_IP:
+                    proto = ETHERNET_TYPE_IP;
+                    break;
+                case PPP_IPV6:
+                    proto = ETHERNET_TYPE_IPV6;
+                    break;
+            }
+            off = PPP_HEADER_LEN;
+            break;
+        case LINKTYPE_RAW:
+            if (len < 1)
+                return 0;
+            if ((pkt[0] >> 4) == 4)
+                proto = ETHERNET_TYPE_IP;
+            else if ((pkt[0] >> 4) == 6)
+                proto = ETHERNET_TYPE_IPV6;
+            break;
+        default:
+            return 0;
+    }
+
+    if (proto == ETHERNET_TYPE_IP) {
+        if (len < off + IPV4_HEADER_LEN)
+            return 0;
+        const uint8_t *ip = pkt + off;
+        memcpy(input, ip + 12, 8);
+        input_len = 8;
+
+        /* fragments don't all have the ports, so hash them on the
+         * addresses only */
+        uint16_t frag = (ip[6] << 8) | ip[7];
+        if ((frag & 0x3fff) == 0) {
+            ipproto = ip[9];
+            hlen = (ip[0] & 0x0f) << 2;
+        }
+    } else if (proto == ETHERNET_TYPE_IPV6) {
+        if (len < off + IPV6_HEADER_LEN)
+            return 0;
+        const uint8_t *ip = pkt + off;
+        memcpy(input, ip + 8, 32);
+        input_len = 32;
+
+        /* extension headers are not walked, those packets are hashed on
+         * the addresses only */
+        ipproto = ip[6];
+        hlen = IPV6_HEADER_LEN;
+    } else {
+        return 0;
+    }
+
+    if ((ipproto == IPPROTO_TCP || ipproto == IPPROTO_UDP ||
+         ipproto == IPPROTO_SCTP) && len >= off + hlen + 4) {
+        memcpy(input + input_len, pkt + off + hlen, 4);
+        input_len += 4;
+    }
+
+    return RssToeplitz(input, input_len);
+}
+
+#ifdef UNITTESTS
+
+/** \brief bit by bit Toeplitz hash, as described by the RSS spec */
+static uint32_t RssToeplitzRef(const uint8_t *key, const uint8_t *data, uint32_t len)
+{
+    uint32_t h = 0;
+    uint32_t window = (key[0] << 24) | (key[1] << 16) | (key[2] << 8) | key[3];
+    uint32_t i, b;
+
+    for (i = 0; i < len; i++) {
+        for (b = 0; b < 8; b++) {
+            if (data[i] & (0x80 >> b))
+                h ^= window;
+            window <<= 1;
+            if (key[i + 4] & (0x80 >> b))
+                window |= 1;
+        }
+    }
+    return h;
+}
+
+/** \test table hash matches the reference implementation */
+static int RssTest01(void)
+{
+    uint8_t key[RSS_INPUT_MAX + 4];
+    uint8_t data[RSS_INPUT_MAX];
+    uint32_t i, len;
+
+    for (i = 0; i < sizeof(key); i++)
+        key[i] = (i & 1) ? 0x5a : 0x6d;
+    for (i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)(i * 37 + 11);
+
+    RssInit();
+
+    for (len = 1; len <= RSS_INPUT_MAX; len++) {
+        if (RssToeplitz(data, len) != RssToeplitzRef(key, data, len)) {
+            printf("len %u: %08x != %08x: ", len, RssToeplitz(data, len),
+                    RssToeplitzRef(key, data, len));
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/** \test both directions of an IPv4 TCP flow, one with a vlan tag, hash
+ *        the same. Other flows don't. */
+static int RssTest02(void)
+{
+    uint8_t fwd[] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x00, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+        0x08, 0x00,
+        0x45, 0x00, 0x00, 0x28, 0x12, 0x34, 0x40, 0x00, 0x40, 0x06, 0x00, 0x00,
+        0xc0, 0xa8, 0x01, 0x01, 0x0a, 0x00, 0x00, 0x02,
+        0xc3, 0x50, 0x00, 0x50, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x50, 0x02, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    uint8_t rev[] = {
+        0x00, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05,
+        0x81, 0x00, 0x00, 0x0a, 0x08, 0x00,
+        0x45, 0x00, 0x00, 0x28, 0x56, 0x78, 0x40, 0x00, 0x40, 0x06, 0x00, 0x00,
+        0x0a, 0x00, 0x00, 0x02, 0xc0, 0xa8, 0x01, 0x01,
+        0x00, 0x50, 0xc3, 0x50, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x50, 0x12, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+    RssInit();
+
+    uint32_t h1 = RssHashRaw(LINKTYPE_ETHERNET, fwd, sizeof(fwd));
+    uint32_t h2 = RssHashRaw(LINKTYPE_ETHERNET, rev, sizeof(rev));
+    if (h1 == 0 || h1 != h2) {
+        printf("%08x != %08x: ", h1, h2);
+        return 0;
+    }
+
+    /* other source port */
+    fwd[34] = 0xc3;
+    fwd[35] = 0x51;
+    if (RssHashRaw(LINKTYPE_ETHERNET, fwd, sizeof(fwd)) == h1) {
+        printf("different flow, same hash: ");
+        return 0;
+    }
+    return 1;
+}
+
+/** \test ipv6 raw packets are symmetric, non-ip returns 0 */
+static int RssTest03(void)
+{
+    uint8_t fwd[48];
+    uint8_t rev[48];
+    int i;
+
+    memset(fwd, 0, sizeof(fwd));
+    fwd[0] = 0x60;
+    fwd[6] = IPPROTO_UDP;
+    for (i = 0; i < 16; i++) {
+        fwd[8 + i] = (uint8_t)(0x20 + i);
+        fwd[24 + i] = (uint8_t)(0x80 + i * 3);
+    }
+    fwd[40] = 0x13;
+    fwd[41] = 0x88;
+    fwd[42] = 0x00;
+    fwd[43] = 0x35;
+
+    memcpy(rev, fwd, sizeof(rev));
+    memcpy(rev + 8, fwd + 24, 16);
+    memcpy(rev + 24, fwd + 8, 16);
+    memcpy(rev + 40, fwd + 42, 2);
+    memcpy(rev + 42, fwd + 40, 2);
+
+    RssInit();
+
+    uint32_t h1 = RssHashRaw(LINKTYPE_RAW, fwd, sizeof(fwd));
+    uint32_t h2 = RssHashRaw(LINKTYPE_RAW, rev, sizeof(rev));
+    if (h1 == 0 || h1 != h2) {
+        printf("%08x != %08x: ", h1, h2);
+        return 0;
+    }
+
+    /* arp */
+    uint8_t arp[] = {
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05,
+        0x08, 0x06, 0x00, 0x01, 0x08, 0x00, 0x06, 0x04, 0x00, 0x01 };
+    if (RssHashRaw(LINKTYPE_ETHERNET, arp, sizeof(arp)) != 0) {
+        printf("non ip packet hashed: ");
+        return 0;
+    }
+    return 1;
+}
+
+#endif /* UNITTESTS */
+
+void RssRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("RssTest01", RssTest01, 1);
+    UtRegisterTest("RssTest02", RssTest02, 1);
+    UtRegisterTest("RssTest03", RssTest03, 1);
+#endif /* UNITTESTS */
+}
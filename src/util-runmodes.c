@@ -44,6 +44,7 @@
 #include "util-cpu.h"
 #include "util-affinity.h"
 #include "util-device.h"
+#include "tmqh-flow.h"
 
 #include "util-runmodes.h"
 
@@ -386,13 +387,16 @@ int RunModeSetLiveCaptureAutoFp(DetectEngineCtx *de_ctx,
             }
             TmSlotSetFuncAppend(tv_receive, tm_module, aconf);
 
-            tm_module = TmModuleGetByName(decode_mod_name);
-            if (tm_module == NULL) {
-                SCLogError(SC_ERR_RUNMODE,
-                        "TmModuleGetByName %s failed", decode_mod_name);
-                exit(EXIT_FAILURE);
+            /* with rss the packets are decoded by the detect threads */
+            if (!TmqhFlowIsRss()) {
+                tm_module = TmModuleGetByName(decode_mod_name);
+                if (tm_module == NULL) {
+                    SCLogError(SC_ERR_RUNMODE,
+                            "TmModuleGetByName %s failed", decode_mod_name);
+                    exit(EXIT_FAILURE);
+                }
+                TmSlotSetFuncAppend(tv_receive, tm_module, NULL);
             }
-            TmSlotSetFuncAppend(tv_receive, tm_module, NULL);
 
             TmThreadSetCPU(tv_receive, RECEIVE_CPU_SET);
 
@@ -447,12 +451,14 @@ int RunModeSetLiveCaptureAutoFp(DetectEngineCtx *de_ctx,
                 }
                 TmSlotSetFuncAppend(tv_receive, tm_module, aconf);
 
-                tm_module = TmModuleGetByName(decode_mod_name);
-                if (tm_module == NULL) {
-                    SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName %s failed", decode_mod_name);
-                    exit(EXIT_FAILURE);
+                if (!TmqhFlowIsRss()) {
+                    tm_module = TmModuleGetByName(decode_mod_name);
+                    if (tm_module == NULL) {
+                        SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName %s failed", decode_mod_name);
+                        exit(EXIT_FAILURE);
+                    }
+                    TmSlotSetFuncAppend(tv_receive, tm_module, NULL);
                 }
-                TmSlotSetFuncAppend(tv_receive, tm_module, NULL);
 
                 TmThreadSetCPU(tv_receive, RECEIVE_CPU_SET);
 
@@ -484,6 +490,14 @@ int RunModeSetLiveCaptureAutoFp(DetectEngineCtx *de_ctx,
             SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
             exit(EXIT_FAILURE);
         }
+        if (TmqhFlowIsRss()) {
+            TmModule *tm_module = TmModuleGetByName(decode_mod_name);
+            if (tm_module == NULL) {
+                SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName %s failed", decode_mod_name);
+                exit(EXIT_FAILURE);
+            }
+            TmSlotSetFuncAppend(tv_detect_ncpu, tm_module, NULL);
+        }
         TmModule *tm_module = TmModuleGetByName("StreamTcp");
         if (tm_module == NULL) {
             SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName StreamTcp failed");
@@ -955,12 +969,15 @@ int RunModeSetIPSAutoFp(DetectEngineCtx *de_ctx,
         }
         TmSlotSetFuncAppend(tv_receive, tm_module, (void *) ConfigParser(i));
 
-        tm_module = TmModuleGetByName(decode_mod_name);
-        if (tm_module == NULL) {
-            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName %s failed", decode_mod_name);
-            exit(EXIT_FAILURE);
+        /* with rss the packets are decoded by the detect threads */
+        if (!TmqhFlowIsRss()) {
+            tm_module = TmModuleGetByName(decode_mod_name);
+            if (tm_module == NULL) {
+                SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName %s failed", decode_mod_name);
+                exit(EXIT_FAILURE);
+            }
+            TmSlotSetFuncAppend(tv_receive, tm_module, NULL);
         }
-        TmSlotSetFuncAppend(tv_receive, tm_module, NULL);
 
         TmThreadSetCPU(tv_receive, RECEIVE_CPU_SET);
 
@@ -990,6 +1007,14 @@ int RunModeSetIPSAutoFp(DetectEngineCtx *de_ctx,
             SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
             exit(EXIT_FAILURE);
         }
+        if (TmqhFlowIsRss()) {
+            TmModule *tm_module = TmModuleGetByName(decode_mod_name);
+            if (tm_module == NULL) {
+                SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName %s failed", decode_mod_name);
+                exit(EXIT_FAILURE);
+            }
+            TmSlotSetFuncAppend(tv_detect_ncpu, tm_module, NULL);
+        }
         TmModule *tm_module = TmModuleGetByName("StreamTcp");
         if (tm_module == NULL) {
             SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName StreamTcp failed");
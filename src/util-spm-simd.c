@@ -0,0 +1,173 @@
+/* Copyright (C) 2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * \author agent <agent@local>
+ *
+ * Single pattern search with a SIMD filter on the first and the last byte
+ * of the pattern. A block of text starting at i is compared against the
+ * first byte of the pattern, the block starting at i + len - 1 against the
+ * last byte. Only the positions where both match are verified. Checking
+ * two bytes that are len - 1 apart rejects most positions, even for
+ * patterns starting with a common byte.
+ *
+ * Nocase is done by setting the 0x20 bit of the text before comparing, but
+ * only when the pattern byte is a letter. For letters that maps exactly the
+ * upper and lower case version to the lower case one.
+ *
+ * No context is needed, so this is also used for the one shot searches.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "util-spm-simd.h"
+#include "util-unittest.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+#define SIMD_WIDTH              32
+typedef __m256i SimdVec;
+#define SIMD_SET1(c)            _mm256_set1_epi8((char)(c))
+#define SIMD_LOAD(p)            _mm256_loadu_si256((const __m256i *)(p))
+#define SIMD_MATCH(v, fold, c)  _mm256_cmpeq_epi8(_mm256_or_si256((v), (fold)), (c))
+#define SIMD_AND(a, b)          _mm256_and_si256((a), (b))
+#define SIMD_MASK(v)            (uint32_t)_mm256_movemask_epi8((v))
+
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+
+#define SIMD_WIDTH              16
+typedef __m128i SimdVec;
+#define SIMD_SET1(c)            _mm_set1_epi8((char)(c))
+#define SIMD_LOAD(p)            _mm_loadu_si128((const __m128i *)(p))
+#define SIMD_MATCH(v, fold, c)  _mm_cmpeq_epi8(_mm_or_si128((v), (fold)), (c))
+#define SIMD_AND(a, b)          _mm_and_si128((a), (b))
+#define SIMD_MASK(v)            (uint32_t)_mm_movemask_epi8((v))
+
+#endif
+
+/**
+ *  \brief verify the bytes between the first and the last one
+ */
+static inline int SimdVerify(const uint8_t *text, const uint8_t *needle,
+                             uint16_t needlelen, const int nocase)
+{
+    uint16_t u;
+
+    if (needlelen <= 2)
+        return 1;
+
+    if (!nocase)
+        return (memcmp(text + 1, needle + 1, needlelen - 2) == 0);
+
+    for (u = 1; u < needlelen - 1; u++) {
+        if (u8_tolower(text[u]) != u8_tolower(needle[u]))
+            return 0;
+    }
+    return 1;
+}
+
+static inline uint8_t *SimdSearchInternal(uint8_t *text, uint32_t textlen,
+                                          uint8_t *needle, uint16_t needlelen,
+                                          const int nocase)
+{
+    if (needlelen == 0 || needlelen > textlen)
+        return NULL;
+
+    const uint32_t last_off = needlelen - 1;
+    uint8_t first = needle[0];
+    uint8_t last = needle[last_off];
+    uint8_t first_fold = 0;
+    uint8_t last_fold = 0;
+    uint32_t i = 0;
+
+    if (nocase) {
+        first = u8_tolower(first);
+        last = u8_tolower(last);
+        if (first >= 'a' && first <= 'z')
+            first_fold = 0x20;
+        if (last >= 'a' && last <= 'z')
+            last_fold = 0x20;
+    }
+
+#ifdef SPM_HAVE_SIMD
+    if (textlen >= last_off + SIMD_WIDTH) {
+        const SimdVec vfirst = SIMD_SET1(first);
+        const SimdVec vlast = SIMD_SET1(last);
+        const SimdVec vfirst_fold = SIMD_SET1(first_fold);
+        const SimdVec vlast_fold = SIMD_SET1(last_fold);
+
+        for ( ; i <= textlen - last_off - SIMD_WIDTH; i += SIMD_WIDTH) {
+            SimdVec f = SIMD_MATCH(SIMD_LOAD(text + i), vfirst_fold, vfirst);
+            SimdVec l = SIMD_MATCH(SIMD_LOAD(text + i + last_off), vlast_fold, vlast);
+            uint32_t mask = SIMD_MASK(SIMD_AND(f, l));
+
+            while (mask != 0) {
+                uint32_t pos = i + __builtin_ctz(mask);
+                if (SimdVerify(text + pos, needle, needlelen, nocase))
+                    return text + pos;
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+
+    /* tail, or everything if we have no simd */
+    for ( ; i + last_off < textlen; i++) {
+        if ((text[i] | first_fold) == first &&
+            (text[i + last_off] | last_fold) == last &&
+            SimdVerify(text + i, needle, needlelen, nocase))
+            return text + i;
+    }
+
+    return NULL;
+}
+
+/**
+ * \brief Search a pattern in the text
+ *
+ * \param text Text to search in
+ * \param textlen length of the text
+ * \param needle pattern to search for
+ * \param needlelen length of the pattern
+ *
+ * \retval ptr to the first match in text, or NULL
+ */
+uint8_t *SimdSearch(uint8_t *text, uint32_t textlen, uint8_t *needle, uint16_t needlelen)
+{
+    return SimdSearchInternal(text, textlen, needle, needlelen, 0);
+}
+
+/**
+ * \brief Search a pattern in the text, ignoring case. The pattern doesn't
+ *        need to be lower case.
+ *
+ * \param text Text to search in
+ * \param textlen length of the text
+ * \param needle pattern to search for
+ * \param needlelen length of the pattern
+ *
+ * \retval ptr to the first match in text, or NULL
+ */
+uint8_t *SimdSearchNocase(uint8_t *text, uint32_t textlen, uint8_t *needle, uint16_t needlelen)
+{
+    return SimdSearchInternal(text, textlen, needle, needlelen, 1);
+}
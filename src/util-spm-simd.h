@@ -0,0 +1,38 @@
+/* Copyright (C) 2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * \author agent <agent@local>
+ */
+
+#ifndef __UTIL_SPM_SIMD__
+#define __UTIL_SPM_SIMD__
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+/** set if the first/last byte filter search is vectorized in this build */
+#if defined(__AVX2__) || defined(__SSE2__)
+#define SPM_HAVE_SIMD 1
+#endif
+
+uint8_t *SimdSearch(uint8_t *, uint32_t, uint8_t *, uint16_t);
+uint8_t *SimdSearchNocase(uint8_t *, uint32_t, uint8_t *, uint16_t);
+
+#endif /* __UTIL_SPM_SIMD__ */
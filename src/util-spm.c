@@ -51,6 +51,7 @@
 #include "util-spm-bs.h"
 #include "util-spm-bs2bm.h"
 #include "util-spm-bm.h"
+#include "util-spm-simd.h"
 #include "util-clock.h"
 
 
@@ -142,6 +143,56 @@ uint8_t *BoyerMooreNocaseSearch(uint8_t *text, uint32_t textlen, uint8_t *needle
     return ret;
 }
 
+/**
+ * \brief Prepare a context for searching a pattern with SpmScan.
+ *
+ * \param needle pattern to search for, copied into the ctx
+ * \param needle_len length of the pattern
+ * \param nocase search case insensitive
+ *
+ * \retval ctx or NULL on error
+ * \initonly
+ */
+SpmCtx *SpmInitCtx(uint8_t *needle, uint16_t needle_len, int nocase)
+{
+    SpmCtx *ctx = SCMalloc(sizeof(SpmCtx) + needle_len);
+    if (unlikely(ctx == NULL))
+        return NULL;
+    memset(ctx, 0, sizeof(SpmCtx));
+
+    ctx->needle = (uint8_t *)ctx + sizeof(SpmCtx);
+    memcpy(ctx->needle, needle, needle_len);
+    ctx->needle_len = needle_len;
+
+#ifndef SPM_HAVE_SIMD
+    ctx->bm_ctx = BoyerMooreCtxInit(ctx->needle, ctx->needle_len);
+#endif
+    if (nocase)
+        SpmCtxToNocase(ctx);
+
+    return ctx;
+}
+
+/**
+ * \brief Switch a context to case insensitive search.
+ */
+void SpmCtxToNocase(SpmCtx *ctx)
+{
+    ctx->nocase = 1;
+    if (ctx->bm_ctx != NULL)
+        BoyerMooreCtxToNocase(ctx->bm_ctx, ctx->needle, ctx->needle_len);
+}
+
+void SpmDestroyCtx(SpmCtx *ctx)
+{
+    if (ctx == NULL)
+        return;
+
+    if (ctx->bm_ctx != NULL)
+        BoyerMooreCtxDeInit(ctx->bm_ctx);
+    SCFree(ctx);
+}
+
 
 #ifdef UNITTESTS
 
@@ -2333,6 +2384,91 @@ int UtilSpmNocaseSearchStatsTest07()
     return 1;
 }
 
+/**
+ * \test SimdSearch and SimdSearchNocase give the same results as the basic
+ *       search, for all text and pattern lengths around the simd width, at
+ *       all alignments.
+ */
+int UtilSpmSimdSearchTest01()
+{
+    uint8_t text[256];
+    uint8_t needle[40];
+    uint32_t seed = 1;
+    uint32_t i, tlen, start;
+    uint16_t nlen;
+
+    /* small alphabet so that we get lots of partial matches */
+    for (i = 0; i < sizeof(text); i++) {
+        seed = seed * 1103515245 + 12345;
+        text[i] = "aAbB-\x00"[(seed >> 16) % 6];
+    }
+
+    for (nlen = 1; nlen < sizeof(needle); nlen++) {
+        for (start = 0; start < 8; start++) {
+            for (tlen = 0; tlen + start <= sizeof(text); tlen += 7) {
+                /* a pattern that is in the text and one that may not be */
+                memcpy(needle, text + ((start * 31 + nlen) % (sizeof(text) - nlen)), nlen);
+                if (start & 1)
+                    needle[nlen - 1] ^= 0x20;
+
+                uint8_t *t = text + start;
+                if (SimdSearch(t, tlen, needle, nlen) !=
+                        BasicSearch(t, tlen, needle, nlen)) {
+                    printf("nlen %u start %u tlen %u: ", nlen, start, tlen);
+                    return 0;
+                }
+                if (SimdSearchNocase(t, tlen, needle, nlen) !=
+                        BasicSearchNocase(t, tlen, needle, nlen)) {
+                    printf("nocase nlen %u start %u tlen %u: ", nlen, start, tlen);
+                    return 0;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * \test prepared contexts, including switching to nocase
+ */
+int UtilSpmScanTest01()
+{
+    uint8_t text[] = "this is a longer text, long enough to be vectorized: AbCdEf";
+    int result = 0;
+
+    SpmCtx *ctx = SpmInitCtx((uint8_t *)"abcdef", 6, 0);
+    if (ctx == NULL)
+        return 0;
+    if (SpmScan(ctx, text, sizeof(text) - 1) != NULL) {
+        printf("case sensitive search matched: ");
+        goto end;
+    }
+
+    SpmCtxToNocase(ctx);
+    if (SpmScan(ctx, text, sizeof(text) - 1) != text + sizeof(text) - 7) {
+        printf("nocase search didn't match at the end: ");
+        goto end;
+    }
+    SpmDestroyCtx(ctx);
+
+    ctx = SpmInitCtx((uint8_t *)"long", 4, 1);
+    if (ctx == NULL)
+        return 0;
+    if (SpmScan(ctx, text, sizeof(text) - 1) != text + 10) {
+        printf("expected the first match: ");
+        goto end;
+    }
+    if (SpmScan(ctx, text, 13) != NULL) {
+        printf("matched beyond the text len: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    SpmDestroyCtx(ctx);
+    return result;
+}
+
 #endif
 
 /* Register unittests */
@@ -2362,6 +2498,9 @@ void UtilSpmSearchRegistertests(void) {
     UtRegisterTest("UtilSpmSearchOffsetsTest01", UtilSpmSearchOffsetsTest01, 1);
     UtRegisterTest("UtilSpmSearchOffsetsNocaseTest01", UtilSpmSearchOffsetsNocaseTest01, 1);
 
+    UtRegisterTest("UtilSpmSimdSearchTest01", UtilSpmSimdSearchTest01, 1);
+    UtRegisterTest("UtilSpmScanTest01", UtilSpmScanTest01, 1);
+
 #ifdef ENABLE_SEARCH_STATS
     /* Give some stats searching given a prepared context (look at the wrappers) */
     UtRegisterTest("UtilSpmSearchStatsTest01", UtilSpmSearchStatsTest01, 1);
@@ -27,6 +27,42 @@
 #include "util-spm-bs.h"
 #include "util-spm-bs2bm.h"
 #include "util-spm-bm.h"
+#include "util-spm-simd.h"
+
+/** \brief Prepared context to search a single pattern. Uses the simd
+ *         search if it's available in this build, Boyer Moore otherwise. */
+typedef struct SpmCtx_ {
+    /* copy of the pattern */
+    uint8_t *needle;
+    uint16_t needle_len;
+    uint8_t nocase;
+    /* Boyer Moore context, only set if we have no simd search */
+    BmCtx *bm_ctx;
+} SpmCtx;
+
+SpmCtx *SpmInitCtx(uint8_t *needle, uint16_t needle_len, int nocase);
+void SpmCtxToNocase(SpmCtx *);
+void SpmDestroyCtx(SpmCtx *);
+
+/**
+ * \brief Search the pattern of a prepared context in the text
+ *
+ * \retval ptr to the first match in text, or NULL
+ */
+static inline uint8_t *SpmScan(SpmCtx *ctx, uint8_t *text, uint32_t textlen)
+{
+#ifdef SPM_HAVE_SIMD
+    if (ctx->nocase)
+        return SimdSearchNocase(text, textlen, ctx->needle, ctx->needle_len);
+    return SimdSearch(text, textlen, ctx->needle, ctx->needle_len);
+#else
+    if (ctx->nocase)
+        return BoyerMooreNocase(ctx->needle, ctx->needle_len, text, textlen,
+                                ctx->bm_ctx->bmGs, ctx->bm_ctx->bmBc);
+    return BoyerMoore(ctx->needle, ctx->needle_len, text, textlen,
+                      ctx->bm_ctx->bmGs, ctx->bm_ctx->bmBc);
+#endif
+}
 
 /** Default algorithm to use: Boyer Moore */
 uint8_t *Bs2bmSearch(uint8_t *text, uint32_t textlen, uint8_t *needle, uint16_t needlelen);
@@ -35,6 +71,13 @@ uint8_t *BoyerMooreSearch(uint8_t *text, uint32_t textlen, uint8_t *needle, uint
 uint8_t *BoyerMooreNocaseSearch(uint8_t *text, uint32_t textlen, uint8_t *needle, uint16_t needlelen);
 
 /* Macros for automatic algorithm selection (use them only when you can't store the context) */
+#ifdef SPM_HAVE_SIMD
+/* the simd search has no context to set up, so it's used for all lengths */
+#define SpmSearch(text, textlen, needle, needlelen) \
+    SimdSearch((text), (textlen), (needle), (needlelen))
+#define SpmNocaseSearch(text, textlen, needle, needlelen) \
+    SimdSearchNocase((text), (textlen), (needle), (needlelen))
+#else
 #define SpmSearch(text, textlen, needle, needlelen) ({\
     uint8_t *mfound; \
     if (needlelen < 4 && textlen < 512) \
@@ -56,6 +99,7 @@ uint8_t *BoyerMooreNocaseSearch(uint8_t *text, uint32_t textlen, uint8_t *needle
           mfound = BoyerMooreNocaseSearch(text, textlen, needle, needlelen); \
     mfound; \
     })
+#endif /* SPM_HAVE_SIMD */
 
 void UtilSpmSearchRegistertests(void);
 #endif /* __UTIL_SPM_H__ */
@@ -100,14 +100,16 @@ static pcre_extra *regex_suppress_study = NULL;
  *        return the default path for the threshold file which is
  *        "./threshold.config".
  *
+ * \param de_ctx detection engine, tenant engines use their own setting
+ *
  * \retval log_filename Pointer to a string containing the path for the
  *                      Threshold Config file.
  */
-char *SCThresholdConfGetConfFilename(void)
+char *SCThresholdConfGetConfFilename(const DetectEngineCtx *de_ctx)
 {
     char *log_filename = NULL;
 
-    if (ConfGet("threshold-file", &log_filename) != 1) {
+    if (DetectEngineConfGet(de_ctx, "threshold-file", &log_filename) != 1) {
         log_filename = (char *)THRESHOLD_CONF_DEF_CONF_FILEPATH;
     }
 
@@ -138,7 +140,7 @@ int SCThresholdConfInitContext(DetectEngineCtx *de_ctx, FILE *utfd)
     int opts = 0;
 
     if (fd == NULL) {
-        filename = SCThresholdConfGetConfFilename();
+        filename = SCThresholdConfGetConfFilename(de_ctx);
         if ( (fd = fopen(filename, "r")) == NULL) {
             SCLogWarning(SC_ERR_FOPEN, "Error opening file: \"%s\": %s", filename, strerror(errno));
             goto error;